@@ -16,8 +16,29 @@
 
 #include <exception>
 
-class ArgumentNullException : public std::exception {
-    typedef std::exception Inherited;
+// Base class for the exceptions that carry a message:
+// std::exception(const char*) is a Microsoft extension.
+class Exception : public std::exception {
+public:
+    Exception() : _text(nullptr) {}
+    Exception(const char* text) : _text(text) {}
+    virtual const char* what() const throw() {
+        return (nullptr != _text) ? _text : "Unknown exception";
+    }
+
+private:
+    const char* _text;
+};
+
+class ArgumentException : public Exception {
+    typedef Exception Inherited;
+public:
+    ArgumentException() {}
+    ArgumentException(const char* text) : Inherited(text) {}
+};
+
+class ArgumentNullException : public Exception {
+    typedef Exception Inherited;
 public:
     ArgumentNullException() {}
     ArgumentNullException(const char* text) : Inherited(text) {}
@@ -29,17 +50,24 @@ class OverflowException : public std::exception {
 class DivideByZeroException : public std::exception {
 };
 
-class InvalidOperationException : public std::exception {
-    typedef std::exception Inherited;
+class InvalidOperationException : public Exception {
+    typedef Exception Inherited;
 public:
     InvalidOperationException() {}
     InvalidOperationException(const char* text) : Inherited(text) {}
 };
 
-class ArgumentOutOfRangeException : public std::exception {
-    typedef std::exception Inherited;
+class ArgumentOutOfRangeException : public Exception {
+    typedef Exception Inherited;
 public:
     ArgumentOutOfRangeException() {}
     ArgumentOutOfRangeException(const char* text) : Inherited(text) {}
 };
 
+class IOException : public Exception {
+    typedef Exception Inherited;
+public:
+    IOException() {}
+    IOException(const char* text) : Inherited(text) {}
+};
+
@@ -12,35 +12,364 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include "StdAfx.h"
-#include "Fiber.h"
+#include "stdafx.h"
+#include "fiber.h"
 
 #include <assert.h>
 
-Fiber::Fiber() :
+#ifndef CPPLINQ_FIBER_WIN32
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+#include <map>
+#include <mutex>
+#include <string>
+#endif
+
+#ifdef CPPLINQ_FIBER_ASM
+
+// cpplinq_fiber_switch(void** fromSp, void* toSp)
+// Pushes the callee-saved registers (and the floating point control words)
+// on the current stack, stores the stack pointer in *fromSp, then loads toSp
+// and pops the registers saved there. No system call is involved, unlike
+// swapcontext, which saves and restores the signal mask at every switch.
+//
+// cpplinq_fiber_start
+// First "return address" of a new fiber: calls entry(arg) with the values
+// preloaded in the initial register frame. entry never returns.
+
+#if defined(__x86_64__)
+
+asm(
+    ".text\n"
+    ".globl cpplinq_fiber_switch\n"
+    ".type cpplinq_fiber_switch, @function\n"
+    ".align 16\n"
+"cpplinq_fiber_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size cpplinq_fiber_switch, .-cpplinq_fiber_switch\n"
+
+    ".globl cpplinq_fiber_start\n"
+    ".type cpplinq_fiber_start, @function\n"
+    ".align 16\n"
+"cpplinq_fiber_start:\n"
+    "    .cfi_startproc\n"
+    "    .cfi_undefined rip\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    "    .cfi_endproc\n"
+    ".size cpplinq_fiber_start, .-cpplinq_fiber_start\n"
+);
+
+// Initial frame, from the lowest address: mxcsr/x87 control words, r15, r14,
+// r13 (entry), r12 (arg), rbx, rbp, return address (cpplinq_fiber_start).
+static const size_t InitialFrameWords = 8;
+
+#elif defined(__aarch64__)
+
+asm(
+    ".text\n"
+    ".globl cpplinq_fiber_switch\n"
+    ".type cpplinq_fiber_switch, %function\n"
+    ".align 4\n"
+"cpplinq_fiber_switch:\n"
+    "    sub sp, sp, #176\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mrs x9, fpcr\n"
+    "    str x9, [sp, #160]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldr x9, [sp, #160]\n"
+    "    msr fpcr, x9\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #176\n"
+    "    ret\n"
+    ".size cpplinq_fiber_switch, .-cpplinq_fiber_switch\n"
+
+    ".globl cpplinq_fiber_start\n"
+    ".type cpplinq_fiber_start, %function\n"
+    ".align 4\n"
+"cpplinq_fiber_start:\n"
+    "    .cfi_startproc\n"
+    "    .cfi_undefined x30\n"
+    "    mov x0, x19\n"
+    "    blr x20\n"
+    "    brk #0\n"
+    "    .cfi_endproc\n"
+    ".size cpplinq_fiber_start, .-cpplinq_fiber_start\n"
+);
+
+// Initial frame: x19 (arg), x20 (entry), x21-x28, x29, x30 (cpplinq_fiber_start),
+// d8-d15, fpcr, padding.
+static const size_t InitialFrameWords = 22;
+
+#endif
+
+extern "C" void cpplinq_fiber_switch(void** fromSp, void* toSp);
+extern "C" void cpplinq_fiber_start();
+
+static void* initFiberStack(void* stackTop, void (*entry)(void*), void* arg)
+{
+    uintptr_t top = (uintptr_t)stackTop & ~(uintptr_t)15;
+    void** frame;
+#if defined(__x86_64__)
+    // the return address sits at 16n - 8: once it is popped the stack is
+    // 16-byte aligned for the call in cpplinq_fiber_start.
+    frame = (void**)top - InitialFrameWords;
+    frame[0] = (void*)(uintptr_t)(0x1F80 | ((uintptr_t)0x037F << 32));    // default mxcsr, x87 cw
+    frame[1] = nullptr;                     // r15
+    frame[2] = nullptr;                     // r14
+    frame[3] = (void*)entry;                // r13
+    frame[4] = arg;                         // r12
+    frame[5] = nullptr;                     // rbx
+    frame[6] = nullptr;                     // rbp
+    frame[7] = (void*)&cpplinq_fiber_start; // return address
+#else
+    frame = (void**)top - InitialFrameWords;
+    for (size_t i = 0; i < InitialFrameWords; i++) {
+        frame[i] = nullptr;
+    }
+    frame[0] = arg;                         // x19
+    frame[1] = (void*)entry;                // x20
+    frame[11] = (void*)&cpplinq_fiber_start; // x30
+#endif
+    return frame;
+}
+
+#endif // CPPLINQ_FIBER_ASM
+
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+
+static const unsigned char StackFill = 0xCD;
+
+// Peak depth by fiber name, over all the fibers destroyed so far.
+struct StackProfileTable
+{
+    std::mutex lock;
+    std::map<std::string, Fiber::StackProfile> entries;
+};
+
+static StackProfileTable& stackProfileTable()
+{
+    static StackProfileTable* table = new StackProfileTable();
+    return *table;
+}
+
+static void recordStackProfile(const char* name, size_t stackSize, size_t peakDepth)
+{
+    StackProfileTable& table = stackProfileTable();
+    std::lock_guard<std::mutex> lock(table.lock);
+    Fiber::StackProfile& entry = table.entries[name];
+    if (0 == entry.fibers) {
+        entry.name = name;
+        entry.stackSize = stackSize;
+        entry.peakDepth = 0;
+    }
+    entry.fibers++;
+    if (peakDepth > entry.peakDepth) {
+        entry.peakDepth = peakDepth;
+    }
+}
+
+// static
+std::vector<Fiber::StackProfile> Fiber::stackProfile()
+{
+    StackProfileTable& table = stackProfileTable();
+    std::lock_guard<std::mutex> lock(table.lock);
+    std::vector<StackProfile> result;
+    for (auto it = table.entries.begin(); it != table.entries.end(); ++it) {
+        result.push_back(it->second);
+    }
+    return result;
+}
+
+#ifdef CPPLINQ_FIBER_WIN32
+
+// The stack of a Windows fiber is committed a page at a time as it grows,
+// so its committed size is its peak depth (rounded to pages). A pooled
+// fiber keeps its committed pages, so this is the peak of all its owners.
+void Fiber::updatePeakStackDepth()
+{
+    NT_TIB* tib = (NT_TIB*)::NtCurrentTeb();
+    size_t depth = (char*)tib->StackBase - (char*)tib->StackLimit;
+    if (depth > _peakDepth) {
+        _peakDepth = depth;
+    }
+}
+
+size_t Fiber::peakStackDepth() const
+{
+    return _peakDepth;
+}
+
+#else
+
+size_t Fiber::peakStackDepth() const
+{
+    if (nullptr == _stack) {
+        return 0;
+    }
+
+    // compare a word at a time up to the first word that was written
+    const size_t* words = (const size_t*)_stack->base;
+    size_t count = _stack->size / sizeof(size_t);
+    size_t fill;
+    ::memset(&fill, StackFill, sizeof(fill));
+    size_t untouched = 0;
+    while (untouched < count && fill == words[untouched]) {
+        untouched++;
+    }
+    return _stack->size - untouched * sizeof(size_t);
+}
+
+// Restores the fill pattern where the previous owner of the stack wrote.
+static void fillStack(FiberStack* stack)
+{
+    ::memset((char*)stack->base + stack->size - stack->dirtySize, StackFill, stack->dirtySize);
+    stack->dirtySize = 0;
+}
+
+#endif
+
+#endif // CPPLINQ_FIBER_STACK_PROFILE
+
+// (the operators pass them to _makeShared by reference)
+const size_t Fiber::SmallStackSize;
+const size_t Fiber::DefaultStackSize;
+
+// The fiber running on each thread, if any.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+static __declspec(thread) Fiber* t_currentFiber = nullptr;
+#else
+static thread_local Fiber* t_currentFiber = nullptr;
+#endif
+
+// static
+Fiber* Fiber::current()
+{
+    return t_currentFiber;
+}
+
+Fiber::Fiber(size_t stackSize, const char* name) :
+    _stack(nullptr),
+    _stackSize(stackSize),
+    _name(name),
+    _abandonable(false),
     _state(FiberCreated),
-    _previousFiber(nullptr),
-    _exception(),
-    _exceptionCaught(false)
+    _exception()
 {
-    // fiber stack size: 256KB
-    _fiber = (PFIBER_START_ROUTINE)::CreateFiber(256 * 1024, fiberProc, this);
+#ifdef CPPLINQ_FIBER_WIN32
+    _previousFiber = nullptr;
+    _fiber = nullptr;
+#if defined(CPPLINQ_FIBER_STACK_PROFILE)
+    _peakDepth = 0;
+#endif
+#endif
+}
+
+// The stack is taken from the pool only when the fiber first runs: a Fiber
+// that is never resumed, like a block whose body runs inline (see
+// IteratorBlock::runInline), costs no stack at all.
+void Fiber::start()
+{
+    _stack = FiberStackPool::instance().acquire(_stackSize);
+    _stack->owner = this;
+#ifdef CPPLINQ_FIBER_WIN32
+    _fiber = (PFIBER_START_ROUTINE)_stack->base;
+#else
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+    fillStack(_stack);
+#endif
+#ifdef CPPLINQ_FIBER_ASM
+    _callerSp = nullptr;
+    _sp = initFiberStack((char*)_stack->base + _stack->size, fiberProc, this);
+#else
+    ::getcontext(&_context);
+    _context.uc_stack.ss_sp = _stack->base;
+    _context.uc_stack.ss_size = _stack->size;
+    _context.uc_link = nullptr;
+    uintptr_t p = (uintptr_t)this;
+    ::makecontext(&_context, (void (*)())contextProc, 2,
+        (unsigned int)((uint64_t)p >> 32), (unsigned int)(p & 0xFFFFFFFF));
+#endif
+#endif
 }
 
 Fiber::~Fiber()
 {
-    if (_state == FiberRunning) {
-        _previousFiber = (PFIBER_START_ROUTINE)::GetCurrentFiber();
+    // A Windows fiber is recycled by its pool only once main() has returned
+    // (see fiberProc), so there a suspended body is always unwound.
+#ifdef CPPLINQ_FIBER_WIN32
+    bool unwind = (_state == FiberRunning);
+#else
+    bool unwind = (_state == FiberRunning && ! _abandonable);
+#endif
+    if (unwind) {
         _state = FiberStopPending;
-        ::SwitchToFiber(_fiber);
+        Fiber* caller = t_currentFiber;
+        t_currentFiber = this;
+        switchToFiber();
+        t_currentFiber = caller;
+    }
+    if (nullptr == _stack) {
+        return;
     }
-    ::DeleteFiber(_fiber);
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+    size_t peakDepth = peakStackDepth();
+    recordStackProfile(nullptr != _name ? _name : "Fiber", _stack->size, peakDepth);
+#ifndef CPPLINQ_FIBER_WIN32
+    _stack->dirtySize = peakDepth;
+#endif
+#endif
+    FiberStackPool::instance().release(_stack);
 }
 
 void* Fiber::main()
 {
     _state = FiberRunning;
-    _exceptionCaught = false;
+    _exception = nullptr;
 
     try {
         run();
@@ -50,33 +379,40 @@ void* Fiber::main()
         // do nothing
         _state = FiberStopped;
     }
-    catch (std::exception& e)
-    {
-        _exception = e;
-        _exceptionCaught = true;
-        _state = FiberStopped;
-    }
     catch (...)
     {
-        _exception = std::exception("win32 exception");
-        _exceptionCaught = true;
+        _exception = std::current_exception();
         _state = FiberStopped;
     }
 
     _state = FiberStopped;
+#ifdef CPPLINQ_FIBER_WIN32
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+    updatePeakStackDepth();
+#endif
     return _previousFiber;
+#else
+    return nullptr;
+#endif
 }
 
 bool Fiber::resume()
 {
-    if (nullptr == _fiber || _state == FiberStopped) {
+    if (_state == FiberStopped) {
         return false;
     }
-    _previousFiber = (PFIBER_START_ROUTINE)::GetCurrentFiber();
-    assert(_previousFiber != _fiber);
-    ::SwitchToFiber(_fiber);
-    if (_exceptionCaught) {
-        throw _exception;
+    if (nullptr == _stack) {
+        start();
+    }
+
+    Fiber* caller = t_currentFiber;
+    t_currentFiber = this;
+    switchToFiber();
+    t_currentFiber = caller;
+    if (_exception) {
+        std::exception_ptr e = _exception;
+        _exception = nullptr;
+        std::rethrow_exception(e);
     }
 
     return (FiberRunning == _state);
@@ -89,17 +425,87 @@ void Fiber::yield(bool goOn)
         _state = FiberStopped;
     }
 
-    ::SwitchToFiber(_previousFiber);
+#if defined(CPPLINQ_FIBER_STACK_PROFILE) && defined(CPPLINQ_FIBER_WIN32)
+    updatePeakStackDepth();
+#endif
+    switchToCaller();
     if (_state == FiberStopPending) {
         // here this object may be deleting ???
         throw StopFiberException();
     }
 }
 
+#ifdef CPPLINQ_FIBER_WIN32
+
+void Fiber::switchToFiber()
+{
+    enableFibersInCurrentThread();
+    _previousFiber = (PFIBER_START_ROUTINE)::GetCurrentFiber();
+    assert(_previousFiber != _fiber);
+    ::SwitchToFiber(_fiber);
+}
+
+void Fiber::switchToCaller()
+{
+    ::SwitchToFiber(_previousFiber);
+}
+
 // static
+// Pooled fibers are reused: once main() has returned, the next switch to
+// this fiber comes from its next owner.
 void CALLBACK Fiber::fiberProc(void* pObj)
+{
+    FiberStack* stack = (FiberStack*)pObj;
+    while (true) {
+        void* previousFiber = stack->owner->main();
+        ::SwitchToFiber(previousFiber);
+    }
+}
+
+#elif defined(CPPLINQ_FIBER_ASM)
+
+void Fiber::switchToFiber()
+{
+    cpplinq_fiber_switch(&_callerSp, _sp);
+}
+
+void Fiber::switchToCaller()
+{
+    cpplinq_fiber_switch(&_sp, _callerSp);
+}
+
+// static
+void Fiber::fiberProc(void* pObj)
+{
+    Fiber* pFiber = (Fiber*)pObj;
+    pFiber->main();
+    pFiber->switchToCaller();
+}
+
+#else
+
+void Fiber::switchToFiber()
+{
+    ::swapcontext(&_callerContext, &_context);
+}
+
+void Fiber::switchToCaller()
+{
+    ::swapcontext(&_context, &_callerContext);
+}
+
+// static
+void Fiber::fiberProc(void* pObj)
 {
     Fiber* pFiber = (Fiber*)pObj;
-    void* previousFiber = pFiber->main();
-    ::SwitchToFiber(previousFiber);
+    pFiber->main();
+    pFiber->switchToCaller();
 }
+
+// static
+void Fiber::contextProc(unsigned int hi, unsigned int lo)
+{
+    fiberProc((void*)(uintptr_t)(((uint64_t)hi << 32) | lo));
+}
+
+#endif
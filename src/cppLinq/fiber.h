@@ -15,7 +15,33 @@
 #pragma once
 
 #include <exception>
+#include <stddef.h>
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+#include <vector>
+#endif
 
+#include "fiberStackPool.h"
+
+// Context switch backend:
+//  - Windows: CreateFiber/SwitchToFiber.
+//  - Linux x86-64/AArch64: hand-written register save/restore (fiber.cpp).
+//  - other POSIX systems: ucontext. Define CPPLINQ_FIBER_UCONTEXT to force it.
+#if defined(_WIN32)
+#define CPPLINQ_FIBER_WIN32
+#elif !defined(CPPLINQ_FIBER_UCONTEXT) && defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define CPPLINQ_FIBER_ASM
+#else
+#ifndef CPPLINQ_FIBER_UCONTEXT
+#define CPPLINQ_FIBER_UCONTEXT
+#endif
+#include <ucontext.h>
+#endif
+
+// A suspended fiber may be resumed (or destroyed) on a different thread than
+// the one that suspended it, provided it is handed over with the usual
+// synchronization and never resumed by two threads at once. Code that runs
+// on a fiber must not keep the address of a thread-local variable across a
+// yield: with MSVC, compile with /GT (fiber-safe optimizations).
 class Fiber
 {
     enum FiberState
@@ -29,15 +55,68 @@ class Fiber
     struct StopFiberException {};
 
 public:
-    Fiber();
+    // Stack sizes are reservations: the memory is committed only when it is
+    // touched, so an idle fiber holds a few KB whatever its stack size.
+    // Blocks that only move elements around (Range, Take, Concat...) use
+    // SmallStackSize; blocks that call user code use DefaultStackSize.
+    static const size_t SmallStackSize = 64 * 1024;
+    static const size_t DefaultStackSize = sizeof(void*) == 8 ? 1024 * 1024 : 256 * 1024;
+
+    // name identifies the kind of fiber in the stack profile.
+    explicit Fiber(size_t stackSize = DefaultStackSize, const char* name = nullptr);
     virtual ~Fiber();
 
+    // The size asked for: the stack is acquired at the first resume().
+    size_t stackSize() const {
+        return _stackSize;
+    }
+
+    // The fiber running on the calling thread, or nullptr.
+    static Fiber* current();
+
+    // Tells whether the body holds, across its yields, no object with a
+    // non-trivial destructor. A fiber destroyed while suspended is normally
+    // switched back to and unwound with an exception; an abandonable one
+    // just gives its stack back to the pool (except on Windows, see ~Fiber).
+    void setAbandonable(bool abandonable) {
+        _abandonable = abandonable;
+    }
+
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+    // With CPPLINQ_FIBER_STACK_PROFILE defined, the stacks are filled with a
+    // known pattern and the deepest byte overwritten is recorded when the
+    // fiber is destroyed, to help tuning the stack size of each block.
+    struct StackProfile
+    {
+        const char* name;
+        size_t stackSize;
+        long long fibers;
+        size_t peakDepth;
+    };
+
+    static std::vector<StackProfile> stackProfile();
+    size_t peakStackDepth() const;
+#endif
+
+#ifdef CPPLINQ_FIBER_WIN32
+    // Optional: a thread is converted the first time it resumes a fiber.
     static void enableFibersInCurrentThread() {
-        ::ConvertThreadToFiberEx(NULL, FIBER_FLAG_FLOAT_SWITCH);
+        if (! ::IsThreadAFiber()) {
+            ::ConvertThreadToFiberEx(NULL, FIBER_FLAG_FLOAT_SWITCH);
+        }
     }
     static bool disableFibersInCurrentThread() {
         return (FALSE != ::ConvertFiberToThread());
     }
+#else
+    // The caller context is saved in the Fiber object itself on every resume(),
+    // so threads do not need to be converted.
+    static void enableFibersInCurrentThread() {
+    }
+    static bool disableFibersInCurrentThread() {
+        return true;
+    }
+#endif
 
     void* main();
     bool resume();
@@ -47,14 +126,42 @@ protected:
     void yield(bool goOn);
 
 private:
+    friend class FiberStackPool;
+
+    void start();
+    void switchToFiber();
+    void switchToCaller();
+
+    FiberStack* _stack;
+    size_t _stackSize;
+    const char* _name;
+    bool _abandonable;
+#if defined(CPPLINQ_FIBER_STACK_PROFILE) && defined(CPPLINQ_FIBER_WIN32)
+    void updatePeakStackDepth();
+
+    size_t _peakDepth;
+#endif
+
+#ifdef CPPLINQ_FIBER_WIN32
     static void WINAPI fiberProc(void* lpFiberParameter);
 
     PFIBER_START_ROUTINE _fiber;
     PFIBER_START_ROUTINE _previousFiber;
+#else
+    static void fiberProc(void* pObj);
+
+#ifdef CPPLINQ_FIBER_ASM
+    void* _sp;
+    void* _callerSp;
+#else
+    static void contextProc(unsigned int hi, unsigned int lo);
+
+    ucontext_t _context;
+    ucontext_t _callerContext;
+#endif
+#endif
     FiberState _state;
 
-    std::exception _exception;
-    bool _exceptionCaught;
+    std::exception_ptr _exception;
 };
 
-
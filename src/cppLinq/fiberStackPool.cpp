@@ -0,0 +1,330 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "fiberStackPool.h"
+#include "fiber.h"
+
+#include <new>
+
+#ifndef CPPLINQ_FIBER_WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////
+// Per-thread cache
+
+#ifdef CPPLINQ_FIBER_STACK_THREAD_CACHE
+
+struct FiberStackPool::ThreadCache
+{
+    ThreadCache() {
+        for (int i = 0; i < SizeClasses; i++) {
+            _free[i] = nullptr;
+            _count[i] = 0;
+        }
+    }
+
+    // The stacks of an exiting thread go back to the shared lists.
+    ~ThreadCache();
+
+    FiberStack* _free[SizeClasses];
+    int _count[SizeClasses];
+};
+
+// Set once the cache of the current thread has been destroyed: fibers
+// released later in the thread exit sequence bypass it.
+static thread_local bool t_threadCacheDestroyed = false;
+
+FiberStackPool::ThreadCache::~ThreadCache()
+{
+    t_threadCacheDestroyed = true;
+    FiberStackPool& pool = FiberStackPool::instance();
+    for (int i = 0; i < SizeClasses; i++) {
+        while (nullptr != _free[i]) {
+            FiberStack* stack = _free[i];
+            _free[i] = stack->next;
+            pool.pushShared(stack);
+        }
+        _count[i] = 0;
+    }
+}
+
+// static
+FiberStackPool::ThreadCache& FiberStackPool::threadCache()
+{
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+#endif // CPPLINQ_FIBER_STACK_THREAD_CACHE
+
+////////////////////////////////////////////////////////////////////////////
+// FiberStackPool
+
+// static
+FiberStackPool& FiberStackPool::instance()
+{
+    // never destroyed: fibers owned by static objects can still release
+    // their stacks during the process shutdown.
+    static FiberStackPool* pool = new FiberStackPool();
+    return *pool;
+}
+
+FiberStackPool::FiberStackPool() :
+    _hits(0),
+    _misses(0),
+    _inUse(0),
+    _highWater(0)
+{
+    for (int i = 0; i < SizeClasses; i++) {
+        _free[i] = nullptr;
+        _freeCount[i] = 0;
+    }
+}
+
+FiberStack* FiberStackPool::acquire(size_t size)
+{
+    int sc = sizeClass(size);
+    FiberStack* stack = nullptr;
+
+    if (sc >= 0) {
+#ifdef CPPLINQ_FIBER_STACK_THREAD_CACHE
+        if (! t_threadCacheDestroyed) {
+            ThreadCache& cache = threadCache();
+            stack = cache._free[sc];
+            if (nullptr != stack) {
+                cache._free[sc] = stack->next;
+                cache._count[sc]--;
+            }
+        }
+#endif
+        if (nullptr == stack) {
+            stack = popShared(sc);
+        }
+    }
+
+    if (nullptr != stack) {
+        _hits++;
+    }
+    else {
+        _misses++;
+        stack = create(sc >= 0 ? classSize(sc) : size, sc);
+    }
+
+    long long inUse = ++_inUse;
+    long long highWater = _highWater.load(std::memory_order_relaxed);
+    while (inUse > highWater && ! _highWater.compare_exchange_weak(highWater, inUse)) {
+    }
+
+    stack->next = nullptr;
+    return stack;
+}
+
+void FiberStackPool::release(FiberStack* stack)
+{
+    _inUse--;
+    stack->owner = nullptr;
+
+    if (stack->sizeClass < 0) {
+        destroy(stack);
+        return;
+    }
+
+#ifdef CPPLINQ_FIBER_STACK_THREAD_CACHE
+    if (! t_threadCacheDestroyed) {
+        ThreadCache& cache = threadCache();
+        int sc = stack->sizeClass;
+        if (cache._count[sc] < ThreadCacheCapacity) {
+            stack->next = cache._free[sc];
+            cache._free[sc] = stack;
+            cache._count[sc]++;
+            return;
+        }
+    }
+#endif
+    pushShared(stack);
+}
+
+void FiberStackPool::trim()
+{
+    FiberStack* released = nullptr;
+
+#ifdef CPPLINQ_FIBER_STACK_THREAD_CACHE
+    if (! t_threadCacheDestroyed) {
+        ThreadCache& cache = threadCache();
+        for (int i = 0; i < SizeClasses; i++) {
+            while (nullptr != cache._free[i]) {
+                FiberStack* stack = cache._free[i];
+                cache._free[i] = stack->next;
+                stack->next = released;
+                released = stack;
+            }
+            cache._count[i] = 0;
+        }
+    }
+#endif
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        for (int i = 0; i < SizeClasses; i++) {
+            while (nullptr != _free[i]) {
+                FiberStack* stack = _free[i];
+                _free[i] = stack->next;
+                stack->next = released;
+                released = stack;
+            }
+            _freeCount[i] = 0;
+        }
+    }
+
+    while (nullptr != released) {
+        FiberStack* stack = released;
+        released = stack->next;
+        destroy(stack);
+    }
+}
+
+FiberStackPool::Statistics FiberStackPool::statistics() const
+{
+    Statistics s;
+    s.hits = _hits;
+    s.misses = _misses;
+    s.inUse = _inUse;
+    s.highWater = _highWater;
+    s.cached = 0;
+
+    std::lock_guard<std::mutex> lock(_lock);
+    for (int i = 0; i < SizeClasses; i++) {
+        s.cached += _freeCount[i];
+    }
+    return s;
+}
+
+FiberStack* FiberStackPool::popShared(int sizeClass)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    FiberStack* stack = _free[sizeClass];
+    if (nullptr != stack) {
+        _free[sizeClass] = stack->next;
+        _freeCount[sizeClass]--;
+    }
+    return stack;
+}
+
+void FiberStackPool::pushShared(FiberStack* stack)
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        int sc = stack->sizeClass;
+        if (_freeCount[sc] < SharedCapacity) {
+            stack->next = _free[sc];
+            _free[sc] = stack;
+            _freeCount[sc]++;
+            return;
+        }
+    }
+    destroy(stack);
+}
+
+// static
+int FiberStackPool::sizeClass(size_t size)
+{
+    for (int i = 0; i < SizeClasses; i++) {
+        if (size <= classSize(i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// static
+size_t FiberStackPool::classSize(int sizeClass)
+{
+    return MinStackSize << sizeClass;
+}
+
+#ifdef CPPLINQ_FIBER_WIN32
+
+// static
+FiberStack* FiberStackPool::create(size_t size, int sizeClass)
+{
+    FiberStack* stack = new FiberStack();
+    stack->size = size;
+    stack->sizeClass = sizeClass;
+    stack->owner = nullptr;
+    stack->next = nullptr;
+    // only reserve the stack: the default commit of the executable (a page,
+    // normally) plus whatever the fiber touches while it grows.
+    stack->base = ::CreateFiberEx(0, size, FIBER_FLAG_FLOAT_SWITCH, Fiber::fiberProc, stack);
+    if (nullptr == stack->base) {
+        delete stack;
+        throw std::bad_alloc();
+    }
+    return stack;
+}
+
+// static
+void FiberStackPool::destroy(FiberStack* stack)
+{
+    ::DeleteFiber(stack->base);
+    delete stack;
+}
+
+#else
+
+// static
+FiberStack* FiberStackPool::create(size_t size, int sizeClass)
+{
+    // Anonymous pages are committed on first touch; MAP_NORESERVE also keeps
+    // the untouched part out of the swap accounting, so a large stack costs
+    // only address space until it is used.
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    size_t pageSize = (size_t)::sysconf(_SC_PAGESIZE);
+    void* p = ::mmap(nullptr, size + pageSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (MAP_FAILED == p) {
+        throw std::bad_alloc();
+    }
+    // an overflow faults on the guard page instead of silently corrupting
+    // the memory below the stack.
+    ::mprotect(p, pageSize, PROT_NONE);
+
+    FiberStack* stack = new FiberStack();
+    stack->base = (char*)p + pageSize;
+    stack->size = size;
+    stack->sizeClass = sizeClass;
+    stack->owner = nullptr;
+    stack->next = nullptr;
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+    stack->dirtySize = size;
+#endif
+    return stack;
+}
+
+// static
+void FiberStackPool::destroy(FiberStack* stack)
+{
+    size_t pageSize = (size_t)::sysconf(_SC_PAGESIZE);
+    ::munmap((char*)stack->base - pageSize, stack->size + pageSize);
+    delete stack;
+}
+
+#endif
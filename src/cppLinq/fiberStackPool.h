@@ -0,0 +1,106 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+
+class Fiber;
+
+// VS2012 has no thread_local; there every stack goes through the shared lists.
+#if !defined(_MSC_VER) || _MSC_VER >= 1900
+#define CPPLINQ_FIBER_STACK_THREAD_CACHE
+#endif
+
+// A fiber stack handed out by FiberStackPool.
+// On Windows the pooled object is a whole fiber (CreateFiber allocates the
+// stack itself): base is the fiber handle, which runs the main() of every
+// Fiber that owns it in turn. Elsewhere base is the lowest usable address of
+// an mmap'ed stack, with an inaccessible guard page right below it.
+struct FiberStack
+{
+    void* base;
+    size_t size;
+    int sizeClass;
+    Fiber* owner;
+    FiberStack* next;
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+    size_t dirtySize;   // bytes at the top that may have lost the fill pattern
+#endif
+};
+
+// Process-wide pool of fiber stacks.
+// Stacks are grouped in power of two size classes. Each thread keeps a few
+// released stacks of every class in a private cache, so a query that is
+// created and run in a loop reuses the same stacks without locking; the
+// overflow goes to the shared free lists, and only past their capacity is
+// the memory given back to the OS.
+class FiberStackPool
+{
+public:
+    struct Statistics
+    {
+        long long hits;         // acquire() served from a cache
+        long long misses;       // acquire() that had to allocate a new stack
+        long long inUse;        // stacks currently owned by a Fiber
+        long long highWater;    // highest value reached by inUse
+        long long cached;       // stacks held in the shared free lists
+    };
+
+    static const size_t MinStackSize = 16 * 1024;
+    static const int SizeClasses = 7;           // 16KB .. 1MB
+    static const int ThreadCacheCapacity = 16;  // stacks per class and thread
+    static const int SharedCapacity = 64;       // stacks per class
+
+    static FiberStackPool& instance();
+
+    // Returns a stack of at least size bytes.
+    FiberStack* acquire(size_t size);
+    void release(FiberStack* stack);
+
+    // Frees the stacks cached by the calling thread and the shared free lists.
+    void trim();
+
+    Statistics statistics() const;
+
+private:
+    FiberStackPool();
+    FiberStackPool(const FiberStackPool&);
+    FiberStackPool& operator=(const FiberStackPool&);
+
+    static int sizeClass(size_t size);
+    static size_t classSize(int sizeClass);
+    static FiberStack* create(size_t size, int sizeClass);
+    static void destroy(FiberStack* stack);
+
+    FiberStack* popShared(int sizeClass);
+    void pushShared(FiberStack* stack);
+
+    mutable std::mutex _lock;
+    FiberStack* _free[SizeClasses];
+    int _freeCount[SizeClasses];
+
+    std::atomic<long long> _hits;
+    std::atomic<long long> _misses;
+    std::atomic<long long> _inUse;
+    std::atomic<long long> _highWater;
+
+#ifdef CPPLINQ_FIBER_STACK_THREAD_CACHE
+    struct ThreadCache;
+    friend struct ThreadCache;
+    static ThreadCache& threadCache();
+#endif
+};
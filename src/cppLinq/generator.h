@@ -0,0 +1,124 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// C++20 stackless coroutines are used when the compiler supports them,
+// unless CPPLINQ_NO_COROUTINES is defined.
+#if !defined(CPPLINQ_NO_COROUTINES) && defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define CPPLINQ_COROUTINES
+#endif
+#endif
+
+#ifdef CPPLINQ_COROUTINES
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+
+// The coroutine counterpart of an iterator block body: co_yield replaces
+// IteratorBlock::yieldReturn, and co_return replaces yieldBreak.
+// The coroutine starts suspended and runs up to the next co_yield every time
+// next() is called. Only the frame of the coroutine is allocated (typically a
+// few hundred bytes), there is no separate stack.
+template <typename T>
+class Generator
+{
+public:
+    struct promise_type
+    {
+        promise_type() : _current(nullptr) {
+        }
+
+        Generator get_return_object() {
+            return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept {
+            return std::suspend_always();
+        }
+        std::suspend_always final_suspend() noexcept {
+            return std::suspend_always();
+        }
+
+        // A yielded lvalue or temporary stays alive while the coroutine is
+        // suspended in the co_yield expression, so it is published by address.
+        std::suspend_always yield_value(T& value) noexcept {
+            _current = std::addressof(value);
+            return std::suspend_always();
+        }
+        std::suspend_always yield_value(T&& value) noexcept {
+            _current = std::addressof(value);
+            return std::suspend_always();
+        }
+        std::suspend_always yield_value(const T& value) {
+            _copy.emplace(value);
+            _current = std::addressof(*_copy);
+            return std::suspend_always();
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            _exception = std::current_exception();
+        }
+
+        T* _current;
+        std::optional<T> _copy;
+        std::exception_ptr _exception;
+    };
+
+    Generator(Generator&& rhs) noexcept : _handle(rhs._handle) {
+        rhs._handle = nullptr;
+    }
+
+    ~Generator() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    // Resumes the coroutine; returns false when it has completed.
+    bool next() {
+        if (! _handle || _handle.done()) {
+            return false;
+        }
+        _handle.resume();
+        if (_handle.promise()._exception) {
+            std::exception_ptr e = _handle.promise()._exception;
+            _handle.promise()._exception = nullptr;
+            std::rethrow_exception(e);
+        }
+        return ! _handle.done();
+    }
+
+    T& current() {
+        return *_handle.promise()._current;
+    }
+
+private:
+    explicit Generator(std::coroutine_handle<promise_type> handle) : _handle(handle) {
+    }
+
+    Generator(const Generator&);
+    Generator& operator=(const Generator&);
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+#endif // CPPLINQ_COROUTINES
@@ -0,0 +1,315 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <set>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+
+// Open-addressing hash set, the set of Distinct, Union, Except and Intersect.
+// The elements live in one flat array of slots, probed linearly from the
+// slot picked by their hash. A parallel array of control bytes, one per
+// slot, says whether the slot is full and keeps 7 more bits of the hash of
+// its element: a probe walks through bytes in the same cache lines, and
+// compares elements only when those bits match, instead of following the
+// pointers of a tree.
+// An erased element leaves a tombstone, which the probes walk past, until
+// the next rehash.
+template <typename T, typename Hasher = std::hash<T>, typename KeyEqual = std::equal_to<T>>
+class FlatHashSet
+{
+public:
+    static const size_t MinCapacity = 16;
+
+    // With room for expected elements.
+    explicit FlatHashSet(size_t expected = 0, const Hasher& hasher = Hasher(), const KeyEqual& keyEqual = KeyEqual()) :
+        _hasher(hasher),
+        _keyEqual(keyEqual),
+        _control(nullptr),
+        _slots(nullptr),
+        _capacity(0),
+        _size(0),
+        _used(0),
+        _shift(64) {
+        reserve(expected);
+    }
+
+    FlatHashSet(FlatHashSet&& rhs) :
+        _hasher(rhs._hasher),
+        _keyEqual(rhs._keyEqual),
+        _control(rhs._control),
+        _slots(rhs._slots),
+        _capacity(rhs._capacity),
+        _size(rhs._size),
+        _used(rhs._used),
+        _shift(rhs._shift) {
+        rhs._control = nullptr;
+        rhs._slots = nullptr;
+        rhs._capacity = 0;
+        rhs._size = 0;
+        rhs._used = 0;
+        rhs._shift = 64;
+    }
+
+    ~FlatHashSet() {
+        _release(_control, _slots, _capacity);
+    }
+
+    // Adds a copy of item, unless an equal element is already in the set.
+    // Returns the element in the set, and whether it was added.
+    std::pair<const T*, bool> insert(const T& item) {
+        if (0 == _capacity) {
+            _rehash(MinCapacity);
+        }
+
+        uint64_t hash = _hash(item);
+        unsigned char tag = _tag(hash);
+        size_t mask = _capacity - 1;
+        size_t i = (size_t)(hash >> _shift);
+        while (Empty != _control[i]) {
+            if (tag == _control[i] && _keyEqual(_slots[i], item)) {
+                return std::pair<const T*, bool>(&_slots[i], false);
+            }
+            i = (i + 1) & mask;
+        }
+
+        if (_used >= _maxSize(_capacity)) {
+            // (the same size, if most of what is used is tombstones)
+            _rehash((_size >= _maxSize(_capacity) / 2) ? _capacity * 2 : _capacity);
+            tag = _tag(hash);
+            i = _findEmpty(hash);
+        }
+        ::new (&_slots[i]) T(item);
+        _control[i] = tag;
+        _size++;
+        _used++;
+        return std::pair<const T*, bool>(&_slots[i], true);
+    }
+
+    bool contains(const T& item) const {
+        return nullptr != _find(item);
+    }
+
+    // As std::set::count: 1 if an equal element is in the set, else 0.
+    size_t count(const T& item) const {
+        return (nullptr != _find(item)) ? 1 : 0;
+    }
+
+    // Removes the element equal to item, if any. Returns how many were
+    // removed, 0 or 1, as std::set::erase.
+    size_t erase(const T& item) {
+        T* element = _find(item);
+        if (nullptr == element) {
+            return 0;
+        }
+        element->~T();
+        _control[element - _slots] = Deleted;
+        _size--;
+        return 1;
+    }
+
+    // Makes room for count elements, so that adding them does not rehash.
+    void reserve(size_t count) {
+        size_t capacity = capacityFor(count);
+        if (count > 0 && capacity > _capacity) {
+            _rehash(capacity);
+        }
+    }
+
+    // The smallest capacity with room for count elements: that of a set
+    // that grew to count elements, with no tombstones.
+    static size_t capacityFor(size_t count) {
+        size_t capacity = MinCapacity;
+        while (_maxSize(capacity) < count) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    bool empty() const {
+        return 0 == _size;
+    }
+
+    // The number of slots: a power of two, at most three quarters full
+    // (or taken by tombstones).
+    size_t capacity() const {
+        return _capacity;
+    }
+
+    // Whether adding an element rehashes the set (and, if there are no
+    // tombstones, grows it to capacityFor(size() + 1)).
+    bool full() const {
+        return _used >= _maxSize(_capacity);
+    }
+
+private:
+    FlatHashSet(const FlatHashSet&);
+    FlatHashSet& operator=(const FlatHashSet&);
+
+    // The control byte of a slot: Empty, Deleted or, if the high bit is
+    // set, full.
+    enum { Empty = 0, Deleted = 1 };
+
+    static bool _full(unsigned char control) {
+        return 0 != (control & 0x80);
+    }
+
+    T* _find(const T& item) const {
+        if (0 == _size) {
+            return nullptr;
+        }
+
+        uint64_t hash = _hash(item);
+        unsigned char tag = _tag(hash);
+        size_t mask = _capacity - 1;
+        for (size_t i = (size_t)(hash >> _shift); Empty != _control[i]; i = (i + 1) & mask) {
+            if (tag == _control[i] && _keyEqual(_slots[i], item)) {
+                return &_slots[i];
+            }
+        }
+        return nullptr;
+    }
+
+    static size_t _maxSize(size_t capacity) {
+        return capacity - capacity / 4;
+    }
+
+    // Fibonacci hashing: the multiplication spreads the bits of a weak hash
+    // (std::hash of an integer is the integer itself) over the high bits,
+    // which pick the slot.
+    uint64_t _hash(const T& item) const {
+        return (uint64_t)_hasher(item) * 0x9E3779B97F4A7C15ULL;
+    }
+
+    // The 7 bits below those of the slot, with the high bit set: a full slot.
+    unsigned char _tag(uint64_t hash) const {
+        return (unsigned char)(0x80 | ((hash >> (_shift - 7)) & 0x7F));
+    }
+
+    size_t _findEmpty(uint64_t hash) const {
+        size_t mask = _capacity - 1;
+        size_t i = (size_t)(hash >> _shift);
+        while (Empty != _control[i]) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void _rehash(size_t capacity) {
+        unsigned char* control = _control;
+        T* slots = _slots;
+        size_t oldCapacity = _capacity;
+
+        std::unique_ptr<unsigned char[]> newControl(new unsigned char[capacity]);
+        memset(newControl.get(), 0, capacity);
+        _slots = std::allocator<T>().allocate(capacity);
+        _control = newControl.release();
+        _capacity = capacity;
+        _used = _size;
+        _shift = 64;
+        for (size_t c = capacity; c > 1; c /= 2) {
+            _shift--;
+        }
+
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (_full(control[i])) {
+                uint64_t hash = _hash(slots[i]);
+                size_t j = _findEmpty(hash);
+                ::new (&_slots[j]) T(std::move(slots[i]));
+                _control[j] = _tag(hash);
+            }
+        }
+        _release(control, slots, oldCapacity);
+    }
+
+    static void _release(unsigned char* control, T* slots, size_t capacity) {
+        if (nullptr == control) {
+            return;
+        }
+        for (size_t i = 0; i < capacity; i++) {
+            if (_full(control[i])) {
+                slots[i].~T();
+            }
+        }
+        std::allocator<T>().deallocate(slots, capacity);
+        delete[] control;
+    }
+
+    Hasher _hasher;
+    KeyEqual _keyEqual;
+    unsigned char* _control;
+    T* _slots;
+    size_t _capacity;
+    size_t _size;
+    size_t _used;   // full slots and tombstones
+    int _shift;     // 64 - log2(_capacity)
+};
+
+// The finalizer of MurmurHash3, which spreads every bit of hash over all
+// the bits of the result: std::hash of an integer is the integer itself.
+inline uint64_t _mixHash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Whether T has std::hash and operator==.
+template <typename T>
+class _IsHashable
+{
+    template <typename U>
+    static char test(decltype(std::hash<U>()(std::declval<const U&>()),
+                              std::declval<const U&>() == std::declval<const U&>(), 0)*);
+    template <typename U>
+    static long test(...);
+
+public:
+    static const bool value = (sizeof(char) == sizeof(test<T>(nullptr)));
+};
+
+// The set of Distinct, Union and Except when no comparer is given: a
+// FlatHashSet if T can be hashed, else a std::set, which only needs
+// operator<.
+template <typename T, bool Hashable = _IsHashable<T>::value>
+struct _DefaultSet
+{
+    typedef FlatHashSet<T> type;
+
+    static type create(size_t expected) {
+        return type(expected);
+    }
+};
+
+template <typename T>
+struct _DefaultSet<T, false>
+{
+    typedef std::set<T> type;
+
+    static type create(size_t) {
+        return type();
+    }
+};
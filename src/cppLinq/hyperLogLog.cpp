@@ -0,0 +1,131 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "stdafx.h"
+#include "hyperLogLog.h"
+
+#include "exceptions.h"
+#include <math.h>
+
+// sigma(x) = x + sum(k >= 1, x^(2^k) * 2^(k - 1)), for the registers
+// still at zero; infinite when all are.
+static double sigma(double x)
+{
+    if (1.0 == x) {
+        return HUGE_VAL;
+    }
+    double y = 1.0;
+    double z = x;
+    for (;;) {
+        x *= x;
+        double previous = z;
+        z += x * y;
+        y += y;
+        if (z == previous) {
+            return z;
+        }
+    }
+}
+
+// tau(x) = (1 - x - sum(k >= 1, (1 - x^(2^-k))^2 * 2^-k)) / 3, for the
+// registers that saw all the bits of a hash at zero.
+static double tau(double x)
+{
+    if (0.0 == x || 1.0 == x) {
+        return 0.0;
+    }
+    double y = 1.0;
+    double z = 1.0 - x;
+    for (;;) {
+        x = sqrt(x);
+        double previous = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+        if (z == previous) {
+            return z / 3.0;
+        }
+    }
+}
+
+HyperLogLog::HyperLogLog(int precision) :
+    _precision(precision)
+{
+    if (precision < MinPrecision || precision > MaxPrecision) {
+        throw ArgumentOutOfRangeException("precision");
+    }
+    _registers.resize((size_t)1 << precision);
+}
+
+HyperLogLog::HyperLogLog(std::vector<unsigned char> registers) :
+    _precision(MinPrecision)
+{
+    while (_precision < MaxPrecision && ((size_t)1 << _precision) < registers.size()) {
+        _precision++;
+    }
+    if (((size_t)1 << _precision) != registers.size()) {
+        throw ArgumentException("registers");
+    }
+    for (size_t i = 0; i < registers.size(); i++) {
+        if (registers[i] > 64 - _precision + 1) {
+            throw ArgumentException("registers");
+        }
+    }
+    _registers.swap(registers);
+}
+
+void HyperLogLog::merge(const HyperLogLog& rhs)
+{
+    if (rhs._precision != _precision) {
+        throw ArgumentException("The sketches have different precisions");
+    }
+    for (size_t i = 0; i < _registers.size(); i++) {
+        if (rhs._registers[i] > _registers[i]) {
+            _registers[i] = rhs._registers[i];
+        }
+    }
+}
+
+double HyperLogLog::estimate() const
+{
+    // how many registers hold each value, 0..q + 1
+    const int q = 64 - _precision;
+    int counts[64 + 1] = {};
+    for (size_t i = 0; i < _registers.size(); i++) {
+        counts[_registers[i]]++;
+    }
+
+    const double m = (double)_registers.size();
+    if (counts[0] == (int)_registers.size()) {
+        return 0.0;
+    }
+    double z = m * tau(1.0 - counts[q + 1] / m);
+    for (int k = q; k >= 1; k--) {
+        z = 0.5 * (z + counts[k]);
+    }
+    z += m * sigma(counts[0] / m);
+
+    // alpha = 1 / (2 ln 2)
+    return 0.5 / log(2.0) * m * m / z;
+}
+
+long long HyperLogLog::count() const
+{
+    return (long long)floor(estimate() + 0.5);
+}
+
+double HyperLogLog::relativeError() const
+{
+    return 1.04 / sqrt((double)_registers.size());
+}
@@ -14,12 +14,113 @@
 
 #pragma once
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <map>
 #include <memory>
 #include <functional>
 #include <set>
-#include <stack>
+#include <unordered_map>
+#include <vector>
+#include <type_traits>
+#include <utility>
 #include "exceptions.h"
 #include "fiber.h"
+#include "generator.h"
+#include "hashSet.h"
+#include "hyperLogLog.h"
+#include "memoryBudget.h"
+#include "queryArena.h"
+
+template <typename T> class IEnumerable;
+template <typename TSource> class IteratorBlock;
+template <typename TSource> class _IteratorBlock;
+template <typename TSource> class _CoroutineBlock;
+template <typename TSource, typename TEnumerator> class _StateMachineBlock;
+template <typename T, typename F> class _ForeachSink;
+template <typename T> class _ConcatEnumerator;
+class _RangeEnumerator;
+template <typename T> class _RepeatEnumerator;
+template <typename T, typename TResult, typename Selector> class _SelectEnumerator;
+template <typename T, typename TResult, typename Selector> class _SelectIndexEnumerator;
+template <typename T> class _SkipEnumerator;
+template <typename T, typename Predicate> class _SkipWhileEnumerator;
+template <typename T, typename Predicate> class _SkipWhileIndexEnumerator;
+template <typename T> class _TakeEnumerator;
+template <typename T, typename Predicate> class _TakeWhileEnumerator;
+template <typename T, typename Predicate> class _TakeWhileIndexEnumerator;
+template <typename T, typename Predicate> class _WhereEnumerator;
+template <typename T, typename Predicate> class _WhereIndexEnumerator;
+template <typename T> class _RandomAccessView;
+template <typename T> class _RandomAccessEnumerator;
+template <typename T> class _Array;
+template <typename T> class _VectorSink;
+template <typename T> class _SortedSequence;
+template <typename T> class _SortedDistinctEnumerator;
+template <typename T> class _MergeUnionEnumerator;
+template <typename T, bool intersect> class _MergeDifferenceEnumerator;
+template <typename T> class _SpillingSetEnumerator;
+template <typename T, typename Map, typename KeySelector, typename ValueSelector> class _MapSink;
+
+template <typename T, typename F>
+static void foreach(const std::shared_ptr<IEnumerable<T>>& enumerable, F f);
+
+// The deferred operators, as keys to select the engine that runs their body.
+enum LinqOperator
+{
+    ConcatOperator,
+    DistinctOperator,
+    EmptyOperator,
+    ExceptOperator,
+    IntersectOperator,
+    RangeOperator,
+    RepeatOperator,
+    ReverseOperator,
+    SelectOperator,
+    SelectManyOperator,
+    SkipOperator,
+    SkipWhileOperator,
+    TakeOperator,
+    TakeWhileOperator,
+    UnionOperator,
+    WhereOperator
+};
+
+// Whether a deferred operator on a sequence of T runs its body as a C++20
+// coroutine (_CoroutineBlock) instead of on a fiber (_IteratorBlock).
+// Defining CPPLINQ_COROUTINE_BLOCKS switches all the operators; a single
+// operator is switched by specializing this template, e.g.
+//     template <typename T>
+//     struct UseCoroutineBlock<WhereOperator, T> { static const bool value = true; };
+// Ignored when the compiler does not support coroutines.
+template <LinqOperator op, typename T>
+struct UseCoroutineBlock
+{
+#ifdef CPPLINQ_COROUTINE_BLOCKS
+    static const bool value = true;
+#else
+    static const bool value = false;
+#endif
+};
+
+// Concat, Range, Repeat, Select, Skip, SkipWhile, Take, TakeWhile and Where
+// are implemented as hand-written state machines (_StateMachineBlock), which
+// need no fiber, and Reverse, Skip and Take over a random-access source as
+// views that index it (_RandomAccessView). Specializing this template makes
+// one of them run on a fiber (_IteratorBlock) again; defining
+// CPPLINQ_FIBER_BLOCKS does it for all. UseCoroutineBlock takes precedence.
+template <LinqOperator op, typename T>
+struct UseFiberBlock
+{
+#ifdef CPPLINQ_FIBER_BLOCKS
+    static const bool value = true;
+#else
+    static const bool value = false;
+#endif
+};
 
 template <typename T> 
 class IEnumerator
@@ -29,6 +130,272 @@ public:
     virtual bool MoveNext() = 0;
     virtual T& get_Current() = 0;
     virtual ~IEnumerator() {}
+
+    // Value of max for the callers that take whatever the enumerator has.
+    static const size_t MaxBatch = (size_t)-1;
+
+    // Moves past up to max (> 0) elements at once and points items at them;
+    // returns their number, or 0 at the end. The elements are contiguous and
+    // stay valid until the next call, and get_Current() returns the last one.
+    // Enumerators that hold their elements in an array (a vector, the batch
+    // of an iterator block) return many; by default it is one, through
+    // MoveNext() and get_Current().
+    virtual size_t MoveNextBatch(T*& items, size_t max) {
+        if (! MoveNext()) {
+            return 0;
+        }
+        items = &get_Current();
+        return 1;
+    }
+};
+
+// Receives the elements pushed by IEnumerable::pushTo, in order; push()
+// returns false to stop the enumeration.
+template <typename T>
+class _Sink
+{
+public:
+    virtual bool push(T& item) = 0;
+    virtual ~_Sink() {}
+
+    // Receives count consecutive elements at once, from a source that reads
+    // them with IEnumerator::MoveNextBatch. Sinks that can do better than
+    // one virtual call per element override it.
+    virtual bool pushBatch(T* items, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (! push(items[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Optional capability of the sequences whose elements can be indexed, like
+// IList<T> in .NET: IEnumerable::randomAccess() returns it, or null.
+// Count, ElementAt, Last and SequenceEqual then read the size or the
+// elements they need directly, and Reverse, Skip and Take return views
+// that index the source rather than enumerate it.
+template <typename T>
+class IRandomAccess
+{
+public:
+    virtual size_t get_Count() = 0;
+    virtual T& get_Item(size_t index) = 0;  // index < get_Count()
+    virtual ~IRandomAccess() {}
+
+    // The elements, if they are contiguous in memory, or null.
+    virtual T* get_Data() {
+        return nullptr;
+    }
+};
+
+// Types whose values are equal if and only if their bytes are: two arrays
+// of them can be compared with memcmp.
+template <typename T>
+struct _IsBitwiseComparable
+{
+    static const bool value = std::is_integral<T>::value || std::is_enum<T>::value
+        || std::is_pointer<T>::value;
+};
+
+// What a sequence knows of its number of elements before it is enumerated:
+// nothing, an upper bound, or the exact number (see IEnumerable::sizeHint).
+// The operators derive theirs from those of their sources, and the ones
+// that buffer their source reserve room from it. It is only a hint: the
+// source may change before it is enumerated, so no result depends on it.
+struct SizeHint
+{
+    enum Kind { Unknown, AtMost, Exact };
+
+    // Largest upper bound worth reserving room for: a filter may keep few
+    // of the elements.
+    static const size_t MaxReservedBound = 1024;
+
+    SizeHint() : kind(Unknown), size(0) {
+    }
+
+    static SizeHint unknown() {
+        return SizeHint();
+    }
+    static SizeHint atMost(size_t size) {
+        return SizeHint(AtMost, size);
+    }
+    static SizeHint exact(size_t size) {
+        return SizeHint(Exact, size);
+    }
+
+    bool isKnown() const {
+        return Unknown != kind;
+    }
+    bool isExact() const {
+        return Exact == kind;
+    }
+
+    // Whether capacity() makes room for all the elements, so that a buffer
+    // reserved with it never grows.
+    bool reservable() const {
+        return isExact() || (isKnown() && size <= MaxReservedBound);
+    }
+
+    // Number of elements to reserve room for.
+    size_t capacity() const {
+        switch (kind) {
+        case Exact:
+            return size;
+        case AtMost:
+            return (size < MaxReservedBound) ? size : MaxReservedBound;
+        default:
+            return 0;
+        }
+    }
+
+    // The hint of a filter of the sequence (Where, Distinct...).
+    SizeHint bound() const {
+        return isKnown() ? atMost(size) : unknown();
+    }
+
+    // The hints of Skip(n) and Take(n).
+    SizeHint skip(size_t n) const {
+        return isKnown() ? SizeHint(kind, (size > n) ? size - n : 0) : unknown();
+    }
+    SizeHint take(size_t n) const {
+        return isKnown() ? SizeHint(kind, std::min(size, n)) : atMost(n);
+    }
+
+    // The hint of the intersection of two sequences: at most the smaller.
+    SizeHint intersect(const SizeHint& rhs) const {
+        if (! isKnown()) {
+            return rhs.bound();
+        }
+        if (! rhs.isKnown()) {
+            return bound();
+        }
+        return atMost((size < rhs.size) ? size : rhs.size);
+    }
+
+    // The hint of the concatenation of two sequences.
+    SizeHint operator+(const SizeHint& rhs) const {
+        if (! isKnown() || ! rhs.isKnown() || size + rhs.size < size) {
+            return unknown();
+        }
+        return SizeHint((isExact() && rhs.isExact()) ? Exact : AtMost, size + rhs.size);
+    }
+
+    Kind kind;
+    size_t size;
+
+private:
+    SizeHint(Kind kind, size_t size) : kind(kind), size(size) {
+    }
+};
+
+// How an operator run as an iterator block or a coroutine derives its size
+// hint from those of its sources, which the body of the block keeps alive.
+class _SizeRule
+{
+public:
+    enum Op
+    {
+        None,       // unknown
+        Exact,      // n
+        Same,       // as lhs (Reverse, Select)
+        Bound,      // at most lhs (Where, Distinct, Except...)
+        Skip,       // lhs minus n
+        Take,       // lhs up to n
+        Sum,        // lhs plus rhs (Concat)
+        BoundSum,   // at most lhs plus rhs (Union)
+        BoundMin    // at most the smaller of lhs and rhs (Intersect)
+    };
+
+    _SizeRule() : _op(None), _n(0), _lhs(nullptr), _rhs(nullptr), _hintOf(nullptr) {
+    }
+
+    explicit _SizeRule(size_t n) : _op(Exact), _n(n), _lhs(nullptr), _rhs(nullptr), _hintOf(nullptr) {
+    }
+
+    template <typename T>
+    _SizeRule(Op op, IEnumerable<T>* lhs, IEnumerable<T>* rhs = nullptr) :
+        _op(op), _n(0), _lhs(lhs), _rhs(rhs), _hintOf(&hintOf<T>) {
+    }
+
+    template <typename T>
+    _SizeRule(Op op, IEnumerable<T>* source, size_t n) :
+        _op(op), _n(n), _lhs(source), _rhs(nullptr), _hintOf(&hintOf<T>) {
+    }
+
+    SizeHint apply() const {
+        switch (_op) {
+        case Exact:
+            return SizeHint::exact(_n);
+        case Same:
+            return _hintOf(_lhs);
+        case Bound:
+            return _hintOf(_lhs).bound();
+        case Skip:
+            return _hintOf(_lhs).skip(_n);
+        case Take:
+            return _hintOf(_lhs).take(_n);
+        case Sum:
+            return _hintOf(_lhs) + _hintOf(_rhs);
+        case BoundSum:
+            return (_hintOf(_lhs) + _hintOf(_rhs)).bound();
+        case BoundMin:
+            return _hintOf(_lhs).intersect(_hintOf(_rhs));
+        default:
+            return SizeHint::unknown();
+        }
+    }
+
+private:
+    template <typename T>
+    static SizeHint hintOf(void* source) {
+        return static_cast<IEnumerable<T>*>(source)->sizeHint();
+    }
+
+    Op _op;
+    size_t _n;
+    void* _lhs;
+    void* _rhs;
+    SizeHint (*_hintOf)(void*);
+};
+
+// The order a sequence is known to be sorted in (IEnumerable::AsSorted).
+template <typename T>
+class _Ordering
+{
+public:
+    virtual ~_Ordering() {}
+
+    virtual bool less(const T& lhs, const T& rhs) const = 0;
+
+    // The same for the orderings that compare the same way: those made from
+    // comparers of the same type.
+    virtual const void* key() const = 0;
+
+    static bool same(const std::shared_ptr<_Ordering<T>>& lhs, const std::shared_ptr<_Ordering<T>>& rhs) {
+        return lhs && rhs && lhs->key() == rhs->key();
+    }
+};
+
+template <typename T, typename Comparer>
+class _ComparerOrdering : public _Ordering<T>
+{
+public:
+    explicit _ComparerOrdering(Comparer comparer) : _comparer(comparer) {
+    }
+
+    virtual bool less(const T& lhs, const T& rhs) const {
+        return _comparer(lhs, rhs);
+    }
+
+    virtual const void* key() const {
+        static char s_key;
+        return &s_key;
+    }
+
+private:
+    mutable Comparer _comparer;
 };
 
 template <typename T> 
@@ -38,36 +405,101 @@ public:
     virtual std::shared_ptr<IEnumerator<T>> GetEnumerator() = 0;
     virtual ~IEnumerable() {}
 
+    // The random-access interface of the sequence, if it has one.
+    virtual IRandomAccess<T>* randomAccess() {
+        return nullptr;
+    }
+
+    // How many elements the sequence has, as far as it can tell without
+    // enumerating them: by default, the count of a random-access sequence.
+    virtual SizeHint sizeHint() {
+        IRandomAccess<T>* ra = randomAccess();
+        return (nullptr != ra) ? SizeHint::exact(ra->get_Count()) : SizeHint::unknown();
+    }
+
+    // Whether the elements handed out by the enumerators and by pushTo are
+    // temporaries of the query (the results of Select, the buffer of
+    // Reverse...) rather than elements stored somewhere, as those of a
+    // container are: ToVector and ToArray then move them instead of
+    // copying them. The operators that pass the elements of their source
+    // through (Where, Skip...) say what their source says.
+    virtual bool yieldsTemporaries() {
+        return false;
+    }
+
+    // The order the elements are known to be in, if the sequence was marked
+    // with AsSorted, else null.
+    virtual std::shared_ptr<_Ordering<T>> ordering() {
+        return nullptr;
+    }
+
+    // Pushes the elements to sink until it asks to stop, and returns false
+    // in that case. foreach goes through here: the operators override it to
+    // run a chain of stages as nested calls, rather than pulling each
+    // element through one enumerator (or one fiber) per stage.
+    // By default the elements are pulled in batches (MoveNextBatch).
+    virtual bool pushTo(_Sink<T>& sink) {
+        std::shared_ptr<IEnumerator<T>> e = GetEnumerator();
+        T* items;
+        size_t count;
+        while (0 != (count = e->MoveNextBatch(items, IEnumerator<T>::MaxBatch))) {
+            bool goOn = (1 == count) ? sink.push(*items) : sink.pushBatch(items, count);
+            if (! goOn) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Gives the block made by an operator (an _IteratorBlock or a
+    // _CoroutineBlock) the rule of its size hint, and tells it whether its
+    // elements are temporaries (see yieldsTemporaries).
+    template <typename Block>
+    static std::shared_ptr<Block> _described(std::shared_ptr<Block> block, const _SizeRule& rule,
+        bool temporaries = false) {
+        block->setSizeRule(rule);
+        block->setYieldsTemporaries(temporaries);
+        return block;
+    }
+
+    // foreach on this sequence, for the operators that consume it at once:
+    // they need no shared_ptr to it, so no reference counting.
+    template <typename F>
+    void _foreach(F f) {
+        _ForeachSink<T, F> sink(f);
+        pushTo(sink);
+    }
+
     ////////////////////////////////////////////////////////////////////////////
     // Aggregate
 
     template <typename Func>
     T Aggregate(Func func) {
-        return _Aggregate<T, Func>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), func);
+        return _Aggregate<T, Func>(*this, func);
     }
     T Aggregate(std::function<T(T, T)> func) {
         if (nullptr == func) {
             throw ArgumentNullException();
         }
-        return _Aggregate<T, decltype(func)>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), func);
+        return _Aggregate<T, decltype(func)>(*this, func);
     }
 
     template <typename TAccumulate, typename Func>
     TAccumulate Aggregate(const TAccumulate& seed, Func func) {
-        return _Aggregate<T, TAccumulate, Func>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), seed, func);
+        return _Aggregate<T, TAccumulate, Func>(*this, seed, func);
     }
     template <typename TAccumulate>
     TAccumulate Aggregate(const TAccumulate& seed, std::function<TAccumulate(TAccumulate, T)> func) {
         if (nullptr == func) {
             throw ArgumentNullException();
         }
-        return _Aggregate<T, TAccumulate, decltype(func)>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), seed, func);
+        return _Aggregate<T, TAccumulate, decltype(func)>(*this, seed, func);
     }
 
     template <typename TAccumulate, typename TResult, typename Func, typename ResultSelector>
     TResult Aggregate(const TAccumulate& seed, Func func, ResultSelector resultSelector) {
         return _Aggregate<T, TAccumulate, TResult, Func, ResultSelector>(
-            std::shared_ptr<IEnumerable<T>>(shared_from_this()), seed, func, resultSelector);
+            *this, seed, func, resultSelector);
     }
     template <typename TAccumulate, typename TResult>
     TResult Aggregate(const TAccumulate& seed, std::function<TAccumulate(TAccumulate, T)> func, std::function<TResult(TAccumulate)> resultSelector) {
@@ -75,17 +507,17 @@ public:
             throw ArgumentNullException();
         }
         return _Aggregate<T, TAccumulate, TResult, decltype(func), decltype(resultSelector)>(
-            std::shared_ptr<IEnumerable<T>>(shared_from_this()), seed, func, resultSelector);
+            *this, seed, func, resultSelector);
     }
 
     template <typename TSource, typename Func>
     TSource _Aggregate(
-        const std::shared_ptr<IEnumerable<TSource>> source,
+        IEnumerable<TSource>& source,
         Func func)
     {
         TSource result;
         bool first = true;
-        foreach<TSource>(source, [&result, &first, func](TSource& item) {
+        source._foreach([&result, &first, func](TSource& item) {
             if (first) {
                 first = false;
                 result = item;
@@ -102,12 +534,12 @@ public:
 
     template <typename TSource, typename TAccumulate, typename Func>
     TAccumulate _Aggregate(
-        const std::shared_ptr<IEnumerable<TSource>> source,
+        IEnumerable<TSource>& source,
         const TAccumulate& seed,
         Func func)
     {
         TAccumulate result = seed;
-        foreach<TSource>(source, [&result, func](TSource& item) {
+        source._foreach([&result, func](TSource& item) {
             result = func(result, item);
         });
         return result;
@@ -115,13 +547,13 @@ public:
 
     template <typename TSource, typename TAccumulate, typename TResult, typename Func, typename ResultSelector>
     TResult _Aggregate(
-        const std::shared_ptr<IEnumerable<TSource>> source,
+        IEnumerable<TSource>& source,
         const TAccumulate& seed,
         Func func,
         ResultSelector resultSelector)
     {
         TAccumulate result = seed;
-        foreach<TSource>(source, [&result, func](TSource& item) {
+        source._foreach([&result, func](TSource& item) {
             result = func(result, item);
         });
         return resultSelector(result);
@@ -163,8 +595,41 @@ public:
     template <typename Predicate>
     bool Any(Predicate predicate)
     {
-        std::function<bool(const T&)> func = [predicate](const T& item) { return !predicate(item); };
-        return !All<decltype(func)>(func); 
+        std::shared_ptr<IEnumerator<T>> e = GetEnumerator();
+        while (e->MoveNext())
+        {
+            if (predicate(e->get_Current())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // AsSorted
+
+    // Marks the sequence as sorted by comparer, a strict weak ordering as for
+    // std::sort, without sorting it. Distinct, and Union, Except and Intersect
+    // with a sequence marked with a comparer of the same type, then merge
+    // their inputs instead of keeping a set: they stream in one pass and in
+    // constant memory, take the elements equivalent under the ordering for
+    // equal, and yield them in order, marked in turn. The elements must be
+    // in order: if they are not, the results are undefined, as those of
+    // std::set_union. (Two lambdas are never of the same type: mark both
+    // sides with the same one.)
+    template <typename Comparer>
+    std::shared_ptr<IEnumerable<T>> AsSorted(Comparer comparer) {
+        return _sorted(this->shared_from_this(), std::make_shared<_ComparerOrdering<T, Comparer>>(comparer));
+    }
+
+    // Marks the sequence as sorted by operator<.
+    std::shared_ptr<IEnumerable<T>> AsSorted() {
+        return AsSorted(std::less<T>());
+    }
+
+    static std::shared_ptr<IEnumerable<T>> _sorted(std::shared_ptr<IEnumerable<T>> source,
+                                                   std::shared_ptr<_Ordering<T>> ordering) {
+        return _makeShared<_SortedSequence<T>>(QueryArena::current(), std::move(source), std::move(ordering));
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -207,18 +672,39 @@ public:
         }
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> lhs = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> lhs = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<ConcatOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [lhs, rhs]() {
+                return _ConcatBlock(lhs, rhs);
+            }), _SizeRule(_SizeRule::Sum, lhs.get(), rhs.get()), lhs->yieldsTemporaries() && rhs->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<ConcatOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _ConcatEnumerator<T>>>(QueryArena::current(),
+                _ConcatEnumerator<T>(std::move(lhs), std::move(rhs)));
+        }
         auto fn =  [lhs, rhs](IteratorBlock<T>* it) {
-            foreach<T>(lhs, [it](T& item) { 
-                it->yieldReturn(item);
-            });
-
-            foreach<T>(rhs, [it](T& item) { 
-                it->yieldReturn(item);
-            });
+            it->yieldFrom(lhs);
+            it->yieldFrom(rhs);
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Concat"),
+            _SizeRule(_SizeRule::Sum, lhs.get(), rhs.get()), lhs->yieldsTemporaries() && rhs->yieldsTemporaries());
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    static Generator<T> _ConcatBlock(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs) {
+        std::shared_ptr<IEnumerator<T>> e = lhs->GetEnumerator();
+        while (e->MoveNext()) {
+            co_yield e->get_Current();
+        }
+
+        e = rhs->GetEnumerator();
+        while (e->MoveNext()) {
+            co_yield e->get_Current();
+        }
     }
+#endif
 
     ////////////////////////////////////////////////////////////////////////////
     // Contains
@@ -236,8 +722,7 @@ public:
         //if (comparer == nullptr) {
         //	return false;
         //}
-        std::function<bool(const T& rhs)> func = [&value, &comparer](const T& item) { return comparer(value, item); };
-        return Any<decltype(func)>(func);
+        return Any([&value, &comparer](const T& item) { return comparer(value, item); });
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -245,8 +730,17 @@ public:
 
     // Returns the number of elements in a sequence.
     int Count() {
+        IRandomAccess<T>* ra = randomAccess();
+        if (nullptr != ra) {
+            size_t size = ra->get_Count();
+            if (size > (size_t)INT_MAX) {
+                throw OverflowException();
+            }
+            return (int)size;
+        }
+
         int count = 0;
-        foreach<T>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), [&count](const T& item) {
+        _foreach([&count](const T& item) {
             if (count == INT_MAX) {
                 throw OverflowException();
             }
@@ -263,7 +757,7 @@ public:
         //}
 
         int count = 0;
-        foreach<T>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), [&count, predicate](const T& item) {
+        _foreach([&count, predicate](const T& item) {
             if (predicate(item)) {
                 if (count == INT_MAX) {
                     throw OverflowException();
@@ -274,41 +768,112 @@ public:
         return count;
     }
 
+    ////////////////////////////////////////////////////////////////////////////
+    // CountDistinctApprox
+
+    // Estimates the number of distinct elements of a sequence with a
+    // HyperLogLog sketch of 2^precision bytes, in one pass: within about
+    // 1.2% with the default precision, and 0.4% with 16. Throws
+    // ArgumentOutOfRangeException if precision is not within
+    // HyperLogLog::MinPrecision..MaxPrecision.
+    long long CountDistinctApprox(int precision = HyperLogLog::DefaultPrecision) {
+        return ToHyperLogLog(precision).count();
+    }
+
+    // Estimates the number of distinct elements of a sequence by using a
+    // specified hash function.
+    template <typename Hasher>
+    long long CountDistinctApprox(int precision, Hasher hasher) {
+        return ToHyperLogLog(precision, hasher).count();
+    }
+
     ////////////////////////////////////////////////////////////////////////////
     // Distinct
 
-    // Returns distinct elements from a sequence.
+    // Returns distinct elements from a sequence, in a FlatHashSet if T has
+    // std::hash and operator==, else in a std::set; if the sequence is marked
+    // with AsSorted, by comparing each element with the previous one.
     std::shared_ptr<IEnumerable<T>> Distinct() {
-        // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
-        auto fn =  [source](IteratorBlock<T>* it) {
-            std::set<T> seenElements;
-            foreach<T>(source, [it, &seenElements](T item) { 
-                std::pair<std::set<T>::iterator, bool> result = seenElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
-                }
-            });
-        };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        std::shared_ptr<_Ordering<T>> order = ordering();
+        if (order) {
+            return _sorted(_makeShared<_StateMachineBlock<T, _SortedDistinctEnumerator<T>>>(QueryArena::current(),
+                _SortedDistinctEnumerator<T>(this->shared_from_this(), order)), order);
+        }
+        return _distinct([](size_t expected) {
+            return _DefaultSet<T>::create(expected);
+        }, Fiber::SmallStackSize);
     }
 
     // Returns distinct elements from a sequence by using a specified Comparer to compare values.
     template <typename Comparer>
     std::shared_ptr<IEnumerable<T>> Distinct(Comparer comparer) {
+        return _distinct([comparer](size_t) {
+            return std::set<T, Comparer>(comparer);
+        }, Fiber::DefaultStackSize);
+    }
+
+    // Returns distinct elements from a sequence by using a specified hash
+    // function and equality predicate to compare values.
+    template <typename Hasher, typename KeyEqual>
+    std::shared_ptr<IEnumerable<T>> Distinct(Hasher hasher, KeyEqual keyEqual) {
+        return _distinct([hasher, keyEqual](size_t expected) {
+            return FlatHashSet<T, Hasher, KeyEqual>(expected, hasher, keyEqual);
+        }, Fiber::DefaultStackSize);
+    }
+
+    // Returns distinct elements from a sequence, in a FlatHashSet kept within
+    // budget: past it, the elements spill to temporary files (see
+    // MemoryBudget). T needs std::hash, operator== and SpillTraits.
+    std::shared_ptr<IEnumerable<T>> Distinct(std::shared_ptr<MemoryBudget> budget) {
+        return _spillingSet(nullptr, this->shared_from_this(), nullptr, budget);
+    }
+
+    std::shared_ptr<IEnumerable<T>> _spillingSet(std::shared_ptr<IEnumerable<T>> excluded, std::shared_ptr<IEnumerable<T>> first,
+                                                 std::shared_ptr<IEnumerable<T>> second, std::shared_ptr<MemoryBudget> budget) {
+        if (! budget) {
+            throw ArgumentNullException("budget");
+        }
+        return _makeShared<_StateMachineBlock<T, _SpillingSetEnumerator<T>>>(QueryArena::current(),
+            _SpillingSetEnumerator<T>(std::move(excluded), std::move(first), std::move(second), std::move(budget)));
+    }
+
+    // newSet(expected) returns the empty set of the elements seen, with
+    // room for expected of them, when the enumeration starts.
+    template <typename NewSet>
+    std::shared_ptr<IEnumerable<T>> _distinct(NewSet newSet, size_t stackSize) {
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
-        auto fn =  [source, comparer](IteratorBlock<T>* it) {
-            std::set<T, Comparer> seenElements(comparer);
-            foreach<T>(source, [it, &seenElements](T item) { 
-                std::pair<std::set<T, Comparer>::iterator, bool> result = seenElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<DistinctOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, newSet]() {
+                return _DistinctBlock(source, newSet(source->sizeHint().bound().capacity()));
+            }), _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+        }
+#endif
+        auto fn =  [source, newSet](IteratorBlock<T>* it) {
+            auto seenElements = newSet(source->sizeHint().bound().capacity());
+            foreach<T>(source, [it, &seenElements](T& item) {
+                if (seenElements.insert(item).second) {
+                    it->yieldReturnRef(item);
                 }
             });
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, stackSize, "Distinct"),
+            _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename Set>
+    static Generator<T> _DistinctBlock(std::shared_ptr<IEnumerable<T>> source, Set seenElements) {
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (seenElements.insert(item).second) {
+                co_yield item;
+            }
+        }
     }
+#endif
 
     ////////////////////////////////////////////////////////////////////////////
     // ElementAt
@@ -339,6 +904,15 @@ public:
             return false;
         }
 
+        IRandomAccess<T>* ra = randomAccess();
+        if (nullptr != ra) {
+            if ((size_t)index >= ra->get_Count()) {
+                return false;
+            }
+            element = ra->get_Item((size_t)index);
+            return true;
+        }
+
         // We don't need to fetch the current value each time - get to the right place first.
         std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
 
@@ -359,37 +933,43 @@ public:
 
     static std::shared_ptr<IEnumerable<T>> Empty() {
         // deferred
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<EmptyOperator, T>::value) {
+            static std::shared_ptr<IEnumerable<T>> instance(_described(std::make_shared<_CoroutineBlock<T>>([]() {
+                return _EmptyBlock();
+            }), _SizeRule(0)));
+            return instance;
+        }
+#endif
         auto fn =  [](IteratorBlock<T>* it) {
             it->yieldBreak();
         };
-        static std::shared_ptr<IEnumerable<T>> instance(new _IteratorBlock<T>(fn));
+        static std::shared_ptr<IEnumerable<T>> instance(_described(
+            std::make_shared<_IteratorBlock<T>>(fn, Fiber::SmallStackSize, "Empty"), _SizeRule(0)));
         return instance;
     }
 
+#ifdef CPPLINQ_COROUTINES
+    static Generator<T> _EmptyBlock() {
+        co_return;
+    }
+#endif
+
     ////////////////////////////////////////////////////////////////////////////
     // Except
 
+    // Produces the set difference of two sequences, in a FlatHashSet if T
+    // has std::hash and operator==, else in a std::set; if both are marked
+    // sorted the same way (AsSorted), by merging them.
     std::shared_ptr<IEnumerable<T>> Except(std::shared_ptr<IEnumerable<T>> rhs) {
-        if (rhs.get() == nullptr) {
-            throw ArgumentNullException();
+        std::shared_ptr<_Ordering<T>> order = ordering();
+        if (rhs && _Ordering<T>::same(order, rhs->ordering())) {
+            return _sorted(_makeShared<_StateMachineBlock<T, _MergeDifferenceEnumerator<T, false>>>(QueryArena::current(),
+                _MergeDifferenceEnumerator<T, false>(this->shared_from_this(), rhs, order)), order);
         }
-
-        // deferred execution
-        std::shared_ptr<IEnumerable<T>> lhs = shared_from_this();
-        auto fn =  [lhs, rhs](IteratorBlock<T>* it) {
-            std::set<T> bannedElements;
-            foreach<T>(rhs, [&bannedElements](T& item) { 
-                bannedElements.insert(item);
-            } );
-
-            foreach<T>(lhs, [it, &bannedElements](T& item) { 
-                std::pair<std::set<T>::iterator, bool> result = bannedElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
-                }
-            } );
-        };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _except(rhs, [](size_t expected) {
+            return _DefaultSet<T>::create(expected);
+        }, Fiber::SmallStackSize);
     }
 
     template <typename Comparer>
@@ -398,27 +978,80 @@ public:
         //	return Except(rhs);
         //}
 
+        return _except(rhs, [comparer](size_t) {
+            return std::set<T, Comparer>(comparer);
+        }, Fiber::DefaultStackSize);
+    }
+
+    // Produces the set difference of two sequences by using a specified hash
+    // function and equality predicate to compare values.
+    template <typename Hasher, typename KeyEqual>
+    std::shared_ptr<IEnumerable<T>> Except(std::shared_ptr<IEnumerable<T>> rhs, Hasher hasher, KeyEqual keyEqual) {
+        return _except(rhs, [hasher, keyEqual](size_t expected) {
+            return FlatHashSet<T, Hasher, KeyEqual>(expected, hasher, keyEqual);
+        }, Fiber::DefaultStackSize);
+    }
+
+    // Produces the set difference of two sequences, in a FlatHashSet kept
+    // within budget: past it, the elements of both spill to temporary files
+    // (see MemoryBudget).
+    std::shared_ptr<IEnumerable<T>> Except(std::shared_ptr<IEnumerable<T>> rhs, std::shared_ptr<MemoryBudget> budget) {
+        if (! rhs) {
+            throw ArgumentNullException("rhs");
+        }
+        return _spillingSet(rhs, this->shared_from_this(), nullptr, budget);
+    }
+
+    // The banned elements are those of rhs and those of lhs already yielded:
+    // newSet gets room for both.
+    template <typename NewSet>
+    std::shared_ptr<IEnumerable<T>> _except(std::shared_ptr<IEnumerable<T>> rhs, NewSet newSet, size_t stackSize) {
         if (rhs.get() == nullptr) {
             throw ArgumentNullException();
         }
 
         // deferred execution
-        std::shared_ptr<IEnumerable<T>> lhs = shared_from_this();
-        auto fn =  [lhs, rhs, comparer](IteratorBlock<T>* it) {
-            std::set<T, Comparer> bannedElements(comparer);
+        std::shared_ptr<IEnumerable<T>> lhs = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<ExceptOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [lhs, rhs, newSet]() {
+                return _ExceptBlock(lhs, rhs, newSet((lhs->sizeHint() + rhs->sizeHint()).bound().capacity()));
+            }), _SizeRule(_SizeRule::Bound, lhs.get()), lhs->yieldsTemporaries());
+        }
+#endif
+        auto fn =  [lhs, rhs, newSet](IteratorBlock<T>* it) {
+            auto bannedElements = newSet((lhs->sizeHint() + rhs->sizeHint()).bound().capacity());
             foreach<T>(rhs, [&bannedElements](T& item) { 
                 bannedElements.insert(item);
             } );
 
             foreach<T>(lhs, [it, &bannedElements](T& item) { 
-                std::pair<std::set<T, Comparer>::iterator, bool> result = bannedElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
+                if (bannedElements.insert(item).second) {
+                    it->yieldReturnRef(item);
                 }
             } );
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, stackSize, "Except"),
+            _SizeRule(_SizeRule::Bound, lhs.get()), lhs->yieldsTemporaries());
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename Set>
+    static Generator<T> _ExceptBlock(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs, Set bannedElements) {
+        std::shared_ptr<IEnumerator<T>> e = rhs->GetEnumerator();
+        while (e->MoveNext()) {
+            bannedElements.insert(e->get_Current());
+        }
+
+        e = lhs->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (bannedElements.insert(item).second) {
+                co_yield item;
+            }
+        }
     }
+#endif
 
     ////////////////////////////////////////////////////////////////////////////
     // First
@@ -475,40 +1108,199 @@ public:
     }
 
     ////////////////////////////////////////////////////////////////////////////
-    // Last
-
-    T Last() {
-        std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
-        if (!iterator->MoveNext()) {
-            throw InvalidOperationException("Sequence was empty");
-        }
-
-        T last = iterator->get_Current();
-        while (iterator->MoveNext()) {
-            last = iterator->get_Current();
+    // Intersect
+
+    // Produces the set intersection of two sequences: the distinct elements
+    // of this sequence that are also in rhs, in the order of this sequence.
+    // The set is a FlatHashSet if T has std::hash and operator==, else a
+    // std::set; if both sequences are marked sorted the same way (AsSorted),
+    // they are merged instead.
+    std::shared_ptr<IEnumerable<T>> Intersect(std::shared_ptr<IEnumerable<T>> rhs) {
+        std::shared_ptr<_Ordering<T>> order = ordering();
+        if (rhs && _Ordering<T>::same(order, rhs->ordering())) {
+            return _sorted(_makeShared<_StateMachineBlock<T, _MergeDifferenceEnumerator<T, true>>>(QueryArena::current(),
+                _MergeDifferenceEnumerator<T, true>(this->shared_from_this(), rhs, order)), order);
         }
-        return last;
+        return _intersect(rhs, [](size_t expected) {
+            return _DefaultSet<T>::create(expected);
+        }, Fiber::SmallStackSize);
     }
 
-    template <typename Predicate>
-    T Last(Predicate predicate) {
-        //if (nullptr == predicate) {
-        //	throw ArgumentNullException("predicate");
-        //}
+    // Produces the set intersection of two sequences by using a specified
+    // Comparer to compare values.
+    template <typename Comparer>
+    std::shared_ptr<IEnumerable<T>> Intersect(std::shared_ptr<IEnumerable<T>> rhs, Comparer comparer) {
+        return _intersect(rhs, [comparer](size_t) {
+            return std::set<T, Comparer>(comparer);
+        }, Fiber::DefaultStackSize);
+    }
+
+    // Produces the set intersection of two sequences by using a specified
+    // hash function and equality predicate to compare values.
+    template <typename Hasher, typename KeyEqual>
+    std::shared_ptr<IEnumerable<T>> Intersect(std::shared_ptr<IEnumerable<T>> rhs, Hasher hasher, KeyEqual keyEqual) {
+        return _intersect(rhs, [hasher, keyEqual](size_t expected) {
+            return FlatHashSet<T, Hasher, KeyEqual>(expected, hasher, keyEqual);
+        }, Fiber::DefaultStackSize);
+    }
+
+    // As in .NET, the set is built from rhs, read whole when the enumeration
+    // starts, and this sequence is then streamed through it: an element is
+    // yielded as soon as it is found, and removed from the set so that it
+    // is yielded once.
+    // When the size hints of both sequences are known and tell that this one
+    // is the smaller, the set is built from it instead, to take less memory:
+    // its distinct elements are kept in order, rhs is streamed to remove
+    // from the set those it has, and they are yielded at the end.
+    template <typename NewSet>
+    std::shared_ptr<IEnumerable<T>> _intersect(std::shared_ptr<IEnumerable<T>> rhs, NewSet newSet, size_t stackSize) {
+        if (rhs.get() == nullptr) {
+            throw ArgumentNullException();
+        }
 
-        bool foundAny = false;
-        T last = T();
+        // deferred execution
+        std::shared_ptr<IEnumerable<T>> lhs = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<IntersectOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [lhs, rhs, newSet]() {
+                SizeHint lhsHint = lhs->sizeHint();
+                SizeHint rhsHint = rhs->sizeHint();
+                if (_isSmaller(lhsHint, rhsHint)) {
+                    return _IntersectSmallerBlock(lhs, rhs, newSet(lhsHint.bound().capacity()), lhsHint.bound().capacity());
+                }
+                return _IntersectBlock(lhs, rhs, newSet(rhsHint.bound().capacity()));
+            }), _SizeRule(_SizeRule::BoundMin, lhs.get(), rhs.get()), lhs->yieldsTemporaries());
+        }
+#endif
+        auto fn =  [lhs, rhs, newSet](IteratorBlock<T>* it) {
+            SizeHint lhsHint = lhs->sizeHint();
+            SizeHint rhsHint = rhs->sizeHint();
+            if (! _isSmaller(lhsHint, rhsHint)) {
+                auto candidates = newSet(rhsHint.bound().capacity());
+                foreach<T>(rhs, [&candidates](T& item) {
+                    candidates.insert(item);
+                });
 
-        std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
-        while (iterator->MoveNext()) {
-            T& item = iterator->get_Current();
-            if (predicate(item)) {
-                foundAny = true;
-                last = item;
+                foreach<T>(lhs, [it, &candidates](T& item) {
+                    if (candidates.erase(item)) {
+                        it->yieldReturnRef(item);
+                    }
+                });
+                return;
             }
-        }
 
-        if (!foundAny) {
+            auto unmatched = newSet(lhsHint.bound().capacity());
+            std::vector<T> distinct;
+            distinct.reserve(lhsHint.bound().capacity());
+            foreach<T>(lhs, [&unmatched, &distinct](T& item) {
+                if (unmatched.insert(item).second) {
+                    distinct.push_back(item);
+                }
+            });
+            foreach<T>(rhs, [&unmatched](T& item) {
+                unmatched.erase(item);
+            });
+
+            for (size_t i = 0; i < distinct.size(); i++) {
+                if (0 == unmatched.count(distinct[i])) {
+                    it->yieldReturnRef(distinct[i]);
+                }
+            }
+        };
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, stackSize, "Intersect"),
+            _SizeRule(_SizeRule::BoundMin, lhs.get(), rhs.get()), lhs->yieldsTemporaries());
+    }
+
+    static bool _isSmaller(const SizeHint& lhs, const SizeHint& rhs) {
+        return lhs.isKnown() && rhs.isKnown() && lhs.size < rhs.size;
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename Set>
+    static Generator<T> _IntersectBlock(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs, Set candidates) {
+        std::shared_ptr<IEnumerator<T>> e = rhs->GetEnumerator();
+        while (e->MoveNext()) {
+            candidates.insert(e->get_Current());
+        }
+
+        e = lhs->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (candidates.erase(item)) {
+                co_yield item;
+            }
+        }
+    }
+
+    template <typename Set>
+    static Generator<T> _IntersectSmallerBlock(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs, Set unmatched, size_t expected) {
+        std::vector<T> distinct;
+        distinct.reserve(expected);
+        std::shared_ptr<IEnumerator<T>> e = lhs->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (unmatched.insert(item).second) {
+                distinct.push_back(item);
+            }
+        }
+
+        e = rhs->GetEnumerator();
+        while (e->MoveNext()) {
+            unmatched.erase(e->get_Current());
+        }
+
+        for (size_t i = 0; i < distinct.size(); i++) {
+            if (0 == unmatched.count(distinct[i])) {
+                co_yield distinct[i];
+            }
+        }
+    }
+#endif
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Last
+
+    T Last() {
+        IRandomAccess<T>* ra = randomAccess();
+        if (nullptr != ra) {
+            size_t size = ra->get_Count();
+            if (0 == size) {
+                throw InvalidOperationException("Sequence was empty");
+            }
+            return ra->get_Item(size - 1);
+        }
+
+        std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
+        if (!iterator->MoveNext()) {
+            throw InvalidOperationException("Sequence was empty");
+        }
+
+        T last = iterator->get_Current();
+        while (iterator->MoveNext()) {
+            last = iterator->get_Current();
+        }
+        return last;
+    }
+
+    template <typename Predicate>
+    T Last(Predicate predicate) {
+        //if (nullptr == predicate) {
+        //	throw ArgumentNullException("predicate");
+        //}
+
+        bool foundAny = false;
+        T last = T();
+
+        std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
+        while (iterator->MoveNext()) {
+            T& item = iterator->get_Current();
+            if (predicate(item)) {
+                foundAny = true;
+                last = item;
+            }
+        }
+
+        if (!foundAny) {
             throw InvalidOperationException("No items matched the predicate");
         }
         return last;
@@ -518,6 +1310,12 @@ public:
     // LastOrDefault
 
     T LastOrDefault() {
+        IRandomAccess<T>* ra = randomAccess();
+        if (nullptr != ra) {
+            size_t size = ra->get_Count();
+            return (0 == size) ? T() : ra->get_Item(size - 1);
+        }
+
         std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
 
         if (!iterator->MoveNext()) {
@@ -556,10 +1354,15 @@ public:
     // LongCount
 
     // Returns the number of elements in a sequence.
-    __int64 LongCount() {
-        __int64 count = 0;
-        foreach<T>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), [&count](const T& item) {
-            if (count == INT64_MAX) {
+    long long LongCount() {
+        IRandomAccess<T>* ra = randomAccess();
+        if (nullptr != ra) {
+            return (long long)ra->get_Count();
+        }
+
+        long long count = 0;
+        _foreach([&count](const T& item) {
+            if (count == LLONG_MAX) {
                 throw OverflowException();
             }
             count++;
@@ -569,15 +1372,15 @@ public:
 
     // Returns a number that represents how many elements in the specified sequence satisfy a condition.
     template <typename Predicate>
-    __int64 LongCount(Predicate predicate) {
+    long long LongCount(Predicate predicate) {
         //if (predicate == nullptr) {
         //	throw ArgumentNullException("predicate");
         //}
 
-        __int64 count = 0;
-        foreach<T>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), [&count, predicate](const T& item) {
+        long long count = 0;
+        _foreach([&count, predicate](const T& item) {
             if (predicate(item)) {
-                if (count == INT64_MAX) {
+                if (count == LLONG_MAX) {
                     throw OverflowException();
                 }
                 count++;
@@ -590,18 +1393,16 @@ public:
     // Max
 
     T Max() {
-        std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
-        if (! iterator->MoveNext()) {
-            throw InvalidOperationException("Sequence was empty");
-        }
-
-        T max = iterator->get_Current();
-        while (iterator->MoveNext())
-        {
-            T& item = iterator->get_Current();
-            if (max < item) {
+        T max = T();
+        bool empty = true;
+        _foreach([&max, &empty](T& item) {
+            if (empty || max < item) {
                 max = item;
+                empty = false;
             }
+        });
+        if (empty) {
+            throw InvalidOperationException("Sequence was empty");
         }
         return max;
     }
@@ -615,18 +1416,16 @@ public:
     // Min
 
     T Min() {
-        std::shared_ptr<IEnumerator<T>> iterator = GetEnumerator();
-        if (! iterator->MoveNext()) {
-            throw InvalidOperationException("Sequence was empty");
-        }
-
-        T min = iterator->get_Current();
-        while (iterator->MoveNext())
-        {
-            T& item = iterator->get_Current();
-            if (min > item) {
+        T min = T();
+        bool empty = true;
+        _foreach([&min, &empty](T& item) {
+            if (empty || min > item) {
                 min = item;
+                empty = false;
             }
+        });
+        if (empty) {
+            throw InvalidOperationException("Sequence was empty");
         }
         return min;
     }
@@ -655,7 +1454,7 @@ public:
     IComparer<T>* sourceComparer = new ProjectionComparer<T, TKey>(keySelector, comparer);
     sourceComparer = new ReverseComparer<T>(sourceComparer);
     return std::shared_ptr<IOrderedEnumerable<T, TKey, std::function<TKey(T)>>>(
-    new OrderedEnumerable<T, TKey, std::function<TKey(T)>>(std::shared_ptr<IEnumerable<T>>(shared_from_this()), sourceComparer));
+    new OrderedEnumerable<T, TKey, std::function<TKey(T)>>(std::shared_ptr<IEnumerable<T>>(this->shared_from_this()), sourceComparer));
     }
     */
     ////////////////////////////////////////////////////////////////////////////
@@ -667,20 +1466,42 @@ public:
             throw ArgumentOutOfRangeException("count");
         }
 
-        // Convert everything to __int64 to avoid overflows.
-        if ((__int64)start + (__int64)count - 1 > INT_MAX) {
+        // Convert everything to long long to avoid overflows.
+        if ((long long)start + (long long)count - 1 > INT_MAX) {
             throw ArgumentOutOfRangeException("count");
         }
 
         // deferred
-        auto fn =  [start, count](IteratorBlock<int>* it) {
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<RangeOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [start, count]() {
+                return _RangeBlock(start, count);
+            }), _SizeRule((size_t)count), true);
+        }
+#endif
+        if (! UseFiberBlock<RangeOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _RangeEnumerator>>(QueryArena::current(),
+                _RangeEnumerator(start, count));
+        }
+        auto fn =  [start, count](IteratorBlock<T>* it) {
+            // nothing to unwind if the consumer stops early
+            it->setAbandonable(std::is_trivially_destructible<T>::value);
             for (int i = 0; i < count; i++) {
                 it->yieldReturn(start + i);
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Range"),
+            _SizeRule((size_t)count), true);
     }
 
+#ifdef CPPLINQ_COROUTINES
+    static Generator<T> _RangeBlock(int start, int count) {
+        for (int i = 0; i < count; i++) {
+            co_yield start + i;
+        }
+    }
+#endif
+
     ////////////////////////////////////////////////////////////////////////////
     // Repeat
 
@@ -691,13 +1512,34 @@ public:
         }
 
         // deferred
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<RepeatOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [element, count]() {
+                return _RepeatBlock(element, count);
+            }), _SizeRule((size_t)count));
+        }
+#endif
+        if (! UseFiberBlock<RepeatOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _RepeatEnumerator<T>>>(QueryArena::current(),
+                _RepeatEnumerator<T>(element, count));
+        }
         auto fn =  [element, count](IteratorBlock<T>* it) {
+            it->setAbandonable(std::is_trivially_destructible<T>::value);
             for (int i = 0; i < count; i++) {
                 it->yieldReturn(element);
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Repeat"),
+            _SizeRule((size_t)count));
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    static Generator<T> _RepeatBlock(T element, int count) {
+        for (int i = 0; i < count; i++) {
+            co_yield element;
+        }
     }
+#endif
 
     ////////////////////////////////////////////////////////////////////////////
     // Reverse
@@ -705,22 +1547,71 @@ public:
     // Inverts the order of the elements in a sequence.
     std::shared_ptr<IEnumerable<T>> Reverse() {
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<ReverseOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source]() {
+                SizeHint hint = source->sizeHint();
+                if (hint.reservable()) {
+                    std::vector<T> buffer;
+                    buffer.reserve(hint.capacity());
+                    return _ReverseBlock(source, std::move(buffer));
+                }
+                return _ReverseBlock(source, std::deque<T>());
+            }), _SizeRule(_SizeRule::Same, source.get()), true);
+        }
+#endif
+        if (! UseFiberBlock<ReverseOperator, T>::value && nullptr != randomAccess()) {
+            // read backwards, with no buffer
+            return _makeShared<_RandomAccessView<T>>(QueryArena::current(),
+                std::move(source), typename _RandomAccessView<T>::Reversed());
+        }
         auto fn =  [source](IteratorBlock<T>* it) {
-            std::stack<T> stack;
-            foreach<T>(source, [it, &stack](T& item) { 
-                stack.push(item);
-            } );
-
-            while (! stack.empty()) {
-                T item = stack.top();
-                stack.pop();
-                it->yieldReturn(item);
+            // a vector with room for all the elements if the size hint says
+            // how many there are, else a deque, which grows without moving
+            // what it holds
+            SizeHint hint = source->sizeHint();
+            if (hint.reservable()) {
+                std::vector<T> buffer;
+                buffer.reserve(hint.capacity());
+                _yieldReversed(it, source, buffer);
+            }
+            else {
+                std::deque<T> buffer;
+                _yieldReversed(it, source, buffer);
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Reverse"),
+            _SizeRule(_SizeRule::Same, source.get()), true);
+    }
+
+    template <typename Buffer>
+    static void _yieldReversed(IteratorBlock<T>* it, const std::shared_ptr<IEnumerable<T>>& source, Buffer& buffer) {
+        foreach<T>(source, [&buffer](T& item) {
+            buffer.push_back(item);
+        } );
+
+        while (! buffer.empty()) {
+            it->yieldReturn(std::move(buffer.back()));
+            buffer.pop_back();
+        }
     }
 
+#ifdef CPPLINQ_COROUTINES
+    template <typename Buffer>
+    static Generator<T> _ReverseBlock(std::shared_ptr<IEnumerable<T>> source, Buffer buffer) {
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            buffer.push_back(e->get_Current());
+        }
+
+        while (! buffer.empty()) {
+            co_yield buffer.back();
+            buffer.pop_back();
+        }
+    }
+#endif
+
     ////////////////////////////////////////////////////////////////////////////
     // Select
 
@@ -732,15 +1623,39 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SelectOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<TResult>>(QueryArena::current(), [source, selector]() {
+                return _SelectBlock<TResult>(source, selector);
+            }), _SizeRule(_SizeRule::Same, source.get()),
+                // (co_yield publishes a reference returned by the selector as it is)
+                ! std::is_lvalue_reference<decltype(selector(std::declval<T&>()))>::value);
+        }
+#endif
+        if (! UseFiberBlock<SelectOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<TResult, _SelectEnumerator<T, TResult, Selector>>>(QueryArena::current(),
+                _SelectEnumerator<T, TResult, Selector>(std::move(source), selector));
+        }
         auto fn =  [source, selector](IteratorBlock<TResult>* it) {
             foreach<T>(source, [it, selector](T& item) {
                 it->yieldReturn(selector(item));
             });
         };
-        return std::shared_ptr<IEnumerable<TResult>>(new _IteratorBlock<TResult>(fn));
+        return _described(_makeShared<_IteratorBlock<TResult>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "Select"),
+            _SizeRule(_SizeRule::Same, source.get()), true);
     }
 
+#ifdef CPPLINQ_COROUTINES
+    template <typename TResult, typename Selector>
+    static Generator<TResult> _SelectBlock(std::shared_ptr<IEnumerable<T>> source, Selector selector) {
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            co_yield selector(e->get_Current());
+        }
+    }
+#endif
+
     // Projects each element of a sequence into a new form by incorporating the element's index.
     template <typename TResult, typename Selector>
     std::shared_ptr<IEnumerable<TResult>> SelectIndex(Selector selector) {
@@ -749,7 +1664,19 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SelectOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<TResult>>(QueryArena::current(), [source, selector]() {
+                return _SelectIndexBlock<TResult>(source, selector);
+            }), _SizeRule(_SizeRule::Same, source.get()),
+                ! std::is_lvalue_reference<decltype(selector(std::declval<T&>(), 0))>::value);
+        }
+#endif
+        if (! UseFiberBlock<SelectOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<TResult, _SelectIndexEnumerator<T, TResult, Selector>>>(QueryArena::current(),
+                _SelectIndexEnumerator<T, TResult, Selector>(std::move(source), selector));
+        }
         auto fn =  [source, selector](IteratorBlock<TResult>* it) {
             int index = 0;
             foreach<T>(source, [it, &index, selector](T& item) {
@@ -757,8 +1684,21 @@ public:
                 index++;
             });
         };
-        return std::shared_ptr<IEnumerable<TResult>>(new _IteratorBlock<TResult>(fn));
+        return _described(_makeShared<_IteratorBlock<TResult>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "SelectIndex"),
+            _SizeRule(_SizeRule::Same, source.get()), true);
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename TResult, typename Selector>
+    static Generator<TResult> _SelectIndexBlock(std::shared_ptr<IEnumerable<T>> source, Selector selector) {
+        int index = 0;
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            co_yield selector(e->get_Current(), index);
+            index++;
+        }
     }
+#endif
 
     ////////////////////////////////////////////////////////////////////////////
     // SelectMany
@@ -770,17 +1710,34 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SelectManyOperator, T>::value) {
+            return _makeShared<_CoroutineBlock<TResult>>(QueryArena::current(), [source, selector]() {
+                return _SelectManyBlock<TResult>(source, selector);
+            });
+        }
+#endif
         auto fn =  [source, selector](IteratorBlock<TResult>* it) {
             foreach<T>(source, [it, selector](T& item) {
-                std::shared_ptr<IEnumerable<TResult>> e = selector(item);
-                foreach<TResult>(e, [it](TResult result) {
-                    it->yieldReturn(result);
-                });
+                it->yieldFrom(selector(item));
             });
         };
-        return std::shared_ptr<IEnumerable<TResult>>(new _IteratorBlock<TResult>(fn));
+        return _makeShared<_IteratorBlock<TResult>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "SelectMany");
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename TResult, typename Selector>
+    static Generator<TResult> _SelectManyBlock(std::shared_ptr<IEnumerable<T>> source, Selector selector) {
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            std::shared_ptr<IEnumerator<TResult>> inner = selector(e->get_Current())->GetEnumerator();
+            while (inner->MoveNext()) {
+                co_yield inner->get_Current();
+            }
+        }
     }
+#endif
 
     template <typename TResult, typename TCollection, typename CollectionSelector, typename ResultSelector>
     std::shared_ptr<IEnumerable<TResult>> SelectMany(CollectionSelector collectionSelector, ResultSelector resultSelector) {
@@ -789,18 +1746,39 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SelectManyOperator, T>::value) {
+            return _makeShared<_CoroutineBlock<TResult>>(QueryArena::current(), [source, collectionSelector, resultSelector]() {
+                return _SelectManyBlock<TResult, TCollection>(source, collectionSelector, resultSelector);
+            });
+        }
+#endif
         auto fn =  [source, collectionSelector, resultSelector](IteratorBlock<TResult>* it) {
             foreach<T>(source, [it, collectionSelector, resultSelector](T& item) {
                 std::shared_ptr<IEnumerable<TCollection>> e = collectionSelector(item);
 
-                foreach<TCollection>(e, [it, resultSelector, item](TCollection collectionItem) {
-                    it->yieldReturn(resultSelector(item, collectionItem));
-                });
+                it->yieldFrom(e->template Select<TResult>([resultSelector, item](TCollection& collectionItem) {
+                    return resultSelector(item, collectionItem);
+                }));
             });
         };
-        return std::shared_ptr<IEnumerable<TResult>>(new _IteratorBlock<TResult>(fn));
+        return _makeShared<_IteratorBlock<TResult>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "SelectMany");
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename TResult, typename TCollection, typename CollectionSelector, typename ResultSelector>
+    static Generator<TResult> _SelectManyBlock(std::shared_ptr<IEnumerable<T>> source, CollectionSelector collectionSelector, ResultSelector resultSelector) {
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            std::shared_ptr<IEnumerator<TCollection>> inner = collectionSelector(item)->GetEnumerator();
+            while (inner->MoveNext()) {
+                co_yield resultSelector(item, inner->get_Current());
+            }
+        }
     }
+#endif
 
     template <typename TResult, typename Selector>
     std::shared_ptr<IEnumerable<TResult>> SelectManyIndex(Selector selector) {
@@ -808,22 +1786,39 @@ public:
         //	throw ArgumentNullException("selector");
         //}
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SelectManyOperator, T>::value) {
+            return _makeShared<_CoroutineBlock<TResult>>(QueryArena::current(), [source, selector]() {
+                return _SelectManyIndexBlock<TResult>(source, selector);
+            });
+        }
+#endif
         auto fn =  [source, selector](IteratorBlock<TResult>* it) {
             int index = 0;
             foreach<T>(source, [it, selector, &index](T& item) {
-                std::shared_ptr<IEnumerable<TResult>> e = selector(item, index);
-
-                foreach<TResult>(e, [it, &index, item](TResult result) {
-                    it->yieldReturn(result);
-                });
-
+                it->yieldFrom(selector(item, index));
                 index++;
             });
         };
-        return std::shared_ptr<IEnumerable<TResult>>(new _IteratorBlock<TResult>(fn));
+        return _makeShared<_IteratorBlock<TResult>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "SelectManyIndex");
     }
 
+#ifdef CPPLINQ_COROUTINES
+    template <typename TResult, typename Selector>
+    static Generator<TResult> _SelectManyIndexBlock(std::shared_ptr<IEnumerable<T>> source, Selector selector) {
+        int index = 0;
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            std::shared_ptr<IEnumerator<TResult>> inner = selector(e->get_Current(), index)->GetEnumerator();
+            while (inner->MoveNext()) {
+                co_yield inner->get_Current();
+            }
+            index++;
+        }
+    }
+#endif
+
     template <typename TResult, typename TCollection, typename CollectionSelector, typename ResultSelector>
     std::shared_ptr<IEnumerable<TResult>> SelectManyIndex(CollectionSelector collectionSelector, ResultSelector resultSelector) {
         //if (collectionSelector == nullptr || resultSelector == nullptr) {
@@ -831,74 +1826,145 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SelectManyOperator, T>::value) {
+            return _makeShared<_CoroutineBlock<TResult>>(QueryArena::current(), [source, collectionSelector, resultSelector]() {
+                return _SelectManyIndexBlock<TResult, TCollection>(source, collectionSelector, resultSelector);
+            });
+        }
+#endif
         auto fn =  [source, collectionSelector, resultSelector](IteratorBlock<TResult>* it) {
             int index = 0;
             foreach<T>(source, [it, collectionSelector, resultSelector, &index](T& item) {
                 std::shared_ptr<IEnumerable<TCollection>> e = collectionSelector(item, index);
 
-                foreach<TCollection>(e, [it, resultSelector, item](TCollection collectionItem) {
-                    it->yieldReturn(resultSelector(item, collectionItem));
-                });
+                it->yieldFrom(e->template Select<TResult>([resultSelector, item](TCollection& collectionItem) {
+                    return resultSelector(item, collectionItem);
+                }));
 
                 index++;
             });
         };
-        return std::shared_ptr<IEnumerable<TResult>>(new _IteratorBlock<TResult>(fn));
+        return _makeShared<_IteratorBlock<TResult>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "SelectManyIndex");
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename TResult, typename TCollection, typename CollectionSelector, typename ResultSelector>
+    static Generator<TResult> _SelectManyIndexBlock(std::shared_ptr<IEnumerable<T>> source, CollectionSelector collectionSelector, ResultSelector resultSelector) {
+        int index = 0;
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            std::shared_ptr<IEnumerator<TCollection>> inner = collectionSelector(item, index)->GetEnumerator();
+            while (inner->MoveNext()) {
+                co_yield resultSelector(item, inner->get_Current());
+            }
+            index++;
+        }
     }
+#endif
 
     ////////////////////////////////////////////////////////////////////////////
     // SequenceEqual
 
     // Determines whether two sequences are equal by comparing the elements by using the default equality comparer for their type.
     bool SequenceEqual(std::shared_ptr<IEnumerable<T>> rhs) {
-        if (rhs == null) {
+        if (! rhs) {
             throw ArgumentNullException("rhs");
         }
 
+        IRandomAccess<T>* lRa = randomAccess();
+        IRandomAccess<T>* rRa = rhs->randomAccess();
+        if (nullptr != lRa && nullptr != rRa) {
+            if (lRa->get_Count() != rRa->get_Count()) {
+                return false;
+            }
+            T* lData = lRa->get_Data();
+            T* rData = rRa->get_Data();
+            if (nullptr != lData && nullptr != rData) {
+                return _equal(lData, rData, lRa->get_Count(), std::integral_constant<bool, _IsBitwiseComparable<T>::value>());
+            }
+        }
+
         std::shared_ptr<IEnumerator<T>> lEnum = GetEnumerator();
         std::shared_ptr<IEnumerator<T>> rEnum = rhs->GetEnumerator();
 
+        // compare the batches of the two sides, a new batch being read from
+        // either side when its previous one is used up
+        T* lItems = nullptr;
+        T* rItems = nullptr;
+        size_t lCount = 0;
+        size_t rCount = 0;
         while (true) {
-            bool lNext = lEnum->MoveNext();
-            bool rNext = rEnum->MoveNext();
+            if (0 == lCount) {
+                lCount = lEnum->MoveNextBatch(lItems, IEnumerator<T>::MaxBatch);
+            }
+            if (0 == rCount) {
+                rCount = rEnum->MoveNextBatch(rItems, IEnumerator<T>::MaxBatch);
+            }
 
-            // Sequences aren't of same length. We don't care which way round.
-            if (lNext != rNext) {
-                return false;
+            // Both sequences have finished, or one is longer than the other
+            if (0 == lCount || 0 == rCount) {
+                return lCount == rCount;
             }
 
-            // Both sequences have finished - done
-            if (!lNext) {
-                return true;
+            size_t count = std::min(lCount, rCount);
+            for (size_t i = 0; i < count; i++) {
+                if (!(lItems[i] == rItems[i])) {
+                    return false;
+                }
             }
+            lItems += count;
+            lCount -= count;
+            rItems += count;
+            rCount -= count;
+        }
+    }
 
-            if (!(lNext->get_Current() == rNext->get_Current())) {
+    template <typename TOther>
+    bool SequenceEqual(const TOther* p, size_t len) {
+        IRandomAccess<T>* ra = randomAccess();
+        if (nullptr != ra) {
+            if (ra->get_Count() != len) {
                 return false;
             }
+            T* data = ra->get_Data();
+            if (nullptr != data) {
+                return _equal(data, p, len, std::integral_constant<bool,
+                    std::is_same<T, TOther>::value && _IsBitwiseComparable<T>::value>());
+            }
         }
-    }
 
-    template <typename T>
-    bool SequenceEqual(const T* p, size_t len) {
         std::shared_ptr<IEnumerator<T>> e = GetEnumerator();
-        for (size_t i = 0; i < len; i++) {
-            if ((! e->MoveNext()) || (!(e->get_Current() == p[i]))) {
+        size_t i = 0;
+        while (i < len) {
+            T* items;
+            size_t count = e->MoveNextBatch(items, len - i);
+            if (0 == count) {
                 return false;
             }
+            for (size_t j = 0; j < count; j++, i++) {
+                if (!(items[j] == p[i])) {
+                    return false;
+                }
+            }
         }
         return ! e->MoveNext();
     }
 
-    template <>
-    bool SequenceEqual<std::string>(const std::string* p, size_t len) {
-        std::shared_ptr<IEnumerator<std::string>> e = GetEnumerator();
-        for (size_t i = 0; i < len; i++) {
-            if ((! e->MoveNext()) || 0 != strcmp(e->get_Current().c_str(), p[i].c_str())) {
+    template <typename TOther>
+    static bool _equal(const T* lhs, const TOther* rhs, size_t count, std::false_type) {
+        for (size_t i = 0; i < count; i++) {
+            if (!(lhs[i] == rhs[i])) {
                 return false;
             }
         }
-        return ! e->MoveNext();
+        return true;
+    }
+
+    static bool _equal(const T* lhs, const T* rhs, size_t count, std::true_type) {
+        return 0 == count || 0 == memcmp(lhs, rhs, count * sizeof(T));
     }
 
     ////////////////////////////////////////////////////////////////////////////
@@ -995,7 +2061,22 @@ public:
     // Bypasses a specified number of elements in a sequence and then returns the remaining elements.
     std::shared_ptr<IEnumerable<T>> Skip(int count) {
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SkipOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, count]() {
+                return _SkipBlock(source, count);
+            }), _SizeRule(_SizeRule::Skip, source.get(), (size_t)std::max(count, 0)), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<SkipOperator, T>::value) {
+            if (nullptr != randomAccess()) {
+                return _makeShared<_RandomAccessView<T>>(QueryArena::current(),
+                    std::move(source), typename _RandomAccessView<T>::Slice((size_t)std::max(count, 0), (size_t)-1));
+            }
+            return _makeShared<_StateMachineBlock<T, _SkipEnumerator<T>>>(QueryArena::current(),
+                _SkipEnumerator<T>(std::move(source), count));
+        }
         auto fn =  [source, count](IteratorBlock<T>* it) {
             std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
 
@@ -1006,12 +2087,29 @@ public:
             }
 
             while (iterator->MoveNext()) {
-                it->yieldReturn(iterator->get_Current());
+                it->yieldReturnRef(iterator->get_Current());
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Skip"),
+            _SizeRule(_SizeRule::Skip, source.get(), (size_t)std::max(count, 0)), source->yieldsTemporaries());
     }
 
+#ifdef CPPLINQ_COROUTINES
+    static Generator<T> _SkipBlock(std::shared_ptr<IEnumerable<T>> source, int count) {
+        std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
+
+        for (int i = 0; i < count; i++) {
+            if (! iterator->MoveNext()) {
+                co_return;
+            }
+        }
+
+        while (iterator->MoveNext()) {
+            co_yield iterator->get_Current();
+        }
+    }
+#endif
+
     // Bypasses elements in a sequence as long as a specified condition is true and then returns the remaining elements.
     template <typename Predicate>
     std::shared_ptr<IEnumerable<T>> SkipWhile(Predicate predicate) {
@@ -1020,7 +2118,18 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SkipWhileOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, predicate]() {
+                return _SkipWhileBlock(source, predicate);
+            }), _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<SkipWhileOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _SkipWhileEnumerator<T, Predicate>>>(QueryArena::current(),
+                _SkipWhileEnumerator<T, Predicate>(std::move(source), predicate));
+        }
         auto fn =  [source, predicate](IteratorBlock<T>* it) {
             std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
 
@@ -1028,18 +2137,39 @@ public:
                 T& item = iterator->get_Current();
                 if (! predicate(item)) {
                     // Stop skipping now, and yield this item
-                    it->yieldReturn(item);
+                    it->yieldReturnRef(item);
                     break;
                 }
             }
 
             while (iterator->MoveNext()) {
-                it->yieldReturn(iterator->get_Current());
+                it->yieldReturnRef(iterator->get_Current());
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "SkipWhile"),
+            _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
     }
 
+#ifdef CPPLINQ_COROUTINES
+    template <typename Predicate>
+    static Generator<T> _SkipWhileBlock(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) {
+        std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
+
+        while (iterator->MoveNext()) {
+            T& item = iterator->get_Current();
+            if (! predicate(item)) {
+                // Stop skipping now, and yield this item
+                co_yield item;
+                break;
+            }
+        }
+
+        while (iterator->MoveNext()) {
+            co_yield iterator->get_Current();
+        }
+    }
+#endif
+
     // Bypasses elements in a sequence as long as a specified condition is true and then returns the remaining elements. The element's index is used in the logic of the predicate function.
     template <typename Predicate>
     std::shared_ptr<IEnumerable<T>> SkipWhileIndex(Predicate predicate) {
@@ -1048,7 +2178,18 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<SkipWhileOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, predicate]() {
+                return _SkipWhileIndexBlock(source, predicate);
+            }), _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<SkipWhileOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _SkipWhileIndexEnumerator<T, Predicate>>>(QueryArena::current(),
+                _SkipWhileIndexEnumerator<T, Predicate>(std::move(source), predicate));
+        }
         auto fn =  [source, predicate](IteratorBlock<T>* it) {
             int index = 0;
             std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
@@ -1056,32 +2197,51 @@ public:
                 T& item = iterator->get_Current();
                 if (! predicate(item, index)) {
                     // Stop skipping now, and yield this item
-                    it->yieldReturn(item);
+                    it->yieldReturnRef(item);
                     break;
                 }
                 index++;
             }
 
             while (iterator->MoveNext()) {
-                it->yieldReturn(iterator->get_Current());
+                it->yieldReturnRef(iterator->get_Current());
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "SkipWhileIndex"),
+            _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
     }
 
+#ifdef CPPLINQ_COROUTINES
+    template <typename Predicate>
+    static Generator<T> _SkipWhileIndexBlock(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) {
+        int index = 0;
+        std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
+        while (iterator->MoveNext()) {
+            T& item = iterator->get_Current();
+            if (! predicate(item, index)) {
+                // Stop skipping now, and yield this item
+                co_yield item;
+                break;
+            }
+            index++;
+        }
+
+        while (iterator->MoveNext()) {
+            co_yield iterator->get_Current();
+        }
+    }
+#endif
+
     ////////////////////////////////////////////////////////////////////////////
     // Sum
 
     // Computes the sum of a sequence of T values.
     T Sum() {
         T total = 0;
-
-        std::shared_ptr<IEnumerator<T>> e = GetEnumerator();
-        while (e->MoveNext()) {
+        _foreach([&total](T& item) {
             // code review: overflow?
-            total += e->get_Current();
-        }
-
+            total += item;
+        });
         return total;
     }
 
@@ -1102,21 +2262,57 @@ public:
     // Returns a specified number of contiguous elements from the start of a sequence.
     std::shared_ptr<IEnumerable<T>> Take(int count) {
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<TakeOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, count]() {
+                return _TakeBlock(source, count);
+            }), _SizeRule(_SizeRule::Take, source.get(), (size_t)std::max(count, 0)), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<TakeOperator, T>::value) {
+            if (nullptr != randomAccess()) {
+                return _makeShared<_RandomAccessView<T>>(QueryArena::current(),
+                    std::move(source), typename _RandomAccessView<T>::Slice(0, (size_t)std::max(count, 0)));
+            }
+            return _makeShared<_StateMachineBlock<T, _TakeEnumerator<T>>>(QueryArena::current(),
+                _TakeEnumerator<T>(std::move(source), count));
+        }
         auto fn =  [source, count](IteratorBlock<T>* it) {
             std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
             for (int i = 0; i < count && iterator->MoveNext(); i++) {
-                it->yieldReturn(iterator->get_Current());
+                it->yieldReturnRef(iterator->get_Current());
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Take"),
+            _SizeRule(_SizeRule::Take, source.get(), (size_t)std::max(count, 0)), source->yieldsTemporaries());
     }
 
+#ifdef CPPLINQ_COROUTINES
+    static Generator<T> _TakeBlock(std::shared_ptr<IEnumerable<T>> source, int count) {
+        std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
+        for (int i = 0; i < count && iterator->MoveNext(); i++) {
+            co_yield iterator->get_Current();
+        }
+    }
+#endif
+
     // Returns elements from a sequence as long as a specified condition is true.
     template <typename Predicate>
     std::shared_ptr<IEnumerable<T>> TakeWhile(Predicate predicate) {
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<TakeWhileOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, predicate]() {
+                return _TakeWhileBlock(source, predicate);
+            }), _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<TakeWhileOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _TakeWhileEnumerator<T, Predicate>>>(QueryArena::current(),
+                _TakeWhileEnumerator<T, Predicate>(std::move(source), predicate));
+        }
         auto fn =  [source, predicate](IteratorBlock<T>* it) {
             std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
             while (iterator->MoveNext()) {
@@ -1124,17 +2320,43 @@ public:
                 if (! predicate(item)) {
                     it->yieldBreak();
                 }
-                it->yieldReturn(item);
+                it->yieldReturnRef(item);
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "TakeWhile"),
+            _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename Predicate>
+    static Generator<T> _TakeWhileBlock(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) {
+        std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
+        while (iterator->MoveNext()) {
+            T& item = iterator->get_Current();
+            if (! predicate(item)) {
+                co_return;
+            }
+            co_yield item;
+        }
     }
+#endif
 
     // Returns elements from a sequence as long as a specified condition is true. The element's index is used in the logic of the predicate function.
     template <typename Predicate>
     std::shared_ptr<IEnumerable<T>> TakeWhileIndex(Predicate predicate) {
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<TakeWhileOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, predicate]() {
+                return _TakeWhileIndexBlock(source, predicate);
+            }), _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<TakeWhileOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _TakeWhileIndexEnumerator<T, Predicate>>>(QueryArena::current(),
+                _TakeWhileIndexEnumerator<T, Predicate>(std::move(source), predicate));
+        }
         auto fn =  [source, predicate](IteratorBlock<T>* it) {
             int index = 0;
             std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
@@ -1144,76 +2366,219 @@ public:
                     it->yieldBreak();
                 }
                 index++;
-                it->yieldReturn(item);
+                it->yieldReturnRef(item);
             }
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "TakeWhileIndex"),
+            _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
     }
 
+#ifdef CPPLINQ_COROUTINES
+    template <typename Predicate>
+    static Generator<T> _TakeWhileIndexBlock(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) {
+        int index = 0;
+        std::shared_ptr<IEnumerator<T>> iterator = source->GetEnumerator();
+        while (iterator->MoveNext()) {
+            T& item = iterator->get_Current();
+            if (! predicate(item, index)) {
+                co_return;
+            }
+            index++;
+            co_yield item;
+        }
+    }
+#endif
+
     ////////////////////////////////////////////////////////////////////////////
-    // Union
+    // ToArray
 
-    // Produces the set union of two sequences by using the default equality comparer.
-    std::shared_ptr<IEnumerable<T>> Union(std::shared_ptr<IEnumerable<T>> rhs) {
-        if (! rhs.get()) {
-            throw ArgumentNullException("rhs");
+    // Creates an array from a sequence. As in .NET, the array is itself a
+    // sequence, with random access: a query materialized once, to be
+    // enumerated, counted or indexed many times.
+    std::shared_ptr<IEnumerable<T>> ToArray() {
+        // (not from the arena of the query: it is meant to outlive it)
+        return std::make_shared<_Array<T>>(ToVector());
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // ToHyperLogLog
+
+    // Creates a HyperLogLog sketch of the distinct elements of a sequence,
+    // to be merged with those of other sequences before counting.
+    HyperLogLog ToHyperLogLog(int precision = HyperLogLog::DefaultPrecision) {
+        return ToHyperLogLog(precision, std::hash<T>());
+    }
+
+    // Creates a HyperLogLog sketch of the distinct elements of a sequence by
+    // using a specified hash function.
+    template <typename Hasher>
+    HyperLogLog ToHyperLogLog(int precision, Hasher hasher) {
+        HyperLogLog sketch(precision);
+        _foreach([&sketch, &hasher](const T& item) {
+            sketch.addHash((uint64_t)hasher(item));
+        });
+        return sketch;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // ToMap
+
+    // Creates a std::map from a sequence, according to specified key selector
+    // and element selector functions. Throws ArgumentException if two
+    // elements have the same key.
+    template <typename TKey, typename TValue, typename KeySelector, typename ValueSelector>
+    std::map<TKey, TValue> ToMap(KeySelector keySelector, ValueSelector valueSelector) {
+        std::map<TKey, TValue> result;
+        _toMap(result, keySelector, valueSelector);
+        return result;
+    }
+
+    template <typename Map, typename KeySelector, typename ValueSelector>
+    void _toMap(Map& result, KeySelector& keySelector, ValueSelector& valueSelector) {
+        _MapSink<T, Map, KeySelector, ValueSelector> sink(result, keySelector, valueSelector);
+        pushTo(sink);
+        if (sink.duplicate()) {
+            throw ArgumentException("An element with the same key already exists");
         }
+    }
 
-        // deferred
-        std::shared_ptr<IEnumerable<T>> lhs = shared_from_this();
-        auto fn =  [lhs, rhs](IteratorBlock<T>* it) {
-            std::set<T> seenElements;
+    ////////////////////////////////////////////////////////////////////////////
+    // ToUnorderedMap
+
+    // Creates a std::unordered_map from a sequence, according to specified
+    // key selector and element selector functions, with room reserved for
+    // the elements if the size hint of the sequence says how many there are.
+    // Throws ArgumentException if two elements have the same key.
+    template <typename TKey, typename TValue, typename KeySelector, typename ValueSelector>
+    std::unordered_map<TKey, TValue> ToUnorderedMap(KeySelector keySelector, ValueSelector valueSelector) {
+        std::unordered_map<TKey, TValue> result;
+        result.reserve(sizeHint().capacity());
+        _toMap(result, keySelector, valueSelector);
+        return result;
+    }
 
-            foreach<T>(lhs, [it, &seenElements](T& item) { 
-                std::pair<std::set<T>::iterator, bool> result = seenElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
-                }
-            });
+    ////////////////////////////////////////////////////////////////////////////
+    // ToVector
+
+    // Creates a std::vector from a sequence. The elements of a contiguous
+    // source are copied at once (with memmove, for trivially copyable
+    // types), and so are the batches of the enumerators that hand out many.
+    // Otherwise room is reserved from the size hint of the sequence, and the
+    // elements are moved if they are temporaries of the query
+    // (yieldsTemporaries), e.g. the results of Select.
+    std::vector<T> ToVector() {
+        std::vector<T> result;
+        IRandomAccess<T>* ra = randomAccess();
+        T* data = (nullptr != ra) ? ra->get_Data() : nullptr;
+        if (nullptr != data) {
+            result.assign(data, data + ra->get_Count());
+            return result;
+        }
 
-            foreach<T>(rhs, [it, &seenElements](T& item) { 
-                std::pair<std::set<T>::iterator, bool> result = seenElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
-                }
-            });
-        };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        result.reserve(sizeHint().capacity());
+        _VectorSink<T> sink(result, yieldsTemporaries());
+        pushTo(sink);
+        return result;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Union
+
+    // Produces the set union of two sequences by using the default equality
+    // comparer, in a FlatHashSet if T has std::hash and operator==, else in
+    // a std::set. If both sequences are marked sorted the same way
+    // (AsSorted), they are merged instead, and the union is in order rather
+    // than this sequence first.
+    std::shared_ptr<IEnumerable<T>> Union(std::shared_ptr<IEnumerable<T>> rhs) {
+        std::shared_ptr<_Ordering<T>> order = ordering();
+        if (rhs && _Ordering<T>::same(order, rhs->ordering())) {
+            return _sorted(_makeShared<_StateMachineBlock<T, _MergeUnionEnumerator<T>>>(QueryArena::current(),
+                _MergeUnionEnumerator<T>(this->shared_from_this(), rhs, order)), order);
+        }
+        return _union(rhs, [](size_t expected) {
+            return _DefaultSet<T>::create(expected);
+        }, Fiber::SmallStackSize);
     }
 
     // Produces the set union of two sequences by using a specified Comparer.
     template <typename Comparer>
     std::shared_ptr<IEnumerable<T>> Union(std::shared_ptr<IEnumerable<T>> rhs, Comparer comparer) {
-        if (! rhs.get()) {
-            throw ArgumentNullException("rhs");
-        }
-
         //if (nullptr == comparer) {
         //	return Union(rhs);
         //}
 
-        // deferred
-        std::shared_ptr<IEnumerable<T>> lhs = shared_from_this();
-        auto fn =  [lhs, rhs, comparer](IteratorBlock<T>* it) {
-            std::set<T, Comparer> seenElements(comparer);
-
-            foreach<T>(lhs, [it, &seenElements](T& item) { 
-                std::pair<std::set<T, Comparer>::iterator, bool> result = seenElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
-                }
-            });
+        return _union(rhs, [comparer](size_t) {
+            return std::set<T, Comparer>(comparer);
+        }, Fiber::DefaultStackSize);
+    }
 
-            foreach<T>(rhs, [it, &seenElements](T& item) { 
-                std::pair<std::set<T, Comparer>::iterator, bool> result = seenElements.insert(item);
-                if (result.second) {
-                    it->yieldReturn(item);
-                }
-            });
+    // Produces the set union of two sequences by using a specified hash
+    // function and equality predicate.
+    template <typename Hasher, typename KeyEqual>
+    std::shared_ptr<IEnumerable<T>> Union(std::shared_ptr<IEnumerable<T>> rhs, Hasher hasher, KeyEqual keyEqual) {
+        return _union(rhs, [hasher, keyEqual](size_t expected) {
+            return FlatHashSet<T, Hasher, KeyEqual>(expected, hasher, keyEqual);
+        }, Fiber::DefaultStackSize);
+    }
+
+    // Produces the set union of two sequences, in a FlatHashSet kept within
+    // budget: past it, the elements spill to temporary files (see
+    // MemoryBudget).
+    std::shared_ptr<IEnumerable<T>> Union(std::shared_ptr<IEnumerable<T>> rhs, std::shared_ptr<MemoryBudget> budget) {
+        if (! rhs) {
+            throw ArgumentNullException("rhs");
+        }
+        return _spillingSet(nullptr, this->shared_from_this(), rhs, budget);
+    }
+
+    template <typename NewSet>
+    std::shared_ptr<IEnumerable<T>> _union(std::shared_ptr<IEnumerable<T>> rhs, NewSet newSet, size_t stackSize) {
+        if (! rhs.get()) {
+            throw ArgumentNullException("rhs");
+        }
+
+        // deferred
+        std::shared_ptr<IEnumerable<T>> lhs = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<UnionOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [lhs, rhs, newSet]() {
+                return _UnionBlock(lhs, rhs, newSet((lhs->sizeHint() + rhs->sizeHint()).bound().capacity()));
+            }), _SizeRule(_SizeRule::BoundSum, lhs.get(), rhs.get()), lhs->yieldsTemporaries() && rhs->yieldsTemporaries());
+        }
+#endif
+        auto fn =  [lhs, rhs, newSet](IteratorBlock<T>* it) {
+            auto seenElements = newSet((lhs->sizeHint() + rhs->sizeHint()).bound().capacity());
+
+            auto isNew = [&seenElements](T& item) {
+                return seenElements.insert(item).second;
+            };
+            it->yieldFrom(lhs->Where(isNew));
+            it->yieldFrom(rhs->Where(isNew));
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, stackSize, "Union"),
+            _SizeRule(_SizeRule::BoundSum, lhs.get(), rhs.get()), lhs->yieldsTemporaries() && rhs->yieldsTemporaries());
     }
 
+#ifdef CPPLINQ_COROUTINES
+    template <typename Set>
+    static Generator<T> _UnionBlock(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs, Set seenElements) {
+        std::shared_ptr<IEnumerator<T>> e = lhs->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (seenElements.insert(item).second) {
+                co_yield item;
+            }
+        }
+
+        e = rhs->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (seenElements.insert(item).second) {
+                co_yield item;
+            }
+        }
+    }
+#endif
 
     ////////////////////////////////////////////////////////////////////////////
     // Where
@@ -1225,16 +2590,41 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<WhereOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, predicate]() {
+                return _WhereBlock(source, predicate);
+            }), _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<WhereOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _WhereEnumerator<T, Predicate>>>(QueryArena::current(),
+                _WhereEnumerator<T, Predicate>(std::move(source), predicate));
+        }
         auto fn =  [source, predicate](IteratorBlock<T>* it) {
             foreach<T>(source, [it, predicate](T& item){
                 if (predicate(item)) {
-                    it->yieldReturn(item);
+                    it->yieldReturnRef(item);
                 }
             });
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "Where"),
+            _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+    }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename Predicate>
+    static Generator<T> _WhereBlock(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) {
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (predicate(item)) {
+                co_yield item;
+            }
+        }
     }
+#endif
 
     template <typename Predicate>
     std::shared_ptr<IEnumerable<T>> WhereIndex(Predicate predicate) {
@@ -1243,28 +2633,142 @@ public:
         //}
 
         // deferred
-        std::shared_ptr<IEnumerable<T>> source = shared_from_this();
+        std::shared_ptr<IEnumerable<T>> source = this->shared_from_this();
+#ifdef CPPLINQ_COROUTINES
+        if (UseCoroutineBlock<WhereOperator, T>::value) {
+            return _described(_makeShared<_CoroutineBlock<T>>(QueryArena::current(), [source, predicate]() {
+                return _WhereIndexBlock(source, predicate);
+            }), _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
+        }
+#endif
+        if (! UseFiberBlock<WhereOperator, T>::value) {
+            return _makeShared<_StateMachineBlock<T, _WhereIndexEnumerator<T, Predicate>>>(QueryArena::current(),
+                _WhereIndexEnumerator<T, Predicate>(std::move(source), predicate));
+        }
         auto fn =  [source, predicate](IteratorBlock<T>* it) {
             int index = 0;
             foreach<T>(source, [it, predicate, &index](T& item){
                 if (predicate(item, index)) {
-                    it->yieldReturn(item);
+                    it->yieldReturnRef(item);
                 }
                 index++;
             });
         };
-        return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn));
+        return _described(_makeShared<_IteratorBlock<T>>(QueryArena::current(), fn, Fiber::DefaultStackSize, "WhereIndex"),
+            _SizeRule(_SizeRule::Bound, source.get()), source->yieldsTemporaries());
     }
+
+#ifdef CPPLINQ_COROUTINES
+    template <typename Predicate>
+    static Generator<T> _WhereIndexBlock(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) {
+        int index = 0;
+        std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+        while (e->MoveNext()) {
+            T& item = e->get_Current();
+            if (predicate(item, index)) {
+                co_yield item;
+            }
+            index++;
+        }
+    }
+#endif
+};
+
+// Appends the elements to a vector, moving them if they are temporaries.
+template <typename T>
+class _VectorSink : public _Sink<T>
+{
+public:
+    _VectorSink(std::vector<T>& v, bool move) : _v(v), _move(move) {
+    }
+
+    virtual bool push(T& item) {
+        if (_move) {
+            _v.push_back(std::move(item));
+        }
+        else {
+            _v.push_back(item);
+        }
+        return true;
+    }
+
+    // One insert per batch: a memmove for trivially copyable types.
+    virtual bool pushBatch(T* items, size_t count) {
+        if (_move) {
+            _v.insert(_v.end(), std::make_move_iterator(items), std::make_move_iterator(items + count));
+        }
+        else {
+            _v.insert(_v.end(), items, items + count);
+        }
+        return true;
+    }
+
+private:
+    _VectorSink& operator=(const _VectorSink&);
+
+    std::vector<T>& _v;
+    bool _move;
+};
+
+// Inserts the elements into a std::map or std::unordered_map, and stops at
+// the first duplicate key.
+template <typename T, typename Map, typename KeySelector, typename ValueSelector>
+class _MapSink : public _Sink<T>
+{
+public:
+    _MapSink(Map& map, KeySelector& keySelector, ValueSelector& valueSelector) :
+        _map(map), _keySelector(keySelector), _valueSelector(valueSelector), _duplicate(false) {
+    }
+
+    virtual bool push(T& item) {
+        _duplicate = ! _map.emplace(_keySelector(item), _valueSelector(item)).second;
+        return ! _duplicate;
+    }
+
+    bool duplicate() const {
+        return _duplicate;
+    }
+
+private:
+    _MapSink& operator=(const _MapSink&);
+
+    Map& _map;
+    KeySelector& _keySelector;
+    ValueSelector& _valueSelector;
+    bool _duplicate;
 };
 
 template <typename T, typename F>
-static void foreach(std::shared_ptr<IEnumerable<T>> enumerable, F f)
+class _ForeachSink : public _Sink<T>
 {
-    std::shared_ptr<IEnumerator<T>> e = enumerable->GetEnumerator();
-    while (e->MoveNext()) {
-        f(e->get_Current());
+public:
+    _ForeachSink(F& f) : _f(f) {
+    }
+
+    virtual bool push(T& item) {
+        _f(item);
+        return true;
+    }
+
+    // A plain loop on f, which the compiler can inline and vectorize.
+    virtual bool pushBatch(T* items, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            _f(items[i]);
+        }
+        return true;
     }
-    //e->Dispose();
+
+private:
+    _ForeachSink& operator=(const _ForeachSink&);
+
+    F& _f;
+};
+
+template <typename T, typename F>
+static void foreach(const std::shared_ptr<IEnumerable<T>>& enumerable, F f)
+{
+    _ForeachSink<T, F> sink(f);
+    enumerable->pushTo(sink);
 }
 
 // unfortunately VS11 does not support alias templates
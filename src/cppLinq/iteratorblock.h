@@ -15,6 +15,34 @@
 #pragma once
 
 #include "ienumerable.h"
+#include "stateMachineBlock.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Number of elements an iterator block produces per context switch, unless
+// its constructor says otherwise (see IteratorBlock::yieldReturn).
+#ifndef CPPLINQ_YIELD_BATCH_SIZE
+#define CPPLINQ_YIELD_BATCH_SIZE 64
+#endif
+
+// A batched IteratorBlock copies the elements passed to yieldReturnRef into
+// its batch, unless this is specialized for their type: then it publishes
+// the address of each element, so that get_Current() returns the element
+// itself, and switches to the consumer once per element, since the element
+// may change as soon as the block resumes. A context switch costs about as
+// much as copying a short string: worth it for elements that are large or
+// expensive (or impossible) to copy, e.g.
+//     template <>
+//     struct YieldByReference<Image> { static const bool value = true; };
+template <typename T>
+struct YieldByReference
+{
+    static const bool value = false;
+};
 
 ////////////////////////////////////////////////////////////////////////////
 
@@ -24,11 +52,19 @@ class IteratorBlock : public IEnumerable<TSource>,
     public Fiber
 {
 public:
+    static const size_t DefaultBatchSize = CPPLINQ_YIELD_BATCH_SIZE;
+
+    // Batch size of the blocks that must run in step with their consumer,
+    // e.g. because their side effects are observable between two MoveNext.
+    static const size_t Unbatched = 1;
+
     // IEnumerable
+    // The first call, on whatever thread, gets the block itself, the next
+    // ones a clone. An enumerator may then move from thread to thread
+    // between two MoveNext (see Fiber).
     virtual std::shared_ptr<IEnumerator<TSource>> GetEnumerator() {
-        if (::GetCurrentThreadId() == _threadId && ! _enumeratorCreated) {
-            _enumeratorCreated = true;
-            return std::dynamic_pointer_cast<IEnumerator<TSource>>(shared_from_this());
+        if (! _enumeratorCreated.exchange(true)) {
+            return std::dynamic_pointer_cast<IEnumerator<TSource>>(this->shared_from_this());
         }
 
         std::shared_ptr<IteratorBlock<TSource>> cloned = clone();
@@ -40,38 +76,302 @@ public:
         throw InvalidOperationException();
     }
 
+    // The next element comes from the batch, if any is left, then from the
+    // element published by the last yield, then from the enumerator handed
+    // over by yieldFrom, and only then from the fiber.
     virtual bool MoveNext() {
-        return resume();
+        while (true) {
+            if (_position < _batchCount) {
+                _current = &batchItems()[_position++];
+                return true;
+            }
+            clearBatch();
+
+            if (nullptr != _published) {
+                _current = _published;
+                _published = nullptr;
+                return true;
+            }
+
+            if (_delegate) {
+                if (_delegate->MoveNext()) {
+                    return true;
+                }
+                _delegate = nullptr;
+            }
+
+            if (_pendingException) {
+                std::exception_ptr e = _pendingException;
+                _pendingException = nullptr;
+                std::rethrow_exception(e);
+            }
+            if (_finished) {
+                return false;
+            }
+            try {
+                _finished = ! resume();
+            }
+            catch (...) {
+                // the elements yielded before the exception come first
+                _finished = true;
+                if (0 == _batchCount) {
+                    throw;
+                }
+                _pendingException = std::current_exception();
+            }
+        }
     }
 
     virtual TSource& get_Current() {
-        return _current;
+        if (_delegate) {
+            return _delegate->get_Current();
+        }
+        return *_current;
     }
 
-    void yieldReturn(TSource returnValue) {
-        _current = returnValue;
-        yield(true);
+    // Hands out the rest of the batch at once.
+    virtual size_t MoveNextBatch(TSource*& items, size_t max) {
+        if (_position < _batchCount) {
+            size_t count = std::min(max, _batchCount - _position);
+            items = &batchItems()[_position];
+            _position += count;
+            _current = &items[count - 1];
+            return count;
+        }
+        if (_delegate) {
+            size_t count = _delegate->MoveNextBatch(items, max);
+            if (0 != count) {
+                return count;
+            }
+        }
+
+        if (! MoveNext()) {
+            return 0;
+        }
+        if (0 == _position) {
+            // a published element, or one of the enumerator of yieldFrom
+            items = &get_Current();
+            return 1;
+        }
+        // MoveNext() has read a new batch and moved to its first element
+        size_t count = std::min(max, _batchCount);
+        items = &batchItems()[0];
+        _position = count;
+        _current = &items[count - 1];
+        return count;
+    }
+
+    // With a batch size greater than one the elements are buffered, and the
+    // fiber switches back to the consumer only when the buffer is full or
+    // the block ends: MoveNext() serves the buffered elements without any
+    // context switch.
+    // An element is copied once, into the batch; an rvalue (the result of a
+    // selector, a local passed with std::move) is moved there instead. An
+    // unbatched block copies nothing but a const lvalue: it publishes the
+    // address of the element, which lives until the block resumes.
+    // Running inline, an rvalue is pushed as it is, an lvalue is copied
+    // first since the sink may modify what it receives.
+    void yieldReturn(const TSource& returnValue) {
+        if (nullptr != _sink) {
+            TSource item(returnValue);
+            pushToSink(item);
+            return;
+        }
+        if (_batchSize <= 1) {
+            TSource item(returnValue);
+            publish(item);
+            return;
+        }
+        store(returnValue);
+    }
+
+    void yieldReturn(TSource&& returnValue) {
+        if (nullptr != _sink) {
+            pushToSink(returnValue);
+            return;
+        }
+        if (_batchSize <= 1) {
+            publish(returnValue);
+            return;
+        }
+        store(std::move(returnValue));
+    }
+
+    // Yields an element that stays where it is until the block resumes, e.g.
+    // the current element of an enumerator of the source, or the argument of
+    // the callback of foreach: it is pushed as it is when running inline,
+    // and its address is published by an unbatched block, or if
+    // YieldByReference says so for its type; otherwise it is copied into
+    // the batch. The operators that yield the elements of their source
+    // unchanged (Where, Skip, Take...) use it.
+    void yieldReturnRef(TSource& returnValue) {
+        if (nullptr != _sink) {
+            pushToSink(returnValue);
+            return;
+        }
+        yieldReturnRef(returnValue, std::integral_constant<bool, YieldByReference<TSource>::value>());
+    }
+
+    // Yields all the elements of source. An unbatched block hands the
+    // enumerator of source to its consumer, which pulls from it directly
+    // until it is exhausted: one switch for the whole sequence, whatever the
+    // nesting depth, instead of one per element. Otherwise source is pushed
+    // into this block (see IEnumerable::pushTo), which runs nested blocks
+    // inline.
+    void yieldFrom(std::shared_ptr<IEnumerable<TSource>> source) {
+        if (nullptr == _sink && _batchSize <= 1) {
+            _delegate = source->GetEnumerator();
+            yield(true);
+            return;
+        }
+        YieldSink sink(this);
+        source->pushTo(sink);
     }
 
     void yieldBreak() {
+        if (nullptr != _sink) {
+            throw StopInlineRun(this);
+        }
         yield(false);
     }
 
+    size_t batchSize() const {
+        return _batchSize;
+    }
+
 protected:
-    IteratorBlock() :
-        _current(),
+    IteratorBlock(size_t stackSize = Fiber::DefaultStackSize, const char* name = nullptr,
+        size_t batchSize = DefaultBatchSize) :
+        Fiber(stackSize, name),
+        _current(nullptr),
+        _published(nullptr),
         _enumeratorCreated(false),
-        _threadId(::GetCurrentThreadId())
+        _batchSize(batchSize),
+        _batchCount(0),
+        _position(0),
+        _finished(false),
+        _sink(nullptr),
+        _sinkStopped(false)
     {
     }
-    virtual ~IteratorBlock() {}
+    virtual ~IteratorBlock() {
+        clearBatch();
+    }
 
     virtual std::shared_ptr<IteratorBlock<TSource>> clone() const = 0;
 
+    // Runs the body on the calling stack, with yieldReturn pushing straight
+    // into sink: no context switch and, since the fiber is never resumed,
+    // no stack. Returns false if the sink stopped the enumeration.
+    bool runInline(_Sink<TSource>& sink) {
+        _sink = &sink;
+        _sinkStopped = false;
+        try {
+            run();
+        }
+        catch (StopInlineRun& stop) {
+            // a block running inline in this one may stop the whole chain
+            if (stop.block != this) {
+                throw;
+            }
+        }
+        _sink = nullptr;
+        return ! _sinkStopped;
+    }
+
 private:
-    TSource _current;
-    bool _enumeratorCreated;
-    DWORD _threadId;
+    struct StopInlineRun
+    {
+        StopInlineRun(IteratorBlock* b) : block(b) {}
+        IteratorBlock* block;
+    };
+
+    void pushToSink(TSource& item) {
+        if (! _sink->push(item)) {
+            _sinkStopped = true;
+            throw StopInlineRun(this);
+        }
+    }
+
+    void yieldReturnRef(TSource& returnValue, std::true_type) {
+        publish(returnValue);
+    }
+
+    void yieldReturnRef(TSource& returnValue, std::false_type) {
+        if (_batchSize <= 1) {
+            publish(returnValue);
+            return;
+        }
+        store(returnValue);
+    }
+
+    // Makes value the next element, then switches to the consumer. Any
+    // element still in the batch comes first.
+    void publish(TSource& value) {
+        _published = &value;
+        yield(true);
+    }
+
+    // Elements are constructed in the batch as they are yielded, and
+    // destroyed when the consumer asks for the next batch.
+    template <typename U>
+    void store(U&& value) {
+        if (nullptr == _batch) {
+            _batch.reset(new BatchSlot[_batchSize]);
+        }
+        new (&batchItems()[_batchCount]) TSource(std::forward<U>(value));
+        _batchCount++;
+        if (_batchCount == _batchSize) {
+            yield(true);
+        }
+    }
+
+    TSource* batchItems() {
+        return reinterpret_cast<TSource*>(_batch.get());
+    }
+
+    void clearBatch() {
+        for (size_t i = 0; i < _batchCount; i++) {
+            batchItems()[i].~TSource();
+        }
+        _batchCount = 0;
+        _position = 0;
+    }
+
+    class YieldSink : public _Sink<TSource>
+    {
+    public:
+        YieldSink(IteratorBlock* block) : _block(block) {
+        }
+
+        virtual bool push(TSource& item) {
+            _block->yieldReturnRef(item);
+            return true;
+        }
+
+    private:
+        IteratorBlock* _block;
+    };
+
+
+    // Raw storage: the elements need not be default constructible.
+    typedef typename std::aligned_storage<sizeof(TSource), std::alignment_of<TSource>::value>::type BatchSlot;
+
+    TSource* _current;
+    TSource* _published;
+    std::atomic<bool> _enumeratorCreated;
+
+    size_t _batchSize;
+    std::unique_ptr<BatchSlot[]> _batch;
+    size_t _batchCount;
+    size_t _position;
+    bool _finished;
+    std::exception_ptr _pendingException;
+
+    _Sink<TSource>* _sink;
+    bool _sinkStopped;
+
+    std::shared_ptr<IEnumerator<TSource>> _delegate;
 };
 
 ////////////////////////////////////////////////////////////////////////////
@@ -82,6 +382,9 @@ class _IteratorBlock : public IteratorBlock<TSource>
 protected:
     struct IF {
         virtual void run(IteratorBlock<TSource>* pThis) = 0;
+        // Copy constructs the functor at p.
+        virtual IF* copyTo(void* p) const = 0;
+        virtual ~IF() {}
     };
 
     template <typename Func>
@@ -94,30 +397,210 @@ protected:
             _func(pThis);
         }
 
+        virtual IF* copyTo(void* p) const {
+            return new (p) F(*this);
+        }
+
         Func _func;
     };
 
+    // Room for the functors of the operators, which capture their sources
+    // and a predicate or a selector or two.
+    static const size_t InlineFunctorSize = 64;
+
 public:
+    // stackSize is a hint for the fiber that runs f, name identifies the
+    // block in the stack profile (see Fiber::stackProfile). batchSize is the
+    // number of elements f yields per context switch: pass Unbatched if f
+    // must not run ahead of the consumer.
+    // f is stored in the block if it fits in InlineFunctorSize bytes, so
+    // that the block takes a single allocation; a larger one is allocated
+    // apart, and shared with the clones of the block.
     template <typename _F>
-    _IteratorBlock(_F f) :
-        _f(std::shared_ptr<IF>(new F<_F>(f))) {
+    _IteratorBlock(_F f, size_t stackSize = Fiber::DefaultStackSize, const char* name = nullptr,
+        size_t batchSize = IteratorBlock<TSource>::DefaultBatchSize) :
+        IteratorBlock<TSource>(stackSize, name, batchSize),
+        _arena(QueryArena::current()),
+        _body(nullptr),
+        _inline(false),
+        _name(name),
+        _temporaries(false) {
+        setBody(f, std::integral_constant<bool, sizeof(F<_F>) <= sizeof(InlineStorage)
+            && std::alignment_of<F<_F>>::value <= std::alignment_of<InlineStorage>::value>());
     }
 
     _IteratorBlock(const _IteratorBlock& rhs) :
-        _f(rhs._f) {
+        IteratorBlock<TSource>(rhs.stackSize(), rhs._name, rhs.batchSize()),
+        _arena(rhs._arena),
+        _body(nullptr),
+        _inline(rhs._inline),
+        _shared(rhs._shared),
+        _name(rhs._name),
+        _sizeRule(rhs._sizeRule),
+        _temporaries(rhs._temporaries) {
+        _body = _inline ? rhs._body->copyTo(&_storage) : _shared.get();
+    }
+
+    virtual ~_IteratorBlock() {
+        if (_inline) {
+            _body->~IF();
+        }
+    }
+
+    // A chain of blocks consumed with foreach runs on the fiber of the
+    // consumer: the body of each stage is called inline by the next one,
+    // so an element crosses the whole chain without any context switch.
+    // Not done if the calling fiber has a smaller stack than this block
+    // asked for.
+    virtual bool pushTo(_Sink<TSource>& sink) {
+        Fiber* current = Fiber::current();
+        if (nullptr != current && current->stackSize() < this->stackSize()) {
+            return IteratorBlock<TSource>::pushTo(sink);
+        }
+        // (this block outlives the run: its functor is not copied)
+        _IteratorBlock<TSource> block(*this, Borrow());
+        return block.runInline(sink);
+    }
+
+    virtual SizeHint sizeHint() {
+        return _sizeRule.apply();
+    }
+
+    virtual bool yieldsTemporaries() {
+        return _temporaries;
+    }
+
+    // How the operator that made the block sizes it (unknown by default).
+    void setSizeRule(const _SizeRule& rule) {
+        _sizeRule = rule;
+    }
+
+    void setYieldsTemporaries(bool temporaries) {
+        _temporaries = temporaries;
     }
 
 protected:
     virtual void run() {
-        _f->run(this);
+        _body->run(this);
     }
 
+    // The clones come from the arena of the block, if any.
     virtual std::shared_ptr<IteratorBlock<TSource>> clone() const {
-        return std::shared_ptr<IteratorBlock<TSource>>(new _IteratorBlock<TSource>(*this));
+        return _makeShared<_IteratorBlock<TSource>>(_arena, *this);
     }
 
 private:
-    std::shared_ptr<IF> _f;
+    typedef typename std::aligned_storage<InlineFunctorSize>::type InlineStorage;
+
+    struct Borrow {};
+
+    _IteratorBlock(const _IteratorBlock& rhs, Borrow) :
+        IteratorBlock<TSource>(rhs.stackSize(), rhs._name, rhs.batchSize()),
+        _arena(rhs._arena),
+        _body(rhs._body),
+        _inline(false),
+        _name(rhs._name),
+        _temporaries(false) {
+    }
+
+    _IteratorBlock& operator=(const _IteratorBlock&);
+
+    template <typename _F>
+    void setBody(_F& f, std::true_type) {
+        _body = new (&_storage) F<_F>(f);
+        _inline = true;
+    }
+
+    template <typename _F>
+    void setBody(_F& f, std::false_type) {
+        _shared = _makeShared<F<_F>>(_arena, f);
+        _body = _shared.get();
+    }
+
+    std::shared_ptr<QueryArena> _arena;
+    InlineStorage _storage;
+    IF* _body;                  // in _storage if _inline, else in _shared or
+                                // in the block that lent it
+    bool _inline;
+    std::shared_ptr<IF> _shared;
+    const char* _name;
+    _SizeRule _sizeRule;
+    bool _temporaries;
 };
 
 ////////////////////////////////////////////////////////////////////////////
+
+#ifdef CPPLINQ_COROUTINES
+
+// Alternative to _IteratorBlock that runs the body as a C++20 coroutine
+// instead of on a fiber. f is a function object that returns a new
+// Generator<TSource> every time it is called: each enumerator owns its
+// own coroutine, so there is nothing to clone.
+template <typename TSource>
+class _CoroutineBlock : public IEnumerable<TSource>
+{
+    class Enumerator : public IEnumerator<TSource>
+    {
+    public:
+        Enumerator(Generator<TSource>&& generator) :
+            _generator(std::move(generator)) {
+        }
+
+        virtual void Reset() {
+            throw InvalidOperationException();
+        }
+
+        virtual bool MoveNext() {
+            return _generator.next();
+        }
+
+        virtual TSource& get_Current() {
+            return _generator.current();
+        }
+
+    private:
+        Generator<TSource> _generator;
+    };
+
+public:
+    template <typename _F>
+    _CoroutineBlock(_F f) :
+        _f(f),
+        _arena(QueryArena::current()),
+        _temporaries(false) {
+    }
+
+    // IEnumerable
+    // The enumerators come from the arena of the block, if any (the frames
+    // of the coroutines from the heap).
+    virtual std::shared_ptr<IEnumerator<TSource>> GetEnumerator() {
+        return _makeShared<Enumerator>(_arena, _f());
+    }
+
+    virtual SizeHint sizeHint() {
+        return _sizeRule.apply();
+    }
+
+    virtual bool yieldsTemporaries() {
+        return _temporaries;
+    }
+
+    // How the operator that made the block sizes it (unknown by default).
+    void setSizeRule(const _SizeRule& rule) {
+        _sizeRule = rule;
+    }
+
+    void setYieldsTemporaries(bool temporaries) {
+        _temporaries = temporaries;
+    }
+
+private:
+    std::function<Generator<TSource>()> _f;
+    std::shared_ptr<QueryArena> _arena;
+    _SizeRule _sizeRule;
+    bool _temporaries;
+};
+
+////////////////////////////////////////////////////////////////////////////
+
+#endif // CPPLINQ_COROUTINES
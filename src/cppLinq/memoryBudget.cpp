@@ -0,0 +1,87 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "memoryBudget.h"
+
+#include "exceptions.h"
+
+// static
+std::shared_ptr<MemoryBudget> MemoryBudget::create(size_t bytes)
+{
+    return std::shared_ptr<MemoryBudget>(new MemoryBudget(bytes));
+}
+
+MemoryBudget::MemoryBudget(size_t bytes) :
+    _bytes(bytes),
+    _spills(0),
+    _partitions(0),
+    _spilledBytes(0)
+{
+}
+
+MemoryBudget::Statistics MemoryBudget::statistics() const
+{
+    Statistics statistics;
+    statistics.spills = _spills.load();
+    statistics.partitions = _partitions.load();
+    statistics.bytes = _spilledBytes.load();
+    return statistics;
+}
+
+void MemoryBudget::recordSpill(int partitions, long long bytes)
+{
+    _spills++;
+    _partitions += partitions;
+    _spilledBytes += bytes;
+}
+
+SpillFile::SpillFile() :
+    _file(::tmpfile()),
+    _written(0),
+    _read(0)
+{
+    if (nullptr == _file) {
+        throw IOException("cannot create a temporary file");
+    }
+}
+
+SpillFile::~SpillFile()
+{
+    ::fclose(_file);
+}
+
+void SpillFile::write(const void* data, size_t size)
+{
+    if (::fwrite(data, 1, size, _file) != size) {
+        throw IOException("cannot write a temporary file");
+    }
+    _written += size;
+}
+
+void SpillFile::read(void* data, size_t size)
+{
+    if (::fread(data, 1, size, _file) != size) {
+        throw IOException("cannot read a temporary file");
+    }
+    _read += size;
+}
+
+void SpillFile::rewind()
+{
+    if (0 != ::fflush(_file) || 0 != ::fseek(_file, 0, SEEK_SET)) {
+        throw IOException("cannot read a temporary file");
+    }
+    _read = 0;
+}
@@ -0,0 +1,152 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <type_traits>
+
+// The memory that Distinct, Union and Except may take for their set, with
+// the overloads that take a budget. As long as the set fits, they work as
+// without one, and yield the same elements in the same order. Beyond the
+// budget, the set keeps filtering out the elements it holds, but the other
+// elements are written to temporary files, split by hash into partitions.
+// Once the sources are exhausted, each partition is read back and filtered
+// in turn with a new set, and split again if it does not fit either.
+// The elements of each partition come in the order of the sources, but the
+// partitions come one after the other. So the results are the same, but
+// past the point where the set filled up, they are grouped by partition
+// rather than in source order.
+// The size of the set is estimated from its slots, and from the heap memory
+// of the elements as SpillTraits reports it. A budget can be shared by
+// several queries, on any thread, and counts what they spilled.
+class MemoryBudget
+{
+public:
+    struct Statistics
+    {
+        long long spills;       // sets that outgrew the budget
+        long long partitions;   // partitions written to temporary files
+        long long bytes;        // size of those files
+    };
+
+    static std::shared_ptr<MemoryBudget> create(size_t bytes);
+
+    size_t bytes() const {
+        return _bytes;
+    }
+
+    Statistics statistics() const;
+
+    // Called by the operators.
+    void recordSpill(int partitions, long long bytes);
+
+private:
+    explicit MemoryBudget(size_t bytes);
+    MemoryBudget(const MemoryBudget&);
+    MemoryBudget& operator=(const MemoryBudget&);
+
+    size_t _bytes;
+    std::atomic<long long> _spills;
+    std::atomic<long long> _partitions;
+    std::atomic<long long> _spilledBytes;
+};
+
+// A temporary file (std::tmpfile, removed when closed) that a partition is
+// written to and then read back. Throws IOException when the file cannot be
+// created, written or read.
+class SpillFile
+{
+public:
+    SpillFile();
+    ~SpillFile();
+
+    void write(const void* data, size_t size);
+
+    // Reads what was written, from the start after rewind().
+    void read(void* data, size_t size);
+    void rewind();
+    bool atEnd() const {
+        return _read == _written;
+    }
+
+    long long bytes() const {
+        return _written;
+    }
+
+private:
+    SpillFile(const SpillFile&);
+    SpillFile& operator=(const SpillFile&);
+
+    FILE* _file;
+    long long _written;
+    long long _read;
+};
+
+// How an element is written to a SpillFile and read back, and how much heap
+// memory it holds besides sizeof(T). Defined for the trivially copyable
+// types and std::basic_string; specialize it for other types.
+template <typename T, typename Enable = void>
+struct SpillTraits;
+
+template <typename T>
+struct SpillTraits<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+{
+    static void write(SpillFile& file, const T& item) {
+        file.write(&item, sizeof(T));
+    }
+
+    static T read(SpillFile& file) {
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type buffer;
+        file.read(&buffer, sizeof(T));
+        return *reinterpret_cast<T*>(&buffer);
+    }
+
+    static size_t heapBytes(const T&) {
+        return 0;
+    }
+};
+
+template <typename Char, typename CharTraits, typename Allocator>
+struct SpillTraits<std::basic_string<Char, CharTraits, Allocator>, void>
+{
+    typedef std::basic_string<Char, CharTraits, Allocator> String;
+
+    static void write(SpillFile& file, const String& item) {
+        size_t length = item.size();
+        file.write(&length, sizeof(length));
+        if (length > 0) {
+            file.write(item.data(), length * sizeof(Char));
+        }
+    }
+
+    static String read(SpillFile& file) {
+        size_t length = 0;
+        file.read(&length, sizeof(length));
+        String item(length, Char());
+        if (length > 0) {
+            file.read(&item[0], length * sizeof(Char));
+        }
+        return item;
+    }
+
+    // (the characters of a short string may be in the object itself)
+    static size_t heapBytes(const String& item) {
+        return item.capacity() * sizeof(Char);
+    }
+};
@@ -0,0 +1,634 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "iteratorblock.h"
+#include <iterator>
+#include <type_traits>
+
+////////////////////////////////////////////////////////////////////////////
+
+// Value-typed queries, composed with operator| instead of the methods of
+// IEnumerable:
+//
+//     int total = from(v) | where(isEven) | select(square) | sum();
+//
+// Each stage is a template on the type of the previous one, so the query
+// has no heap allocation, no virtual call and no fiber: run() pushes every
+// element of the source through the stages (like IEnumerable::pushTo), and
+// the compiler can inline the whole chain into one loop.
+// A query converts to std::shared_ptr<IEnumerable<T>> where a type-erased
+// sequence is needed (see _Pipeline::asEnumerable).
+//
+// A pipeline over a container refers to its elements: the container must
+// outlive the pipeline, as for StlEnumerable.
+//
+// Each pipeline class TPipeline derives from _Pipeline<TPipeline, T>, where
+// T is the type of its elements, and has a member
+//     template <typename Next> bool run(Next& next);
+// that calls next(item) on each element, while next returns true; run()
+// returns false if next stopped it.
+
+template <typename TPipeline, typename T>
+class _PipelineEnumerable;
+
+template <typename TPipeline, typename T>
+class _Pipeline
+{
+public:
+    typedef T value_type;
+
+    // The pipeline as an IEnumerable: foreach (pushTo) runs it directly,
+    // GetEnumerator runs it in an iterator block.
+    std::shared_ptr<IEnumerable<T>> asEnumerable() const {
+        return std::shared_ptr<IEnumerable<T>>(
+            new _PipelineEnumerable<TPipeline, T>(static_cast<const TPipeline&>(*this)));
+    }
+
+    operator std::shared_ptr<IEnumerable<T>>() const {
+        return asEnumerable();
+    }
+};
+
+template <typename TPipeline, typename T>
+class _PipelineEnumerable : public IEnumerable<T>
+{
+    struct PushSink
+    {
+        PushSink(_Sink<T>& sink) : _sink(sink) {
+        }
+
+        bool operator()(T& item) {
+            return _sink.push(item);
+        }
+        bool operator()(const T& item) {
+            T copy(item);
+            return _sink.push(copy);
+        }
+
+    private:
+        PushSink& operator=(const PushSink&);
+
+        _Sink<T>& _sink;
+    };
+
+    struct YieldSink
+    {
+        YieldSink(IteratorBlock<T>* it) : _it(it) {
+        }
+
+        bool operator()(const T& item) {
+            _it->yieldReturn(item);
+            return true;
+        }
+
+    private:
+        IteratorBlock<T>* _it;
+    };
+
+public:
+    _PipelineEnumerable(const TPipeline& pipeline) :
+        _pipeline(pipeline) {
+    }
+
+    // IEnumerable
+    virtual std::shared_ptr<IEnumerator<T>> GetEnumerator() {
+        TPipeline pipeline = _pipeline;
+        auto fn = [pipeline](IteratorBlock<T>* it) mutable {
+            YieldSink sink(it);
+            pipeline.run(sink);
+        };
+        std::shared_ptr<IEnumerable<T>> block(new _IteratorBlock<T>(fn, Fiber::DefaultStackSize, "Pipeline"));
+        return block->GetEnumerator();
+    }
+
+    virtual bool pushTo(_Sink<T>& sink) {
+        TPipeline pipeline = _pipeline;
+        PushSink s(sink);
+        return pipeline.run(s);
+    }
+
+private:
+    TPipeline _pipeline;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Sources
+
+template <typename Iterator>
+class _FromPipeline : public _Pipeline<_FromPipeline<Iterator>,
+    typename std::iterator_traits<Iterator>::value_type>
+{
+public:
+    _FromPipeline(Iterator begin, Iterator end) :
+        _begin(begin), _end(end) {
+    }
+
+    template <typename Next>
+    bool run(Next& next) {
+        for (Iterator it = _begin; it != _end; ++it) {
+            if (! next(*it)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    Iterator _begin;
+    Iterator _end;
+};
+
+// The elements of an IEnumerable, pushed through IEnumerable::pushTo.
+template <typename T>
+class _EnumerablePipeline : public _Pipeline<_EnumerablePipeline<T>, T>
+{
+    template <typename Next>
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(Next& next) : _next(next) {
+        }
+
+        virtual bool push(T& item) {
+            return _next(item);
+        }
+
+        virtual bool pushBatch(T* items, size_t count) {
+            for (size_t i = 0; i < count; i++) {
+                if (! _next(items[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        Next& _next;
+    };
+
+public:
+    _EnumerablePipeline(std::shared_ptr<IEnumerable<T>> source) :
+        _source(source) {
+    }
+
+    template <typename Next>
+    bool run(Next& next) {
+        Sink<Next> sink(next);
+        return _source->pushTo(sink);
+    }
+
+private:
+    std::shared_ptr<IEnumerable<T>> _source;
+};
+
+template <typename Container>
+_FromPipeline<typename Container::iterator> from(Container& container)
+{
+    return _FromPipeline<typename Container::iterator>(container.begin(), container.end());
+}
+
+template <typename Container>
+_FromPipeline<typename Container::const_iterator> from(const Container& container)
+{
+    return _FromPipeline<typename Container::const_iterator>(container.begin(), container.end());
+}
+
+template <typename T, size_t N>
+_FromPipeline<T*> from(T (&array)[N])
+{
+    return _FromPipeline<T*>(array, array + N);
+}
+
+template <typename Iterator>
+_FromPipeline<Iterator> from(Iterator begin, Iterator end)
+{
+    return _FromPipeline<Iterator>(begin, end);
+}
+
+template <typename T>
+_EnumerablePipeline<T> from(std::shared_ptr<IEnumerable<T>> source)
+{
+    return _EnumerablePipeline<T>(source);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Where
+
+template <typename TSource, typename Predicate>
+class _WherePipeline : public _Pipeline<_WherePipeline<TSource, Predicate>, typename TSource::value_type>
+{
+    template <typename Next>
+    struct Sink
+    {
+        Sink(Next& next, Predicate& predicate) : _next(next), _predicate(predicate) {
+        }
+
+        template <typename U>
+        bool operator()(U& item) {
+            return ! _predicate(item) || _next(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        Next& _next;
+        Predicate& _predicate;
+    };
+
+public:
+    _WherePipeline(const TSource& source, Predicate predicate) :
+        _source(source), _predicate(predicate) {
+    }
+
+    template <typename Next>
+    bool run(Next& next) {
+        Sink<Next> sink(next, _predicate);
+        return _source.run(sink);
+    }
+
+private:
+    TSource _source;
+    Predicate _predicate;
+};
+
+template <typename Predicate>
+struct _WhereStage
+{
+    Predicate predicate;
+};
+
+template <typename Predicate>
+_WhereStage<Predicate> where(Predicate predicate)
+{
+    _WhereStage<Predicate> stage = { predicate };
+    return stage;
+}
+
+template <typename TSource, typename T, typename Predicate>
+_WherePipeline<TSource, Predicate> operator|(const _Pipeline<TSource, T>& source, const _WhereStage<Predicate>& stage)
+{
+    return _WherePipeline<TSource, Predicate>(static_cast<const TSource&>(source), stage.predicate);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Select
+
+template <typename TSource, typename Selector>
+struct _SelectResult
+{
+    typedef typename std::decay<decltype(std::declval<Selector&>()(
+        std::declval<typename TSource::value_type&>()))>::type type;
+};
+
+template <typename TSource, typename Selector>
+class _SelectPipeline : public _Pipeline<_SelectPipeline<TSource, Selector>,
+    typename _SelectResult<TSource, Selector>::type>
+{
+    typedef typename _SelectResult<TSource, Selector>::type TResult;
+
+    template <typename Next>
+    struct Sink
+    {
+        Sink(Next& next, Selector& selector) : _next(next), _selector(selector) {
+        }
+
+        template <typename U>
+        bool operator()(U& item) {
+            TResult result = _selector(item);
+            return _next(result);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        Next& _next;
+        Selector& _selector;
+    };
+
+public:
+    _SelectPipeline(const TSource& source, Selector selector) :
+        _source(source), _selector(selector) {
+    }
+
+    template <typename Next>
+    bool run(Next& next) {
+        Sink<Next> sink(next, _selector);
+        return _source.run(sink);
+    }
+
+private:
+    TSource _source;
+    Selector _selector;
+};
+
+template <typename Selector>
+struct _SelectStage
+{
+    Selector selector;
+};
+
+template <typename Selector>
+_SelectStage<Selector> select(Selector selector)
+{
+    _SelectStage<Selector> stage = { selector };
+    return stage;
+}
+
+template <typename TSource, typename T, typename Selector>
+_SelectPipeline<TSource, Selector> operator|(const _Pipeline<TSource, T>& source, const _SelectStage<Selector>& stage)
+{
+    return _SelectPipeline<TSource, Selector>(static_cast<const TSource&>(source), stage.selector);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Skip, Take
+
+template <typename TSource>
+class _SkipPipeline : public _Pipeline<_SkipPipeline<TSource>, typename TSource::value_type>
+{
+    template <typename Next>
+    struct Sink
+    {
+        Sink(Next& next, int count) : _next(next), _count(count) {
+        }
+
+        template <typename U>
+        bool operator()(U& item) {
+            if (_count > 0) {
+                _count--;
+                return true;
+            }
+            return _next(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        Next& _next;
+        int _count;
+    };
+
+public:
+    _SkipPipeline(const TSource& source, int count) :
+        _source(source), _count(count) {
+    }
+
+    template <typename Next>
+    bool run(Next& next) {
+        Sink<Next> sink(next, _count);
+        return _source.run(sink);
+    }
+
+private:
+    TSource _source;
+    int _count;
+};
+
+// Stops the source after the last element taken, so that it is not asked
+// for one more.
+template <typename TSource>
+class _TakePipeline : public _Pipeline<_TakePipeline<TSource>, typename TSource::value_type>
+{
+    template <typename Next>
+    struct Sink
+    {
+        Sink(Next& next, int count) : _next(next), _count(count), _stopped(false) {
+        }
+
+        template <typename U>
+        bool operator()(U& item) {
+            _count--;
+            if (! _next(item)) {
+                _stopped = true;
+                return false;
+            }
+            return _count > 0;
+        }
+
+        bool stopped() const {
+            return _stopped;
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        Next& _next;
+        int _count;
+        bool _stopped;      // by the next sink
+    };
+
+public:
+    _TakePipeline(const TSource& source, int count) :
+        _source(source), _count(count) {
+    }
+
+    template <typename Next>
+    bool run(Next& next) {
+        if (_count <= 0) {
+            return true;
+        }
+        Sink<Next> sink(next, _count);
+        _source.run(sink);
+        return ! sink.stopped();
+    }
+
+private:
+    TSource _source;
+    int _count;
+};
+
+struct _SkipStage
+{
+    int count;
+};
+
+struct _TakeStage
+{
+    int count;
+};
+
+inline _SkipStage skip(int count)
+{
+    _SkipStage stage = { count };
+    return stage;
+}
+
+inline _TakeStage take(int count)
+{
+    _TakeStage stage = { count };
+    return stage;
+}
+
+template <typename TSource, typename T>
+_SkipPipeline<TSource> operator|(const _Pipeline<TSource, T>& source, const _SkipStage& stage)
+{
+    return _SkipPipeline<TSource>(static_cast<const TSource&>(source), stage.count);
+}
+
+template <typename TSource, typename T>
+_TakePipeline<TSource> operator|(const _Pipeline<TSource, T>& source, const _TakeStage& stage)
+{
+    return _TakePipeline<TSource>(static_cast<const TSource&>(source), stage.count);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Terminal operators: they run the pipeline and return a value.
+
+struct _SumStage {};
+struct _CountStage {};
+struct _FirstStage {};
+
+template <typename Func>
+struct _AggregateStage
+{
+    Func func;
+};
+
+inline _SumStage sum()
+{
+    return _SumStage();
+}
+
+inline _CountStage count()
+{
+    return _CountStage();
+}
+
+inline _FirstStage first()
+{
+    return _FirstStage();
+}
+
+// func(accumulate, item) -> accumulate, starting from the first element.
+template <typename Func>
+_AggregateStage<Func> aggregate(Func func)
+{
+    _AggregateStage<Func> stage = { func };
+    return stage;
+}
+
+template <typename T>
+struct _SumSink
+{
+    _SumSink() : total(0) {
+    }
+
+    template <typename U>
+    bool operator()(U& item) {
+        // code review: overflow?
+        total += item;
+        return true;
+    }
+
+    T total;
+};
+
+struct _CountSink
+{
+    _CountSink() : count(0) {
+    }
+
+    template <typename U>
+    bool operator()(U&) {
+        count++;
+        return true;
+    }
+
+    int count;
+};
+
+template <typename T>
+struct _FirstSink
+{
+    _FirstSink() : value(), empty(true) {
+    }
+
+    template <typename U>
+    bool operator()(U& item) {
+        value = item;
+        empty = false;
+        return false;
+    }
+
+    T value;
+    bool empty;
+};
+
+template <typename T, typename Func>
+struct _AggregateSink
+{
+    _AggregateSink(Func& func) : func(func), value(), empty(true) {
+    }
+
+    template <typename U>
+    bool operator()(U& item) {
+        value = empty ? T(item) : func(value, item);
+        empty = false;
+        return true;
+    }
+
+    Func& func;
+    T value;
+    bool empty;
+
+private:
+    _AggregateSink& operator=(const _AggregateSink&);
+};
+
+template <typename TSource, typename T>
+T operator|(const _Pipeline<TSource, T>& source, const _SumStage&)
+{
+    TSource pipeline = static_cast<const TSource&>(source);
+    _SumSink<T> sink;
+    pipeline.run(sink);
+    return sink.total;
+}
+
+template <typename TSource, typename T>
+int operator|(const _Pipeline<TSource, T>& source, const _CountStage&)
+{
+    TSource pipeline = static_cast<const TSource&>(source);
+    _CountSink sink;
+    pipeline.run(sink);
+    return sink.count;
+}
+
+template <typename TSource, typename T>
+T operator|(const _Pipeline<TSource, T>& source, const _FirstStage&)
+{
+    TSource pipeline = static_cast<const TSource&>(source);
+    _FirstSink<T> sink;
+    pipeline.run(sink);
+    if (sink.empty) {
+        throw InvalidOperationException("Sequence was empty");
+    }
+    return sink.value;
+}
+
+template <typename TSource, typename T, typename Func>
+T operator|(const _Pipeline<TSource, T>& source, const _AggregateStage<Func>& stage)
+{
+    TSource pipeline = static_cast<const TSource&>(source);
+    Func func = stage.func;
+    _AggregateSink<T, Func> sink(func);
+    pipeline.run(sink);
+    if (sink.empty) {
+        throw InvalidOperationException("Sequence was empty");
+    }
+    return sink.value;
+}
@@ -0,0 +1,147 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "queryArena.h"
+
+#include <new>
+#include <stdlib.h>
+#include <thread>
+
+// The innermost scope open on each thread, if any.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+static __declspec(thread) QueryArena::Scope* t_currentScope = nullptr;
+#else
+static thread_local QueryArena::Scope* t_currentScope = nullptr;
+#endif
+
+// Room for the header of a chunk, keeping the rest of it aligned.
+static const size_t ChunkHeaderSize = 16;
+
+// static
+std::shared_ptr<QueryArena> QueryArena::create(size_t chunkSize)
+{
+    // (the control block comes from the arena itself)
+    QueryArena* arena = new QueryArena(chunkSize);
+    return std::shared_ptr<QueryArena>(arena, [](QueryArena* arena) {
+        arena->release();
+    }, ArenaAllocator<QueryArena>(arena));
+}
+
+QueryArena::QueryArena(size_t chunkSize) :
+    _references(1),
+    _chunkSize(chunkSize),
+    _chunks(nullptr),
+    _next(nullptr),
+    _end(nullptr)
+{
+    _lock.clear();
+    _statistics.allocations = 0;
+    _statistics.bytes = 0;
+    _statistics.chunks = 0;
+}
+
+QueryArena::~QueryArena()
+{
+    while (nullptr != _chunks) {
+        Chunk* next = _chunks->next;
+        ::free(_chunks);
+        _chunks = next;
+    }
+}
+
+void* QueryArena::allocate(size_t size, size_t alignment)
+{
+    lock();
+
+    char* p = (char*)(((size_t)_next + alignment - 1) & ~(alignment - 1));
+    if (nullptr == _next || p + size > _end) {
+        // objects larger than a chunk get one of their own
+        size_t chunkSize = ChunkHeaderSize + ((size + alignment > _chunkSize) ? size + alignment : _chunkSize);
+        Chunk* chunk = (Chunk*)::malloc(chunkSize);
+        if (nullptr == chunk) {
+            unlock();
+            throw std::bad_alloc();
+        }
+        chunk->next = _chunks;
+        _chunks = chunk;
+        _statistics.chunks++;
+
+        _next = (char*)chunk + ChunkHeaderSize;
+        _end = (char*)chunk + chunkSize;
+        p = (char*)(((size_t)_next + alignment - 1) & ~(alignment - 1));
+    }
+
+    _next = p + size;
+    _statistics.allocations++;
+    _statistics.bytes += size;
+    _references++;
+    unlock();
+    return p;
+}
+
+void QueryArena::deallocate(void*)
+{
+    // the memory itself is reclaimed with the arena
+    release();
+}
+
+void QueryArena::release()
+{
+    lock();
+    bool last = (0 == --_references);
+    unlock();
+    if (last) {
+        delete this;
+    }
+}
+
+void QueryArena::lock() const
+{
+    while (_lock.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+}
+
+void QueryArena::unlock() const
+{
+    _lock.clear(std::memory_order_release);
+}
+
+QueryArena::Statistics QueryArena::statistics() const
+{
+    lock();
+    Statistics statistics = _statistics;
+    unlock();
+    return statistics;
+}
+
+// static
+const std::shared_ptr<QueryArena>& QueryArena::current()
+{
+    static const std::shared_ptr<QueryArena> none;
+    return (nullptr != t_currentScope) ? t_currentScope->_arena : none;
+}
+
+QueryArena::Scope::Scope(std::shared_ptr<QueryArena> arena) :
+    _arena(std::move(arena)),
+    _previous(t_currentScope)
+{
+    t_currentScope = this;
+}
+
+QueryArena::Scope::~Scope()
+{
+    t_currentScope = _previous;
+}
@@ -0,0 +1,184 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+// Monotonic buffer for the objects of short-lived queries.
+// While a QueryArena::Scope is alive on a thread, the operators called on
+// that thread allocate their nodes (and the functor and reference count of
+// each) from its arena, and so do the enumerators and clones made later
+// from those nodes, on any thread. Nothing is freed before the arena: every
+// object allocated from it holds a reference to it, and the memory goes
+// back to the heap in one shot when the last of them dies.
+// An arena only grows, so it is meant for a query that is built, run and
+// dropped, not for one that is enumerated again and again.
+class QueryArena
+{
+public:
+    struct Statistics
+    {
+        long long allocations;  // objects allocated from the arena (one is
+                                // the control block of the handles)
+        long long bytes;        // their total size
+        long long chunks;       // blocks of memory taken from the heap
+    };
+
+    static const size_t DefaultChunkSize = 4096;
+
+    static std::shared_ptr<QueryArena> create(size_t chunkSize = DefaultChunkSize);
+
+    // Each allocation holds a reference to the arena until deallocated.
+    void* allocate(size_t size, size_t alignment);
+    void deallocate(void* p);
+
+    Statistics statistics() const;
+
+    // The arena of the scope open on the calling thread, or null.
+    static const std::shared_ptr<QueryArena>& current();
+
+    // Makes arena the current one on this thread, until destroyed. Scopes
+    // can be nested.
+    class Scope
+    {
+    public:
+        explicit Scope(std::shared_ptr<QueryArena> arena);
+        ~Scope();
+
+    private:
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+        std::shared_ptr<QueryArena> _arena;
+        Scope* _previous;
+
+        friend class QueryArena;
+    };
+
+private:
+    explicit QueryArena(size_t chunkSize);
+    ~QueryArena();
+    QueryArena(const QueryArena&);
+    QueryArena& operator=(const QueryArena&);
+
+    void lock() const;
+    void unlock() const;
+    void release();
+
+    struct Chunk
+    {
+        Chunk* next;
+    };
+
+    // A spin lock (held for a few instructions) guards everything; the
+    // shared_ptrs returned by create count as one reference.
+    mutable std::atomic_flag _lock;
+    long _references;
+    size_t _chunkSize;
+    Chunk* _chunks;
+    char* _next;
+    char* _end;
+    Statistics _statistics;
+};
+
+// Allocator of the objects and control blocks of std::allocate_shared.
+// The arena must be alive when allocate is called; then what was allocated
+// keeps it alive, so copies of the allocator need no reference of their own
+// (std::allocate_shared makes a few).
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef ArenaAllocator<U> other;
+    };
+
+    explicit ArenaAllocator(QueryArena* arena) :
+        _arena(arena) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& rhs) :
+        _arena(rhs.arena()) {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), std::alignment_of<T>::value));
+    }
+
+    void deallocate(T* p, size_t) {
+        _arena->deallocate(p);
+    }
+
+    QueryArena* arena() const {
+        return _arena;
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& rhs) const {
+        return _arena == rhs.arena();
+    }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& rhs) const {
+        return _arena != rhs.arena();
+    }
+
+private:
+    QueryArena* _arena;
+};
+
+// std::make_shared, from arena if not null.
+// (VS11 has no variadic templates: one overload per number of arguments)
+template <typename T, typename Arg>
+std::shared_ptr<T> _makeShared(const std::shared_ptr<QueryArena>& arena, Arg&& arg)
+{
+    if (arena) {
+        return std::allocate_shared<T>(ArenaAllocator<T>(arena.get()), std::forward<Arg>(arg));
+    }
+    return std::make_shared<T>(std::forward<Arg>(arg));
+}
+
+template <typename T, typename Arg1, typename Arg2>
+std::shared_ptr<T> _makeShared(const std::shared_ptr<QueryArena>& arena, Arg1&& arg1, Arg2&& arg2)
+{
+    if (arena) {
+        return std::allocate_shared<T>(ArenaAllocator<T>(arena.get()), std::forward<Arg1>(arg1), std::forward<Arg2>(arg2));
+    }
+    return std::make_shared<T>(std::forward<Arg1>(arg1), std::forward<Arg2>(arg2));
+}
+
+template <typename T, typename Arg1, typename Arg2, typename Arg3>
+std::shared_ptr<T> _makeShared(const std::shared_ptr<QueryArena>& arena, Arg1&& arg1, Arg2&& arg2, Arg3&& arg3)
+{
+    if (arena) {
+        return std::allocate_shared<T>(ArenaAllocator<T>(arena.get()),
+            std::forward<Arg1>(arg1), std::forward<Arg2>(arg2), std::forward<Arg3>(arg3));
+    }
+    return std::make_shared<T>(std::forward<Arg1>(arg1), std::forward<Arg2>(arg2), std::forward<Arg3>(arg3));
+}
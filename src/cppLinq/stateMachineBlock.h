@@ -0,0 +1,1867 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "ienumerable.h"
+#include <algorithm>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////
+
+// Alternative to _IteratorBlock for the operators simple enough to be
+// written by hand as state machines: the state of the loop lives in the
+// members of the enumerator and MoveNext() is a plain function call, with
+// no stack and no context switch.
+// TEnumerator is copied from a prototype for every enumeration; it only
+// asks its source for an enumerator at the first MoveNext(), so execution
+// stays deferred. Reset() restarts the enumeration from the prototype.
+// TEnumerator::pushTo does the same loop in push mode: each stage wraps the
+// sink of the next one and passes it to its source, so a chain of stages
+// consumed with foreach costs one call per stage and element, with no
+// enumerator at all. pushTo is const and runs on the prototype itself, with
+// its own copy of the functors: several threads can push the same query
+// without copying, and counting references to, its source.
+// TEnumerator::sizeHint and yieldsTemporaries derive those of the block from
+// its sources.
+template <typename TSource, typename TEnumerator>
+class _StateMachineBlock : public IEnumerable<TSource>
+{
+public:
+    _StateMachineBlock(const TEnumerator& prototype) :
+        _prototype(prototype),
+        _arena(QueryArena::current()) {
+    }
+    _StateMachineBlock(TEnumerator&& prototype) :
+        _prototype(std::move(prototype)),
+        _arena(QueryArena::current()) {
+    }
+
+    // IEnumerable
+    // The enumerators come from the arena of the block, if any.
+    virtual std::shared_ptr<IEnumerator<TSource>> GetEnumerator() {
+        return _makeShared<TEnumerator>(_arena, _prototype);
+    }
+
+    virtual bool pushTo(_Sink<TSource>& sink) {
+        return _prototype.pushTo(sink);
+    }
+
+    virtual SizeHint sizeHint() {
+        return _prototype.sizeHint();
+    }
+
+    virtual bool yieldsTemporaries() {
+        return _prototype.yieldsTemporaries();
+    }
+
+private:
+    TEnumerator _prototype;
+    std::shared_ptr<QueryArena> _arena;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Concat
+
+template <typename T>
+class _ConcatEnumerator : public IEnumerator<T>
+{
+public:
+    _ConcatEnumerator(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs) :
+        _lhs(std::move(lhs)), _rhs(std::move(rhs)), _second(false) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+        _second = false;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _lhs->GetEnumerator();
+        }
+        while (true) {
+            if (_e->MoveNext()) {
+                return true;
+            }
+            if (_second) {
+                return false;
+            }
+            _second = true;
+            _e = _rhs->GetEnumerator();
+        }
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    virtual size_t MoveNextBatch(T*& items, size_t max) {
+        if (! _e) {
+            _e = _lhs->GetEnumerator();
+        }
+        while (true) {
+            size_t count = _e->MoveNextBatch(items, max);
+            if (0 != count || _second) {
+                return count;
+            }
+            _second = true;
+            _e = _rhs->GetEnumerator();
+        }
+    }
+
+    SizeHint sizeHint() const {
+        return _lhs->sizeHint() + _rhs->sizeHint();
+    }
+
+    bool yieldsTemporaries() const {
+        return _lhs->yieldsTemporaries() && _rhs->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        return _lhs->pushTo(sink) && _rhs->pushTo(sink);
+    }
+
+private:
+    std::shared_ptr<IEnumerable<T>> _lhs;
+    std::shared_ptr<IEnumerable<T>> _rhs;
+    std::shared_ptr<IEnumerator<T>> _e;
+    bool _second;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Range
+
+class _RangeEnumerator : public IEnumerator<int>
+{
+public:
+    _RangeEnumerator(int start, int count) :
+        _start(start), _count(count), _index(-1), _current(0) {
+    }
+
+    virtual void Reset() {
+        _index = -1;
+    }
+
+    virtual bool MoveNext() {
+        if (_index + 1 >= _count) {
+            _index = _count;
+            return false;
+        }
+        _index++;
+        _current = _start + _index;
+        return true;
+    }
+
+    virtual int& get_Current() {
+        return _current;
+    }
+
+    // One element at a time, but in one call instead of two.
+    virtual size_t MoveNextBatch(int*& items, size_t) {
+        if (! _RangeEnumerator::MoveNext()) {
+            return 0;
+        }
+        items = &_current;
+        return 1;
+    }
+
+    SizeHint sizeHint() const {
+        return SizeHint::exact((size_t)_count);
+    }
+
+    bool yieldsTemporaries() const {
+        return true;
+    }
+
+    bool pushTo(_Sink<int>& sink) const {
+        for (int i = 0; i < _count; i++) {
+            int current = _start + i;
+            if (! sink.push(current)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    int _start;
+    int _count;
+    int _index;
+    int _current;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Repeat
+
+template <typename T>
+class _RepeatEnumerator : public IEnumerator<T>
+{
+public:
+    _RepeatEnumerator(const T& element, int count) :
+        _element(element), _count(count), _index(0) {
+    }
+
+    virtual void Reset() {
+        _index = 0;
+    }
+
+    virtual bool MoveNext() {
+        if (_index >= _count) {
+            return false;
+        }
+        _index++;
+        return true;
+    }
+
+    virtual T& get_Current() {
+        return _element;
+    }
+
+    virtual size_t MoveNextBatch(T*& items, size_t) {
+        if (! _RepeatEnumerator::MoveNext()) {
+            return 0;
+        }
+        items = &_element;
+        return 1;
+    }
+
+    SizeHint sizeHint() const {
+        return SizeHint::exact((size_t)_count);
+    }
+
+    bool yieldsTemporaries() const {
+        return false;
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        T element(_element);
+        for (int i = 0; i < _count; i++) {
+            if (! sink.push(element)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    T _element;
+    int _count;
+    int _index;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Select
+
+template <typename T, typename TResult, typename Selector>
+class _SelectEnumerator : public IEnumerator<TResult>
+{
+public:
+    _SelectEnumerator(std::shared_ptr<IEnumerable<T>> source, Selector selector) :
+        _source(std::move(source)), _selector(selector), _current() {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        if (! _e->MoveNext()) {
+            return false;
+        }
+        _current = _selector(_e->get_Current());
+        return true;
+    }
+
+    virtual TResult& get_Current() {
+        return _current;
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint();
+    }
+
+    bool yieldsTemporaries() const {
+        return true;
+    }
+
+    bool pushTo(_Sink<TResult>& sink) const {
+        Selector selector(_selector);
+        Sink s(sink, selector);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<TResult>& next, Selector& selector) : _next(next), _selector(selector) {
+        }
+
+        virtual bool push(T& item) {
+            TResult result = _selector(item);
+            return _next.push(result);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<TResult>& _next;
+        Selector& _selector;
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Selector _selector;
+    TResult _current;
+};
+
+template <typename T, typename TResult, typename Selector>
+class _SelectIndexEnumerator : public IEnumerator<TResult>
+{
+public:
+    _SelectIndexEnumerator(std::shared_ptr<IEnumerable<T>> source, Selector selector) :
+        _source(std::move(source)), _selector(selector), _index(0), _current() {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+        _index = 0;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        if (! _e->MoveNext()) {
+            return false;
+        }
+        _current = _selector(_e->get_Current(), _index);
+        _index++;
+        return true;
+    }
+
+    virtual TResult& get_Current() {
+        return _current;
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint();
+    }
+
+    bool yieldsTemporaries() const {
+        return true;
+    }
+
+    bool pushTo(_Sink<TResult>& sink) const {
+        Selector selector(_selector);
+        Sink s(sink, selector);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<TResult>& next, Selector& selector) : _next(next), _selector(selector), _index(0) {
+        }
+
+        virtual bool push(T& item) {
+            TResult result = _selector(item, _index++);
+            return _next.push(result);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<TResult>& _next;
+        Selector& _selector;
+        int _index;
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Selector _selector;
+    int _index;
+    TResult _current;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Skip
+
+template <typename T>
+class _SkipEnumerator : public IEnumerator<T>
+{
+public:
+    _SkipEnumerator(std::shared_ptr<IEnumerable<T>> source, int count) :
+        _source(std::move(source)), _count(count) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e && ! skip()) {
+            return false;
+        }
+        return _e->MoveNext();
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    virtual size_t MoveNextBatch(T*& items, size_t max) {
+        if (! _e && ! skip()) {
+            return 0;
+        }
+        return _e->MoveNextBatch(items, max);
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().skip((size_t)std::max(_count, 0));
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Sink s(sink, _count);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, int count) : _next(next), _count(count) {
+        }
+
+        virtual bool push(T& item) {
+            if (_count > 0) {
+                _count--;
+                return true;
+            }
+            return _next.push(item);
+        }
+
+        virtual bool pushBatch(T* items, size_t count) {
+            if (_count > 0) {
+                size_t skipped = std::min((size_t)_count, count);
+                _count -= (int)skipped;
+                items += skipped;
+                count -= skipped;
+            }
+            return (0 == count) || _next.pushBatch(items, count);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<T>& _next;
+        int _count;
+    };
+
+    // Gets the enumerator of the source and moves past the first _count
+    // elements, a batch at a time; false if the source ends before.
+    bool skip() {
+        _e = _source->GetEnumerator();
+        size_t left = (_count > 0) ? (size_t)_count : 0;
+        while (left > 0) {
+            T* items;
+            size_t count = _e->MoveNextBatch(items, left);
+            if (0 == count) {
+                return false;
+            }
+            left -= count;
+        }
+        return true;
+    }
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    int _count;
+};
+
+template <typename T, typename Predicate>
+class _SkipWhileEnumerator : public IEnumerator<T>
+{
+public:
+    _SkipWhileEnumerator(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) :
+        _source(std::move(source)), _predicate(predicate) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _source->GetEnumerator();
+            while (_e->MoveNext()) {
+                if (! _predicate(_e->get_Current())) {
+                    // Stop skipping now, and yield this item
+                    return true;
+                }
+            }
+            return false;
+        }
+        return _e->MoveNext();
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Predicate predicate(_predicate);
+        Sink s(sink, predicate);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, Predicate& predicate) : _next(next), _predicate(predicate), _skipping(true) {
+        }
+
+        virtual bool push(T& item) {
+            if (_skipping) {
+                if (_predicate(item)) {
+                    return true;
+                }
+                _skipping = false;
+            }
+            return _next.push(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<T>& _next;
+        Predicate& _predicate;
+        bool _skipping;
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Predicate _predicate;
+};
+
+template <typename T, typename Predicate>
+class _SkipWhileIndexEnumerator : public IEnumerator<T>
+{
+public:
+    _SkipWhileIndexEnumerator(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) :
+        _source(std::move(source)), _predicate(predicate) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _source->GetEnumerator();
+            int index = 0;
+            while (_e->MoveNext()) {
+                if (! _predicate(_e->get_Current(), index)) {
+                    // Stop skipping now, and yield this item
+                    return true;
+                }
+                index++;
+            }
+            return false;
+        }
+        return _e->MoveNext();
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Predicate predicate(_predicate);
+        Sink s(sink, predicate);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, Predicate& predicate) : _next(next), _predicate(predicate), _index(0) {
+        }
+
+        virtual bool push(T& item) {
+            if (_index >= 0) {
+                if (_predicate(item, _index)) {
+                    _index++;
+                    return true;
+                }
+                _index = -1;    // done skipping
+            }
+            return _next.push(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<T>& _next;
+        Predicate& _predicate;
+        int _index;
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Predicate _predicate;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Take
+
+template <typename T>
+class _TakeEnumerator : public IEnumerator<T>
+{
+public:
+    _TakeEnumerator(std::shared_ptr<IEnumerable<T>> source, int count) :
+        _source(std::move(source)), _count(count), _taken(0) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+        _taken = 0;
+    }
+
+    virtual bool MoveNext() {
+        if (_taken >= _count) {
+            return false;
+        }
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        if (! _e->MoveNext()) {
+            _taken = _count;
+            return false;
+        }
+        _taken++;
+        return true;
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    virtual size_t MoveNextBatch(T*& items, size_t max) {
+        if (_taken >= _count) {
+            return 0;
+        }
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        size_t count = _e->MoveNextBatch(items, std::min(max, (size_t)(_count - _taken)));
+        if (0 == count) {
+            _taken = _count;
+            return 0;
+        }
+        _taken += (int)count;
+        return count;
+    }
+
+    // Stops the source after the last element taken, so that it is not
+    // asked for one more.
+    SizeHint sizeHint() const {
+        return _source->sizeHint().take((size_t)std::max(_count, 0));
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        if (_count <= 0) {
+            return true;
+        }
+        Sink s(sink, _count);
+        _source->pushTo(s);
+        return ! s._stopped;
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, int count) : _next(next), _count(count), _stopped(false) {
+        }
+
+        virtual bool push(T& item) {
+            _count--;
+            if (! _next.push(item)) {
+                _stopped = true;
+                return false;
+            }
+            return _count > 0;
+        }
+
+        virtual bool pushBatch(T* items, size_t count) {
+            count = std::min(count, (size_t)_count);
+            _count -= (int)count;
+            if (! _next.pushBatch(items, count)) {
+                _stopped = true;
+                return false;
+            }
+            return _count > 0;
+        }
+
+        _Sink<T>& _next;
+        int _count;
+        bool _stopped;      // by the next sink
+
+    private:
+        Sink& operator=(const Sink&);
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    int _count;
+    int _taken;
+};
+
+template <typename T, typename Predicate>
+class _TakeWhileEnumerator : public IEnumerator<T>
+{
+public:
+    _TakeWhileEnumerator(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) :
+        _source(std::move(source)), _predicate(predicate), _done(false) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+        _done = false;
+    }
+
+    virtual bool MoveNext() {
+        if (_done) {
+            return false;
+        }
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        if (! _e->MoveNext() || ! _predicate(_e->get_Current())) {
+            _done = true;
+            return false;
+        }
+        return true;
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Predicate predicate(_predicate);
+        Sink s(sink, predicate);
+        _source->pushTo(s);
+        return ! s._stopped;
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, Predicate& predicate) : _next(next), _predicate(predicate), _stopped(false) {
+        }
+
+        virtual bool push(T& item) {
+            if (! _predicate(item)) {
+                return false;
+            }
+            if (! _next.push(item)) {
+                _stopped = true;
+                return false;
+            }
+            return true;
+        }
+
+        _Sink<T>& _next;
+        Predicate& _predicate;
+        bool _stopped;      // by the next sink
+
+    private:
+        Sink& operator=(const Sink&);
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Predicate _predicate;
+    bool _done;
+};
+
+template <typename T, typename Predicate>
+class _TakeWhileIndexEnumerator : public IEnumerator<T>
+{
+public:
+    _TakeWhileIndexEnumerator(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) :
+        _source(std::move(source)), _predicate(predicate), _index(0), _done(false) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+        _index = 0;
+        _done = false;
+    }
+
+    virtual bool MoveNext() {
+        if (_done) {
+            return false;
+        }
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        if (! _e->MoveNext() || ! _predicate(_e->get_Current(), _index)) {
+            _done = true;
+            return false;
+        }
+        _index++;
+        return true;
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Predicate predicate(_predicate);
+        Sink s(sink, predicate);
+        _source->pushTo(s);
+        return ! s._stopped;
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, Predicate& predicate) : _next(next), _predicate(predicate), _index(0), _stopped(false) {
+        }
+
+        virtual bool push(T& item) {
+            if (! _predicate(item, _index++)) {
+                return false;
+            }
+            if (! _next.push(item)) {
+                _stopped = true;
+                return false;
+            }
+            return true;
+        }
+
+        _Sink<T>& _next;
+        Predicate& _predicate;
+        int _index;
+        bool _stopped;      // by the next sink
+
+    private:
+        Sink& operator=(const Sink&);
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Predicate _predicate;
+    int _index;
+    bool _done;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Where
+
+template <typename T, typename Predicate>
+class _WhereEnumerator : public IEnumerator<T>
+{
+public:
+    _WhereEnumerator(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) :
+        _source(std::move(source)), _predicate(predicate) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        while (_e->MoveNext()) {
+            if (_predicate(_e->get_Current())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Predicate predicate(_predicate);
+        Sink s(sink, predicate);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, Predicate& predicate) : _next(next), _predicate(predicate) {
+        }
+
+        virtual bool push(T& item) {
+            return ! _predicate(item) || _next.push(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<T>& _next;
+        Predicate& _predicate;
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Predicate _predicate;
+};
+
+template <typename T, typename Predicate>
+class _WhereIndexEnumerator : public IEnumerator<T>
+{
+public:
+    _WhereIndexEnumerator(std::shared_ptr<IEnumerable<T>> source, Predicate predicate) :
+        _source(std::move(source)), _predicate(predicate), _index(0) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+        _index = 0;
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        while (_e->MoveNext()) {
+            int index = _index++;
+            if (_predicate(_e->get_Current(), index)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Predicate predicate(_predicate);
+        Sink s(sink, predicate);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, Predicate& predicate) : _next(next), _predicate(predicate), _index(0) {
+        }
+
+        virtual bool push(T& item) {
+            return ! _predicate(item, _index++) || _next.push(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<T>& _next;
+        Predicate& _predicate;
+        int _index;
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<IEnumerator<T>> _e;
+    Predicate _predicate;
+    int _index;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Sorted
+
+// A sequence marked with AsSorted: the elements of its source, untouched,
+// and the order they are in.
+template <typename T>
+class _SortedSequence : public IEnumerable<T>
+{
+public:
+    _SortedSequence(std::shared_ptr<IEnumerable<T>> source, std::shared_ptr<_Ordering<T>> ordering) :
+        _source(std::move(source)), _ordering(std::move(ordering)) {
+    }
+
+    // IEnumerable
+    virtual std::shared_ptr<IEnumerator<T>> GetEnumerator() {
+        return _source->GetEnumerator();
+    }
+
+    virtual bool pushTo(_Sink<T>& sink) {
+        return _source->pushTo(sink);
+    }
+
+    virtual IRandomAccess<T>* randomAccess() {
+        return _source->randomAccess();
+    }
+
+    virtual SizeHint sizeHint() {
+        return _source->sizeHint();
+    }
+
+    virtual bool yieldsTemporaries() {
+        return _source->yieldsTemporaries();
+    }
+
+    virtual std::shared_ptr<_Ordering<T>> ordering() {
+        return _ordering;
+    }
+
+private:
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<_Ordering<T>> _ordering;
+};
+
+// The set of the merges: the elements come in order, so those equivalent
+// are adjacent, and an element is new if it is not equivalent to the last
+// new one, a copy of which is all the state. (Kept in a vector of at most
+// one element: T needs no default constructor.)
+template <typename T>
+class _LastElement
+{
+public:
+    // Whether item is new; if so, it becomes the last element.
+    bool insert(const _Ordering<T>& ordering, const T& item) {
+        if (_last.empty()) {
+            _last.push_back(item);
+            return true;
+        }
+        if (! ordering.less(_last[0], item)) {
+            return false;
+        }
+        _last[0] = item;
+        return true;
+    }
+
+    void clear() {
+        _last.clear();
+    }
+
+private:
+    std::vector<T> _last;
+};
+
+// pushTo of the merges of two sequences, which pull their elements from
+// both: e is a copy of the prototype.
+template <typename T, typename TEnumerator>
+bool _pullTo(TEnumerator e, _Sink<T>& sink)
+{
+    while (e.MoveNext()) {
+        if (! sink.push(e.get_Current())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Distinct of a sorted sequence.
+template <typename T>
+class _SortedDistinctEnumerator : public IEnumerator<T>
+{
+public:
+    _SortedDistinctEnumerator(std::shared_ptr<IEnumerable<T>> source, std::shared_ptr<_Ordering<T>> ordering) :
+        _source(std::move(source)), _ordering(std::move(ordering)) {
+    }
+
+    virtual void Reset() {
+        _e = nullptr;
+        _seen.clear();
+    }
+
+    virtual bool MoveNext() {
+        if (! _e) {
+            _e = _source->GetEnumerator();
+        }
+        while (_e->MoveNext()) {
+            if (_seen.insert(*_ordering, _e->get_Current())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    virtual T& get_Current() {
+        return _e->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return _source->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _source->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        Sink s(sink, *_ordering);
+        return _source->pushTo(s);
+    }
+
+private:
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_Sink<T>& next, const _Ordering<T>& ordering) : _next(next), _ordering(ordering) {
+        }
+
+        virtual bool push(T& item) {
+            return ! _seen.insert(_ordering, item) || _next.push(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _Sink<T>& _next;
+        const _Ordering<T>& _ordering;
+        _LastElement<T> _seen;
+    };
+
+    std::shared_ptr<IEnumerable<T>> _source;
+    std::shared_ptr<_Ordering<T>> _ordering;
+    std::shared_ptr<IEnumerator<T>> _e;
+    _LastElement<T> _seen;
+};
+
+// Union of two sorted sequences: the smaller of the current elements of
+// the two (that of lhs, if they are equivalent) comes next.
+template <typename T>
+class _MergeUnionEnumerator : public IEnumerator<T>
+{
+public:
+    _MergeUnionEnumerator(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs,
+                          std::shared_ptr<_Ordering<T>> ordering) :
+        _lhs(std::move(lhs)), _rhs(std::move(rhs)), _ordering(std::move(ordering)),
+        _lhsHas(false), _rhsHas(false), _current(nullptr) {
+    }
+
+    virtual void Reset() {
+        _l = nullptr;
+        _r = nullptr;
+        _lhsHas = false;
+        _rhsHas = false;
+        _current = nullptr;
+        _seen.clear();
+    }
+
+    virtual bool MoveNext() {
+        if (! _l) {
+            _l = _lhs->GetEnumerator();
+            _lhsHas = _l->MoveNext();
+            _r = _rhs->GetEnumerator();
+            _rhsHas = _r->MoveNext();
+        }
+        else if (nullptr != _current) {
+            _advance(_current);
+        }
+
+        while (_lhsHas || _rhsHas) {
+            IEnumerator<T>* next =
+                (! _rhsHas || (_lhsHas && ! _ordering->less(_r->get_Current(), _l->get_Current()))) ? _l.get() : _r.get();
+            if (_seen.insert(*_ordering, next->get_Current())) {
+                _current = next;
+                return true;
+            }
+            _advance(next);
+        }
+        _current = nullptr;
+        return false;
+    }
+
+    virtual T& get_Current() {
+        return _current->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return (_lhs->sizeHint() + _rhs->sizeHint()).bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _lhs->yieldsTemporaries() && _rhs->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        return _pullTo(*this, sink);
+    }
+
+private:
+    void _advance(IEnumerator<T>* e) {
+        if (e == _l.get()) {
+            _lhsHas = _l->MoveNext();
+        }
+        else {
+            _rhsHas = _r->MoveNext();
+        }
+    }
+
+    std::shared_ptr<IEnumerable<T>> _lhs;
+    std::shared_ptr<IEnumerable<T>> _rhs;
+    std::shared_ptr<_Ordering<T>> _ordering;
+    std::shared_ptr<IEnumerator<T>> _l;
+    std::shared_ptr<IEnumerator<T>> _r;
+    bool _lhsHas;
+    bool _rhsHas;
+    IEnumerator<T>* _current;   // _l or _r: the one the current element is from
+    _LastElement<T> _seen;
+};
+
+// Except (or, if intersect, Intersect) of two sorted sequences: rhs is read
+// up to the current element of lhs, which is yielded if rhs has no
+// equivalent one (or, if intersect, if it has).
+template <typename T, bool intersect>
+class _MergeDifferenceEnumerator : public IEnumerator<T>
+{
+public:
+    _MergeDifferenceEnumerator(std::shared_ptr<IEnumerable<T>> lhs, std::shared_ptr<IEnumerable<T>> rhs,
+                               std::shared_ptr<_Ordering<T>> ordering) :
+        _lhs(std::move(lhs)), _rhs(std::move(rhs)), _ordering(std::move(ordering)), _rhsHas(false) {
+    }
+
+    virtual void Reset() {
+        _l = nullptr;
+        _r = nullptr;
+        _rhsHas = false;
+        _seen.clear();
+    }
+
+    virtual bool MoveNext() {
+        if (! _l) {
+            _l = _lhs->GetEnumerator();
+            _r = _rhs->GetEnumerator();
+            _rhsHas = _r->MoveNext();
+        }
+
+        while ((_rhsHas || ! intersect) && _l->MoveNext()) {
+            T& item = _l->get_Current();
+            if (! _seen.insert(*_ordering, item)) {
+                continue;
+            }
+            while (_rhsHas && _ordering->less(_r->get_Current(), item)) {
+                _rhsHas = _r->MoveNext();
+            }
+            bool found = _rhsHas && ! _ordering->less(item, _r->get_Current());
+            if (found == intersect) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    virtual T& get_Current() {
+        return _l->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        return intersect ? _lhs->sizeHint().intersect(_rhs->sizeHint()) : _lhs->sizeHint().bound();
+    }
+
+    bool yieldsTemporaries() const {
+        return _lhs->yieldsTemporaries();
+    }
+
+    bool pushTo(_Sink<T>& sink) const {
+        return _pullTo(*this, sink);
+    }
+
+private:
+    std::shared_ptr<IEnumerable<T>> _lhs;
+    std::shared_ptr<IEnumerable<T>> _rhs;
+    std::shared_ptr<_Ordering<T>> _ordering;
+    std::shared_ptr<IEnumerator<T>> _l;
+    std::shared_ptr<IEnumerator<T>> _r;
+    bool _rhsHas;
+    _LastElement<T> _seen;
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Spilling
+
+// Reads back a partition of a spilling set operator.
+template <typename T>
+class _SpillFileEnumerator : public IEnumerator<T>
+{
+public:
+    explicit _SpillFileEnumerator(std::shared_ptr<SpillFile> file) : _file(std::move(file)) {
+        _file->rewind();
+    }
+
+    virtual void Reset() {
+        _file->rewind();
+        _current.clear();
+    }
+
+    virtual bool MoveNext() {
+        _current.clear();
+        if (_file->atEnd()) {
+            return false;
+        }
+        _current.push_back(SpillTraits<T>::read(*_file));
+        return true;
+    }
+
+    virtual T& get_Current() {
+        return _current[0];
+    }
+
+private:
+    std::shared_ptr<SpillFile> _file;
+    std::vector<T> _current;   // (at most one element)
+};
+
+// Distinct, Union and Except within a MemoryBudget. A pass reads the
+// excluded elements (rhs, for Except) into the set without yielding them,
+// then adds to the set and yields the elements of the inputs not in it yet,
+// until the set would outgrow the budget. From there on, the elements not
+// in the set are written to Fanout partitions by hash, each a pair of files
+// for the excluded elements and the inputs. When the inputs are exhausted,
+// each partition is read back by a pass of its own, with a new set. The
+// pass at level n picks partitions by the bits from PartitionBits * n of
+// the hash, so a partition that does not fit either is split by the next
+// bits; past the last level, the budget is ignored.
+template <typename T>
+class _SpillingSetEnumerator : public IEnumerator<T>
+{
+    typedef FlatHashSet<T> Set;
+
+    enum { PartitionBits = 4, Fanout = 1 << PartitionBits, MaxLevel = 64 / PartitionBits };
+
+    struct Partition
+    {
+        Partition(std::shared_ptr<SpillFile> excludedFile, std::shared_ptr<SpillFile> inputFile, int partitionLevel) :
+            excluded(std::move(excludedFile)), input(std::move(inputFile)), level(partitionLevel) {
+        }
+
+        std::shared_ptr<SpillFile> excluded;   // (null if there were none)
+        std::shared_ptr<SpillFile> input;
+        int level;
+    };
+
+public:
+    // excluded and second can be null.
+    _SpillingSetEnumerator(std::shared_ptr<IEnumerable<T>> excluded, std::shared_ptr<IEnumerable<T>> first,
+                           std::shared_ptr<IEnumerable<T>> second, std::shared_ptr<MemoryBudget> budget) :
+        _excludedSource(std::move(excluded)), _budget(std::move(budget)),
+        _input(0), _level(0), _spilling(false), _heapBytes(0) {
+        _sources.push_back(std::move(first));
+        if (second) {
+            _sources.push_back(std::move(second));
+        }
+    }
+
+    virtual void Reset() {
+        _set = nullptr;
+        _excluded = nullptr;
+        _inputs.clear();
+        _input = 0;
+        _files.clear();
+        _pending.clear();
+        _level = 0;
+        _spilling = false;
+        _heapBytes = 0;
+    }
+
+    virtual bool MoveNext() {
+        if (! _set) {
+            _start();
+            if (_excludedSource) {
+                _excluded = _excludedSource->GetEnumerator();
+            }
+        }
+
+        for (;;) {
+            if (_excluded) {
+                while (_excluded->MoveNext()) {
+                    _add(_excluded->get_Current(), false);
+                }
+                _excluded = nullptr;
+            }
+
+            while (_input < _inputs.size()) {
+                if (! _inputs[_input]) {
+                    _inputs[_input] = _sources[_input]->GetEnumerator();
+                }
+                if (! _inputs[_input]->MoveNext()) {
+                    _inputs[_input] = nullptr;
+                    _input++;
+                    continue;
+                }
+                if (_add(_inputs[_input]->get_Current(), true)) {
+                    return true;
+                }
+            }
+
+            if (! _nextPass()) {
+                return false;
+            }
+        }
+    }
+
+    virtual T& get_Current() {
+        return _inputs[_input]->get_Current();
+    }
+
+    SizeHint sizeHint() const {
+        SizeHint hint = _sources[0]->sizeHint();
+        if (_sources.size() > 1) {
+            hint = hint + _sources[1]->sizeHint();
+        }
+        return hint.bound();
+    }
+
+    // (those read back from the partitions are temporaries)
+    bool yieldsTemporaries() const {
+        for (size_t i = 0; i < _sources.size(); i++) {
+            if (! _sources[i]->yieldsTemporaries()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The first pass pushes the sources through the set; the partitions are
+    // pulled.
+    bool pushTo(_Sink<T>& sink) const {
+        _SpillingSetEnumerator e(*this);
+        e._start();
+        if (_excludedSource) {
+            Sink excluded(e, nullptr);
+            _excludedSource->pushTo(excluded);
+        }
+        Sink input(e, &sink);
+        for (size_t i = 0; i < _sources.size(); i++) {
+            if (! _sources[i]->pushTo(input)) {
+                return false;
+            }
+        }
+
+        e._input = e._inputs.size();
+        while (e.MoveNext()) {
+            if (! sink.push(e.get_Current())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    // Adds the elements pushed by a source, excluded (if next is null) or
+    // input, to the set of a pass, or to its partitions.
+    class Sink : public _Sink<T>
+    {
+    public:
+        Sink(_SpillingSetEnumerator& e, _Sink<T>* next) : _e(e), _next(next) {
+        }
+
+        virtual bool push(T& item) {
+            return ! _e._add(item, nullptr != _next) || nullptr == _next || _next->push(item);
+        }
+
+    private:
+        Sink& operator=(const Sink&);
+
+        _SpillingSetEnumerator& _e;
+        _Sink<T>* _next;
+    };
+
+    // The first pass, over the sources: the inputs are opened in turn.
+    void _start() {
+        _set = std::make_shared<Set>();
+        _inputs.resize(_sources.size());
+    }
+
+    // Adds item, unless it is in the set already, to the set if it fits,
+    // else to its partition. Returns whether it was added to the set.
+    // As long as the set need not grow, this is one probe.
+    bool _add(const T& item, bool input) {
+        if (! _spilling && ! _set->full()) {
+            size_t heapBytes = SpillTraits<T>::heapBytes(item);
+            if (_fits(_set->capacity(), heapBytes)) {
+                if (! _set->insert(item).second) {
+                    return false;
+                }
+                _heapBytes += heapBytes;
+                return true;
+            }
+        }
+        return _growOrSpill(item, input);
+    }
+
+    // _add, when the set is full or spilling.
+    bool _growOrSpill(const T& item, bool input) {
+        if (_set->contains(item)) {
+            return false;
+        }
+        if (! _spilling) {
+            size_t heapBytes = SpillTraits<T>::heapBytes(item);
+            if (_fits(Set::capacityFor(_set->size() + 1), heapBytes)) {
+                _set->insert(item);
+                _heapBytes += heapBytes;
+                return true;
+            }
+            _spilling = true;
+            _files.resize(2 * Fanout);
+        }
+
+        uint64_t hash = _mixHash((uint64_t)std::hash<T>()(item));
+        size_t partition = (size_t)((hash >> (PartitionBits * _level)) & (Fanout - 1));
+        std::shared_ptr<SpillFile>& file = _files[2 * partition + (input ? 1 : 0)];
+        if (! file) {
+            file = std::make_shared<SpillFile>();
+        }
+        SpillTraits<T>::write(*file, item);
+        return false;
+    }
+
+    // Whether the set, with capacity slots and one more element holding
+    // heapBytes, is within the budget.
+    bool _fits(size_t capacity, size_t heapBytes) const {
+        return _level >= MaxLevel || capacity * (sizeof(T) + 1) + _heapBytes + heapBytes <= _budget->bytes();
+    }
+
+    // Queues the partitions of the pass, if it spilled, then starts the next
+    // pass, if any.
+    bool _nextPass() {
+        if (_spilling) {
+            int partitions = 0;
+            long long bytes = 0;
+            for (int p = Fanout - 1; p >= 0; p--) {
+                const std::shared_ptr<SpillFile>& excluded = _files[2 * p];
+                const std::shared_ptr<SpillFile>& input = _files[2 * p + 1];
+                if (excluded || input) {
+                    partitions++;
+                    bytes += (excluded ? excluded->bytes() : 0) + (input ? input->bytes() : 0);
+                }
+                // (with no input, a partition yields nothing)
+                if (input) {
+                    _pending.push_back(Partition(excluded, input, _level + 1));
+                }
+            }
+            _budget->recordSpill(partitions, bytes);
+            _files.clear();
+            _spilling = false;
+        }
+
+        _set = std::make_shared<Set>();
+        _heapBytes = 0;
+        if (_pending.empty()) {
+            return false;
+        }
+
+        Partition next = _pending.back();
+        _pending.pop_back();
+        _level = next.level;
+        if (next.excluded) {
+            _excluded = std::make_shared<_SpillFileEnumerator<T>>(next.excluded);
+        }
+        _inputs.assign(1, std::make_shared<_SpillFileEnumerator<T>>(next.input));
+        _input = 0;
+        return true;
+    }
+
+    std::shared_ptr<IEnumerable<T>> _excludedSource;
+    std::vector<std::shared_ptr<IEnumerable<T>>> _sources;
+    std::shared_ptr<MemoryBudget> _budget;
+
+    // The current pass.
+    std::shared_ptr<Set> _set;
+    std::shared_ptr<IEnumerator<T>> _excluded;
+    std::vector<std::shared_ptr<IEnumerator<T>>> _inputs;
+    size_t _input;
+    int _level;
+    bool _spilling;
+    size_t _heapBytes;
+    std::vector<std::shared_ptr<SpillFile>> _files;   // excluded and input files of each partition
+
+    std::vector<Partition> _pending;                  // the partitions left, the next one last
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Random access
+
+// Reverse, Skip and Take over a source with random access (IRandomAccess):
+// the elements are read from the source by index, with no buffer, and the
+// view has random access too, so Count or ElementAt on it cost O(1), and
+// so does stacking another view on it. The size of the source is read
+// when an enumeration starts.
+template <typename T>
+class _RandomAccessView : public IEnumerable<T>, public IRandomAccess<T>
+{
+public:
+    struct Reversed {};
+
+    // The (at most) count elements from first on.
+    struct Slice
+    {
+        Slice(size_t f, size_t c) : first(f), count(c) {}
+        size_t first;
+        size_t count;
+    };
+
+    _RandomAccessView(std::shared_ptr<IEnumerable<T>> source, Reversed) :
+        _source(std::move(source)),
+        _first(0),
+        _count((size_t)-1),
+        _reversed(true),
+        _arena(QueryArena::current()) {
+        _ra = _source->randomAccess();
+    }
+
+    _RandomAccessView(std::shared_ptr<IEnumerable<T>> source, const Slice& slice) :
+        _source(std::move(source)),
+        _first(slice.first),
+        _count(slice.count),
+        _reversed(false),
+        _arena(QueryArena::current()) {
+        _ra = _source->randomAccess();
+    }
+
+    // IEnumerable
+    // The enumerators come from the arena of the view, if any.
+    virtual std::shared_ptr<IEnumerator<T>> GetEnumerator() {
+        return _makeShared<_RandomAccessEnumerator<T>>(_arena, this->shared_from_this(), this);
+    }
+
+    virtual bool pushTo(_Sink<T>& sink) {
+        size_t count = get_Count();
+        T* data = get_Data();
+        if (nullptr != data) {
+            return (0 == count) || sink.pushBatch(data, count);
+        }
+        data = _reversed ? _ra->get_Data() : nullptr;
+        if (nullptr != data) {
+            for (size_t i = count; i > 0; i--) {
+                if (! sink.push(data[i - 1])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (! sink.push(get_Item(i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    virtual IRandomAccess<T>* randomAccess() {
+        return this;
+    }
+
+    // IRandomAccess
+    virtual size_t get_Count() {
+        size_t size = _ra->get_Count();
+        size = (size > _first) ? size - _first : 0;
+        return std::min(size, _count);
+    }
+
+    virtual T& get_Item(size_t index) {
+        if (_reversed) {
+            return _ra->get_Item(_ra->get_Count() - 1 - index);
+        }
+        return _ra->get_Item(_first + index);
+    }
+
+    virtual T* get_Data() {
+        T* data = _reversed ? nullptr : _ra->get_Data();
+        return (nullptr != data) ? data + std::min(_first, _ra->get_Count()) : nullptr;
+    }
+
+private:
+    std::shared_ptr<IEnumerable<T>> _source;
+    IRandomAccess<T>* _ra;
+    size_t _first;
+    size_t _count;
+    bool _reversed;
+    std::shared_ptr<QueryArena> _arena;
+};
+
+// Enumerator of a sequence with random access, owned by owner: the elements
+// are read by index, or handed out in one batch if contiguous.
+template <typename T>
+class _RandomAccessEnumerator : public IEnumerator<T>
+{
+public:
+    _RandomAccessEnumerator(std::shared_ptr<IEnumerable<T>> owner, IRandomAccess<T>* ra) :
+        _owner(std::move(owner)), _ra(ra), _started(false), _next(0), _count(0), _data(nullptr) {
+    }
+
+    virtual void Reset() {
+        _started = false;
+    }
+
+    virtual bool MoveNext() {
+        if (! _started) {
+            start();
+        }
+        if (_next >= _count) {
+            return false;
+        }
+        _next++;
+        return true;
+    }
+
+    virtual T& get_Current() {
+        return (nullptr != _data) ? _data[_next - 1] : _ra->get_Item(_next - 1);
+    }
+
+    // Contiguous elements in one batch.
+    virtual size_t MoveNextBatch(T*& items, size_t max) {
+        if (! _started) {
+            start();
+        }
+        if (_next >= _count) {
+            return 0;
+        }
+        if (nullptr == _data) {
+            items = &_ra->get_Item(_next++);
+            return 1;
+        }
+        size_t count = std::min(max, _count - _next);
+        items = _data + _next;
+        _next += count;
+        return count;
+    }
+
+private:
+    void start() {
+        _started = true;
+        _next = 0;
+        _count = _ra->get_Count();
+        _data = _ra->get_Data();
+    }
+
+    std::shared_ptr<IEnumerable<T>> _owner;
+    IRandomAccess<T>* _ra;
+    bool _started;
+    size_t _next;       // index of the element after the current one
+    size_t _count;
+    T* _data;
+};
+
+// The result of ToArray: a sequence that owns its elements, with random
+// access.
+template <typename T>
+class _Array : public IEnumerable<T>, public IRandomAccess<T>
+{
+public:
+    explicit _Array(std::vector<T>&& elements) :
+        _elements(std::move(elements)) {
+    }
+
+    // IEnumerable
+    virtual std::shared_ptr<IEnumerator<T>> GetEnumerator() {
+        return std::make_shared<_RandomAccessEnumerator<T>>(this->shared_from_this(), this);
+    }
+
+    virtual bool pushTo(_Sink<T>& sink) {
+        return _elements.empty() || sink.pushBatch(&_elements[0], _elements.size());
+    }
+
+    virtual IRandomAccess<T>* randomAccess() {
+        return this;
+    }
+
+    // IRandomAccess
+    virtual size_t get_Count() {
+        return _elements.size();
+    }
+
+    virtual T& get_Item(size_t index) {
+        return _elements[index];
+    }
+
+    virtual T* get_Data() {
+        return _elements.empty() ? nullptr : &_elements[0];
+    }
+
+private:
+    std::vector<T> _elements;
+};
@@ -5,8 +5,12 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
 
 #include <stdio.h>
 #include <tchar.h>
-#include <Windows.h>
\ No newline at end of file
+#include <Windows.h>
+#else
+#include <stdio.h>
+#endif
\ No newline at end of file
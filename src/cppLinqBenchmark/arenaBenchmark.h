@@ -0,0 +1,104 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Short queries of six operators, built, run and dropped: the heap
+    // allocations made by each query with the nodes allocated from the heap
+    // and from a QueryArena, and the time per query.
+    class ArenaBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "query arenas (ns/query)\n");
+
+            const int queries = 100000;
+            measure("6 operators, Sum, heap", queries, false, [](int i) {
+                return build(i)->Sum();
+            });
+            measure("6 operators, Sum, arena", queries, true, [](int i) {
+                return build(i)->Sum();
+            });
+            measure("6 operators, MoveNext, heap", queries, false, [](int i) {
+                return enumerate(build(i));
+            });
+            measure("6 operators, MoveNext, arena", queries, true, [](int i) {
+                return enumerate(build(i));
+            });
+
+            std::shared_ptr<QueryArena> arena = QueryArena::create();
+            {
+                QueryArena::Scope scope(arena);
+                consume(enumerate(build(0)));
+            }
+            QueryArena::Statistics statistics = arena->statistics();
+            fprintf(stdout, "    arena of one query: %lld objects, %lld bytes, %lld chunk(s)\n",
+                statistics.allocations, statistics.bytes, statistics.chunks);
+        }
+
+    private:
+        static std::shared_ptr<IEnumerable<int>> build(int i)
+        {
+            return IEnumerable<int>::Range(i % 8, 32)
+                ->Where([](int x) { return x % 3 != 0; })
+                ->Select<int>([](int x) { return x * 2; })
+                ->Skip(2)
+                ->Take(16)
+                ->Where([](int x) { return x > 4; });
+        }
+
+        static int enumerate(std::shared_ptr<IEnumerable<int>> query)
+        {
+            int total = 0;
+            auto e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total += e->get_Current();
+            }
+            return total;
+        }
+
+        template <typename F>
+        static void measure(const char* name, int queries, bool useArena, F f)
+        {
+            long long result = 0;
+            long long chunks = 0;
+            long long allocations = AllocationCounter::count();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                std::shared_ptr<QueryArena> arena;
+                if (useArena) {
+                    arena = QueryArena::create();
+                }
+                QueryArena::Scope scope(arena);
+                result += f(i);
+                if (arena) {
+                    // (the chunks are malloc'ed, not counted by operator new)
+                    chunks += arena->statistics().chunks;
+                }
+            }
+            double elapsed = sw.elapsedNs();
+            allocations = AllocationCounter::count() - allocations + chunks;
+
+            char label[80];
+            sprintf(label, "%s (%.1f allocations/query)", name, (double)allocations / queries);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+    };
+}
@@ -0,0 +1,110 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Cost per element of the terminal operators over a vector of 10M ints,
+    // read one element at a time (MoveNext and get_Current, two virtual calls
+    // per element) and in batches (IEnumerator::MoveNextBatch), and the same
+    // operators over a Range, whose enumerator has no batches of its own.
+    class BatchBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "batch enumeration\n");
+
+            const int count = 10000000;
+            std::vector<int> v(count);
+            std::vector<int> w(count);
+            for (int i = 0; i < count; i++) {
+                v[i] = w[i] = (i * 7) % 1000;
+            }
+            std::shared_ptr<IEnumerable<int>> vector(new VectorEnumerable(v));
+            std::shared_ptr<IEnumerable<int>> other(new VectorEnumerable(w));
+            std::shared_ptr<IEnumerable<int>> range = IEnumerable<int>::Range(0, count);
+
+            measure("vector, Sum, MoveNext", count, [vector]() { return sum(vector); });
+            measure("vector, Sum", count, [vector]() { return (long long)vector->Sum(); });
+            measure("vector, Count", count, [vector]() { return (long long)vector->Count(); });
+            measure("vector, Min", count, [vector]() { return (long long)vector->Min(); });
+            measure("vector, Max", count, [vector]() { return (long long)vector->Max(); });
+            measure("vector, Aggregate", count, [vector]() {
+                return (long long)vector->Aggregate([](int a, int b) { return a ^ b; });
+            });
+            measure("vector, SequenceEqual, MoveNext", count, [vector, other]() {
+                return (long long)sequenceEqual(vector, other);
+            });
+            measure("vector, SequenceEqual", count, [vector, other]() {
+                return (long long)vector->SequenceEqual(other);
+            });
+            measure("vector, SequenceEqual(array)", count, [vector, &w]() {
+                return (long long)vector->SequenceEqual<int>(&w[0], w.size());
+            });
+
+            measure("range, Sum, MoveNext", count, [range]() { return sum(range); });
+            measure("range, Sum", count, [range]() { return (long long)range->Sum(); });
+            measure("range, Max", count, [range]() { return (long long)range->Max(); });
+            measure("range, SequenceEqual, MoveNext", count, [range]() {
+                return (long long)sequenceEqual(range, IEnumerable<int>::Range(0, 10000000));
+            });
+            measure("range, SequenceEqual", count, [range]() {
+                return (long long)range->SequenceEqual(IEnumerable<int>::Range(0, 10000000));
+            });
+        }
+
+    private:
+        // The loops of Sum and SequenceEqual without batches.
+        static long long sum(std::shared_ptr<IEnumerable<int>> source)
+        {
+            int total = 0;
+            auto e = source->GetEnumerator();
+            while (e->MoveNext()) {
+                total += e->get_Current();
+            }
+            return total;
+        }
+
+        static bool sequenceEqual(std::shared_ptr<IEnumerable<int>> lhs, std::shared_ptr<IEnumerable<int>> rhs)
+        {
+            auto l = lhs->GetEnumerator();
+            auto r = rhs->GetEnumerator();
+            while (true) {
+                bool lNext = l->MoveNext();
+                if (lNext != r->MoveNext()) {
+                    return false;
+                }
+                if (! lNext) {
+                    return true;
+                }
+                if (l->get_Current() != r->get_Current()) {
+                    return false;
+                }
+            }
+        }
+
+        template <typename F>
+        static void measure(const char* name, int count, F f)
+        {
+            Stopwatch sw;
+            long long result = f();
+            report(name, sw.elapsedNs(), count);
+            consume(result);
+        }
+    };
+}
@@ -0,0 +1,204 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "../cppLinq/iteratorblock.h"
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+class Stopwatch
+{
+public:
+    Stopwatch() : _start(std::chrono::steady_clock::now()) {
+    }
+
+    void restart() {
+        _start = std::chrono::steady_clock::now();
+    }
+
+    double elapsedNs() const {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Prints the cost of one measure, in nanoseconds per item.
+inline void report(const char* name, double elapsedNs, long long items)
+{
+    fprintf(stdout, "  %-52s %10.2f ns/item\n", name, elapsedNs / (double)items);
+}
+
+// Number and total size of the heap allocations made by the benchmark
+// process (operator new is replaced in main.cpp).
+struct AllocationCounter
+{
+    static long long& count() {
+        static long long s_count = 0;
+        return s_count;
+    }
+    static long long& bytes() {
+        static long long s_bytes = 0;
+        return s_bytes;
+    }
+};
+
+// Resident memory (working set) of the process, in KB.
+inline double residentKB()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    ::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize / 1024.0;
+#else
+    long pages = 0;
+    long resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (nullptr != f) {
+        if (2 != fscanf(f, "%ld %ld", &pages, &resident)) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (::sysconf(_SC_PAGESIZE) / 1024.0);
+#endif
+}
+
+namespace Benchmark
+{
+    // An int whose operators always run on fibers (see UseFiberBlock): the
+    // benchmarks that measure fibers use it, since the operators on int are
+    // state machines.
+    struct FiberInt
+    {
+        FiberInt() : value(0) {}
+        FiberInt(int v) : value(v) {}
+        operator int() const { return value; }
+
+        int value;
+    };
+
+    // A vector seen as an IEnumerable, which hands out all its elements
+    // in one batch (IEnumerator::MoveNextBatch), and with random access
+    // (IRandomAccess) if asked to.
+    template <typename T>
+    class VectorOf : public IEnumerable<T>, public IRandomAccess<T>
+    {
+        class Enumerator : public IEnumerator<T>
+        {
+        public:
+            Enumerator(std::vector<T>& v) : _v(v), _pos(-1) {
+            }
+
+            virtual void Reset() {
+                _pos = -1;
+            }
+            virtual bool MoveNext() {
+                if (_pos + 1 >= (long long)_v.size()) {
+                    _pos = (long long)_v.size();
+                    return false;
+                }
+                _pos++;
+                return true;
+            }
+            virtual T& get_Current() {
+                return _v[(size_t)_pos];
+            }
+            virtual size_t MoveNextBatch(T*& items, size_t max) {
+                size_t first = (size_t)(_pos + 1);
+                if (first >= _v.size()) {
+                    _pos = (long long)_v.size();
+                    return 0;
+                }
+                size_t count = std::min(max, _v.size() - first);
+                items = &_v[first];
+                _pos = (long long)(first + count - 1);
+                return count;
+            }
+
+        private:
+            Enumerator& operator=(const Enumerator&);
+
+            std::vector<T>& _v;
+            long long _pos;
+        };
+
+    public:
+        VectorOf(std::vector<T>& v, bool randomAccess = false) : _v(v), _randomAccess(randomAccess) {
+        }
+        virtual std::shared_ptr<IEnumerator<T>> GetEnumerator() {
+            return std::shared_ptr<IEnumerator<T>>(new Enumerator(_v));
+        }
+        virtual IRandomAccess<T>* randomAccess() {
+            return _randomAccess ? this : nullptr;
+        }
+
+        // IRandomAccess
+        virtual size_t get_Count() {
+            return _v.size();
+        }
+        virtual T& get_Item(size_t index) {
+            return _v[index];
+        }
+        virtual T* get_Data() {
+            return _v.empty() ? nullptr : &_v[0];
+        }
+
+    private:
+        VectorOf& operator=(const VectorOf&);
+
+        std::vector<T>& _v;
+        bool _randomAccess;
+    };
+
+    typedef VectorOf<int> VectorEnumerable;
+
+    // The equivalent of IEnumerable<int>::Range on a fiber.
+    inline std::shared_ptr<IEnumerable<FiberInt>> fiberRange(int start, int count)
+    {
+        auto fn = [start, count](IteratorBlock<FiberInt>* it) {
+            it->setAbandonable(true);
+            for (int i = 0; i < count; i++) {
+                it->yieldReturn(FiberInt(start + i));
+            }
+        };
+        return std::shared_ptr<IEnumerable<FiberInt>>(
+            new _IteratorBlock<FiberInt>(fn, Fiber::SmallStackSize, "Range"));
+    }
+}
+
+template <LinqOperator op>
+struct UseFiberBlock<op, Benchmark::FiberInt>
+{
+    static const bool value = true;
+};
+
+// Keeps the optimizer from discarding the results of a measured loop.
+template <typename T>
+inline void consume(const T& value)
+{
+    static volatile long long sink = 0;
+    sink = sink + (long long)value;
+}
@@ -0,0 +1,85 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <thread>
+
+namespace Benchmark
+{
+    // Cost of short queries run at the same time by one to eight threads on
+    // the same source, where every copy of a shared_ptr to it is an atomic
+    // operation on the same cache line: operators applied to the shared
+    // source, terminal operators and enumerators of a shared query. The time
+    // is per query and thread: without contention it does not grow with the
+    // number of threads (on as many cores).
+    class ContentionBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "shared sources (ns/query, %u hardware threads)\n", std::thread::hardware_concurrency());
+
+            std::shared_ptr<IEnumerable<int>> source = IEnumerable<int>::Range(0, 16);
+            std::shared_ptr<IEnumerable<int>> query = source
+                ->Where([](int x) { return x % 2 == 0; })
+                ->Select<int>([](int x) { return x * 3; });
+
+            const int queries = 200000;
+            char name[64];
+            for (int threads = 1; threads <= 8; threads *= 2) {
+                sprintf(name, "%d thread(s), Where->Count on the source", threads);
+                measure(name, threads, queries, [source]() {
+                    return source->Where([](int x) { return x > 4; })->Count();
+                });
+                sprintf(name, "%d thread(s), Sum of the query", threads);
+                measure(name, threads, queries, [query]() {
+                    return query->Sum();
+                });
+                sprintf(name, "%d thread(s), MoveNext on the query", threads);
+                measure(name, threads, queries, [query]() {
+                    int total = 0;
+                    auto e = query->GetEnumerator();
+                    while (e->MoveNext()) {
+                        total += e->get_Current();
+                    }
+                    return total;
+                });
+            }
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, int threads, int queries, F f)
+        {
+            std::vector<std::thread> workers;
+            std::vector<long long> results(threads);
+            Stopwatch sw;
+            for (int t = 0; t < threads; t++) {
+                long long* result = &results[t];
+                workers.push_back(std::thread([f, queries, result]() {
+                    for (int i = 0; i < queries; i++) {
+                        *result += f();
+                    }
+                }));
+            }
+            for (int t = 0; t < threads; t++) {
+                workers[t].join();
+            }
+            report(name, sw.elapsedNs() / threads, queries);
+            consume(results[0]);
+        }
+    };
+}
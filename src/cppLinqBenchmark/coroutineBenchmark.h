@@ -0,0 +1,90 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+
+#ifdef CPPLINQ_COROUTINES
+
+namespace Benchmark
+{
+    // Fiber blocks (_IteratorBlock) against coroutine blocks (_CoroutineBlock)
+    // on the same Range->Where->Select pipeline.
+    class CoroutineBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "coroutine blocks\n");
+
+            const int count = 2000000;
+            pipeline("Range->Where->Select->Sum, fibers", fiberPipeline(count), count);
+            pipeline("Range->Where->Select->Sum, coroutines", coroutinePipeline(count), count);
+
+            enumeratorSize("heap bytes per live enumerator, fibers (+1 stack)", fiberPipeline(count));
+            enumeratorSize("heap bytes per live enumerator, coroutines", coroutinePipeline(count));
+        }
+
+    private:
+        static std::shared_ptr<IEnumerable<FiberInt>> fiberPipeline(int count)
+        {
+            return fiberRange(0, count)
+                ->Where([](const FiberInt& x) { return (x & 1) == 0; })
+                ->Select<FiberInt>([](const FiberInt& x) { return FiberInt(x * 3); });
+        }
+
+        static std::shared_ptr<IEnumerable<int>> coroutinePipeline(int count)
+        {
+            std::shared_ptr<IEnumerable<int>> range(new _CoroutineBlock<int>([count]() {
+                return IEnumerable<int>::_RangeBlock(0, count);
+            }));
+            auto predicate = [](int x) { return (x & 1) == 0; };
+            std::shared_ptr<IEnumerable<int>> where(new _CoroutineBlock<int>([range, predicate]() {
+                return IEnumerable<int>::_WhereBlock(range, predicate);
+            }));
+            auto selector = [](int x) { return x * 3; };
+            return std::shared_ptr<IEnumerable<int>>(new _CoroutineBlock<int>([where, selector]() {
+                return IEnumerable<int>::_SelectBlock<int>(where, selector);
+            }));
+        }
+
+        template <typename T>
+        static void pipeline(const char* name, std::shared_ptr<IEnumerable<T>> query, int count)
+        {
+            Stopwatch sw;
+            long long total = 0;
+            std::shared_ptr<IEnumerator<T>> e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total += e->get_Current();
+            }
+            report(name, sw.elapsedNs(), count);
+            consume(total);
+        }
+
+        // Heap allocated by GetEnumerator() and the first MoveNext(), which
+        // starts the whole chain. The fiber chain also reserves a stack for
+        // its last stage, which runs the other two inline.
+        template <typename T>
+        static void enumeratorSize(const char* name, std::shared_ptr<IEnumerable<T>> query)
+        {
+            long long before = AllocationCounter::bytes();
+            std::shared_ptr<IEnumerator<T>> e = query->GetEnumerator();
+            e->MoveNext();
+            fprintf(stdout, "  %-52s %10lld bytes\n", name, AllocationCounter::bytes() - before);
+        }
+    };
+}
+
+#endif // CPPLINQ_COROUTINES
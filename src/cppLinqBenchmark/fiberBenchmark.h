@@ -0,0 +1,191 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <vector>
+
+#ifndef _WIN32
+#include <ucontext.h>
+#endif
+
+namespace Benchmark
+{
+    // Cost of the context switches behind IteratorBlock::yieldReturn.
+    class FiberBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "fiber (%s)\n", backendName());
+
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+            // timings are meaningless while the stacks are filled and scanned
+            shortQueries(1000, true);
+            stackProfile();
+#else
+            const int count = 2000000;
+            yieldReturnRoundTrip(count, IteratorBlock<int>::Unbatched);
+            yieldReturnRoundTrip(count, 16);
+            yieldReturnRoundTrip(count, IteratorBlock<int>::DefaultBatchSize);
+            yieldReturnRoundTrip(count, 1024);
+#ifndef _WIN32
+            swapcontextRoundTrip(count);
+#endif
+            shortQueries(100000, true);
+            shortQueries(100000, false);
+            idleEnumerators(2000);
+#endif
+        }
+
+    private:
+        static const char* backendName()
+        {
+#if defined(CPPLINQ_FIBER_WIN32)
+            return "win32 fibers";
+#elif defined(CPPLINQ_FIBER_ASM)
+            return "native register switch";
+#else
+            return "ucontext";
+#endif
+        }
+
+        // One MoveNext() on an iterator block: a switch into the fiber and,
+        // at the next yieldReturn, a switch back to the consumer. With
+        // batching the switches happen once every batchSize elements.
+        static void yieldReturnRoundTrip(int count, size_t batchSize)
+        {
+            auto fn = [count](IteratorBlock<int>* it) {
+                for (int i = 0; i < count; i++) {
+                    it->yieldReturn(i);
+                }
+            };
+            std::shared_ptr<IEnumerable<int>> source(new _IteratorBlock<int>(fn, Fiber::DefaultStackSize,
+                nullptr, batchSize));
+            std::shared_ptr<IEnumerator<int>> e = source->GetEnumerator();
+
+            Stopwatch sw;
+            long long total = 0;
+            while (e->MoveNext()) {
+                total += e->get_Current();
+            }
+            char name[64];
+            sprintf(name, "yieldReturn, batches of %u", (unsigned)batchSize);
+            report(name, sw.elapsedNs(), count);
+            consume(total);
+        }
+
+        // A small query built and run in a tight loop. Its three stages share
+        // the fiber of the last one, which gets a brand new stack for every
+        // query when the stack pool is trimmed after each of them.
+        static void shortQueries(int count, bool pooled)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+            FiberStackPool::Statistics before = pool.statistics();
+
+            Stopwatch sw;
+            long long total = 0;
+            for (int i = 0; i < count; i++) {
+                {
+                    auto e = fiberRange(0, 8)
+                        ->Where([](const FiberInt& x) { return (x & 1) == 0; })
+                        ->Select<FiberInt>([](const FiberInt& x) { return FiberInt(x * 2); })
+                        ->GetEnumerator();
+                    while (e->MoveNext()) {
+                        total++;
+                    }
+                }
+                if (! pooled) {
+                    pool.trim();
+                }
+            }
+            report(pooled ? "short query, pooled stacks (per query)" : "short query, new stacks (per query)",
+                sw.elapsedNs(), count);
+            consume(total);
+
+            FiberStackPool::Statistics after = pool.statistics();
+            fprintf(stdout, "    stack pool: %lld hits, %lld misses, high water %lld\n",
+                after.hits - before.hits, after.misses - before.misses, after.highWater);
+        }
+
+        // Resident memory held by suspended enumerators: each one has run up
+        // to its first yieldReturn, on the fiber of Where (Range runs inline).
+        static void idleEnumerators(int count)
+        {
+            FiberStackPool::instance().trim();
+            std::vector<std::shared_ptr<IEnumerator<FiberInt>>> enumerators;
+            enumerators.reserve(count);
+
+            double before = residentKB();
+            for (int i = 0; i < count; i++) {
+                auto e = fiberRange(0, 10)
+                    ->Where([](const FiberInt& x) { return x > 2; })
+                    ->GetEnumerator();
+                e->MoveNext();
+                enumerators.push_back(e);
+            }
+            double after = residentKB();
+            fprintf(stdout, "  %-52s %10.2f KB\n", "resident memory per idle enumerator",
+                (after - before) / count);
+        }
+
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+        static void stackProfile()
+        {
+            std::vector<Fiber::StackProfile> profile = Fiber::stackProfile();
+            fprintf(stdout, "  fiber stack profile\n");
+            for (size_t i = 0; i < profile.size(); i++) {
+                fprintf(stdout, "    %-20s %8lld fibers, peak %7u of %7u bytes\n", profile[i].name,
+                    profile[i].fibers, (unsigned)profile[i].peakDepth, (unsigned)profile[i].stackSize);
+            }
+        }
+#endif
+
+#ifndef _WIN32
+        static ucontext_t s_mainContext;
+        static ucontext_t s_fiberContext;
+
+        static void pingPong()
+        {
+            while (true) {
+                ::swapcontext(&s_fiberContext, &s_mainContext);
+            }
+        }
+
+        // The same round trip done with two swapcontext calls, for reference.
+        static void swapcontextRoundTrip(int count)
+        {
+            std::vector<char> stack(64 * 1024);
+            ::getcontext(&s_fiberContext);
+            s_fiberContext.uc_stack.ss_sp = &stack[0];
+            s_fiberContext.uc_stack.ss_size = stack.size();
+            s_fiberContext.uc_link = nullptr;
+            ::makecontext(&s_fiberContext, pingPong, 0);
+
+            Stopwatch sw;
+            for (int i = 0; i < count; i++) {
+                ::swapcontext(&s_mainContext, &s_fiberContext);
+            }
+            report("swapcontext round trip", sw.elapsedNs(), count);
+        }
+#endif
+    };
+
+#ifndef _WIN32
+    // static
+    ucontext_t FiberBenchmark::s_mainContext;
+    ucontext_t FiberBenchmark::s_fiberContext;
+#endif
+}
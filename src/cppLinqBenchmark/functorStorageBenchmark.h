@@ -0,0 +1,84 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Short queries of four iterator blocks, built, run and dropped: the
+    // heap allocations made by each query and the time per query. And Any
+    // with a predicate over a vector of 1M ints, true at the last one.
+    class FunctorStorageBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "functor storage\n");
+
+            const int queries = 100000;
+            measure("4 iterator blocks, Sum", queries, [](int i) {
+                return build(i)->Sum();
+            });
+            measure("4 iterator blocks, MoveNext", queries, [](int i) {
+                int total = 0;
+                auto e = build(i)->GetEnumerator();
+                while (e->MoveNext()) {
+                    total += e->get_Current();
+                }
+                return total;
+            });
+
+            const int count = 1000000;
+            std::vector<int> v(count);
+            for (int i = 0; i < count; i++) {
+                v[i] = i;
+            }
+            std::shared_ptr<IEnumerable<int>> vector(new VectorEnumerable(v));
+            Stopwatch sw;
+            bool found = vector->Any([count](int x) { return x == count - 1; });
+            report("Any(predicate)", sw.elapsedNs(), count);
+            consume(found ? 1 : 0);
+        }
+
+    private:
+        // Where, on a fiber.
+        template <typename Predicate>
+        static std::shared_ptr<IEnumerable<int>> where(std::shared_ptr<IEnumerable<int>> source, Predicate predicate)
+        {
+            auto fn = [source, predicate](IteratorBlock<int>* it) {
+                foreach<int>(source, [it, predicate](int& x) {
+                    if (predicate(x)) {
+                        it->yieldReturnRef(x);
+                    }
+                });
+            };
+            return std::make_shared<_IteratorBlock<int>>(fn, Fiber::SmallStackSize, "where");
+        }
+
+        static std::shared_ptr<IEnumerable<int>> build(int i)
+        {
+            std::shared_ptr<IEnumerable<int>> query = IEnumerable<int>::Range(i % 8, 32);
+            query = where(query, [](int x) { return x % 3 != 0; });
+            query = where(query, [](int x) { return x % 5 != 0; });
+            query = where(query, [](int x) { return x % 7 != 0; });
+            return where(query, [](int x) { return x > 4; });
+        }
+
+        template <typename F>
+        static void measure(const char* name, int queries, F f)
+        {
+            long long result = 0;
+            long long allocations = AllocationCounter::count();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += f(i);
+            }
+            double elapsed = sw.elapsedNs();
+            allocations = AllocationCounter::count() - allocations;
+
+            char label[80];
+            sprintf(label, "%s (%.1f allocations/query)", name, (double)allocations / queries);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+    };
+}
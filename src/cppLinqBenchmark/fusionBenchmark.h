@@ -0,0 +1,150 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Cost per element of a chain of one to eight stages, each adding one
+    // to the element:
+    //  - fiber blocks that pull from the previous stage: one fiber per stage;
+    //  - fiber blocks that use foreach: the stages run inline on the fiber of
+    //    the last one (IteratorBlock::runInline);
+    //  - Select state machines, enumerated with MoveNext() and with foreach
+    //    (IEnumerable::pushTo).
+    // And the cost of flattening one to four levels of nested unbatched
+    // blocks, re-yielding every element against IteratorBlock::yieldFrom.
+    class FusionBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "stage fusion\n");
+
+            const int count = 1000000;
+            char name[64];
+            for (int stages = 1; stages <= 8; stages++) {
+                sprintf(name, "%d stage(s), fiber per stage", stages);
+                pull(name, fiberChain(count, stages, false), count);
+                sprintf(name, "%d stage(s), fused fibers", stages);
+                pull(name, fiberChain(count, stages, true), count);
+                sprintf(name, "%d stage(s), state machines, MoveNext", stages);
+                pull(name, selectChain(count, stages), count);
+                sprintf(name, "%d stage(s), state machines, foreach", stages);
+                push(name, selectChain(count, stages), count);
+            }
+
+            for (int depth = 1; depth <= 4; depth++) {
+                sprintf(name, "depth %d, re-yield", depth);
+                pull(name, nested(count, depth, false), count);
+                sprintf(name, "depth %d, yieldFrom", depth);
+                pull(name, nested(count, depth, true), count);
+            }
+        }
+
+    private:
+        static std::shared_ptr<IEnumerable<int>> fiberChain(int count, int stages, bool fused)
+        {
+            auto range = [count](IteratorBlock<int>* it) {
+                for (int i = 0; i < count; i++) {
+                    it->yieldReturn(i);
+                }
+            };
+            std::shared_ptr<IEnumerable<int>> result(new _IteratorBlock<int>(range));
+
+            for (int stage = 1; stage < stages; stage++) {
+                std::shared_ptr<IEnumerable<int>> source = result;
+                if (fused) {
+                    result.reset(new _IteratorBlock<int>([source](IteratorBlock<int>* it) {
+                        foreach<int>(source, [it](int& item) {
+                            it->yieldReturn(item + 1);
+                        });
+                    }));
+                }
+                else {
+                    result.reset(new _IteratorBlock<int>([source](IteratorBlock<int>* it) {
+                        auto e = source->GetEnumerator();
+                        while (e->MoveNext()) {
+                            it->yieldReturn(e->get_Current() + 1);
+                        }
+                    }));
+                }
+            }
+            return result;
+        }
+
+        static std::shared_ptr<IEnumerable<int>> nested(int count, int depth, bool delegate)
+        {
+            auto range = [count](IteratorBlock<int>* it) {
+                for (int i = 0; i < count; i++) {
+                    it->yieldReturn(i);
+                }
+            };
+            std::shared_ptr<IEnumerable<int>> result(
+                new _IteratorBlock<int>(range, Fiber::DefaultStackSize, nullptr, IteratorBlock<int>::Unbatched));
+
+            for (int level = 1; level < depth; level++) {
+                std::shared_ptr<IEnumerable<int>> inner = result;
+                if (delegate) {
+                    result.reset(new _IteratorBlock<int>([inner](IteratorBlock<int>* it) {
+                        it->yieldFrom(inner);
+                    }, Fiber::DefaultStackSize, nullptr, IteratorBlock<int>::Unbatched));
+                }
+                else {
+                    result.reset(new _IteratorBlock<int>([inner](IteratorBlock<int>* it) {
+                        auto e = inner->GetEnumerator();
+                        while (e->MoveNext()) {
+                            it->yieldReturn(e->get_Current());
+                        }
+                    }, Fiber::DefaultStackSize, nullptr, IteratorBlock<int>::Unbatched));
+                }
+            }
+            return result;
+        }
+
+        static std::shared_ptr<IEnumerable<int>> selectChain(int count, int stages)
+        {
+            std::shared_ptr<IEnumerable<int>> result = IEnumerable<int>::Range(0, count);
+            for (int stage = 1; stage < stages; stage++) {
+                result = result->Select<int>([](int x) { return x + 1; });
+            }
+            return result;
+        }
+
+        static void pull(const char* name, std::shared_ptr<IEnumerable<int>> query, int count)
+        {
+            Stopwatch sw;
+            long long total = 0;
+            std::shared_ptr<IEnumerator<int>> e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total += e->get_Current();
+            }
+            report(name, sw.elapsedNs(), count);
+            consume(total);
+        }
+
+        static void push(const char* name, std::shared_ptr<IEnumerable<int>> query, int count)
+        {
+            Stopwatch sw;
+            long long total = 0;
+            foreach<int>(query, [&total](int& item) {
+                total += item;
+            });
+            report(name, sw.elapsedNs(), count);
+            consume(total);
+        }
+    };
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <functional>
+#include <string>
+
+namespace Benchmark
+{
+    // Distinct, Union and Except over 1M ints, 1M 64-bit keys and 200K
+    // strings, with about one distinct element in ten: each element is
+    // looked up in the set of the operator, a std::set when an ordering
+    // comparer is given, a FlatHashSet by default.
+    class HashSetBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "hash sets (ns/query)\n");
+
+            std::vector<int> ints(1000000);
+            std::vector<long long> keys(ints.size());
+            for (size_t i = 0; i < ints.size(); i++) {
+                ints[i] = (int)((i * 7919) % 100000);
+                keys[i] = (long long)ints[i] * 0x100000001LL;
+            }
+            std::vector<std::string> strings(200000);
+            for (size_t i = 0; i < strings.size(); i++) {
+                strings[i] = "customer-" + std::to_string((i * 7919) % 20000);
+            }
+
+            std::shared_ptr<IEnumerable<int>> intSource(new VectorOf<int>(ints, true));
+            std::shared_ptr<IEnumerable<long long>> keySource(new VectorOf<long long>(keys, true));
+            std::shared_ptr<IEnumerable<std::string>> stringSource(new VectorOf<std::string>(strings, true));
+            std::shared_ptr<IEnumerable<int>> evens = IEnumerable<int>::Range(0, 50000)
+                ->Select<int>([](int x) { return x * 2; });
+
+            measure("ints, Distinct", "std::set", [intSource]() {
+                return intSource->Distinct(std::less<int>())->Count();
+            });
+            measure("ints, Distinct", "FlatHashSet", [intSource]() {
+                return intSource->Distinct()->Count();
+            });
+            measure("64-bit keys, Distinct", "std::set", [keySource]() {
+                return keySource->Distinct(std::less<long long>())->Count();
+            });
+            measure("64-bit keys, Distinct", "FlatHashSet", [keySource]() {
+                return keySource->Distinct()->Count();
+            });
+            measure("strings, Distinct", "std::set", [stringSource]() {
+                return stringSource->Distinct(std::less<std::string>())->Count();
+            });
+            measure("strings, Distinct", "FlatHashSet", [stringSource]() {
+                return stringSource->Distinct()->Count();
+            });
+
+            measure("ints, Union", "std::set", [intSource, evens]() {
+                return intSource->Union(evens, std::less<int>())->Count();
+            });
+            measure("ints, Union", "FlatHashSet", [intSource, evens]() {
+                return intSource->Union(evens)->Count();
+            });
+            measure("ints, Except", "std::set", [intSource, evens]() {
+                return intSource->Except(evens, std::less<int>())->Count();
+            });
+            measure("ints, Except", "FlatHashSet", [intSource, evens]() {
+                return intSource->Except(evens)->Count();
+            });
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, const char* set, F f)
+        {
+            const int queries = 3;
+            long long result = 0;
+            long long allocations = AllocationCounter::count();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += f();
+            }
+            double elapsed = sw.elapsedNs();
+            allocations = AllocationCounter::count() - allocations;
+
+            char label[100];
+            sprintf(label, "%s, %s (%lld allocations)", name, set, allocations / queries);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+    };
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <math.h>
+#include <string>
+
+namespace Benchmark
+{
+    // Counting the distinct elements of 2M ints (500K distinct) and of 500K
+    // strings (100K distinct) exactly, with Distinct()->Count(), and with
+    // HyperLogLog sketches of 8 KB (the default precision, 13) and 64 KB
+    // (16), whole or in four partitions merged afterwards: the time per
+    // element, the memory allocated, and the error of the estimates.
+    class HyperLogLogBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "approximate distinct count (ns/element)\n");
+
+            std::vector<int> ints(2000000);
+            for (size_t i = 0; i < ints.size(); i++) {
+                ints[i] = (int)((i * 7919) % 500000);
+            }
+            std::vector<std::string> strings(500000);
+            for (size_t i = 0; i < strings.size(); i++) {
+                strings[i] = "a string too long for the small buffer, #" + std::to_string((i * 7919) % 100000);
+            }
+            std::shared_ptr<IEnumerable<int>> intSource(new VectorOf<int>(ints, true));
+            std::shared_ptr<IEnumerable<std::string>> stringSource(new VectorOf<std::string>(strings, true));
+
+            measure("ints, Distinct()->Count()", 500000, ints.size(), [intSource]() {
+                return (long long)intSource->Distinct()->Count();
+            });
+            measure("ints, CountDistinctApprox()", 500000, ints.size(), [intSource]() {
+                return intSource->CountDistinctApprox();
+            });
+            measure("ints, CountDistinctApprox(16)", 500000, ints.size(), [intSource]() {
+                return intSource->CountDistinctApprox(16);
+            });
+            measure("ints, 4 sketches merged", 500000, ints.size(), [intSource]() {
+                return merged(intSource, 500000);
+            });
+
+            measure("strings, Distinct()->Count()", 100000, strings.size(), [stringSource]() {
+                return (long long)stringSource->Distinct()->Count();
+            });
+            measure("strings, CountDistinctApprox()", 100000, strings.size(), [stringSource]() {
+                return stringSource->CountDistinctApprox();
+            });
+            measure("strings, CountDistinctApprox(16)", 100000, strings.size(), [stringSource]() {
+                return stringSource->CountDistinctApprox(16);
+            });
+            measure("strings, 4 sketches merged", 100000, strings.size(), [stringSource]() {
+                return merged(stringSource, 125000);
+            });
+        }
+
+    private:
+        // The sketches of four quarters of source, of size elements each,
+        // as if counted apart, then merged.
+        template <typename T>
+        static long long merged(const std::shared_ptr<IEnumerable<T>>& source, int size)
+        {
+            HyperLogLog sketch = source->Take(size)->ToHyperLogLog();
+            for (int i = 1; i < 4; i++) {
+                sketch.merge(source->Skip(i * size)->Take(size)->ToHyperLogLog());
+            }
+            return sketch.count();
+        }
+
+        template <typename F>
+        static void measure(const char* name, long long distinct, size_t elements, F f)
+        {
+            const int queries = 3;
+            long long result = 0;
+            long long bytes = AllocationCounter::bytes();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result = f();
+            }
+            double elapsed = sw.elapsedNs();
+            bytes = AllocationCounter::bytes() - bytes;
+
+            char label[100];
+            sprintf(label, "%s (%lld KB allocated)", name, bytes / queries / 1024);
+            report(label, elapsed, (long long)elements * queries);
+            fprintf(stdout, "    %lld distinct, error %.2f%%\n",
+                result, 100.0 * fabs((double)(result - distinct)) / distinct);
+        }
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Intersect against the Where(x => rhs->Contains(x)) it replaces, on 5K
+    // ints (Contains scans rhs for each element); then a small sequence
+    // (1K ints) intersected with a large one (1M): with size hints the set
+    // is built from the small one, without them from the large rhs.
+    class IntersectBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "intersect (ns/query)\n");
+
+            std::vector<int> lhs(5000);
+            std::vector<int> rhs(5000);
+            for (size_t i = 0; i < lhs.size(); i++) {
+                lhs[i] = (int)i * 2;
+                rhs[i] = (int)i * 3;
+            }
+            std::shared_ptr<IEnumerable<int>> lhsSource(new VectorOf<int>(lhs, true));
+            std::shared_ptr<IEnumerable<int>> rhsSource(new VectorOf<int>(rhs, true));
+
+            measure("5K ints, Where(Contains)", [lhsSource, rhsSource]() {
+                return lhsSource->Where([rhsSource](int x) { return rhsSource->Contains(x); })->Count();
+            });
+            measure("5K ints, Intersect", [lhsSource, rhsSource]() {
+                return lhsSource->Intersect(rhsSource)->Count();
+            });
+
+            std::vector<int> small(1000);
+            std::vector<int> large(1000000);
+            for (size_t i = 0; i < small.size(); i++) {
+                small[i] = (int)i * 1000;
+            }
+            for (size_t i = 0; i < large.size(); i++) {
+                large[i] = (int)((i * 7919) % large.size());
+            }
+            for (int pass = 0; pass < 2; pass++) {
+                bool sized = (1 == pass);
+                std::shared_ptr<IEnumerable<int>> smallSource(new VectorOf<int>(small, sized));
+                std::shared_ptr<IEnumerable<int>> largeSource(new VectorOf<int>(large, sized));
+                measure(sized ? "1K with 1M ints, set of the 1K (size hints)" : "1K with 1M ints, set of the 1M (no hints)",
+                    [smallSource, largeSource]() {
+                        return smallSource->Intersect(largeSource)->Count();
+                    });
+            }
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, F f)
+        {
+            const int queries = 3;
+            long long result = 0;
+            long long bytes = AllocationCounter::bytes();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += f();
+            }
+            double elapsed = sw.elapsedNs();
+            bytes = AllocationCounter::bytes() - bytes;
+
+            char label[100];
+            sprintf(label, "%s (%lld KB)", name, bytes / queries / 1024);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+    };
+}
@@ -0,0 +1,92 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+
+#include "batchBenchmark.h"
+#include "fiberBenchmark.h"
+#include "fusionBenchmark.h"
+#include "pipelineBenchmark.h"
+#include "contentionBenchmark.h"
+#include "arenaBenchmark.h"
+#include "moveBenchmark.h"
+#include "yieldByReferenceBenchmark.h"
+#include "functorStorageBenchmark.h"
+#include "randomAccessBenchmark.h"
+#include "sizeHintBenchmark.h"
+#include "materializeBenchmark.h"
+#include "hashSetBenchmark.h"
+#include "intersectBenchmark.h"
+#include "sortedBenchmark.h"
+#include "spillBenchmark.h"
+#include "hyperLogLogBenchmark.h"
+#include "coroutineBenchmark.h"
+#include "stateMachineBenchmark.h"
+#include "teardownBenchmark.h"
+#include <new>
+#include <stdlib.h>
+using namespace Benchmark;
+
+void* operator new(size_t size)
+{
+    AllocationCounter::count()++;
+    AllocationCounter::bytes() += size;
+    void* p = malloc(size ? size : 1);
+    if (nullptr == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void benchmark()
+{
+    FiberBenchmark::run();
+    StateMachineBenchmark::run();
+    FusionBenchmark::run();
+    TeardownBenchmark::run();
+    BatchBenchmark::run();
+    PipelineBenchmark::run();
+    ContentionBenchmark::run();
+    ArenaBenchmark::run();
+    MoveBenchmark::run();
+    YieldByReferenceBenchmark::run();
+    FunctorStorageBenchmark::run();
+    RandomAccessBenchmark::run();
+    SizeHintBenchmark::run();
+    MaterializeBenchmark::run();
+    HashSetBenchmark::run();
+    IntersectBenchmark::run();
+    SortedBenchmark::run();
+    SpillBenchmark::run();
+    HyperLogLogBenchmark::run();
+#ifdef CPPLINQ_COROUTINES
+    CoroutineBenchmark::run();
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    Fiber::enableFibersInCurrentThread();
+    benchmark();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <string>
+
+namespace Benchmark
+{
+    // Materializing 1M ints and 100K strings into a std::vector, by hand
+    // (a foreach that push_backs every element) and with ToVector, which
+    // copies a contiguous source in one shot, reserves from the size hint
+    // and moves the temporaries of a projection instead of copying them.
+    class MaterializeBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "materialize (ns/query)\n");
+
+            std::vector<int> ints(1000000);
+            for (size_t i = 0; i < ints.size(); i++) {
+                ints[i] = (int)i;
+            }
+            std::vector<std::string> strings(100000);
+            for (size_t i = 0; i < strings.size(); i++) {
+                strings[i] = "a string too long for the small buffer, #" + std::to_string(i);
+            }
+            std::shared_ptr<IEnumerable<int>> intSource(new VectorOf<int>(ints, true));
+            std::shared_ptr<IEnumerable<std::string>> stringSource(new VectorOf<std::string>(strings, true));
+
+            measure("ints, contiguous", "foreach", [intSource]() {
+                return byHand<int>(intSource).size();
+            });
+            measure("ints, contiguous", "ToVector", [intSource]() {
+                return intSource->ToVector().size();
+            });
+
+            auto doubled = [intSource]() {
+                return intSource->Select<int>([](int x) { return x * 2; });
+            };
+            measure("ints, Select", "foreach", [doubled]() {
+                return byHand<int>(doubled()).size();
+            });
+            measure("ints, Select", "ToVector", [doubled]() {
+                return doubled()->ToVector().size();
+            });
+
+            auto copied = [stringSource]() {
+                return stringSource->Select<std::string>([](const std::string& s) { return std::string(s); });
+            };
+            measure("strings, Select", "foreach", [copied]() {
+                return byHand<std::string>(copied()).size();
+            });
+            measure("strings, Select", "ToVector", [copied]() {
+                return copied()->ToVector().size();
+            });
+        }
+
+    private:
+        template <typename T>
+        static std::vector<T> byHand(const std::shared_ptr<IEnumerable<T>>& query)
+        {
+            std::vector<T> v;
+            foreach<T>(query, [&v](T& item) {
+                v.push_back(item);
+            });
+            return v;
+        }
+
+        template <typename F>
+        static void measure(const char* name, const char* how, F f)
+        {
+            const int queries = 5;
+            long long result = 0;
+            long long allocations = AllocationCounter::count();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += (long long)f();
+            }
+            double elapsed = sw.elapsedNs();
+            allocations = AllocationCounter::count() - allocations;
+
+            char label[100];
+            sprintf(label, "%s, %s (%lld allocations)", name, how, allocations / queries);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+    };
+}
@@ -0,0 +1,116 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <string>
+
+namespace Benchmark
+{
+    // Operators on elements that are expensive to copy: 100K strings of 48
+    // characters (too long for the small string buffer) and records that
+    // own a vector of 16 doubles, consumed with foreach and with MoveNext.
+    class MoveBenchmark
+    {
+        struct Record
+        {
+            Record() {}
+            Record(int i) : data(16, (double)i) {}
+
+            std::vector<double> data;
+        };
+
+    public:
+        static void run()
+        {
+            fprintf(stdout, "heavy elements\n");
+
+            const int count = 100000;
+            std::vector<std::string> strings(count);
+            std::vector<Record> records(count);
+            for (int i = 0; i < count; i++) {
+                char buffer[16];
+                sprintf(buffer, "%08d", i % (count / 2));
+                strings[i] = std::string(40, '*') + buffer;
+                records[i] = Record(i);
+            }
+            std::shared_ptr<IEnumerable<std::string>> s(new VectorOf<std::string>(strings));
+            std::shared_ptr<IEnumerable<Record>> r(new VectorOf<Record>(records));
+
+            measure("strings, Reverse", count, s->Reverse());
+            measure("strings, Distinct", count, s->Distinct());
+            measure("strings, Select to a new string", count, s->Select<std::string>([](std::string& x) {
+                return x + "!";
+            }));
+            measure("strings, yielded with std::move", count, yielded(count));
+            measure("records, Reverse", count, r->Reverse());
+            measure("records, Where on a fiber", count, fiberWhere(r));
+        }
+
+    private:
+        static std::shared_ptr<IEnumerable<std::string>> yielded(int count)
+        {
+            auto fn = [count](IteratorBlock<std::string>* it) {
+                for (int i = 0; i < count; i++) {
+                    std::string s(48, 'a' + i % 26);
+                    it->yieldReturn(std::move(s));
+                }
+            };
+            return std::shared_ptr<IEnumerable<std::string>>(new _IteratorBlock<std::string>(fn, Fiber::SmallStackSize));
+        }
+
+        static std::shared_ptr<IEnumerable<Record>> fiberWhere(std::shared_ptr<IEnumerable<Record>> source)
+        {
+            auto fn = [source](IteratorBlock<Record>* it) {
+                foreach<Record>(source, [it](Record& record) {
+                    if (record.data[0] >= 0) {
+                        it->yieldReturn(record);
+                    }
+                });
+            };
+            return std::shared_ptr<IEnumerable<Record>>(new _IteratorBlock<Record>(fn, Fiber::SmallStackSize));
+        }
+
+        static size_t size(const std::string& s) {
+            return s.size();
+        }
+        static size_t size(const Record& r) {
+            return r.data.size();
+        }
+
+        template <typename T>
+        static void measure(const char* name, int count, std::shared_ptr<IEnumerable<T>> query)
+        {
+            char label[80];
+            size_t total = 0;
+
+            Stopwatch sw;
+            foreach<T>(query, [&total](T& x) {
+                total += size(x);
+            });
+            sprintf(label, "%s, foreach", name);
+            report(label, sw.elapsedNs(), count);
+
+            sw.restart();
+            auto e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total += size(e->get_Current());
+            }
+            sprintf(label, "%s, MoveNext", name);
+            report(label, sw.elapsedNs(), count);
+            consume(total);
+        }
+    };
+}
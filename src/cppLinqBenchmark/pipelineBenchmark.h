@@ -0,0 +1,97 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+#include "../cppLinq/pipeline.h"
+
+namespace Benchmark
+{
+    // Where, Select and Sum over a vector of 10M ints: a hand-written loop,
+    // the value-typed pipeline (pipeline.h), the same pipeline used as an
+    // IEnumerable, and the Where and Select state machines of IEnumerable,
+    // consumed with foreach and with MoveNext. And the heap allocations made
+    // by each query.
+    class PipelineBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "value-typed pipelines\n");
+
+            const int count = 10000000;
+            std::vector<int> v(count);
+            for (int i = 0; i < count; i++) {
+                v[i] = i % 1000;
+            }
+            std::shared_ptr<IEnumerable<int>> vector(new VectorEnumerable(v));
+
+            measure("loop", count, [&v]() {
+                int total = 0;
+                for (size_t i = 0; i < v.size(); i++) {
+                    if (v[i] % 3 != 0) {
+                        total += v[i] * 2;
+                    }
+                }
+                return total;
+            });
+            measure("from | where | select | sum", count, [&v]() {
+                return from(v)
+                    | where([](int x) { return x % 3 != 0; })
+                    | select([](int x) { return x * 2; })
+                    | sum();
+            });
+            measure("pipeline as IEnumerable, Sum", count, [&v]() {
+                std::shared_ptr<IEnumerable<int>> query = from(v)
+                    | where([](int x) { return x % 3 != 0; })
+                    | select([](int x) { return x * 2; });
+                return query->Sum();
+            });
+            measure("Where->Select->Sum, foreach", count, [vector]() {
+                return vector
+                    ->Where([](int x) { return x % 3 != 0; })
+                    ->Select<int>([](int x) { return x * 2; })
+                    ->Sum();
+            });
+            measure("Where->Select->Sum, MoveNext", count, [vector]() {
+                auto e = vector
+                    ->Where([](int x) { return x % 3 != 0; })
+                    ->Select<int>([](int x) { return x * 2; })
+                    ->GetEnumerator();
+                int total = 0;
+                while (e->MoveNext()) {
+                    total += e->get_Current();
+                }
+                return total;
+            });
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, int count, F f)
+        {
+            long long allocations = AllocationCounter::count();
+            Stopwatch sw;
+            int result = f();
+            double elapsed = sw.elapsedNs();
+            allocations = AllocationCounter::count() - allocations;
+
+            char label[64];
+            sprintf(label, "%s (%lld allocations)", name, allocations);
+            report(label, elapsed, count);
+            consume(result);
+        }
+    };
+}
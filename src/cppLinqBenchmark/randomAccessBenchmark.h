@@ -0,0 +1,69 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Count, ElementAt, Last, Skip, Reverse and SequenceEqual over a vector
+    // of 1M ints, enumerated and with random access (IRandomAccess).
+    class RandomAccessBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "random access (ns/query)\n");
+
+            const int count = 1000000;
+            std::vector<int> v(count);
+            std::vector<int> w(count);
+            for (int i = 0; i < count; i++) {
+                v[i] = w[i] = i;
+            }
+
+            for (int pass = 0; pass < 2; pass++) {
+                bool randomAccess = (1 == pass);
+                std::shared_ptr<IEnumerable<int>> lhs(new VectorOf<int>(v, randomAccess));
+                std::shared_ptr<IEnumerable<int>> rhs(new VectorOf<int>(w, randomAccess));
+                const char* suffix = randomAccess ? "random access" : "enumerated";
+
+                measure("Count", suffix, [lhs]() {
+                    return (long long)lhs->Count();
+                });
+                measure("ElementAt(n / 2)", suffix, [lhs, count]() {
+                    return (long long)lhs->ElementAt(count / 2);
+                });
+                measure("Last", suffix, [lhs]() {
+                    return (long long)lhs->Last();
+                });
+                measure("Skip(n - 10)->Sum", suffix, [lhs, count]() {
+                    return (long long)lhs->Skip(count - 10)->Sum();
+                });
+                measure("Reverse->Take(10)->Sum", suffix, [lhs]() {
+                    return (long long)lhs->Reverse()->Take(10)->Sum();
+                });
+                measure("Reverse->Sum", suffix, [lhs]() {
+                    return (long long)lhs->Reverse()->Sum();
+                });
+                measure("SequenceEqual", suffix, [lhs, rhs]() {
+                    return (long long)lhs->SequenceEqual(rhs);
+                });
+            }
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, const char* suffix, F f)
+        {
+            const int queries = 5;
+            long long result = 0;
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += f();
+            }
+            char label[80];
+            sprintf(label, "%s, %s", name, suffix);
+            report(label, sw.elapsedNs(), queries);
+            consume(result);
+        }
+    };
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <string>
+
+namespace Benchmark
+{
+    // Reverse, which buffers its source, over a projection of 1M ints and
+    // of 100K strings: without a size hint the buffer is a deque that grows
+    // a chunk at a time, with one (the source is random-access, and the
+    // projection keeps its count) a vector reserved up front. And the heap
+    // allocations made by each query.
+    class SizeHintBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "size hints (ns/query)\n");
+
+            std::vector<int> ints(1000000);
+            for (size_t i = 0; i < ints.size(); i++) {
+                ints[i] = (int)i;
+            }
+            std::vector<std::string> strings(100000);
+            for (size_t i = 0; i < strings.size(); i++) {
+                strings[i] = "element #" + std::to_string(i);
+            }
+
+            for (int pass = 0; pass < 2; pass++) {
+                bool sized = (1 == pass);
+                std::shared_ptr<IEnumerable<int>> intSource(new VectorOf<int>(ints, sized));
+                std::shared_ptr<IEnumerable<std::string>> stringSource(new VectorOf<std::string>(strings, sized));
+                const char* suffix = sized ? "exact hint" : "no hint";
+
+                measure("ints, Select->Reverse->Sum", suffix, [intSource]() {
+                    return (long long)intSource
+                        ->Select<int>([](int x) { return x; })
+                        ->Reverse()
+                        ->Sum();
+                });
+                measure("strings, Select->Reverse->Count", suffix, [stringSource]() {
+                    return (long long)stringSource
+                        ->Select<std::string>([](const std::string& s) { return s; })
+                        ->Reverse()
+                        ->Count();
+                });
+            }
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, const char* suffix, F f)
+        {
+            const int queries = 5;
+            long long result = 0;
+            long long allocations = AllocationCounter::count();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += f();
+            }
+            double elapsed = sw.elapsedNs();
+            allocations = AllocationCounter::count() - allocations;
+
+            char label[100];
+            sprintf(label, "%s, %s (%lld allocations)", name, suffix, allocations / queries);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+    };
+}
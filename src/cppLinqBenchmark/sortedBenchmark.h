@@ -0,0 +1,94 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <string>
+
+namespace Benchmark
+{
+    // Distinct, Union, Except and Intersect over 1M sorted ints and 200K
+    // sorted strings, with about one distinct element in four, in a hash set
+    // and, once the inputs are marked with AsSorted, by merging them: one
+    // pass, and no memory but a copy of the last element.
+    class SortedBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "sorted set operators (ns/query)\n");
+
+            std::vector<int> ints(1000000);
+            std::vector<int> evens(ints.size() / 4);
+            for (size_t i = 0; i < ints.size(); i++) {
+                ints[i] = (int)(i / 4);
+            }
+            for (size_t i = 0; i < evens.size(); i++) {
+                evens[i] = (int)(i * 2);
+            }
+            std::vector<std::string> strings(200000);
+            for (size_t i = 0; i < strings.size(); i++) {
+                char s[32];
+                sprintf(s, "customer-%08d", (int)(i / 4));
+                strings[i] = s;
+            }
+
+            std::shared_ptr<IEnumerable<int>> intSource(new VectorOf<int>(ints, true));
+            std::shared_ptr<IEnumerable<int>> evenSource(new VectorOf<int>(evens, true));
+            std::shared_ptr<IEnumerable<std::string>> stringSource(new VectorOf<std::string>(strings, true));
+            std::shared_ptr<IEnumerable<int>> sortedInts = intSource->AsSorted();
+            std::shared_ptr<IEnumerable<int>> sortedEvens = evenSource->AsSorted();
+            std::shared_ptr<IEnumerable<std::string>> sortedStrings = stringSource->AsSorted();
+
+            measure("ints, Distinct", "hashed", [intSource]() {
+                return intSource->Distinct()->Count();
+            });
+            measure("ints, Distinct", "merged", [sortedInts]() {
+                return sortedInts->Distinct()->Count();
+            });
+            measure("strings, Distinct", "hashed", [stringSource]() {
+                return stringSource->Distinct()->Count();
+            });
+            measure("strings, Distinct", "merged", [sortedStrings]() {
+                return sortedStrings->Distinct()->Count();
+            });
+
+            measure("ints, Union", "hashed", [intSource, evenSource]() {
+                return intSource->Union(evenSource)->Count();
+            });
+            measure("ints, Union", "merged", [sortedInts, sortedEvens]() {
+                return sortedInts->Union(sortedEvens)->Count();
+            });
+            measure("ints, Except", "hashed", [intSource, evenSource]() {
+                return intSource->Except(evenSource)->Count();
+            });
+            measure("ints, Except", "merged", [sortedInts, sortedEvens]() {
+                return sortedInts->Except(sortedEvens)->Count();
+            });
+            measure("ints, Intersect", "hashed", [intSource, evenSource]() {
+                return intSource->Intersect(evenSource)->Count();
+            });
+            measure("ints, Intersect", "merged", [sortedInts, sortedEvens]() {
+                return sortedInts->Intersect(sortedEvens)->Count();
+            });
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, const char* how, F f)
+        {
+            const int queries = 3;
+            long long result = 0;
+            long long bytes = AllocationCounter::bytes();
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += f();
+            }
+            double elapsed = sw.elapsedNs();
+            bytes = AllocationCounter::bytes() - bytes;
+
+            char label[100];
+            sprintf(label, "%s, %s (%lld KB allocated)", name, how, bytes / queries / 1024);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+    };
+}
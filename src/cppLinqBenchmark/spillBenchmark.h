@@ -0,0 +1,97 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <string>
+
+namespace Benchmark
+{
+    // Distinct and Except over 2M ints with 500K distinct ones, and Distinct
+    // over 500K strings with 100K distinct ones, without a budget and within
+    // budgets that fit the set (a FlatHashSet of 1M slots of 5 bytes, for
+    // the ints) or only a fraction of it: what spilling to temporary files
+    // costs, and how much is written.
+    class SpillBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "spilling set operators (ns/query)\n");
+
+            std::vector<int> ints(2000000);
+            for (size_t i = 0; i < ints.size(); i++) {
+                ints[i] = (int)((i * 7919) % 500000);
+            }
+            std::vector<std::string> strings(500000);
+            for (size_t i = 0; i < strings.size(); i++) {
+                strings[i] = "a string too long for the small buffer, #" + std::to_string((i * 7919) % 100000);
+            }
+            std::shared_ptr<IEnumerable<int>> intSource(new VectorOf<int>(ints, true));
+            std::shared_ptr<IEnumerable<int>> evens = IEnumerable<int>::Range(0, 250000)
+                ->Select<int>([](int x) { return x * 2; });
+            std::shared_ptr<IEnumerable<std::string>> stringSource(new VectorOf<std::string>(strings, true));
+
+            measure("ints, Distinct", "no budget", [intSource]() {
+                return intSource->Distinct()->Count();
+            });
+            const size_t budgets[] = { 8 << 20, 1 << 20, 256 << 10 };
+            for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+                std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(budgets[i]);
+                measure("ints, Distinct", budget, [intSource, budget]() {
+                    return intSource->Distinct(budget)->Count();
+                });
+            }
+
+            measure("ints, Except", "no budget", [intSource, evens]() {
+                return intSource->Except(evens)->Count();
+            });
+            for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+                std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(budgets[i]);
+                measure("ints, Except", budget, [intSource, evens, budget]() {
+                    return intSource->Except(evens, budget)->Count();
+                });
+            }
+
+            measure("strings, Distinct", "no budget", [stringSource]() {
+                return stringSource->Distinct()->Count();
+            });
+            for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+                std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(budgets[i]);
+                measure("strings, Distinct", budget, [stringSource, budget]() {
+                    return stringSource->Distinct(budget)->Count();
+                });
+            }
+        }
+
+    private:
+        template <typename F>
+        static void measure(const char* name, const std::shared_ptr<MemoryBudget>& budget, F f)
+        {
+            char how[100];
+            sprintf(how, "budget %d KB", (int)(budget->bytes() / 1024));
+            measure(name, how, f);
+
+            // (per query)
+            MemoryBudget::Statistics statistics = budget->statistics();
+            fprintf(stdout, "    spilled %lld KB in %lld partitions\n",
+                statistics.bytes / queries / 1024, statistics.partitions / queries);
+        }
+
+        template <typename F>
+        static void measure(const char* name, const char* how, F f)
+        {
+            long long result = 0;
+            Stopwatch sw;
+            for (int i = 0; i < queries; i++) {
+                result += f();
+            }
+            double elapsed = sw.elapsedNs();
+
+            char label[100];
+            sprintf(label, "%s, %s", name, how);
+            report(label, elapsed, queries);
+            consume(result);
+        }
+
+        enum { queries = 3 };
+    };
+}
@@ -0,0 +1,76 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Fiber blocks (_IteratorBlock) against state machines (_StateMachineBlock)
+    // on pipelines of one to five stages: a range followed by Where, Select,
+    // TakeWhile and Skip.
+    class StateMachineBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "state machines\n");
+
+            const int count = 1000000;
+            char name[64];
+            for (int stages = 1; stages <= 5; stages++) {
+                sprintf(name, "%d stage(s), fibers", stages);
+                pipeline(name, query(fiberRange(0, count), stages), count);
+                sprintf(name, "%d stage(s), state machines", stages);
+                pipeline(name, query(IEnumerable<int>::Range(0, count), stages), count);
+            }
+        }
+
+    private:
+        // All the stages let every element through, so that each pipeline
+        // moves the same number of items.
+        template <typename T>
+        static std::shared_ptr<IEnumerable<T>> query(std::shared_ptr<IEnumerable<T>> source, int stages)
+        {
+            std::shared_ptr<IEnumerable<T>> result = source;
+            if (stages > 1) {
+                result = result->Where([](const T& x) { return x >= 0; });
+            }
+            if (stages > 2) {
+                result = result->template Select<T>([](const T& x) { return T(x + 1); });
+            }
+            if (stages > 3) {
+                result = result->TakeWhile([](const T& x) { return x > 0; });
+            }
+            if (stages > 4) {
+                result = result->Skip(0);
+            }
+            return result;
+        }
+
+        template <typename T>
+        static void pipeline(const char* name, std::shared_ptr<IEnumerable<T>> query, int count)
+        {
+            Stopwatch sw;
+            long long total = 0;
+            std::shared_ptr<IEnumerator<T>> e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total += e->get_Current();
+            }
+            report(name, sw.elapsedNs(), count);
+            consume(total);
+        }
+    };
+}
@@ -0,0 +1,78 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "benchmarkUtils.h"
+
+namespace Benchmark
+{
+    // Cost of First() on pipelines of one to eight stages: a fiber block
+    // followed by Select state machines, with the block unwound when the
+    // query is dropped or just abandoned (Fiber::setAbandonable), and the
+    // same stages on FiberInt, fused on the fiber of the last one.
+    class TeardownBenchmark
+    {
+    public:
+        static void run()
+        {
+            fprintf(stdout, "teardown of abandoned blocks (ns/query)\n");
+
+            const int queries = 20000;
+            char name[64];
+            for (int stages = 1; stages <= 8; stages++) {
+                sprintf(name, "%d stage(s), source unwound", stages);
+                first(name, pipeline(range(false), stages), queries);
+                sprintf(name, "%d stage(s), source abandoned", stages);
+                first(name, pipeline(range(true), stages), queries);
+                sprintf(name, "%d stage(s), fused fibers", stages);
+                first(name, pipeline(fiberRange(0, 1000), stages), queries);
+            }
+        }
+
+    private:
+        static std::shared_ptr<IEnumerable<int>> range(bool abandonable)
+        {
+            auto fn = [abandonable](IteratorBlock<int>* it) {
+                it->setAbandonable(abandonable);
+                for (int i = 0; i < 1000; i++) {
+                    it->yieldReturn(i);
+                }
+            };
+            return std::shared_ptr<IEnumerable<int>>(new _IteratorBlock<int>(fn, Fiber::SmallStackSize));
+        }
+
+        template <typename T>
+        static std::shared_ptr<IEnumerable<T>> pipeline(std::shared_ptr<IEnumerable<T>> source, int stages)
+        {
+            std::shared_ptr<IEnumerable<T>> result = source;
+            for (int stage = 1; stage < stages; stage++) {
+                result = result->template Select<T>([](const T& x) { return T(x + 1); });
+            }
+            return result;
+        }
+
+        template <typename T>
+        static void first(const char* name, std::shared_ptr<IEnumerable<T>> query, int queries)
+        {
+            Stopwatch sw;
+            long long total = 0;
+            for (int i = 0; i < queries; i++) {
+                total += query->First();
+            }
+            report(name, sw.elapsedNs(), queries);
+            consume(total);
+        }
+    };
+}
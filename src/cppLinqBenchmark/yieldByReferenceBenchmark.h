@@ -0,0 +1,122 @@
+#pragma once
+
+#include "benchmarkUtils.h"
+#include <string>
+
+namespace Benchmark
+{
+    // An element that owns 4KB of doubles.
+    struct BigRecord
+    {
+        BigRecord() {}
+        BigRecord(int i) : data(512, (double)i) {}
+
+        std::vector<double> data;
+    };
+}
+
+template <>
+struct YieldByReference<Benchmark::BigRecord>
+{
+    static const bool value = true;
+};
+
+namespace Benchmark
+{
+    // A pass-through iterator block (a Where with no predicate) over 100K
+    // elements pulled with MoveNext, yielding each one with yieldReturn,
+    // which copies it into the batch, or with yieldReturnRef, which
+    // publishes its address and switches to the consumer once per element
+    // in an unbatched block, or in any block for BigRecord (see
+    // YieldByReference). For strings of 48 characters, records that own a
+    // vector of 16 doubles, BigRecords and ints.
+    class YieldByReferenceBenchmark
+    {
+        struct Record
+        {
+            Record() {}
+            Record(int i) : data(16, (double)i) {}
+
+            std::vector<double> data;
+        };
+
+    public:
+        static void run()
+        {
+            fprintf(stdout, "yield by reference\n");
+
+            const int count = 100000;
+            std::vector<std::string> strings(count);
+            std::vector<Record> records(count);
+            std::vector<BigRecord> bigRecords(count / 10);
+            std::vector<int> ints(count);
+            for (int i = 0; i < count; i++) {
+                strings[i] = std::string(48, 'a' + i % 26);
+                records[i] = Record(i);
+                ints[i] = i;
+            }
+            for (int i = 0; i < count / 10; i++) {
+                bigRecords[i] = BigRecord(i);
+            }
+            std::shared_ptr<IEnumerable<std::string>> s(new VectorOf<std::string>(strings));
+            std::shared_ptr<IEnumerable<Record>> r(new VectorOf<Record>(records));
+            std::shared_ptr<IEnumerable<BigRecord>> b(new VectorOf<BigRecord>(bigRecords));
+            std::shared_ptr<IEnumerable<int>> n(new VectorOf<int>(ints));
+
+            measure("strings, copied into the batch", count, passThrough(s, true));
+            measure("strings, by reference (unbatched)", count, passThrough(s, false, IteratorBlock<std::string>::Unbatched));
+            measure("records, copied into the batch", count, passThrough(r, true));
+            measure("records, by reference (unbatched)", count, passThrough(r, false, IteratorBlock<Record>::Unbatched));
+            measure("4KB records, copied into the batch", count / 10, passThrough(b, true));
+            measure("4KB records, by reference", count / 10, passThrough(b, false));
+            measure("ints, copied into the batch", count, passThrough(n, true));
+            measure("ints, by reference (unbatched)", count, passThrough(n, false, IteratorBlock<int>::Unbatched));
+        }
+
+    private:
+        template <typename T>
+        static std::shared_ptr<IEnumerable<T>> passThrough(std::shared_ptr<IEnumerable<T>> source, bool copy,
+            size_t batchSize = IteratorBlock<T>::DefaultBatchSize)
+        {
+            auto fn = [source, copy](IteratorBlock<T>* it) {
+                std::shared_ptr<IEnumerator<T>> e = source->GetEnumerator();
+                while (e->MoveNext()) {
+                    if (copy) {
+                        it->yieldReturn(const_cast<const T&>(e->get_Current()));
+                    }
+                    else {
+                        it->yieldReturnRef(e->get_Current());
+                    }
+                }
+            };
+            return std::shared_ptr<IEnumerable<T>>(new _IteratorBlock<T>(fn, Fiber::SmallStackSize, nullptr, batchSize));
+        }
+
+        static size_t size(const std::string& s) {
+            return s.size();
+        }
+        static size_t size(const Record& r) {
+            return r.data.size();
+        }
+        static size_t size(const BigRecord& r) {
+            return r.data.size();
+        }
+        static size_t size(int x) {
+            return (size_t)x;
+        }
+
+        // (pushed with foreach, the block would run inline, with no batch)
+        template <typename T>
+        static void measure(const char* name, int count, std::shared_ptr<IEnumerable<T>> query)
+        {
+            size_t total = 0;
+            Stopwatch sw;
+            auto e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total += size(e->get_Current());
+            }
+            report(name, sw.elapsedNs(), count);
+            consume(total);
+        }
+    };
+}
@@ -20,27 +20,50 @@
 #include "../cpplinqunittest/averageTest.cpp"
 #include "../cpplinqunittest/concatTest.cpp"
 #include "../cpplinqunittest/containsTest.cpp"
+#include "../cpplinqunittest/coroutineBlockTest.cpp"
 #include "../cpplinqunittest/countTest.cpp"
 #include "../cpplinqunittest/distinctTest.cpp"
 #include "../cpplinqunittest/elementAtTest.cpp"
+#include "../cpplinqunittest/elementCopyTest.cpp"
 #include "../cpplinqunittest/emptyTest.cpp"
 #include "../cpplinqunittest/exceptTest.cpp"
+#include "../cpplinqunittest/fiberStackPoolTest.cpp"
+#include "../cpplinqunittest/fiberTeardownTest.cpp"
 #include "../cpplinqunittest/firstTest.cpp"
+#include "../cpplinqunittest/functorStorageTest.cpp"
+#include "../cpplinqunittest/hashSetTest.cpp"
+#include "../cpplinqunittest/hyperLogLogTest.cpp"
+#include "../cpplinqunittest/intersectTest.cpp"
 #include "../cpplinqunittest/lastTest.cpp"
 #include "../cpplinqunittest/longCountTest.cpp"
+#include "../cpplinqunittest/materializeTest.cpp"
 #include "../cpplinqunittest/maxTest.cpp"
 #include "../cpplinqunittest/minTest.cpp"
+#include "../cpplinqunittest/moveNextBatchTest.cpp"
+#include "../cpplinqunittest/pipelineTest.cpp"
+#include "../cpplinqunittest/queryArenaTest.cpp"
+#include "../cpplinqunittest/randomAccessTest.cpp"
 #include "../cpplinqunittest/rangeTest.cpp"
 #include "../cpplinqunittest/repeatTest.cpp"
 #include "../cpplinqunittest/reverseTest.cpp"
 #include "../cpplinqunittest/selectManyTest.cpp"
 #include "../cpplinqunittest/selectTest.cpp"
+#include "../cpplinqunittest/sharedSourceTest.cpp"
 #include "../cpplinqunittest/singleTest.cpp"
+#include "../cpplinqunittest/sizeHintTest.cpp"
 #include "../cpplinqunittest/skipTest.cpp"
+#include "../cpplinqunittest/sortedTest.cpp"
+#include "../cpplinqunittest/spillTest.cpp"
+#include "../cpplinqunittest/stageFusionTest.cpp"
+#include "../cpplinqunittest/stateMachineTest.cpp"
 #include "../cpplinqunittest/sumTest.cpp"
 #include "../cpplinqunittest/takeTest.cpp"
+#include "../cpplinqunittest/threadMigrationTest.cpp"
 #include "../cpplinqunittest/unionTest.cpp"
 #include "../cpplinqunittest/whereTest.cpp"
+#include "../cpplinqunittest/yieldBatchTest.cpp"
+#include "../cpplinqunittest/yieldByReferenceTest.cpp"
+#include "../cpplinqunittest/yieldFromTest.cpp"
 using namespace UnitTest;
 
 void test()
@@ -51,33 +74,58 @@ void test()
     AverageTest::test();
     ConcatTest::test();
     ContainsTest::test();
+#ifdef CPPLINQ_COROUTINES
+    CoroutineBlockTest::test();
+#endif
     CountTest::test();
     DistinctTest::test();
     ElementAtTest::test();
     ElementAtOrDefaultTest::test();
+    ElementCopyTest::test();
     EmptyTest::test();
     ExceptTest::test();
+    FiberStackPoolTest::test();
+    FiberTeardownTest::test();
     FirstTest::test();
     FirstOrDefaultTest::test();
+    FunctorStorageTest::test();
+    HashSetTest::test();
+    HyperLogLogTest::test();
+    IntersectTest::test();
     LastTest::test();
     LastOrDefaultTest::test();
     LongCountTest::test();
+    MaterializeTest::test();
     MaxTest::test();
     MinTest::test();
+    MoveNextBatchTest::test();
+    PipelineTest::test();
+    QueryArenaTest::test();
+    RandomAccessTest::test();
     RangeTest::test();
     RepeatTest::test();
     ReverseTest::test();
     SelectTest::test();
     SelectManyTest::test();
+    SharedSourceTest::test();
     SingleTest::test();
     SingleOrDefaultTest::test();
+    SizeHintTest::test();
     SkipTest::test();
     SkiWhileTest::test();
+    SortedTest::test();
+    SpillTest::test();
+    StageFusionTest::test();
+    StateMachineTest::test();
     SumTest::test();
     TakeTest::test();
     TakeWhileTest::test();
+    ThreadMigrationTest::test();
     UnionTest::test();
     WhereTest::test();
+    YieldBatchTest::test();
+    YieldByReferenceTest::test();
+    YieldFromTest::test();
 }
 
 int _tmain(int argc, _TCHAR* argv[])
@@ -0,0 +1,187 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+#ifdef CPPLINQ_COROUTINES
+
+namespace UnitTest
+{
+    // Element type used only by these tests: every deferred operator on a
+    // sequence of CoNumber runs as a coroutine.
+    struct CoNumber
+    {
+        CoNumber() : value(0) {}
+        CoNumber(int v) : value(v) {}
+
+        bool operator==(const CoNumber& rhs) const {
+            return value == rhs.value;
+        }
+        bool operator<(const CoNumber& rhs) const {
+            return value < rhs.value;
+        }
+
+        int value;
+    };
+}
+
+template <LinqOperator op>
+struct UseCoroutineBlock<op, UnitTest::CoNumber>
+{
+    static const bool value = true;
+};
+
+namespace UnitTest
+{
+    TEST_CLASS(CoroutineBlockTest)
+    {
+    public:
+        static void test()
+        {
+            fprintf(stdout, "coroutineBlock\n");
+
+            CoroutineBlockTest t;
+            t.CoroutineBlock_OperatorsUseCoroutines();
+            t.CoroutineBlock_ExecutionIsDeferred();
+            t.CoroutineBlock_Pipeline();
+            t.CoroutineBlock_SetOperators();
+            t.CoroutineBlock_SelectMany();
+            t.CoroutineBlock_EnumerateTwice();
+            t.CoroutineBlock_ExceptionsArePropagated();
+            t.CoroutineBlock_AbandonedEnumerator();
+        }
+
+        TEST_METHOD(CoroutineBlock_OperatorsUseCoroutines)
+        {
+            CoNumber v[] = { 1, 2, 3 };
+            std::shared_ptr<IEnumerable<CoNumber>> source(new Vector<CoNumber>(v, ARRAYSIZE(v)));
+
+            auto where = source->Where([](const CoNumber& x) { return x.value > 1; });
+            Assert::IsTrue(nullptr != dynamic_cast<_CoroutineBlock<CoNumber>*>(where.get()));
+
+#ifndef CPPLINQ_COROUTINE_BLOCKS
+            // the selection is per operator and element type: int does not use coroutines
+            auto range = IEnumerable<int>::Range(0, 3);
+            Assert::IsTrue(nullptr == dynamic_cast<_CoroutineBlock<int>*>(range.get()));
+#endif
+        }
+
+        TEST_METHOD(CoroutineBlock_ExecutionIsDeferred)
+        {
+            bool called = false;
+            CoNumber v[] = { 1, 2, 3 };
+            std::shared_ptr<IEnumerable<CoNumber>> source(new Vector<CoNumber>(v, ARRAYSIZE(v)));
+
+            auto result = source->Where([&called](const CoNumber& x) { called = true; return true; });
+            auto e = result->GetEnumerator();
+            Assert::IsFalse(called);
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(called);
+        }
+
+        TEST_METHOD(CoroutineBlock_Pipeline)
+        {
+            CoNumber v[] = { 5, 1, 4, 2, 8, 3, 7 };
+            std::shared_ptr<IEnumerable<CoNumber>> source(new Vector<CoNumber>(v, ARRAYSIZE(v)));
+
+            auto result = source->Skip(1)
+                ->Where([](const CoNumber& x) { return x.value < 8; })
+                ->Select<CoNumber>([](const CoNumber& x) { return CoNumber(x.value * 10); })
+                ->Take(4)
+                ->Reverse();
+
+            CoNumber exp[] = { 30, 20, 40, 10 };
+            Assert::IsTrue(result->SequenceEqual<CoNumber>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(CoroutineBlock_SetOperators)
+        {
+            CoNumber v0[] = { 1, 2, 2, 3, 1 };
+            std::shared_ptr<IEnumerable<CoNumber>> first(new Vector<CoNumber>(v0, ARRAYSIZE(v0)));
+            CoNumber v1[] = { 3, 4 };
+            std::shared_ptr<IEnumerable<CoNumber>> second(new Vector<CoNumber>(v1, ARRAYSIZE(v1)));
+
+            CoNumber distinct[] = { 1, 2, 3 };
+            Assert::IsTrue(first->Distinct()->SequenceEqual<CoNumber>(distinct, ARRAYSIZE(distinct)));
+
+            CoNumber unionExp[] = { 1, 2, 3, 4 };
+            Assert::IsTrue(first->Union(second)->SequenceEqual<CoNumber>(unionExp, ARRAYSIZE(unionExp)));
+
+            CoNumber except[] = { 1, 2 };
+            Assert::IsTrue(first->Except(second)->SequenceEqual<CoNumber>(except, ARRAYSIZE(except)));
+
+            CoNumber concat[] = { 1, 2, 2, 3, 1, 3, 4 };
+            Assert::IsTrue(first->Concat(second)->SequenceEqual<CoNumber>(concat, ARRAYSIZE(concat)));
+        }
+
+        TEST_METHOD(CoroutineBlock_SelectMany)
+        {
+            CoNumber v[] = { 1, 2, 3 };
+            std::shared_ptr<IEnumerable<CoNumber>> source(new Vector<CoNumber>(v, ARRAYSIZE(v)));
+
+            auto result = source->SelectMany<CoNumber>([](const CoNumber& x) {
+                return IEnumerable<CoNumber>::Repeat(x, x.value);
+            });
+
+            CoNumber exp[] = { 1, 2, 2, 3, 3, 3 };
+            Assert::IsTrue(result->SequenceEqual<CoNumber>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(CoroutineBlock_EnumerateTwice)
+        {
+            auto source = IEnumerable<CoNumber>::Repeat(CoNumber(7), 3);
+
+            Assert::AreEqual(3, source->Count());
+            Assert::AreEqual(3, source->Count());
+        }
+
+        TEST_METHOD(CoroutineBlock_ExceptionsArePropagated)
+        {
+            CoNumber v[] = { 1, 0 };
+            std::shared_ptr<IEnumerable<CoNumber>> source(new Vector<CoNumber>(v, ARRAYSIZE(v)));
+
+            auto result = source->Where([](const CoNumber& x) -> bool {
+                if (x.value == 0) {
+                    throw InvalidOperationException();
+                }
+                return true;
+            });
+            auto e = result->GetEnumerator();
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::ExpectException<InvalidOperationException&>([e]() {
+                e->MoveNext();
+            });
+        }
+
+        TEST_METHOD(CoroutineBlock_AbandonedEnumerator)
+        {
+            auto source = IEnumerable<CoNumber>::Repeat(CoNumber(1), 1000);
+            auto result = source->Where([](const CoNumber& x) { return true; });
+
+            // releasing the enumerator destroys the suspended coroutine frame
+            for (int i = 0; i < 100; i++) {
+                Assert::AreEqual(1, result->First().value);
+            }
+        }
+    };
+}
+
+#endif // CPPLINQ_COROUTINES
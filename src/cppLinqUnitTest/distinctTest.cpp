@@ -35,6 +35,8 @@ namespace UnitTest
             DistinctTest t;
             t.Distinct_DistinctStringsWithCaseInsensitiveComparer();
             t.Distinct_NoComparerSpecifiedUsesDefault();
+            t.Distinct_DistinctStringsWithCaseInsensitiveHasher();
+            t.Distinct_HashedElementsKeepTheirOrder();
         }
 
         TEST_METHOD(Distinct_NoComparerSpecifiedUsesDefault)
@@ -54,6 +56,42 @@ namespace UnitTest
             String exp[] = { "xyz", TestString1, "def" };
             Assert::IsTrue(source->Distinct(CompareIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
         }
+
+        TEST_METHOD(Distinct_DistinctStringsWithCaseInsensitiveHasher)
+        {
+            String v[] = { "xyz", TestString1, "XYZ", TestString2, "def", "TEST" };
+            std::shared_ptr<IEnumerable<String>> source(new Vector<String>(v, ARRAYSIZE(v)));
+
+            String exp[] = { "xyz", TestString1, "def" };
+            Assert::IsTrue(source->Distinct(HashIgnoreCase(), EqualIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(Distinct_HashedElementsKeepTheirOrder)
+        {
+            // first occurrences, in the order of the source, whatever the
+            // order of the slots of the hash set
+            std::vector<long long> keys;
+            for (long long i = 0; i < 20000; i++) {
+                keys.push_back(((i * 7919) % 1000) << 40);
+            }
+            std::shared_ptr<IEnumerable<long long>> source(new Vector<long long>(&keys[0], keys.size()));
+
+            std::vector<long long> result = source->Distinct()->ToVector();
+            Assert::IsTrue(1000 == result.size());
+            bool ordered = true;
+            for (size_t i = 0; i < result.size(); i++) {
+                ordered = ordered && (keys[i] == result[i]);
+            }
+            Assert::IsTrue(ordered);
+
+            std::vector<std::string> words;
+            for (int i = 0; i < 3000; i++) {
+                words.push_back("word #" + std::to_string(i % 700));
+            }
+            std::shared_ptr<IEnumerable<std::string>> text(new Vector<std::string>(&words[0], words.size()));
+            Assert::AreEqual(700, text->Distinct()->Count());
+            Assert::IsTrue("word #699" == text->Distinct()->Last());
+        }
     };
 
     // static
@@ -0,0 +1,159 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(ElementCopyTest)
+    {
+        static const int Count = 100;
+
+        // Count elements: 0..49, twice.
+        static std::shared_ptr<Vector<Counted>> source()
+        {
+            std::vector<Counted> elements;
+            for (int i = 0; i < Count; i++) {
+                elements.push_back(Counted(i % 50));
+            }
+            return std::make_shared<Vector<Counted>>(&elements[0], elements.size());
+        }
+
+        // The sum of the values, read both with foreach and with MoveNext;
+        // the copies are counted from here.
+        static int consume(std::shared_ptr<IEnumerable<Counted>> query)
+        {
+            Counted::reset();
+            int total = 0;
+            foreach<Counted>(query, [&total](Counted& c) {
+                total += c.value;
+            });
+            auto e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total -= e->get_Current().value;
+            }
+            Assert::AreEqual(0, total);
+
+            foreach<Counted>(query, [&total](Counted& c) {
+                total += c.value;
+            });
+            return total;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "elementCopy\n");
+
+            ElementCopyTest t;
+            t.ElementCopy_YieldReturnMovesRvalues();
+            t.ElementCopy_Where();
+            t.ElementCopy_Select();
+            t.ElementCopy_Reverse();
+            t.ElementCopy_Distinct();
+            t.ElementCopy_SelectMany();
+            t.ElementCopy_Concat();
+            t.ElementCopy_SkipTake();
+        }
+
+        TEST_METHOD(ElementCopy_YieldReturnMovesRvalues)
+        {
+            auto fn = [](IteratorBlock<Counted>* it) {
+                for (int i = 0; i < 10; i++) {
+                    if (i % 2 == 0) {
+                        it->yieldReturn(Counted(i));
+                    }
+                    else {
+                        Counted c(i);
+                        it->yieldReturn(std::move(c));
+                    }
+                }
+            };
+            std::shared_ptr<IEnumerable<Counted>> batched(new _IteratorBlock<Counted>(fn, Fiber::SmallStackSize));
+            std::shared_ptr<IEnumerable<Counted>> unbatched(new _IteratorBlock<Counted>(fn, Fiber::SmallStackSize,
+                nullptr, IteratorBlock<Counted>::Unbatched));
+
+            // MoveNext, then inline
+            Assert::AreEqual(45, consume(batched));
+            Assert::AreEqual(0, Counted::copies());
+            Assert::AreEqual(45, consume(unbatched));
+            Assert::AreEqual(0, Counted::copies());
+        }
+
+        TEST_METHOD(ElementCopy_Where)
+        {
+            auto query = source()->Where([](Counted& c) { return c.value % 2 == 0; });
+            Assert::AreEqual(2 * (0 + 48) * 25 / 2, consume(query));
+            // at most one per element
+            Assert::IsTrue(Counted::copies() <= 3 * Count / 2);
+        }
+
+        TEST_METHOD(ElementCopy_Select)
+        {
+            auto query = source()->Select<Counted>([](Counted& c) { return Counted(c.value * 2); });
+            Assert::AreEqual(2 * 2 * (0 + 49) * 50 / 2, consume(query));
+            // the projections are moved (a state machine copies its current
+            // element along with its prototype, once per enumerator)
+            Assert::IsTrue(Counted::copies() <= 1);
+        }
+
+        TEST_METHOD(ElementCopy_Reverse)
+        {
+            auto query = source()->Reverse();
+            Assert::AreEqual(2 * (0 + 49) * 50 / 2, consume(query));
+            // one per element, into the buffer
+            Assert::IsTrue(Counted::copies() <= 3 * Count);
+        }
+
+        TEST_METHOD(ElementCopy_Distinct)
+        {
+            auto query = source()->Distinct();
+            Assert::AreEqual((0 + 49) * 50 / 2, consume(query));
+            // one per distinct element into the set, one to yield it
+            Assert::IsTrue(Counted::copies() <= 3 * 2 * 50);
+        }
+
+        TEST_METHOD(ElementCopy_SelectMany)
+        {
+            auto query = source()->SelectMany<Counted>([](Counted& c) {
+                return IEnumerable<int>::Range(c.value, 2)->Select<Counted>([](int x) { return Counted(x); });
+            });
+            Assert::AreEqual(2 * 2 * (0 + 49) * 50 / 2 + Count, consume(query));
+            // at most one per element, yielded from the inner sequence
+            Assert::IsTrue(Counted::copies() <= 3 * 2 * Count);
+        }
+
+        TEST_METHOD(ElementCopy_Concat)
+        {
+            std::shared_ptr<IEnumerable<Counted>> lhs = source();
+            auto query = lhs->Concat(source());
+            Assert::AreEqual(4 * (0 + 49) * 50 / 2, consume(query));
+            Assert::IsTrue(Counted::copies() <= 3 * 2 * Count);
+        }
+
+        TEST_METHOD(ElementCopy_SkipTake)
+        {
+            auto query = std::shared_ptr<IEnumerable<Counted>>(source())->Skip(10)->Take(50);
+            Assert::AreEqual((10 + 49) * 40 / 2 + (0 + 9) * 10 / 2, consume(query));
+            // at most one per element and operator, plus the batch that Skip
+            // produces ahead of Take
+            Assert::IsTrue(Counted::copies() <= 3 * (2 * 50 + (int)IteratorBlock<Counted>::DefaultBatchSize));
+        }
+    };
+}
@@ -34,6 +34,7 @@ namespace UnitTest
             t.Except_NullSecondWithComparer();
             t.Except_NoComparerSpecified();
             t.Except_CaseInsensitiveComparerSpecified();
+            t.Except_CaseInsensitiveHasherSpecified();
             t.Except_NoSequencesUsedBeforeIteration();
             t.Except_SecondSequenceReadFullyOnFirstResultIteration();
             t.Except_FirstSequenceOnlyReadAsResultsAreRead();
@@ -98,6 +99,23 @@ namespace UnitTest
             Assert::IsTrue(first->Except(second, CompareIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
         }
 
+        TEST_METHOD(Except_CaseInsensitiveHasherSpecified)
+        {
+            String v0[] = { "A", "a", "b", "c", "b", "C" };
+            std::shared_ptr<IEnumerable<String>> first(new Vector<String>(v0, ARRAYSIZE(v0)));
+
+            String v1[] = {  "B", "a", "d", "a" };
+            std::shared_ptr<IEnumerable<String>> second(new Vector<String>(v1, ARRAYSIZE(v1)));
+
+            String exp[] = { "c" };
+            Assert::IsTrue(first->Except(second, HashIgnoreCase(), EqualIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
+
+            std::shared_ptr<IEnumerable<String>> nothing(nullptr);
+            Assert::ExpectException<ArgumentNullException&>([&first, &nothing]() {
+                first->Except(nothing, HashIgnoreCase(), EqualIgnoreCase());
+            });
+        }
+
         TEST_METHOD(Except_NoSequencesUsedBeforeIteration)
         {
             std::shared_ptr<IEnumerable<int>> first(new ThrowingEnumerable());
@@ -0,0 +1,208 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(FiberStackPoolTest)
+    {
+        // A chain of fiber blocks that pass 0..count-1 along, whatever engine
+        // the operators use. Each stage pulls from the previous one: with
+        // foreach the whole chain would run on the fiber of the last stage.
+        static std::shared_ptr<IEnumerable<int>> fiberChain(int count, int stages)
+        {
+            auto range = [count](IteratorBlock<int>* it) {
+                for (int i = 0; i < count; i++) {
+                    it->yieldReturn(i);
+                }
+            };
+            std::shared_ptr<IEnumerable<int>> result(new _IteratorBlock<int>(range));
+
+            for (int stage = 1; stage < stages; stage++) {
+                std::shared_ptr<IEnumerable<int>> source = result;
+                auto pass = [source](IteratorBlock<int>* it) {
+                    auto e = source->GetEnumerator();
+                    while (e->MoveNext()) {
+                        it->yieldReturn(e->get_Current());
+                    }
+                };
+                result.reset(new _IteratorBlock<int>(pass));
+            }
+            return result;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "fiberStackPool\n");
+
+            FiberStackPoolTest t;
+            t.FiberStackPool_ReleasedStacksAreReused();
+            t.FiberStackPool_SizeIsRoundedUpToSizeClass();
+            t.FiberStackPool_LargeStacksAreNotPooled();
+            t.FiberStackPool_HighWaterMark();
+            t.FiberStackPool_QueriesInALoopHitThePool();
+            t.FiberStackPool_Trim();
+            t.FiberStackPool_BlocksUseTheirStackSizeHint();
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+            t.FiberStackPool_PeakStackDepthIsRecorded();
+#endif
+        }
+
+        TEST_METHOD(FiberStackPool_ReleasedStacksAreReused)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+
+            FiberStack* stack = pool.acquire(64 * 1024);
+            void* base = stack->base;
+            pool.release(stack);
+
+            long long hits = pool.statistics().hits;
+            stack = pool.acquire(64 * 1024);
+            Assert::IsTrue(base == stack->base);
+            Assert::AreEqual(hits + 1, pool.statistics().hits);
+            pool.release(stack);
+        }
+
+        TEST_METHOD(FiberStackPool_SizeIsRoundedUpToSizeClass)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+
+            FiberStack* stack = pool.acquire(100 * 1024);
+            Assert::IsTrue(128 * 1024 == stack->size);
+            pool.release(stack);
+
+            stack = pool.acquire(1);
+            Assert::IsTrue(FiberStackPool::MinStackSize == stack->size);
+            pool.release(stack);
+        }
+
+        TEST_METHOD(FiberStackPool_LargeStacksAreNotPooled)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+
+            long long misses = pool.statistics().misses;
+            for (int i = 0; i < 2; i++) {
+                FiberStack* stack = pool.acquire(4 * 1024 * 1024);
+                Assert::IsTrue(4 * 1024 * 1024 == stack->size);
+                pool.release(stack);
+            }
+            Assert::AreEqual(misses + 2, pool.statistics().misses);
+        }
+
+        TEST_METHOD(FiberStackPool_HighWaterMark)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+            long long inUse = pool.statistics().inUse;
+
+            auto query = fiberChain(10, 3);
+            auto e = query->GetEnumerator();
+            e->MoveNext();
+
+            FiberStackPool::Statistics s = pool.statistics();
+            Assert::IsTrue(s.inUse >= inUse + 3);
+            Assert::IsTrue(s.highWater >= s.inUse);
+        }
+
+        TEST_METHOD(FiberStackPool_QueriesInALoopHitThePool)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+            auto query = [](){
+                return fiberChain(5, 3)->Count();
+            };
+
+            query();
+            FiberStackPool::Statistics before = pool.statistics();
+            for (int i = 0; i < 100; i++) {
+                Assert::AreEqual(5, query());
+            }
+            FiberStackPool::Statistics after = pool.statistics();
+
+            Assert::AreEqual(before.misses, after.misses);
+            Assert::IsTrue(after.hits > before.hits);
+            Assert::AreEqual(before.inUse, after.inUse);
+        }
+
+        TEST_METHOD(FiberStackPool_Trim)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+
+            fiberChain(5, 2)->Count();
+            pool.trim();
+            Assert::AreEqual(0LL, pool.statistics().cached);
+
+            long long misses = pool.statistics().misses;
+            fiberChain(5, 2)->Count();
+            Assert::IsTrue(pool.statistics().misses > misses);
+        }
+
+        TEST_METHOD(FiberStackPool_BlocksUseTheirStackSizeHint)
+        {
+#ifndef CPPLINQ_COROUTINE_BLOCKS
+            auto reverse = IEnumerable<int>::Range(0, 10)->Reverse();
+            Assert::IsTrue(Fiber::SmallStackSize == dynamic_cast<Fiber*>(reverse.get())->stackSize());
+
+            auto selectMany = reverse->SelectMany<int>([](int x) { return IEnumerable<int>::Repeat(x, 2); });
+            Assert::IsTrue(Fiber::DefaultStackSize == dynamic_cast<Fiber*>(selectMany.get())->stackSize());
+#endif
+
+            auto fn = [](IteratorBlock<int>* it) {
+                it->yieldReturn(1);
+            };
+            std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(fn, 32 * 1024));
+            Assert::IsTrue(32 * 1024 == dynamic_cast<Fiber*>(block.get())->stackSize());
+
+            // the enumerators cloned from a block keep its hint
+            block->GetEnumerator();
+            auto e = block->GetEnumerator();
+            Assert::IsTrue(block.get() != dynamic_cast<IEnumerable<int>*>(e.get()));
+            Assert::IsTrue(32 * 1024 == dynamic_cast<Fiber*>(e.get())->stackSize());
+        }
+
+#ifdef CPPLINQ_FIBER_STACK_PROFILE
+        TEST_METHOD(FiberStackPool_PeakStackDepthIsRecorded)
+        {
+            auto deep = [](IteratorBlock<int>* it) {
+                volatile char buffer[20000];
+                for (size_t i = 0; i < sizeof(buffer); i++) {
+                    buffer[i] = 1;
+                }
+                it->yieldReturn(buffer[0]);
+            };
+            {
+                std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(deep, 64 * 1024, "DeepBlock"));
+                Assert::AreEqual(1, block->First());
+                Assert::IsTrue(dynamic_cast<Fiber*>(block.get())->peakStackDepth() > 20000);
+            }
+
+            std::vector<Fiber::StackProfile> profile = Fiber::stackProfile();
+            bool found = false;
+            for (size_t i = 0; i < profile.size(); i++) {
+                if (0 == strcmp("DeepBlock", profile[i].name)) {
+                    found = true;
+                    Assert::IsTrue(profile[i].peakDepth > 20000);
+                    Assert::IsTrue(profile[i].peakDepth < 64 * 1024);
+                }
+            }
+            Assert::IsTrue(found);
+        }
+#endif
+    };
+}
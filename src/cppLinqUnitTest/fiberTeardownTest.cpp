@@ -0,0 +1,136 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(FiberTeardownTest)
+    {
+        // An unbatched block that yields 0..count-1, counts the elements
+        // produced so far and records whether it was unwound.
+        static std::shared_ptr<IEnumerable<int>> counter(int count, bool abandonable, int* produced, bool* unwound)
+        {
+            auto fn = [count, abandonable, produced, unwound](IteratorBlock<int>* it) {
+                it->setAbandonable(abandonable);
+                try {
+                    for (int i = 0; i < count; i++) {
+                        (*produced)++;
+                        it->yieldReturn(i);
+                    }
+                }
+                catch (...) {
+                    *unwound = true;
+                    throw;
+                }
+            };
+            return std::shared_ptr<IEnumerable<int>>(
+                new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, IteratorBlock<int>::Unbatched));
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "fiberTeardown\n");
+
+            FiberTeardownTest t;
+            t.FiberTeardown_SuspendedBlocksAreUnwound();
+            t.FiberTeardown_AbandonableBlocksAreNotUnwound();
+            t.FiberTeardown_AbandonedStacksAreReused();
+            t.FiberTeardown_ShortCircuitsOverAbandonableSources();
+        }
+
+        TEST_METHOD(FiberTeardown_SuspendedBlocksAreUnwound)
+        {
+            int produced = 0;
+            bool unwound = false;
+            auto e = counter(10, false, &produced, &unwound)->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            e = nullptr;
+            Assert::IsTrue(unwound);
+        }
+
+        TEST_METHOD(FiberTeardown_AbandonableBlocksAreNotUnwound)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+            long long inUse = pool.statistics().inUse;
+
+            int produced = 0;
+            bool unwound = false;
+            auto e = counter(10, true, &produced, &unwound)->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(inUse + 1, pool.statistics().inUse);
+            e = nullptr;
+
+            Assert::AreEqual(inUse, pool.statistics().inUse);
+            Assert::AreEqual(2, produced);
+#ifdef CPPLINQ_FIBER_WIN32
+            // (a Windows fiber must leave its body to be recycled)
+            Assert::IsTrue(unwound);
+#else
+            Assert::IsFalse(unwound);
+#endif
+        }
+
+        TEST_METHOD(FiberTeardown_AbandonedStacksAreReused)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+            int produced = 0;
+            bool unwound = false;
+            auto block = counter(100, true, &produced, &unwound);
+
+            for (int i = 0; i < 10; i++) {
+                auto e = block->GetEnumerator();
+                for (int j = 0; j <= i; j++) {
+                    Assert::IsTrue(e->MoveNext());
+                    Assert::AreEqual(j, e->get_Current());
+                }
+            }
+
+            FiberStackPool::Statistics before = pool.statistics();
+            int count = 0;
+            auto e = block->GetEnumerator();
+            while (e->MoveNext()) {
+                Assert::AreEqual(count, e->get_Current());
+                count++;
+            }
+            Assert::AreEqual(100, count);
+            Assert::AreEqual(before.misses, pool.statistics().misses);
+        }
+
+        TEST_METHOD(FiberTeardown_ShortCircuitsOverAbandonableSources)
+        {
+            int produced = 0;
+            bool unwound = false;
+            auto query = counter(100, true, &produced, &unwound)
+                ->Where([](int x) { return x > 2; })
+                ->Select<int>([](int x) { return x * 10; });
+
+            Assert::AreEqual(30, query->First());
+            Assert::AreEqual(100, query->ElementAt(7));
+            Assert::IsTrue(query->Any());
+            Assert::IsFalse(query->All([](int x) { return x < 50; }));
+#if !defined(CPPLINQ_FIBER_WIN32) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // (as blocks, Where and Select run the source inline on their fiber)
+            Assert::IsFalse(unwound);
+#endif
+        }
+    };
+}
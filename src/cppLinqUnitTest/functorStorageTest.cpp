@@ -0,0 +1,170 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(FunctorStorageTest)
+    {
+        // Too large to be stored in an iterator block.
+        struct Large
+        {
+            Large() {
+                memset(bytes, 0, sizeof(bytes));
+            }
+
+            char bytes[256];
+        };
+
+        // Allocations made from arena by f.
+        template <typename F>
+        static long long allocations(const std::shared_ptr<QueryArena>& arena, F f)
+        {
+            QueryArena::Scope scope(arena);
+            long long before = arena->statistics().allocations;
+            f();
+            return arena->statistics().allocations - before;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "functorStorage\n");
+
+            FunctorStorageTest t;
+            t.FunctorStorage_OneAllocationPerOperator();
+            t.FunctorStorage_LargeFunctorsAreAllocatedApart();
+            t.FunctorStorage_ClonesCopySmallFunctors();
+            t.FunctorStorage_InlineRunsDoNotCopyTheFunctor();
+            t.FunctorStorage_AnyAndAllStopAtTheFirstMatch();
+        }
+
+        TEST_METHOD(FunctorStorage_OneAllocationPerOperator)
+        {
+            std::shared_ptr<QueryArena> arena = QueryArena::create();
+            std::shared_ptr<IEnumerable<int>> query;
+
+            Assert::AreEqual(1LL, allocations(arena, [&query]() {
+                query = IEnumerable<int>::Range(0, 100);
+            }));
+            Assert::AreEqual(1LL, allocations(arena, [&query]() {
+                query = query->Where([](int x) { return x % 2 == 0; });
+            }));
+            Assert::AreEqual(1LL, allocations(arena, [&query]() {
+                query = query->Select<int>([](int x) { return x * 3; });
+            }));
+            Assert::AreEqual(1LL, allocations(arena, [&query]() {
+                query = query->Skip(10);
+            }));
+            Assert::AreEqual(1LL, allocations(arena, [&query]() {
+                query = query->Take(20);
+            }));
+            Assert::AreEqual(1LL, allocations(arena, [&query]() {
+                query = query->Concat(query);
+            }));
+            Assert::AreEqual(2 * 3 * (20 + 58) * 10, query->Sum());
+
+            // an iterator block and its functor
+            Assert::AreEqual(1LL, allocations(arena, [&query]() {
+                auto fn = [](IteratorBlock<int>* it) {
+                    it->yieldReturn(1);
+                };
+                query = _makeShared<_IteratorBlock<int>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Test");
+            }));
+            Assert::AreEqual(1, query->Sum());
+        }
+
+        TEST_METHOD(FunctorStorage_LargeFunctorsAreAllocatedApart)
+        {
+            std::shared_ptr<QueryArena> arena = QueryArena::create();
+            std::shared_ptr<IEnumerable<int>> query;
+
+            Assert::AreEqual(2LL, allocations(arena, [&query]() {
+                Large large;
+                auto fn = [large](IteratorBlock<int>* it) {
+                    it->yieldReturn(large.bytes[0] + 1);
+                };
+                query = _makeShared<_IteratorBlock<int>>(QueryArena::current(), fn, Fiber::SmallStackSize, "Test");
+            }));
+            Assert::AreEqual(1, query->Sum());
+            Assert::AreEqual(1, query->Sum());
+        }
+
+        TEST_METHOD(FunctorStorage_ClonesCopySmallFunctors)
+        {
+            Counted counted(1);
+            auto small = [counted](IteratorBlock<int>* it) {
+                it->yieldReturn(counted.value);
+            };
+            std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(small, Fiber::SmallStackSize));
+
+            // the first enumerator is the block itself, the next ones clones
+            Counted::reset();
+            auto e1 = block->GetEnumerator();
+            Assert::AreEqual(0, Counted::copies());
+            auto e2 = block->GetEnumerator();
+            Assert::AreEqual(1, Counted::copies());
+            Assert::IsTrue(e2->MoveNext());
+            Assert::AreEqual(1, e2->get_Current());
+
+            Large large;
+            auto big = [counted, large](IteratorBlock<int>* it) {
+                it->yieldReturn(counted.value + large.bytes[0]);
+            };
+            block = std::shared_ptr<IEnumerable<int>>(new _IteratorBlock<int>(big, Fiber::SmallStackSize));
+            Counted::reset();
+            e1 = block->GetEnumerator();
+            e2 = block->GetEnumerator();
+            Assert::AreEqual(0, Counted::copies());
+            Assert::IsTrue(e2->MoveNext());
+            Assert::AreEqual(1, e2->get_Current());
+        }
+
+        TEST_METHOD(FunctorStorage_InlineRunsDoNotCopyTheFunctor)
+        {
+            Counted counted(2);
+            auto fn = [counted](IteratorBlock<int>* it) {
+                for (int i = 0; i < 10; i++) {
+                    it->yieldReturn(counted.value * i);
+                }
+            };
+            std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(fn, Fiber::SmallStackSize));
+
+            Counted::reset();
+            int total = 0;
+            foreach<int>(block, [&total](int& x) {
+                total += x;
+            });
+            Assert::AreEqual(90, total);
+            Assert::AreEqual(90, block->Sum());
+            Assert::AreEqual(0, Counted::copies());
+        }
+
+        TEST_METHOD(FunctorStorage_AnyAndAllStopAtTheFirstMatch)
+        {
+            int calls = 0;
+            std::shared_ptr<IEnumerable<int>> source = IEnumerable<int>::Range(0, 100);
+            Assert::IsTrue(source->Any([&calls](int x) { calls++; return x == 10; }));
+            Assert::AreEqual(11, calls);
+
+            calls = 0;
+            Assert::IsFalse(source->All([&calls](int x) { calls++; return x < 20; }));
+            Assert::AreEqual(21, calls);
+
+            calls = 0;
+            Assert::IsTrue(source->Contains(5, [&calls](int lhs, int rhs) { calls++; return lhs == rhs; }));
+            Assert::AreEqual(6, calls);
+
+            // through an operator
+            calls = 0;
+            std::shared_ptr<IEnumerable<int>> block = source->Select<int>([](int x) { return x * 2; });
+            Assert::IsTrue(block->Any([&calls](int x) { calls++; return x == 20; }));
+            Assert::AreEqual(11, calls);
+            Assert::IsFalse(block->Any([](int x) { return x < 0; }));
+            Assert::IsTrue(block->All([](int x) { return x % 2 == 0; }));
+        }
+    };
+}
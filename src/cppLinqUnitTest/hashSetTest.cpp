@@ -0,0 +1,218 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(HashSetTest)
+    {
+        // An element with no default constructor, that counts its instances.
+        struct Live
+        {
+            explicit Live(int v) : value(v) {
+                count()++;
+            }
+            Live(const Live& rhs) : value(rhs.value) {
+                count()++;
+            }
+            Live(Live&& rhs) : value(rhs.value) {
+                count()++;
+            }
+            ~Live() {
+                count()--;
+            }
+
+            bool operator==(const Live& rhs) const {
+                return value == rhs.value;
+            }
+
+            static int& count() {
+                static int s_count = 0;
+                return s_count;
+            }
+
+            int value;
+
+        private:
+            Live& operator=(const Live&);
+        };
+
+        struct HashLive
+        {
+            size_t operator()(const Live& l) const {
+                return (size_t)l.value;
+            }
+        };
+
+        // Every element in the same slot.
+        struct Collide
+        {
+            size_t operator()(int) const {
+                return 42;
+            }
+        };
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "hashSet\n");
+
+            HashSetTest t;
+            t.HashSet_InsertAndContains();
+            t.HashSet_Grows();
+            t.HashSet_Reserve();
+            t.HashSet_Collisions();
+            t.HashSet_Erase();
+            t.HashSet_ElementsAreDestroyed();
+            t.HashSet_DefaultSet();
+        }
+
+        TEST_METHOD(HashSet_InsertAndContains)
+        {
+            FlatHashSet<std::string> set;
+            Assert::IsTrue(set.empty());
+            Assert::IsFalse(set.contains("a"));
+
+            std::pair<const std::string*, bool> result = set.insert("a");
+            Assert::IsTrue(result.second);
+            Assert::IsTrue("a" == *result.first);
+            Assert::IsTrue(set.insert("b").second);
+
+            result = set.insert(std::string("a"));
+            Assert::IsFalse(result.second);
+            Assert::IsTrue("a" == *result.first);
+            Assert::IsTrue(2 == set.size());
+            Assert::IsTrue(set.contains("a"));
+            Assert::IsTrue(set.contains("b"));
+            Assert::IsFalse(set.contains("c"));
+        }
+
+        TEST_METHOD(HashSet_Grows)
+        {
+            FlatHashSet<long long> set;
+            for (long long i = 0; i < 100000; i++) {
+                // keys that differ only in their high bits
+                Assert::IsTrue(set.insert(i << 32).second);
+            }
+            Assert::IsTrue(100000 == set.size());
+            Assert::IsTrue(set.size() <= set.capacity() - set.capacity() / 4);
+
+            bool found = true;
+            for (long long i = 0; i < 100000; i++) {
+                found = found && set.contains(i << 32) && ! set.insert(i << 32).second;
+            }
+            Assert::IsTrue(found);
+            Assert::IsFalse(set.contains(1));
+            Assert::IsFalse(set.contains(100000LL << 32));
+        }
+
+        TEST_METHOD(HashSet_Reserve)
+        {
+            FlatHashSet<int> set(1000);
+            size_t capacity = set.capacity();
+            Assert::IsTrue(capacity >= 1000);
+            Assert::IsTrue(0 == (capacity & (capacity - 1)));
+
+            for (int i = 0; i < 1000; i++) {
+                set.insert(i);
+            }
+            Assert::IsTrue(capacity == set.capacity());
+            Assert::IsTrue(1000 == set.size());
+
+            // never shrinks
+            set.reserve(10);
+            Assert::IsTrue(capacity == set.capacity());
+
+            FlatHashSet<int> empty;
+            Assert::IsTrue(0 == empty.capacity());
+        }
+
+        TEST_METHOD(HashSet_Collisions)
+        {
+            FlatHashSet<int, Collide> set;
+            for (int i = 0; i < 100; i++) {
+                set.insert(i);
+            }
+            Assert::IsTrue(100 == set.size());
+            Assert::IsTrue(set.contains(99));
+            Assert::IsFalse(set.contains(100));
+            Assert::IsFalse(set.insert(50).second);
+        }
+
+        TEST_METHOD(HashSet_Erase)
+        {
+            FlatHashSet<int, Collide> collisions;
+            for (int i = 0; i < 10; i++) {
+                collisions.insert(i);
+            }
+
+            // the probes walk past the tombstones
+            Assert::IsTrue(1 == collisions.erase(3));
+            Assert::IsTrue(0 == collisions.erase(3));
+            Assert::IsTrue(0 == collisions.erase(42));
+            Assert::IsFalse(collisions.contains(3));
+            Assert::IsTrue(collisions.contains(9));
+            Assert::IsTrue(0 == collisions.count(3));
+            Assert::IsTrue(1 == collisions.count(9));
+            Assert::IsTrue(9 == collisions.size());
+            Assert::IsTrue(collisions.insert(3).second);
+            Assert::IsTrue(10 == collisions.size());
+
+            // inserted and erased again and again: the tombstones are
+            // dropped by a rehash, which need not grow the set
+            Live::count() = 0;
+            {
+                FlatHashSet<Live, HashLive> set;
+                for (int i = 0; i < 100000; i++) {
+                    Assert::IsTrue(set.insert(Live(i)).second);
+                    if (i >= 10) {
+                        Assert::IsTrue(1 == set.erase(Live(i - 10)));
+                    }
+                }
+                Assert::IsTrue(10 == set.size());
+                Assert::IsTrue(set.capacity() <= 64);
+                Assert::AreEqual(10, Live::count());
+                Assert::IsTrue(set.contains(Live(99999)));
+                Assert::IsFalse(set.contains(Live(99989)));
+            }
+            Assert::AreEqual(0, Live::count());
+        }
+
+        TEST_METHOD(HashSet_ElementsAreDestroyed)
+        {
+            Live::count() = 0;
+            {
+                FlatHashSet<Live, HashLive> set;
+                for (int i = 0; i < 1000; i++) {
+                    set.insert(Live(i % 300));
+                }
+                Assert::AreEqual(300, Live::count());
+
+                // moved, not copied
+                FlatHashSet<Live, HashLive> moved(std::move(set));
+                Assert::AreEqual(300, Live::count());
+                Assert::IsTrue(300 == moved.size());
+                Assert::IsTrue(0 == set.size());
+                Assert::IsTrue(moved.contains(Live(299)));
+                Assert::IsFalse(set.contains(Live(299)));
+            }
+            Assert::AreEqual(0, Live::count());
+        }
+
+        TEST_METHOD(HashSet_DefaultSet)
+        {
+            // hashed when std::hash and operator== are there, ordered
+            // otherwise
+            Assert::IsTrue(_IsHashable<int>::value);
+            Assert::IsTrue(_IsHashable<std::string>::value);
+            Assert::IsFalse(_IsHashable<String>::value);
+            Assert::IsFalse(_IsHashable<Counted>::value);
+            Assert::IsTrue((std::is_same<FlatHashSet<int>, _DefaultSet<int>::type>::value));
+            Assert::IsTrue((std::is_same<std::set<Counted>, _DefaultSet<Counted>::type>::value));
+        }
+    };
+}
@@ -0,0 +1,175 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include "throwingEnumerable.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(HyperLogLogTest)
+    {
+        // Whether estimate is within four standard errors of count.
+        static bool near(long long estimate, long long count, const HyperLogLog& sketch)
+        {
+            return fabs((double)(estimate - count)) <= 4 * sketch.relativeError() * count;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "hyperLogLog\n");
+
+            HyperLogLogTest t;
+            t.HyperLogLog_Empty();
+            t.HyperLogLog_Small();
+            t.HyperLogLog_Accuracy();
+            t.HyperLogLog_Duplicates();
+            t.HyperLogLog_Merge();
+            t.HyperLogLog_Registers();
+            t.HyperLogLog_Precision();
+            t.HyperLogLog_Strings();
+            t.HyperLogLog_Hasher();
+            t.HyperLogLog_Exceptions();
+        }
+
+        TEST_METHOD(HyperLogLog_Empty)
+        {
+            Assert::IsTrue(0 == IEnumerable<int>::Range(0, 0)->CountDistinctApprox());
+            Assert::IsTrue(0.0 == HyperLogLog().estimate());
+        }
+
+        TEST_METHOD(HyperLogLog_Small)
+        {
+            // far fewer elements than registers: about exact
+            for (int count = 1; count <= 100; count++) {
+                long long estimate = IEnumerable<int>::Range(0, count)->CountDistinctApprox();
+                Assert::IsTrue(llabs(estimate - count) <= 1 + count / 50);
+            }
+        }
+
+        TEST_METHOD(HyperLogLog_Accuracy)
+        {
+            HyperLogLog sketch;
+            const int counts[] = { 1000, 5000, 20000, 100000, 300000 };
+            for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+                long long estimate = IEnumerable<int>::Range(0, counts[i])->CountDistinctApprox();
+                Assert::IsTrue(near(estimate, counts[i], sketch));
+            }
+
+            // more registers, smaller error
+            HyperLogLog precise(16);
+            long long estimate = IEnumerable<int>::Range(0, 300000)->CountDistinctApprox(16);
+            Assert::IsTrue(near(estimate, 300000, precise));
+            Assert::IsTrue(precise.relativeError() < sketch.relativeError());
+            Assert::IsTrue(65536 == precise.registers().size());
+        }
+
+        TEST_METHOD(HyperLogLog_Duplicates)
+        {
+            std::shared_ptr<IEnumerable<int>> source = IEnumerable<int>::Range(0, 10000);
+            HyperLogLog once = source->ToHyperLogLog();
+            HyperLogLog thrice = source->Concat(source)->Concat(source)->ToHyperLogLog();
+            Assert::IsTrue(once.registers() == thrice.registers());
+            Assert::IsTrue(once.count() == thrice.count());
+        }
+
+        TEST_METHOD(HyperLogLog_Merge)
+        {
+            std::shared_ptr<IEnumerable<int>> lhs = IEnumerable<int>::Range(0, 50000);
+            std::shared_ptr<IEnumerable<int>> rhs = IEnumerable<int>::Range(25000, 50000);
+
+            // the sketch of the union
+            HyperLogLog merged = lhs->ToHyperLogLog();
+            merged.merge(rhs->ToHyperLogLog());
+            Assert::IsTrue(lhs->Concat(rhs)->ToHyperLogLog().registers() == merged.registers());
+            Assert::IsTrue(near(merged.count(), 75000, merged));
+
+            // with itself, or an empty one
+            HyperLogLog sketch = lhs->ToHyperLogLog();
+            sketch.merge(sketch);
+            sketch.merge(HyperLogLog());
+            Assert::IsTrue(lhs->ToHyperLogLog().registers() == sketch.registers());
+
+            Assert::ExpectException<ArgumentException&>([&merged]() {
+                merged.merge(HyperLogLog(14));
+            });
+        }
+
+        TEST_METHOD(HyperLogLog_Registers)
+        {
+            // a sketch saved and restored
+            HyperLogLog sketch = IEnumerable<int>::Range(0, 20000)->ToHyperLogLog(10);
+            HyperLogLog restored(sketch.registers());
+            Assert::IsTrue(10 == restored.precision());
+            Assert::IsTrue(sketch.count() == restored.count());
+
+            // not a power of two in size, or a rank beyond the bits of the hash
+            Assert::ExpectException<ArgumentException&>([]() {
+                std::vector<unsigned char> registers(1000);
+                HyperLogLog sketch(registers);
+            });
+            Assert::ExpectException<ArgumentException&>([]() {
+                std::vector<unsigned char> registers(16, 100);
+                HyperLogLog sketch(registers);
+            });
+        }
+
+        TEST_METHOD(HyperLogLog_Precision)
+        {
+            std::shared_ptr<IEnumerable<int>> source = IEnumerable<int>::Range(0, 1000);
+            for (int precision = HyperLogLog::MinPrecision; precision <= HyperLogLog::MaxPrecision; precision++) {
+                HyperLogLog sketch = source->ToHyperLogLog(precision);
+                Assert::IsTrue(precision == sketch.precision());
+                Assert::IsTrue(((size_t)1 << precision) == sketch.registers().size());
+                Assert::IsTrue(near(sketch.count(), 1000, sketch));
+            }
+
+            Assert::ExpectException<ArgumentOutOfRangeException&>([&source]() {
+                source->CountDistinctApprox(HyperLogLog::MinPrecision - 1);
+            });
+            Assert::ExpectException<ArgumentOutOfRangeException&>([&source]() {
+                source->CountDistinctApprox(HyperLogLog::MaxPrecision + 1);
+            });
+        }
+
+        TEST_METHOD(HyperLogLog_Strings)
+        {
+            std::vector<std::string> strings;
+            for (int i = 0; i < 30000; i++) {
+                strings.push_back("customer #" + std::to_string(i % 10000));
+            }
+            std::shared_ptr<IEnumerable<std::string>> source =
+                std::make_shared<Vector<std::string>>(&strings[0], strings.size());
+
+            HyperLogLog sketch;
+            for (size_t i = 0; i < strings.size(); i++) {
+                sketch.add(strings[i]);
+            }
+            Assert::IsTrue(source->ToHyperLogLog().registers() == sketch.registers());
+            Assert::IsTrue(near(source->CountDistinctApprox(), 10000, sketch));
+        }
+
+        TEST_METHOD(HyperLogLog_Hasher)
+        {
+            // elements with the same hash count as one
+            long long estimate = IEnumerable<int>::Range(0, 10000)->CountDistinctApprox(12, [](int x) {
+                return (size_t)(x % 100);
+            });
+            Assert::IsTrue(llabs(estimate - 100) <= 3);
+        }
+
+        TEST_METHOD(HyperLogLog_Exceptions)
+        {
+            // not deferred: the sequence is enumerated at once
+            std::shared_ptr<IEnumerable<int>> throwing(new ThrowingEnumerable());
+            Assert::ExpectException<InvalidOperationException&>([&throwing]() {
+                throwing->CountDistinctApprox();
+            });
+        }
+    };
+}
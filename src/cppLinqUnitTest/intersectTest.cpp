@@ -0,0 +1,229 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include "throwingEnumerable.h"
+#include <list>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(IntersectTest)
+    {
+        typedef StlEnumerable<std::list<Counted>, Counted> ListOfCounted;
+
+        static std::vector<Counted> counted(int first, int count)
+        {
+            std::vector<Counted> v;
+            for (int i = 0; i < count; i++) {
+                v.push_back(Counted(first + i));
+            }
+            return v;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "intersect\n");
+
+            IntersectTest t;
+            t.Intersect_NullSecondWithoutComparer();
+            t.Intersect_NullSecondWithComparer();
+            t.Intersect_NoComparerSpecified();
+            t.Intersect_CaseInsensitiveComparerSpecified();
+            t.Intersect_CaseInsensitiveHasherSpecified();
+            t.Intersect_NoSequencesUsedBeforeIteration();
+            t.Intersect_SecondSequenceReadFullyOnFirstResultIteration();
+            t.Intersect_FirstSequenceOnlyReadAsResultsAreRead();
+            t.Intersect_BuildsOnTheSmallerSide();
+            t.Intersect_SizeHint();
+        }
+
+        TEST_METHOD(Intersect_NullSecondWithoutComparer)
+        {
+            int v[] = { 5 };
+            std::shared_ptr<IEnumerable<int>> first(new Vector<int>(v, ARRAYSIZE(v)));
+            std::shared_ptr<IEnumerable<int>> second(nullptr);
+
+            Assert::ExpectException<ArgumentNullException&>([&first, &second]() {
+                first->Intersect(second);
+            });
+        }
+
+        TEST_METHOD(Intersect_NullSecondWithComparer)
+        {
+            String v0[] = { "A" };
+            std::shared_ptr<IEnumerable<String>> first(new Vector<String>(v0, ARRAYSIZE(v0)));
+            std::shared_ptr<IEnumerable<String>> second(nullptr);
+
+            Assert::ExpectException<ArgumentNullException&>([&first, &second]() {
+                first->Intersect(second, CompareIgnoreCase());
+            });
+            Assert::ExpectException<ArgumentNullException&>([&first, &second]() {
+                first->Intersect(second, HashIgnoreCase(), EqualIgnoreCase());
+            });
+        }
+
+        TEST_METHOD(Intersect_NoComparerSpecified)
+        {
+            String v0[] = { "A", "a", "b", "c", "b" };
+            std::shared_ptr<IEnumerable<String>> first(new Vector<String>(v0, ARRAYSIZE(v0)));
+
+            String v1[] = { "b", "a", "d", "a" };
+            std::shared_ptr<IEnumerable<String>> second(new Vector<String>(v1, ARRAYSIZE(v1)));
+
+            String exp[] = { "a", "b" };
+            Assert::IsTrue(first->Intersect(second)->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
+
+            int i0[] = { 5, 1, 3, 1, 8, 5 };
+            std::shared_ptr<IEnumerable<int>> ints(new Vector<int>(i0, ARRAYSIZE(i0)));
+            int iexp[] = { 5, 1, 8 };
+            Assert::IsTrue(ints->Intersect(IEnumerable<int>::Range(0, 10)->Where([](int x) { return x != 3; }))
+                ->SequenceEqual(iexp, ARRAYSIZE(iexp)));
+            Assert::AreEqual(0, ints->Intersect(IEnumerable<int>::Empty())->Count());
+        }
+
+        TEST_METHOD(Intersect_CaseInsensitiveComparerSpecified)
+        {
+            String v0[] = { "A", "a", "b", "c", "b" };
+            std::shared_ptr<IEnumerable<String>> first(new Vector<String>(v0, ARRAYSIZE(v0)));
+
+            String v1[] = { "b", "a", "d", "a" };
+            std::shared_ptr<IEnumerable<String>> second(new Vector<String>(v1, ARRAYSIZE(v1)));
+
+            String exp[] = { "A", "b" };
+            Assert::IsTrue(first->Intersect(second, CompareIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(Intersect_CaseInsensitiveHasherSpecified)
+        {
+            String v0[] = { "A", "a", "b", "c", "B" };
+            std::shared_ptr<IEnumerable<String>> first(new Vector<String>(v0, ARRAYSIZE(v0)));
+
+            String v1[] = { "b", "a", "d", "a" };
+            std::shared_ptr<IEnumerable<String>> second(new Vector<String>(v1, ARRAYSIZE(v1)));
+
+            String exp[] = { "A", "b" };
+            Assert::IsTrue(first->Intersect(second, HashIgnoreCase(), EqualIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(Intersect_NoSequencesUsedBeforeIteration)
+        {
+            std::shared_ptr<IEnumerable<int>> first(new ThrowingEnumerable());
+            std::shared_ptr<IEnumerable<int>> second(new ThrowingEnumerable());
+
+            // No exceptions!
+            auto query = first->Intersect(second);
+
+            // Still no exceptions... we're not calling MoveNext.
+            auto iterator = query->GetEnumerator();
+        }
+
+        TEST_METHOD(Intersect_SecondSequenceReadFullyOnFirstResultIteration)
+        {
+            int v0[] = { 1 };
+            std::shared_ptr<IEnumerable<int>> first(new Vector<int>(v0, ARRAYSIZE(v0)));
+
+            int v1[] = { 10, 2, 0 };
+            std::shared_ptr<IEnumerable<int>> second(new Vector<int>(v1, ARRAYSIZE(v1)));
+            auto secondQuery = second->Select<int>([](int x) -> int {
+                return 10 / x;
+            });
+
+            auto query = first->Intersect(secondQuery);
+            auto iterator = query->GetEnumerator();
+
+            Assert::ExpectException<std::exception&>([iterator]() {
+                iterator->MoveNext();
+            });
+        }
+
+        TEST_METHOD(Intersect_FirstSequenceOnlyReadAsResultsAreRead)
+        {
+            int v0[] = { 10, 2, 0, 2 };
+            std::shared_ptr<IEnumerable<int>> first(new Vector<int>(v0, ARRAYSIZE(v0)));
+            auto firstQuery = first->Select<int>([](int x) { return 10 / x; });
+
+            int v1[] = { 1 };
+            std::shared_ptr<IEnumerable<int>> second(new Vector<int>(v1, ARRAYSIZE(v1)));
+
+            auto query = firstQuery->Intersect(second);
+            auto iterator = query->GetEnumerator();
+
+            // We can get the first value with no problems
+            Assert::IsTrue(iterator->MoveNext());
+            Assert::AreEqual(1, iterator->get_Current());
+
+            // Getting at the *second* value of the result sequence requires
+            // reading from the first input sequence until the "bad" division
+            Assert::ExpectException<std::exception&>([iterator]() {
+                iterator->MoveNext();
+            });
+        }
+
+        TEST_METHOD(Intersect_BuildsOnTheSmallerSide)
+        {
+            std::vector<Counted> small = counted(90, 20);
+            small.push_back(Counted(95));
+            std::vector<Counted> large = counted(0, 1000);
+            std::list<Counted> unsized(large.begin(), large.end());
+
+            std::shared_ptr<IEnumerable<Counted>> smallSource(new Vector<Counted>(&small[0], small.size()));
+            std::shared_ptr<IEnumerable<Counted>> largeSource(new Vector<Counted>(&large[0], large.size()));
+            std::shared_ptr<IEnumerable<Counted>> unsizedSource(new ListOfCounted(unsized));
+
+            // the elements of the smaller side are copied into the set
+            // (and into the list of the distinct ones), not those of the
+            // larger one; the order is that of the first sequence
+            Counted::reset();
+            std::vector<Counted> result = smallSource->Intersect(largeSource)->ToVector();
+            Assert::IsTrue(result.size() < 100 && Counted::copies() < 100);
+            Assert::IsTrue(20 == result.size());
+            Assert::AreEqual(90, result[0].value);
+            Assert::AreEqual(109, result[19].value);
+
+            Counted::reset();
+            result = largeSource->Intersect(smallSource)->ToVector();
+            Assert::IsTrue(Counted::copies() < 100);
+            Assert::IsTrue(20 == result.size());
+            Assert::AreEqual(90, result[0].value);
+            Assert::AreEqual(109, result[19].value);
+
+            // without a size hint on both sides, the set is built from rhs
+            Counted::reset();
+            result = smallSource->Intersect(unsizedSource)->ToVector();
+            Assert::IsTrue(Counted::copies() >= 1000);
+            Assert::IsTrue(20 == result.size());
+            Assert::AreEqual(109, result[19].value);
+        }
+
+        TEST_METHOD(Intersect_SizeHint)
+        {
+            std::shared_ptr<IEnumerable<int>> source = IEnumerable<int>::Range(0, 100);
+            std::list<int> l(10);
+            std::shared_ptr<IEnumerable<int>> unsized(new StlEnumerable<std::list<int>, int>(l));
+
+            SizeHint hint = source->Intersect(IEnumerable<int>::Range(50, 30))->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 30 == hint.size);
+            hint = source->Intersect(unsized)->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 100 == hint.size);
+            hint = unsized->Intersect(unsized)->sizeHint();
+            Assert::IsFalse(hint.isKnown());
+        }
+    };
+}
@@ -0,0 +1,201 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include <list>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(MaterializeTest)
+    {
+        typedef StlEnumerable<std::list<int>, int> ListOfInts;
+
+        static std::vector<int> sequence(int first, int last)
+        {
+            std::vector<int> v;
+            for (int i = first; i <= last; i++) {
+                v.push_back(i);
+            }
+            return v;
+        }
+
+        static std::shared_ptr<Vector<Counted>> counted(int count)
+        {
+            std::vector<Counted> elements;
+            for (int i = 0; i < count; i++) {
+                elements.push_back(Counted(i));
+            }
+            return std::make_shared<Vector<Counted>>(&elements[0], elements.size());
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "materialize\n");
+
+            MaterializeTest t;
+            t.Materialize_ToVector();
+            t.Materialize_ToVectorReserves();
+            t.Materialize_ToVectorMovesTemporaries();
+            t.Materialize_ToArray();
+            t.Materialize_ToMap();
+            t.Materialize_ToUnorderedMap();
+        }
+
+        TEST_METHOD(Materialize_ToVector)
+        {
+            std::vector<int> v = sequence(0, 9);
+            std::shared_ptr<IEnumerable<int>> source = std::make_shared<Vector<int>>(&v[0], v.size());
+            std::list<int> l(v.begin(), v.end());
+
+            Assert::IsTrue(v == source->ToVector());
+            Assert::IsTrue(v == std::make_shared<ListOfInts>(l)->ToVector());
+            Assert::IsTrue(v == IEnumerable<int>::Range(0, 10)->ToVector());
+            Assert::IsTrue(sequence(3, 6) == source->Skip(3)->Take(4)->ToVector());
+            Assert::IsTrue(sequence(1, 10) == source->Select<int>([](int x) { return x + 1; })->ToVector());
+            Assert::IsTrue(sequence(5, 9) == source->Where([](int x) { return x >= 5; })->ToVector());
+
+            std::vector<int> reversed(v.rbegin(), v.rend());
+            Assert::IsTrue(reversed == source->Reverse()->ToVector());
+
+            Assert::IsTrue(IEnumerable<int>::Empty()->ToVector().empty());
+            Assert::IsTrue(source->Take(0)->ToVector().empty());
+        }
+
+        TEST_METHOD(Materialize_ToVectorReserves)
+        {
+            std::vector<int> v = sequence(0, 999);
+            std::shared_ptr<IEnumerable<int>> source = std::make_shared<Vector<int>>(&v[0], v.size());
+
+            // no room is wasted, and the vector never grows, when the size
+            // is known
+            Assert::IsTrue(1000 == source->ToVector().capacity());
+            Assert::IsTrue(1000 == IEnumerable<int>::Range(0, 1000)->ToVector().capacity());
+            Assert::IsTrue(1000 == source->Select<int>([](int x) { return x * 2; })->ToVector().capacity());
+            Assert::IsTrue(300 == source->Select<int>([](int x) { return x * 2; })->Skip(700)->ToVector().capacity());
+            Assert::IsTrue(2000 == source->Concat(IEnumerable<int>::Range(0, 1000))->ToVector().capacity());
+        }
+
+        TEST_METHOD(Materialize_ToVectorMovesTemporaries)
+        {
+            std::shared_ptr<IEnumerable<Counted>> source = counted(100);
+
+            // the projections are moved out of the query...
+            auto projected = source->Select<Counted>([](Counted& c) { return Counted(c.value * 2); });
+            Assert::IsTrue(projected->yieldsTemporaries());
+            Counted::reset();
+            std::vector<Counted> result = projected->ToVector();
+            Assert::AreEqual(0, Counted::copies());
+            Assert::IsTrue(100 == result.size());
+            Assert::AreEqual(198, result[99].value);
+
+            // ...and so is the buffer of Reverse...
+            auto reversed = projected->Reverse();
+            Assert::IsTrue(reversed->yieldsTemporaries());
+            Counted::reset();
+            result = reversed->ToVector();
+            Assert::AreEqual(100, Counted::copies());   // into the buffer
+            Assert::AreEqual(0, result[99].value);
+
+            // ...but the elements of a container are copied
+            Assert::IsFalse(source->yieldsTemporaries());
+            Assert::IsFalse(source->Where([](Counted& c) { return c.value > 0; })->yieldsTemporaries());
+            Assert::IsFalse(projected->Concat(source)->yieldsTemporaries());
+            Assert::IsFalse(IEnumerable<Counted>::Repeat(Counted(1), 3)->yieldsTemporaries());
+            Counted::reset();
+            result = source->ToVector();
+            Assert::AreEqual(100, Counted::copies());
+
+            std::vector<std::string> strings(10, std::string("not moved"));
+            std::shared_ptr<IEnumerable<std::string>> container =
+                std::make_shared<Vector<std::string>>(&strings[0], strings.size());
+            Assert::IsTrue(8 == container
+                ->Skip(1)
+                ->Where([](std::string& s) { return ! s.empty(); })
+                ->Take(8)
+                ->ToVector().size());
+            Assert::IsTrue(10 == container->Count([](const std::string& s) { return s == "not moved"; }));
+        }
+
+        TEST_METHOD(Materialize_ToArray)
+        {
+            std::vector<int> v = sequence(0, 9);
+            std::shared_ptr<IEnumerable<int>> array = IEnumerable<int>::Range(0, 10)
+                ->Select<int>([](int x) { return x; })
+                ->ToArray();
+
+            Assert::IsTrue(nullptr != array->randomAccess());
+            Assert::AreEqual(10, array->Count());
+            Assert::AreEqual(7, array->ElementAt(7));
+            Assert::AreEqual(9, array->Last());
+            Assert::IsTrue(array->SequenceEqual(&v[0], v.size()));
+            Assert::IsTrue(v == array->ToVector());
+
+            // enumerated again and again, in every way
+            std::vector<int> moveNext;
+            auto e = array->GetEnumerator();
+            while (e->MoveNext()) {
+                moveNext.push_back(e->get_Current());
+            }
+            Assert::IsTrue(v == moveNext);
+
+            int* items = nullptr;
+            e = array->GetEnumerator();
+            Assert::IsTrue(10 == e->MoveNextBatch(items, IEnumerator<int>::MaxBatch));
+            Assert::AreEqual(0, items[0]);
+            Assert::IsTrue(0 == e->MoveNextBatch(items, IEnumerator<int>::MaxBatch));
+
+            Assert::AreEqual(45, array->Sum());
+            Assert::AreEqual(9 + 8 + 7, array->Reverse()->Take(3)->Sum());
+
+            // a snapshot of its source
+            std::shared_ptr<Vector<int>> source = std::make_shared<Vector<int>>(&v[0], v.size());
+            std::shared_ptr<IEnumerable<int>> snapshot = source->ToArray();
+            (*source)[0] = 100;
+            Assert::AreEqual(0, snapshot->First());
+
+            Assert::AreEqual(0, IEnumerable<int>::Empty()->ToArray()->Count());
+        }
+
+        TEST_METHOD(Materialize_ToMap)
+        {
+            std::vector<int> v = sequence(0, 9);
+            std::shared_ptr<IEnumerable<int>> source = std::make_shared<Vector<int>>(&v[0], v.size());
+
+            std::map<int, std::string> map = source->ToMap<int, std::string>(
+                [](int x) { return x * 10; },
+                [](int x) { return std::string(x, '*'); });
+            Assert::IsTrue(10 == map.size());
+            Assert::IsTrue("***" == map[30]);
+            Assert::IsTrue(map.begin()->second.empty());
+
+            Assert::IsTrue(IEnumerable<int>::Empty()->ToMap<int, int>(
+                [](int x) { return x; }, [](int x) { return x; }).empty());
+
+            // duplicate keys
+            Assert::ExpectException<ArgumentException&>([&]() {
+                source->ToMap<int, int>([](int x) { return x % 5; }, [](int x) { return x; });
+            });
+        }
+
+        TEST_METHOD(Materialize_ToUnorderedMap)
+        {
+            std::vector<int> v = sequence(0, 999);
+            std::shared_ptr<IEnumerable<int>> source = std::make_shared<Vector<int>>(&v[0], v.size());
+
+            std::unordered_map<int, int> map = source
+                ->Where([](int x) { return x % 2 == 0; })
+                ->ToUnorderedMap<int, int>([](int x) { return x; }, [](int x) { return x * x; });
+            Assert::IsTrue(500 == map.size());
+            Assert::AreEqual(998 * 998, map[998]);
+            Assert::IsTrue(map.end() == map.find(999));
+
+            Assert::ExpectException<ArgumentException&>([&]() {
+                source->ToUnorderedMap<int, int>([](int x) { return x / 2; }, [](int x) { return x; });
+            });
+        }
+    };
+}
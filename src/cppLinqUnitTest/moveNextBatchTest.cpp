@@ -0,0 +1,215 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(MoveNextBatchTest)
+    {
+        // Reads source with MoveNextBatch(max), checking that get_Current()
+        // is the last element of each batch.
+        template <typename T>
+        static std::vector<T> toVector(std::shared_ptr<IEnumerable<T>> source, size_t max, size_t* batches)
+        {
+            std::vector<T> result;
+            *batches = 0;
+            auto e = source->GetEnumerator();
+            T* items;
+            size_t count;
+            while (0 != (count = e->MoveNextBatch(items, max))) {
+                Assert::IsTrue(count <= max);
+                Assert::IsTrue(&e->get_Current() == &items[count - 1]);
+                result.insert(result.end(), items, items + count);
+                (*batches)++;
+            }
+            Assert::AreEqual((size_t)0, e->MoveNextBatch(items, max));
+            return result;
+        }
+
+        static std::vector<int> iota(int start, int count)
+        {
+            std::vector<int> result;
+            for (int i = 0; i < count; i++) {
+                result.push_back(start + i);
+            }
+            return result;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "moveNextBatch\n");
+
+            MoveNextBatchTest t;
+            t.MoveNextBatch_ContiguousSources();
+            t.MoveNextBatch_DefaultIsOneElement();
+            t.MoveNextBatch_IteratorBlocks();
+            t.MoveNextBatch_MixedWithMoveNext();
+            t.MoveNextBatch_ConcatSkipTake();
+            t.MoveNextBatch_TerminalOperators();
+        }
+
+        TEST_METHOD(MoveNextBatch_ContiguousSources)
+        {
+            std::vector<int> v = iota(0, 100);
+            std::shared_ptr<IEnumerable<int>> source(new StlEnumerable<std::vector<int>, int>(v));
+
+            size_t batches;
+            Assert::IsTrue(v == toVector(source, IEnumerator<int>::MaxBatch, &batches));
+            Assert::AreEqual((size_t)1, batches);
+            Assert::IsTrue(v == toVector(source, 30, &batches));
+            Assert::AreEqual((size_t)4, batches);
+
+            // the elements are those of the container
+            int* items;
+            Assert::AreEqual((size_t)100, source->GetEnumerator()->MoveNextBatch(items, 1000));
+            Assert::IsTrue(&v[0] == items);
+
+            std::vector<int> empty;
+            std::shared_ptr<IEnumerable<int>> none(new StlEnumerable<std::vector<int>, int>(empty));
+            Assert::IsTrue(toVector(none, 10, &batches).empty());
+        }
+
+        TEST_METHOD(MoveNextBatch_DefaultIsOneElement)
+        {
+            size_t batches;
+            Assert::IsTrue(iota(5, 10) == toVector(IEnumerable<int>::Range(5, 10), 4, &batches));
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // (as a block, Range yields batches)
+            Assert::AreEqual((size_t)10, batches);
+#endif
+        }
+
+        TEST_METHOD(MoveNextBatch_IteratorBlocks)
+        {
+            auto fn = [](IteratorBlock<int>* it) {
+                for (int i = 0; i < 10; i++) {
+                    it->yieldReturn(i);
+                }
+            };
+            size_t batchSizes[] = { IteratorBlock<int>::Unbatched, 4, 16 };
+            size_t expected[] = { 10, 3, 1 };
+            for (size_t i = 0; i < ARRAYSIZE(batchSizes); i++) {
+                std::shared_ptr<IEnumerable<int>> block(
+                    new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, batchSizes[i]));
+                size_t batches;
+                Assert::IsTrue(iota(0, 10) == toVector(block, IEnumerator<int>::MaxBatch, &batches));
+                Assert::AreEqual(expected[i], batches);
+                Assert::IsTrue(iota(0, 10) == toVector(block, 3, &batches));
+            }
+
+            // yieldFrom forwards the batches of the inner sequence
+            std::vector<int> v = iota(1, 50);
+            std::shared_ptr<IEnumerable<int>> inner(new StlEnumerable<std::vector<int>, int>(v));
+            auto outer = [inner](IteratorBlock<int>* it) {
+                it->yieldReturn(0);
+                it->yieldFrom(inner);
+            };
+            std::shared_ptr<IEnumerable<int>> block(
+                new _IteratorBlock<int>(outer, Fiber::SmallStackSize, nullptr, IteratorBlock<int>::Unbatched));
+            size_t batches;
+            Assert::IsTrue(iota(0, 51) == toVector(block, IEnumerator<int>::MaxBatch, &batches));
+            Assert::AreEqual((size_t)3, batches);
+        }
+
+        TEST_METHOD(MoveNextBatch_MixedWithMoveNext)
+        {
+            std::vector<int> v = iota(0, 10);
+            std::shared_ptr<IEnumerable<int>> source(new StlEnumerable<std::vector<int>, int>(v));
+            auto e = source->GetEnumerator();
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(0, e->get_Current());
+            int* items;
+            Assert::AreEqual((size_t)4, e->MoveNextBatch(items, 4));
+            Assert::AreEqual(1, items[0]);
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(5, e->get_Current());
+            Assert::AreEqual((size_t)4, e->MoveNextBatch(items, 100));
+            Assert::AreEqual(6, items[0]);
+            Assert::IsFalse(e->MoveNext());
+        }
+
+        TEST_METHOD(MoveNextBatch_ConcatSkipTake)
+        {
+            std::vector<int> v = iota(0, 100);
+            std::shared_ptr<IEnumerable<int>> source(new StlEnumerable<std::vector<int>, int>(v));
+            size_t batches;
+
+            auto twice = source->Concat(source);
+            std::vector<int> expected = iota(0, 100);
+            expected.insert(expected.end(), v.begin(), v.end());
+            Assert::IsTrue(expected == toVector(twice, IEnumerator<int>::MaxBatch, &batches));
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // (as blocks, Concat, Skip and Take yield batches of their own size)
+            Assert::AreEqual((size_t)2, batches);
+#endif
+
+            Assert::IsTrue(iota(30, 40) == toVector(source->Skip(30)->Take(40), IEnumerator<int>::MaxBatch, &batches));
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            Assert::AreEqual((size_t)1, batches);
+#endif
+            Assert::IsTrue(toVector(source->Skip(200), 10, &batches).empty());
+            Assert::IsTrue(toVector(source->Take(0), 10, &batches).empty());
+            Assert::IsTrue(iota(90, 10) == toVector(source->Skip(90)->Take(50), 3, &batches));
+
+            // the same in push mode
+            std::vector<int> pushed;
+            foreach<int>(source->Skip(30)->Take(40), [&pushed](int& item) {
+                pushed.push_back(item);
+            });
+            Assert::IsTrue(iota(30, 40) == pushed);
+        }
+
+        TEST_METHOD(MoveNextBatch_TerminalOperators)
+        {
+            std::vector<int> v = iota(-50, 100);
+            std::shared_ptr<IEnumerable<int>> source(new StlEnumerable<std::vector<int>, int>(v));
+
+            Assert::AreEqual(-50, source->Sum());
+            Assert::AreEqual(-50, source->Min());
+            Assert::AreEqual(49, source->Max());
+            Assert::AreEqual(100, source->Count());
+            Assert::AreEqual(-41, source->Take(10)->Skip(5)->Max());
+
+            std::vector<int> w = v;
+            std::shared_ptr<IEnumerable<int>> other(new StlEnumerable<std::vector<int>, int>(w));
+            Assert::IsTrue(source->SequenceEqual(other));
+            Assert::IsTrue(source->SequenceEqual(IEnumerable<int>::Range(-50, 100)));
+            Assert::IsTrue(source->Skip(3)->Concat(source->Take(3))->SequenceEqual(
+                IEnumerable<int>::Range(-47, 97)->Concat(IEnumerable<int>::Range(-50, 3))));
+            Assert::IsFalse(source->SequenceEqual(source->Take(99)));
+            Assert::IsFalse(source->Take(99)->SequenceEqual(source));
+            Assert::IsTrue(source->SequenceEqual<int>(&w[0], w.size()));
+            Assert::IsFalse(source->SequenceEqual<int>(&w[0], w.size() - 1));
+            w[70] = 0;
+            Assert::IsFalse(source->SequenceEqual(other));
+
+            std::vector<int> empty;
+            std::shared_ptr<IEnumerable<int>> none(new StlEnumerable<std::vector<int>, int>(empty));
+            Assert::ExpectException<InvalidOperationException&>([none]() {
+                none->Min();
+            });
+            Assert::ExpectException<InvalidOperationException&>([none]() {
+                none->Max();
+            });
+        }
+    };
+}
@@ -0,0 +1,170 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include "../cppLinq/pipeline.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(PipelineTest)
+    {
+        static std::vector<int> iota(int start, int count)
+        {
+            std::vector<int> result;
+            for (int i = 0; i < count; i++) {
+                result.push_back(start + i);
+            }
+            return result;
+        }
+
+        template <typename T>
+        static std::vector<T> toVector(std::shared_ptr<IEnumerable<T>> source)
+        {
+            std::vector<T> result;
+            auto e = source->GetEnumerator();
+            while (e->MoveNext()) {
+                result.push_back(e->get_Current());
+            }
+            return result;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "pipeline\n");
+
+            PipelineTest t;
+            t.Pipeline_WhereSelectSum();
+            t.Pipeline_Sources();
+            t.Pipeline_SkipTake();
+            t.Pipeline_TerminalOperators();
+            t.Pipeline_StagesAreLazy();
+            t.Pipeline_ConvertsToIEnumerable();
+        }
+
+        TEST_METHOD(Pipeline_WhereSelectSum)
+        {
+            std::vector<int> v = iota(0, 10);
+            int total = from(v)
+                | where([](int x) { return x % 2 == 0; })
+                | select([](int x) { return x * x; })
+                | sum();
+            Assert::AreEqual(0 + 4 + 16 + 36 + 64, total);
+
+            // the same query with the operators of IEnumerable
+            std::shared_ptr<IEnumerable<int>> source(new StlEnumerable<std::vector<int>, int>(v));
+            Assert::AreEqual(total, source
+                ->Where([](int x) { return x % 2 == 0; })
+                ->Select<int>([](int x) { return x * x; })
+                ->Sum());
+
+            // select can change the type of the elements
+            double half = from(v) | select([](int x) { return x / 2.0; }) | sum();
+            Assert::AreEqual(22.5, half);
+            std::string letters = from(v)
+                | take(3)
+                | select([](int x) { return std::string(1, (char)('a' + x)); })
+                | aggregate([](const std::string& a, const std::string& b) { return a + b; });
+            Assert::IsTrue("abc" == letters);
+        }
+
+        TEST_METHOD(Pipeline_Sources)
+        {
+            int array[] = { 1, 2, 3, 4 };
+            Assert::AreEqual(10, from(array) | sum());
+            Assert::AreEqual(5, from(array + 1, array + 3) | sum());
+
+            const std::vector<int> v = iota(1, 4);
+            Assert::AreEqual(10, from(v) | sum());
+
+            std::string s("hello");
+            Assert::AreEqual(2, from(s) | where([](char c) { return c == 'l'; }) | count());
+
+            Assert::AreEqual(45, from(IEnumerable<int>::Range(0, 10)) | sum());
+            Assert::AreEqual(3, from(IEnumerable<int>::Range(0, 10)->Where([](int x) { return x < 3; })) | count());
+        }
+
+        TEST_METHOD(Pipeline_SkipTake)
+        {
+            std::vector<int> v = iota(0, 100);
+            Assert::AreEqual(30 + 31 + 32, from(v) | skip(30) | take(3) | sum());
+            Assert::AreEqual(0, from(v) | take(0) | count());
+            Assert::AreEqual(0, from(v) | skip(200) | count());
+            Assert::AreEqual(100, from(v) | take(200) | count());
+            Assert::AreEqual(3, from(v) | take(5) | take(3) | count());
+            Assert::AreEqual(2, from(v) | take(5) | skip(3) | count());
+        }
+
+        TEST_METHOD(Pipeline_TerminalOperators)
+        {
+            std::vector<int> v = iota(1, 10);
+            Assert::AreEqual(10, from(v) | count());
+            Assert::AreEqual(4, from(v) | where([](int x) { return x > 3; }) | first());
+            Assert::AreEqual(3628800, from(v) | aggregate([](int a, int b) { return a * b; }));
+
+            std::vector<int> empty;
+            Assert::AreEqual(0, from(empty) | sum());
+            Assert::AreEqual(0, from(empty) | count());
+            Assert::ExpectException<InvalidOperationException&>([&empty]() {
+                from(empty) | first();
+            });
+            Assert::ExpectException<InvalidOperationException&>([&v]() {
+                from(v) | where([](int x) { return x > 100; }) | aggregate([](int a, int b) { return a + b; });
+            });
+        }
+
+        TEST_METHOD(Pipeline_StagesAreLazy)
+        {
+            std::vector<int> v = iota(0, 100);
+            int selected = 0;
+            auto query = from(v) | select([&selected](int x) { selected++; return x; });
+            Assert::AreEqual(0, selected);
+
+            Assert::AreEqual(5, query | where([](int x) { return x >= 5; }) | first());
+            Assert::AreEqual(6, selected);
+
+            // the query runs again each time
+            selected = 0;
+            Assert::AreEqual(3, query | take(3) | count());
+            Assert::AreEqual(3, selected);
+        }
+
+        TEST_METHOD(Pipeline_ConvertsToIEnumerable)
+        {
+            std::vector<int> v = iota(0, 10);
+            auto query = from(v) | where([](int x) { return x % 3 == 0; }) | select([](int x) { return x + 1; });
+            int exp[] = { 1, 4, 7, 10 };
+
+            std::shared_ptr<IEnumerable<int>> e = query;
+            Assert::IsTrue(e->SequenceEqual<int>(exp, ARRAYSIZE(exp)));
+            Assert::IsTrue(std::vector<int>(exp, exp + ARRAYSIZE(exp)) == toVector(e));
+            Assert::AreEqual(22, e->Sum());
+            Assert::AreEqual(7, query.asEnumerable()->Where([](int x) { return x > 5; })->First());
+
+            std::vector<int> pushed;
+            foreach<int>(e, [&pushed](int& item) {
+                pushed.push_back(item);
+            });
+            Assert::IsTrue(std::vector<int>(exp, exp + ARRAYSIZE(exp)) == pushed);
+
+            // and back
+            Assert::AreEqual(2, from(e) | skip(2) | count());
+        }
+    };
+}
@@ -0,0 +1,178 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(QueryArenaTest)
+    {
+    public:
+        static void test()
+        {
+            fprintf(stdout, "queryArena\n");
+
+            QueryArenaTest t;
+            t.QueryArena_NodesAreAllocatedFromTheArena();
+            t.QueryArena_NoScopeNoArena();
+            t.QueryArena_OutlivesTheScope();
+            t.QueryArena_EnumeratorsUseTheArenaOfTheirNode();
+            t.QueryArena_NestedScopes();
+            t.QueryArena_LargeObjects();
+        }
+
+        TEST_METHOD(QueryArena_NodesAreAllocatedFromTheArena)
+        {
+            std::shared_ptr<QueryArena> arena = QueryArena::create();
+            std::shared_ptr<IEnumerable<int>> query;
+            {
+                QueryArena::Scope scope(arena);
+                Assert::IsTrue(arena == QueryArena::current());
+                query = IEnumerable<int>::Range(0, 100)
+                    ->Where([](int x) { return x % 2 == 0; })
+                    ->Select<int>([](int x) { return x * 3; })
+                    ->Skip(10)
+                    ->Take(20);
+            }
+            Assert::IsTrue(nullptr == QueryArena::current());
+
+            QueryArena::Statistics statistics = arena->statistics();
+            Assert::IsTrue(statistics.allocations >= 5);
+            Assert::IsTrue(statistics.bytes > 0);
+            Assert::IsTrue(statistics.chunks >= 1);
+
+            Assert::AreEqual(20, query->Count());
+            Assert::AreEqual(3 * (20 + 58) * 10, query->Sum());
+            Assert::AreEqual(60, query->First());
+        }
+
+        TEST_METHOD(QueryArena_NoScopeNoArena)
+        {
+            std::shared_ptr<QueryArena> arena = QueryArena::create();
+            long long allocations = arena->statistics().allocations;
+            {
+                QueryArena::Scope scope(arena);
+            }
+            auto query = IEnumerable<int>::Range(0, 10)->Where([](int x) { return x > 4; });
+            Assert::AreEqual(5, query->Count());
+            Assert::AreEqual(allocations, arena->statistics().allocations);
+        }
+
+        TEST_METHOD(QueryArena_OutlivesTheScope)
+        {
+            std::weak_ptr<QueryArena> weak;
+            std::shared_ptr<IEnumerable<int>> query;
+            {
+                std::shared_ptr<QueryArena> arena = QueryArena::create();
+                weak = arena;
+                QueryArena::Scope scope(arena);
+                query = IEnumerable<int>::Range(1, 10)->Select<int>([](int x) { return x * x; });
+            }
+            // the scope and the handle are gone, the query still needs it
+            Assert::IsFalse(weak.expired());
+            Assert::AreEqual(385, query->Sum());
+
+            auto e = query->GetEnumerator();
+            query.reset();
+            Assert::IsFalse(weak.expired());
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(1, e->get_Current());
+
+            e.reset();
+            Assert::IsTrue(weak.expired());
+        }
+
+        TEST_METHOD(QueryArena_EnumeratorsUseTheArenaOfTheirNode)
+        {
+            std::shared_ptr<QueryArena> arena = QueryArena::create();
+            std::shared_ptr<IEnumerable<int>> query;
+            {
+                QueryArena::Scope scope(arena);
+                query = IEnumerable<int>::Range(0, 10)
+                    ->Where([](int x) { return x % 2 == 1; })
+                    ->Select<int>([](int x) { return x * 2; });
+            }
+
+            long long allocations = arena->statistics().allocations;
+            for (int i = 0; i < 3; i++) {
+                auto e = query->GetEnumerator();
+                int total = 0;
+                while (e->MoveNext()) {
+                    total += e->get_Current();
+                }
+                Assert::AreEqual(50, total);
+            }
+            Assert::IsTrue(arena->statistics().allocations > allocations);
+        }
+
+        TEST_METHOD(QueryArena_NestedScopes)
+        {
+            std::shared_ptr<QueryArena> outer = QueryArena::create();
+            std::shared_ptr<QueryArena> inner = QueryArena::create();
+            std::shared_ptr<IEnumerable<int>> a;
+            std::shared_ptr<IEnumerable<int>> b;
+            std::shared_ptr<IEnumerable<int>> c;
+            {
+                QueryArena::Scope outerScope(outer);
+                a = IEnumerable<int>::Range(0, 10);
+                long long allocations = outer->statistics().allocations;
+                Assert::IsTrue(allocations > 0);
+                {
+                    QueryArena::Scope innerScope(inner);
+                    Assert::IsTrue(inner == QueryArena::current());
+                    b = a->Where([](int x) { return x < 5; });
+                }
+                Assert::IsTrue(outer == QueryArena::current());
+                Assert::AreEqual(allocations, outer->statistics().allocations);
+                Assert::IsTrue(inner->statistics().allocations > 0);
+                c = b->Select<int>([](int x) { return x + 1; });
+            }
+            Assert::IsTrue(nullptr == QueryArena::current());
+            Assert::AreEqual(15, c->Sum());
+        }
+
+        TEST_METHOD(QueryArena_LargeObjects)
+        {
+            std::shared_ptr<QueryArena> handle = QueryArena::create(64);
+            QueryArena* arena = handle.get();
+            QueryArena::Statistics before = arena->statistics();
+            void* small = arena->allocate(16, 8);
+            long long chunks = arena->statistics().chunks;
+            // larger than a chunk: one of its own
+            void* large = arena->allocate(1000, 16);
+            Assert::AreEqual(chunks + 1, arena->statistics().chunks);
+            void* aligned = arena->allocate(8, 64);
+            Assert::IsTrue(nullptr != small && nullptr != large && nullptr != aligned);
+            Assert::AreEqual(0, (int)((size_t)large % 16));
+            Assert::AreEqual(0, (int)((size_t)aligned % 64));
+
+            // the allocations keep the arena alive
+            handle.reset();
+            memset(large, 0, 1000);
+            QueryArena::Statistics statistics = arena->statistics();
+            Assert::AreEqual(3LL, statistics.allocations - before.allocations);
+            Assert::AreEqual(16LL + 1000 + 8, statistics.bytes - before.bytes);
+            Assert::IsTrue(statistics.chunks > before.chunks);
+
+            arena->deallocate(large);
+            arena->deallocate(small);
+            arena->deallocate(aligned);
+        }
+    };
+}
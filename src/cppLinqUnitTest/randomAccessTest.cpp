@@ -0,0 +1,218 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include <list>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(RandomAccessTest)
+    {
+        // 0..count-1 in a vector, counting the enumerators asked for.
+        class Indexed : public Vector<int>
+        {
+        public:
+            Indexed(const int* p, size_t len) : Vector<int>(p, len), _enumerators(0) {
+            }
+
+            virtual std::shared_ptr<IEnumerator<int>> GetEnumerator() {
+                _enumerators++;
+                return Vector<int>::GetEnumerator();
+            }
+
+            int enumerators() const {
+                return _enumerators;
+            }
+
+        private:
+            int _enumerators;
+        };
+
+        static std::shared_ptr<Indexed> indexed(int count)
+        {
+            std::vector<int> v(count + 1);
+            for (int i = 0; i < count; i++) {
+                v[i] = i;
+            }
+            return std::make_shared<Indexed>(&v[0], (size_t)count);
+        }
+
+        // The elements read with MoveNext, MoveNextBatch and foreach, which
+        // must agree.
+        static std::vector<int> elements(std::shared_ptr<IEnumerable<int>> source)
+        {
+            std::vector<int> moveNext;
+            auto e = source->GetEnumerator();
+            while (e->MoveNext()) {
+                moveNext.push_back(e->get_Current());
+            }
+
+            std::vector<int> batches;
+            e = source->GetEnumerator();
+            int* items;
+            size_t count;
+            while (0 != (count = e->MoveNextBatch(items, 3))) {
+                batches.insert(batches.end(), items, items + count);
+            }
+
+            std::vector<int> pushed;
+            foreach<int>(source, [&pushed](int& x) {
+                pushed.push_back(x);
+            });
+
+            Assert::IsTrue(moveNext == batches);
+            Assert::IsTrue(moveNext == pushed);
+            return moveNext;
+        }
+
+        static std::vector<int> sequence(int first, int last, int step = 1)
+        {
+            std::vector<int> v;
+            for (int i = first; (step > 0) ? (i <= last) : (i >= last); i += step) {
+                v.push_back(i);
+            }
+            return v;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "randomAccess\n");
+
+            RandomAccessTest t;
+            t.RandomAccess_Capability();
+            t.RandomAccess_TerminalOperatorsDoNotEnumerate();
+            t.RandomAccess_SkipTakeReverse();
+            t.RandomAccess_ViewsAreDeferred();
+            t.RandomAccess_ViewsHaveRandomAccess();
+            t.RandomAccess_SequenceEqual();
+        }
+
+        TEST_METHOD(RandomAccess_Capability)
+        {
+            std::vector<int> v(3);
+            std::list<int> l(3);
+            std::shared_ptr<IEnumerable<int>> vector(new StlEnumerable<std::vector<int>, int>(v));
+            std::shared_ptr<IEnumerable<int>> list(new StlEnumerable<std::list<int>, int>(l));
+
+            Assert::IsTrue(nullptr != vector->randomAccess());
+            Assert::IsTrue(&v[0] == vector->randomAccess()->get_Data());
+            Assert::IsTrue(nullptr == list->randomAccess());
+            Assert::IsTrue(nullptr == IEnumerable<int>::Range(0, 3)->randomAccess());
+            Assert::IsTrue(nullptr == vector->Where([](int) { return true; })->randomAccess());
+        }
+
+        TEST_METHOD(RandomAccess_TerminalOperatorsDoNotEnumerate)
+        {
+            std::shared_ptr<Indexed> source = indexed(100);
+            std::shared_ptr<IEnumerable<int>> empty = indexed(0);
+
+            Assert::AreEqual(100, source->Count());
+            Assert::AreEqual(100LL, source->LongCount());
+            Assert::AreEqual(42, source->ElementAt(42));
+            Assert::AreEqual(0, source->ElementAtOrDefault(100));
+            Assert::AreEqual(0, source->ElementAtOrDefault(-1));
+            Assert::AreEqual(99, source->Last());
+            Assert::AreEqual(99, source->LastOrDefault());
+            Assert::AreEqual(0, empty->LastOrDefault());
+            Assert::AreEqual(0, source->enumerators());
+
+            bool thrown = false;
+            try {
+                empty->Last();
+            }
+            catch (InvalidOperationException&) {
+                thrown = true;
+            }
+            Assert::IsTrue(thrown);
+        }
+
+        TEST_METHOD(RandomAccess_SkipTakeReverse)
+        {
+            std::shared_ptr<IEnumerable<int>> source = indexed(10);
+
+            Assert::IsTrue(sequence(3, 9) == elements(source->Skip(3)));
+            Assert::IsTrue(sequence(0, 9) == elements(source->Skip(-1)));
+            Assert::IsTrue(elements(source->Skip(10)).empty());
+            Assert::IsTrue(elements(source->Skip(11)).empty());
+            Assert::IsTrue(sequence(0, 3) == elements(source->Take(4)));
+            Assert::IsTrue(elements(source->Take(0)).empty());
+            Assert::IsTrue(elements(source->Take(-2)).empty());
+            Assert::IsTrue(sequence(0, 9) == elements(source->Take(20)));
+            Assert::IsTrue(sequence(2, 5) == elements(source->Skip(2)->Take(4)));
+            Assert::IsTrue(sequence(9, 0, -1) == elements(source->Reverse()));
+            Assert::IsTrue(sequence(7, 2, -1) == elements(source->Skip(2)->Reverse()->Skip(2)));
+            Assert::IsTrue(sequence(0, 9) == elements(source->Reverse()->Reverse()));
+            Assert::IsTrue(elements(indexed(0)->Reverse()).empty());
+
+            // stopped early
+            Assert::AreEqual(9 + 8 + 7, source->Reverse()->Take(3)->Sum());
+            Assert::AreEqual(5, source->Skip(5)->First());
+        }
+
+        TEST_METHOD(RandomAccess_ViewsAreDeferred)
+        {
+            std::vector<int> v = sequence(0, 4);
+            std::shared_ptr<IEnumerable<int>> source(new StlEnumerable<std::vector<int>, int>(v));
+            auto skipped = source->Skip(2);
+            auto reversed = source->Reverse();
+
+            v.push_back(5);
+            Assert::IsTrue(sequence(2, 5) == elements(skipped));
+            Assert::IsTrue(sequence(5, 0, -1) == elements(reversed));
+            v.clear();
+            Assert::AreEqual(0, skipped->Count());
+            Assert::AreEqual(0, reversed->Count());
+        }
+
+        TEST_METHOD(RandomAccess_ViewsHaveRandomAccess)
+        {
+            std::shared_ptr<Indexed> source = indexed(100);
+            auto query = std::shared_ptr<IEnumerable<int>>(source)->Skip(10)->Reverse()->Take(20);
+
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            Assert::IsTrue(nullptr != query->randomAccess());
+            Assert::AreEqual(20, query->Count());
+            Assert::AreEqual(89, query->ElementAt(10));
+            Assert::AreEqual(80, query->Last());
+            Assert::AreEqual(0, source->enumerators());
+#endif
+            Assert::IsTrue(sequence(99, 80, -1) == elements(query));
+        }
+
+        TEST_METHOD(RandomAccess_SequenceEqual)
+        {
+            std::vector<int> a = sequence(0, 99);
+            std::vector<int> b = sequence(0, 99);
+            std::vector<int> shorter = sequence(0, 98);
+            std::shared_ptr<IEnumerable<int>> lhs(new StlEnumerable<std::vector<int>, int>(a));
+            std::shared_ptr<IEnumerable<int>> rhs(new StlEnumerable<std::vector<int>, int>(b));
+            std::shared_ptr<IEnumerable<int>> other(new StlEnumerable<std::vector<int>, int>(shorter));
+
+            Assert::IsTrue(lhs->SequenceEqual(rhs));
+            Assert::IsFalse(lhs->SequenceEqual(other));
+            Assert::IsFalse(other->SequenceEqual(lhs));
+            Assert::IsTrue(lhs->SequenceEqual(&b[0], b.size()));
+            Assert::IsFalse(lhs->SequenceEqual(&shorter[0], shorter.size()));
+            Assert::IsTrue(lhs->Reverse()->Reverse()->SequenceEqual(rhs));
+            Assert::IsTrue(lhs->Skip(1)->SequenceEqual(rhs->Skip(1)));
+            b[99] = -1;
+            Assert::IsFalse(lhs->SequenceEqual(rhs));
+            Assert::IsFalse(lhs->SequenceEqual(&b[0], b.size()));
+
+            // compared with ==: 0.0 == -0.0
+            std::vector<double> zeros(10, 0.0);
+            std::vector<double> negativeZeros(10, -0.0);
+            std::shared_ptr<IEnumerable<double>> z(new StlEnumerable<std::vector<double>, double>(zeros));
+            std::shared_ptr<IEnumerable<double>> nz(new StlEnumerable<std::vector<double>, double>(negativeZeros));
+            Assert::IsTrue(z->SequenceEqual(nz));
+            Assert::IsTrue(z->SequenceEqual(&negativeZeros[0], negativeZeros.size()));
+
+            // and with another type
+            long longs[] = { 0, 1, 2 };
+            Assert::IsTrue(lhs->Take(3)->SequenceEqual(longs, ARRAYSIZE(longs)));
+        }
+    };
+}
@@ -71,9 +71,16 @@ namespace UnitTest
             iterator->MoveNext();
             Assert::AreEqual(3, iterator->get_Current());
 
-            V[2] = 100; // This change *won't* be seen                
+            V[2] = 100;
             iterator->MoveNext();
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // This change *will* be seen too: a source with random access
+            // is read in place, not buffered (see IRandomAccess)
+            Assert::AreEqual(100, iterator->get_Current());
+#else
+            // This change *won't* be seen
             Assert::AreEqual(2, iterator->get_Current());
+#endif
 
             iterator->MoveNext();
             Assert::AreEqual(99, iterator->get_Current());
@@ -0,0 +1,146 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(SharedSourceTest)
+    {
+        // 0..count-1, recording the number of shared_ptrs to it while it is
+        // pushed.
+        class Probe : public IEnumerable<int>
+        {
+        public:
+            Probe(int count) : _range(IEnumerable<int>::Range(0, count)), _owners(0) {
+            }
+
+            virtual std::shared_ptr<IEnumerator<int>> GetEnumerator() {
+                return _range->GetEnumerator();
+            }
+
+            virtual bool pushTo(_Sink<int>& sink) {
+                // (minus the one made here)
+                _owners = shared_from_this().use_count() - 1;
+                return _range->pushTo(sink);
+            }
+
+            long owners() const {
+                return _owners;
+            }
+
+        private:
+            std::shared_ptr<IEnumerable<int>> _range;
+            long _owners;
+        };
+
+        // A predicate with a state: true for every other element.
+        struct EveryOther
+        {
+            EveryOther() : n(0) {
+            }
+
+            bool operator()(int) const {
+                return 0 == (n++ % 2);
+            }
+
+            mutable int n;
+        };
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "sharedSource\n");
+
+            SharedSourceTest t;
+            t.SharedSource_TerminalOperatorsTakeNoReference();
+            t.SharedSource_StagesDoNotCopyTheirSource();
+            t.SharedSource_FunctorsAreCopiedForEachRun();
+            t.SharedSource_ConcurrentQueries();
+        }
+
+        TEST_METHOD(SharedSource_TerminalOperatorsTakeNoReference)
+        {
+            std::shared_ptr<Probe> probe(new Probe(10));
+            std::shared_ptr<IEnumerable<int>> source = probe;
+
+            Assert::AreEqual(10, source->Count());
+            Assert::AreEqual(2L, probe->owners());
+            Assert::AreEqual(45, source->Sum());
+            Assert::AreEqual(2L, probe->owners());
+            Assert::AreEqual(9, source->Max());
+            Assert::AreEqual(45, source->Aggregate([](int a, int b) { return a + b; }));
+            Assert::AreEqual(2L, probe->owners());
+
+            int count = 0;
+            foreach<int>(source, [&count](int&) {
+                count++;
+            });
+            Assert::AreEqual(10, count);
+            Assert::AreEqual(2L, probe->owners());
+        }
+
+        TEST_METHOD(SharedSource_StagesDoNotCopyTheirSource)
+        {
+            std::shared_ptr<Probe> probe(new Probe(10));
+            std::shared_ptr<IEnumerable<int>> query = std::shared_ptr<IEnumerable<int>>(probe)
+                ->Where([](int x) { return x % 2 == 0; })
+                ->Select<int>([](int x) { return x + 1; });
+            Assert::AreEqual(25, query->Sum());
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // probe and the prototype of Where
+            Assert::AreEqual(2L, probe->owners());
+#endif
+        }
+
+        TEST_METHOD(SharedSource_FunctorsAreCopiedForEachRun)
+        {
+            auto query = IEnumerable<int>::Range(0, 10)->Where(EveryOther());
+            Assert::AreEqual(5, query->Count());
+            Assert::AreEqual(5, query->Count());
+            Assert::AreEqual(0 + 2 + 4 + 6 + 8, query->Sum());
+        }
+
+        TEST_METHOD(SharedSource_ConcurrentQueries)
+        {
+            std::shared_ptr<IEnumerable<int>> source = IEnumerable<int>::Range(0, 100);
+            std::shared_ptr<IEnumerable<int>> query = source->Where([](int x) { return x % 2 == 0; });
+
+            std::vector<int> totals(4);
+            std::vector<std::thread> workers;
+            for (size_t t = 0; t < totals.size(); t++) {
+                int* total = &totals[t];
+                workers.push_back(std::thread([source, query, total]() {
+                    for (int i = 0; i < 100; i++) {
+                        *total += query->Sum() - source->Where([](int x) { return x < 50; })->Count();
+                    }
+                }));
+            }
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
+            }
+            for (size_t t = 0; t < totals.size(); t++) {
+                Assert::AreEqual(100 * (2450 - 50), totals[t]);
+            }
+            // source and the prototype of query
+            Assert::AreEqual(2L, source.use_count());
+        }
+    };
+}
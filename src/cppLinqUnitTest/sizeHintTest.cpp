@@ -0,0 +1,204 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include <list>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(SizeHintTest)
+    {
+        typedef StlEnumerable<std::vector<int>, int> VectorOfInts;
+        typedef StlEnumerable<std::list<int>, int> ListOfInts;
+
+        static void isExact(size_t size, const SizeHint& hint)
+        {
+            Assert::IsTrue(SizeHint::Exact == hint.kind);
+            Assert::IsTrue(size == hint.size);
+        }
+
+        static void isAtMost(size_t size, const SizeHint& hint)
+        {
+            Assert::IsTrue(SizeHint::AtMost == hint.kind);
+            Assert::IsTrue(size == hint.size);
+        }
+
+        static void isUnknown(const SizeHint& hint)
+        {
+            Assert::IsFalse(hint.isKnown());
+        }
+
+        static std::shared_ptr<Vector<Counted>> counted(int count)
+        {
+            std::vector<Counted> elements;
+            for (int i = 0; i < count; i++) {
+                elements.push_back(Counted(i));
+            }
+            return std::make_shared<Vector<Counted>>(&elements[0], elements.size());
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "sizeHint\n");
+
+            SizeHintTest t;
+            t.SizeHint_Sources();
+            t.SizeHint_Arithmetic();
+            t.SizeHint_Propagation();
+            t.SizeHint_SetOperators();
+            t.SizeHint_Deferred();
+            t.SizeHint_ReverseReserves();
+        }
+
+        TEST_METHOD(SizeHint_Sources)
+        {
+            std::vector<int> v(10);
+            std::list<int> l(10);
+
+            isExact(10, std::make_shared<VectorOfInts>(v)->sizeHint());
+            isUnknown(std::make_shared<ListOfInts>(l)->sizeHint());
+            isExact(7, IEnumerable<int>::Range(3, 7)->sizeHint());
+            isExact(5, IEnumerable<int>::Repeat(1, 5)->sizeHint());
+            isExact(0, IEnumerable<int>::Repeat(1, 0)->sizeHint());
+            isExact(0, IEnumerable<int>::Empty()->sizeHint());
+        }
+
+        TEST_METHOD(SizeHint_Arithmetic)
+        {
+            isExact(3, SizeHint::exact(10).skip(7));
+            isExact(0, SizeHint::exact(10).skip(20));
+            isAtMost(3, SizeHint::atMost(10).skip(7));
+            isUnknown(SizeHint::unknown().skip(7));
+
+            isExact(7, SizeHint::exact(10).take(7));
+            isExact(10, SizeHint::exact(10).take(20));
+            isAtMost(7, SizeHint::atMost(10).take(7));
+            isAtMost(7, SizeHint::unknown().take(7));
+
+            isExact(15, SizeHint::exact(10) + SizeHint::exact(5));
+            isAtMost(15, SizeHint::exact(10) + SizeHint::atMost(5));
+            isUnknown(SizeHint::exact(10) + SizeHint::unknown());
+            isUnknown(SizeHint::exact((size_t)-1) + SizeHint::exact(1));
+
+            isAtMost(10, SizeHint::exact(10).bound());
+            isUnknown(SizeHint::unknown().bound());
+
+            // the room reserved for a hint: an upper bound only if small
+            Assert::IsTrue(100000 == SizeHint::exact(100000).capacity());
+            Assert::IsTrue(100 == SizeHint::atMost(100).capacity());
+            Assert::IsTrue(SizeHint::MaxReservedBound == SizeHint::atMost(100000).capacity());
+            Assert::IsTrue(0 == SizeHint::unknown().capacity());
+            Assert::IsTrue(SizeHint::exact(100000).reservable());
+            Assert::IsTrue(SizeHint::atMost(100).reservable());
+            Assert::IsFalse(SizeHint::atMost(100000).reservable());
+            Assert::IsFalse(SizeHint::unknown().reservable());
+        }
+
+        TEST_METHOD(SizeHint_Propagation)
+        {
+            std::vector<int> v(100);
+            std::list<int> l(100);
+            std::shared_ptr<IEnumerable<int>> sized = std::make_shared<VectorOfInts>(v);
+            std::shared_ptr<IEnumerable<int>> unsized = std::make_shared<ListOfInts>(l);
+
+            // Select keeps the count, Take caps it, Skip subtracts from it
+            isExact(100, sized->Select<int>([](int x) { return x + 1; })->sizeHint());
+            isExact(100, sized->SelectIndex<int>([](int x, int i) { return x + i; })->sizeHint());
+            isExact(10, sized->Take(10)->sizeHint());
+            isExact(100, sized->Take(1000)->sizeHint());
+            isExact(0, sized->Take(-1)->sizeHint());
+            isExact(90, sized->Skip(10)->sizeHint());
+            isExact(0, sized->Skip(1000)->sizeHint());
+            isExact(100, sized->Skip(-1)->sizeHint());
+            isExact(80, sized->Select<int>([](int x) { return x; })->Skip(10)->Take(80)->sizeHint());
+            isAtMost(10, unsized->Take(10)->sizeHint());
+            isUnknown(unsized->Skip(10)->sizeHint());
+
+            // Concat adds, Reverse keeps
+            isExact(200, sized->Concat(sized)->sizeHint());
+            isAtMost(110, sized->Concat(unsized->Take(10))->sizeHint());
+            isUnknown(sized->Concat(unsized)->sizeHint());
+            isExact(100, sized->Reverse()->sizeHint());
+            isExact(100, sized->Select<int>([](int x) { return x; })->Reverse()->sizeHint());
+            isExact(5, IEnumerable<int>::Range(0, 10)->Concat(IEnumerable<int>::Repeat(1, 10))->Skip(15)->sizeHint());
+
+            // the filters keep an upper bound
+            isAtMost(100, sized->Where([](int x) { return x > 0; })->sizeHint());
+            isAtMost(100, sized->WhereIndex([](int x, int i) { return x > i; })->sizeHint());
+            isAtMost(100, sized->SkipWhile([](int x) { return x > 0; })->sizeHint());
+            isAtMost(100, sized->TakeWhile([](int x) { return x > 0; })->sizeHint());
+            isAtMost(10, sized->Where([](int x) { return x > 0; })->Take(10)->sizeHint());
+            isAtMost(50, sized->Where([](int x) { return x > 0; })->Skip(50)->sizeHint());
+            isUnknown(unsized->Where([](int x) { return x > 0; })->sizeHint());
+
+            // nothing is known of what SelectMany flattens
+            isUnknown(sized->SelectMany<int>([](int x) { return IEnumerable<int>::Range(0, 2); })->sizeHint());
+        }
+
+        TEST_METHOD(SizeHint_SetOperators)
+        {
+            std::vector<int> v(100);
+            std::vector<int> w(30);
+            std::list<int> l(100);
+            std::shared_ptr<IEnumerable<int>> lhs = std::make_shared<VectorOfInts>(v);
+            std::shared_ptr<IEnumerable<int>> rhs = std::make_shared<VectorOfInts>(w);
+            std::shared_ptr<IEnumerable<int>> unsized = std::make_shared<ListOfInts>(l);
+
+            isAtMost(100, lhs->Distinct()->sizeHint());
+            isAtMost(100, lhs->Distinct(std::less<int>())->sizeHint());
+            isAtMost(130, lhs->Union(rhs)->sizeHint());
+            isAtMost(130, lhs->Union(rhs, std::less<int>())->sizeHint());
+            isUnknown(lhs->Union(unsized)->sizeHint());
+            isAtMost(100, lhs->Except(rhs)->sizeHint());
+            isAtMost(100, lhs->Except(unsized, std::less<int>())->sizeHint());
+        }
+
+        TEST_METHOD(SizeHint_Deferred)
+        {
+            std::vector<int> v(10);
+            std::shared_ptr<IEnumerable<int>> query = std::make_shared<VectorOfInts>(v)
+                ->Select<int>([](int x) { return x * 2; })
+                ->Take(100);
+            isExact(10, query->sizeHint());
+
+            // the hint is worked out when asked for
+            v.resize(50);
+            isExact(50, query->sizeHint());
+            v.resize(500);
+            isExact(100, query->sizeHint());
+            Assert::AreEqual(100, query->Count());
+        }
+
+        TEST_METHOD(SizeHint_ReverseReserves)
+        {
+            // Select hides the random access of the source, so Reverse
+            // buffers it: Counted has no noexcept move constructor, so a
+            // buffer that grew would copy the elements again
+            std::shared_ptr<IEnumerable<Counted>> source = counted(100);
+            auto reversed = source->Select<Counted>([](Counted& c) { return Counted(c.value); })->Reverse();
+
+            Counted::reset();
+            int last = 100;
+            bool ordered = true;
+            foreach<Counted>(reversed, [&last, &ordered](Counted& c) {
+                ordered = ordered && (c.value == --last);
+            });
+            Assert::IsTrue(ordered);
+            Assert::AreEqual(0, last);
+            Assert::AreEqual(100, Counted::copies());
+
+            // an upper bound is as good
+            auto even = source->Where([](Counted& c) { return c.value % 2 == 0; })->Reverse();
+            Counted::reset();
+            int total = 0;
+            foreach<Counted>(even, [&total](Counted& c) {
+                total += c.value;
+            });
+            Assert::AreEqual((0 + 98) * 50 / 2, total);
+            Assert::AreEqual(50, Counted::copies());
+        }
+    };
+}
@@ -0,0 +1,259 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include "throwingEnumerable.h"
+#include <functional>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(SortedTest)
+    {
+        static std::shared_ptr<IEnumerable<int>> ints(const std::vector<int>& v)
+        {
+            return std::make_shared<Vector<int>>(&v[0], v.size());
+        }
+
+        static std::shared_ptr<IEnumerable<Counted>> counted(const std::vector<int>& v)
+        {
+            std::vector<Counted> elements;
+            for (size_t i = 0; i < v.size(); i++) {
+                elements.push_back(Counted(v[i]));
+            }
+            return std::make_shared<Vector<Counted>>(&elements[0], elements.size());
+        }
+
+        static std::vector<int> values(const std::vector<Counted>& v)
+        {
+            std::vector<int> result;
+            for (size_t i = 0; i < v.size(); i++) {
+                result.push_back(v[i].value);
+            }
+            return result;
+        }
+
+        static std::vector<int> list(std::initializer_list<int> l)
+        {
+            return std::vector<int>(l);
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "sorted\n");
+
+            SortedTest t;
+            t.Sorted_Marks();
+            t.Sorted_Distinct();
+            t.Sorted_Union();
+            t.Sorted_Except();
+            t.Sorted_Intersect();
+            t.Sorted_Comparer();
+            t.Sorted_MismatchedOrderings();
+            t.Sorted_Streams();
+            t.Sorted_SizeHint();
+            t.Sorted_ConstantMemory();
+        }
+
+        TEST_METHOD(Sorted_Marks)
+        {
+            std::shared_ptr<IEnumerable<int>> source = ints(list({ 1, 2, 2, 3 }));
+            Assert::IsTrue(nullptr == source->ordering());
+
+            // the elements pass through, untouched
+            auto sorted = source->AsSorted();
+            Assert::IsTrue(nullptr != sorted->ordering());
+            Assert::IsTrue(list({ 1, 2, 2, 3 }) == sorted->ToVector());
+            Assert::IsTrue(nullptr != sorted->randomAccess());
+            Assert::AreEqual(3, sorted->ElementAt(3));
+
+            // the results of the merges are marked; those of the other
+            // operators are not
+            Assert::IsTrue(nullptr != sorted->Distinct()->ordering());
+            Assert::IsTrue(nullptr != sorted->Union(sorted)->Except(sorted)->ordering());
+            Assert::IsTrue(nullptr == sorted->Where([](int x) { return x > 1; })->ordering());
+            Assert::IsTrue(nullptr == sorted->Distinct(std::less<int>())->ordering());
+        }
+
+        TEST_METHOD(Sorted_Distinct)
+        {
+            Assert::IsTrue(list({ 1, 2, 3, 7 }) == ints(list({ 1, 1, 2, 3, 3, 3, 7 }))->AsSorted()->Distinct()->ToVector());
+            Assert::IsTrue(list({ 5 }) == ints(list({ 5, 5, 5 }))->AsSorted()->Distinct()->ToVector());
+            Assert::AreEqual(0, IEnumerable<int>::Empty()->AsSorted()->Distinct()->Count());
+
+            // pulled as well as pushed
+            std::vector<int> pulled;
+            auto e = ints(list({ 1, 1, 2 }))->AsSorted()->Distinct()->GetEnumerator();
+            while (e->MoveNext()) {
+                pulled.push_back(e->get_Current());
+            }
+            Assert::IsTrue(list({ 1, 2 }) == pulled);
+            e->Reset();
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(1, e->get_Current());
+        }
+
+        TEST_METHOD(Sorted_Union)
+        {
+            auto lhs = ints(list({ 1, 3, 3, 5, 9 }))->AsSorted();
+            auto rhs = ints(list({ 0, 3, 4, 9, 9, 12 }))->AsSorted();
+
+            // in order, not lhs first
+            Assert::IsTrue(list({ 0, 1, 3, 4, 5, 9, 12 }) == lhs->Union(rhs)->ToVector());
+            Assert::IsTrue(list({ 0, 1, 3, 4, 5, 9, 12 }) == rhs->Union(lhs)->ToVector());
+            Assert::IsTrue(list({ 1, 3, 5, 9 }) == lhs->Union(IEnumerable<int>::Empty()->AsSorted())->ToVector());
+            Assert::IsTrue(list({ 1, 3, 5, 9 }) == IEnumerable<int>::Empty()->AsSorted()->Union(lhs)->ToVector());
+
+            Assert::ExpectException<ArgumentNullException&>([&lhs]() {
+                lhs->Union(nullptr);
+            });
+        }
+
+        TEST_METHOD(Sorted_Except)
+        {
+            auto lhs = ints(list({ 1, 2, 2, 3, 5, 8, 8, 13 }))->AsSorted();
+            auto rhs = ints(list({ 0, 2, 4, 8, 8, 20 }))->AsSorted();
+
+            Assert::IsTrue(list({ 1, 3, 5, 13 }) == lhs->Except(rhs)->ToVector());
+            Assert::IsTrue(list({ 0, 4, 20 }) == rhs->Except(lhs)->ToVector());
+            Assert::IsTrue(list({ 1, 2, 3, 5, 8, 13 }) == lhs->Except(IEnumerable<int>::Empty()->AsSorted())->ToVector());
+            Assert::AreEqual(0, lhs->Except(lhs)->Count());
+
+            Assert::ExpectException<ArgumentNullException&>([&lhs]() {
+                lhs->Except(nullptr);
+            });
+        }
+
+        TEST_METHOD(Sorted_Intersect)
+        {
+            auto lhs = ints(list({ 1, 2, 2, 3, 5, 8, 8, 13 }))->AsSorted();
+            auto rhs = ints(list({ 0, 2, 4, 8, 8, 20 }))->AsSorted();
+
+            Assert::IsTrue(list({ 2, 8 }) == lhs->Intersect(rhs)->ToVector());
+            Assert::IsTrue(list({ 2, 8 }) == rhs->Intersect(lhs)->ToVector());
+            Assert::IsTrue(list({ 1, 2, 3, 5, 8, 13 }) == lhs->Intersect(lhs)->ToVector());
+            Assert::AreEqual(0, lhs->Intersect(IEnumerable<int>::Empty()->AsSorted())->Count());
+
+            Assert::ExpectException<ArgumentNullException&>([&lhs]() {
+                lhs->Intersect(nullptr);
+            });
+        }
+
+        TEST_METHOD(Sorted_Comparer)
+        {
+            String v0[] = { "a", "A", "b", "C", "c" };
+            String v1[] = { "B", "c", "d" };
+            std::shared_ptr<IEnumerable<String>> first =
+                std::make_shared<Vector<String>>(v0, ARRAYSIZE(v0))->AsSorted(CompareIgnoreCase());
+            std::shared_ptr<IEnumerable<String>> second =
+                std::make_shared<Vector<String>>(v1, ARRAYSIZE(v1))->AsSorted(CompareIgnoreCase());
+
+            // the equivalent elements are equal: the first one is yielded,
+            // that of the first sequence on ties
+            String distinct[] = { "a", "b", "C" };
+            Assert::IsTrue(first->Distinct()->SequenceEqual<String>(distinct, ARRAYSIZE(distinct)));
+            String united[] = { "a", "b", "C", "d" };
+            Assert::IsTrue(first->Union(second)->SequenceEqual<String>(united, ARRAYSIZE(united)));
+            String except[] = { "a" };
+            Assert::IsTrue(first->Except(second)->SequenceEqual<String>(except, ARRAYSIZE(except)));
+            String intersect[] = { "b", "C" };
+            Assert::IsTrue(first->Intersect(second)->SequenceEqual<String>(intersect, ARRAYSIZE(intersect)));
+
+            // descending
+            auto descending = ints(list({ 9, 9, 5, 1 }))->AsSorted(std::greater<int>());
+            Assert::IsTrue(list({ 9, 5, 1 }) == descending->Distinct()->ToVector());
+            Assert::IsTrue(list({ 10, 9, 5, 1, 0 }) ==
+                descending->Union(ints(list({ 10, 5, 0 }))->AsSorted(std::greater<int>()))->ToVector());
+        }
+
+        TEST_METHOD(Sorted_MismatchedOrderings)
+        {
+            auto ascending = ints(list({ 1, 2, 3 }))->AsSorted();
+            auto descending = ints(list({ 4, 3, 2 }))->AsSorted(std::greater<int>());
+            auto unmarked = ints(list({ 4, 3, 2 }));
+
+            // the hash set, in the order of the first sequence, and unmarked
+            auto united = ascending->Union(descending);
+            Assert::IsTrue(nullptr == united->ordering());
+            Assert::IsTrue(list({ 1, 2, 3, 4 }) == united->ToVector());
+            Assert::IsTrue(list({ 1, 2, 3, 4 }) == ascending->Union(unmarked)->ToVector());
+            Assert::IsTrue(list({ 4, 3, 2, 1 }) == unmarked->Union(ascending)->ToVector());
+            Assert::IsTrue(list({ 1 }) == ascending->Except(descending)->ToVector());
+            Assert::IsTrue(list({ 2, 3 }) == ascending->Intersect(unmarked)->ToVector());
+            Assert::IsTrue(nullptr == ascending->Intersect(unmarked)->ordering());
+        }
+
+        TEST_METHOD(Sorted_Streams)
+        {
+            // no input is read before the first MoveNext
+            std::shared_ptr<IEnumerable<int>> throwing(new ThrowingEnumerable());
+            auto sorted = throwing->AsSorted();
+            auto e = sorted->Union(sorted)->GetEnumerator();
+            e = sorted->Except(sorted)->GetEnumerator();
+            e = sorted->Intersect(sorted)->GetEnumerator();
+            e = sorted->Distinct()->GetEnumerator();
+
+            // and then the inputs are read as the results are: rhs up to the
+            // current element of lhs, with Except and Intersect
+            auto lhs = ints(list({ 1, 2, 5 }))->AsSorted();
+            auto rhs = ints(list({ 3, 2, 0 }))->Select<int>([](int x) { return 6 / x; })->AsSorted();   // 2, 3, then throws
+            e = lhs->Except(rhs)->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(1, e->get_Current());
+            Assert::ExpectException<std::exception&>([e]() {
+                e->MoveNext();
+            });
+
+            // Intersect stops as soon as either input is exhausted
+            auto spiked = ints(list({ 0, 1, 2 }))->Select<int>([](int x) { return 10 / (2 - x); })->AsSorted();   // 5, 10, then throws
+            Assert::IsTrue(list({ 5 }) == spiked->Intersect(ints(list({ 5 }))->AsSorted())->ToVector());
+        }
+
+        TEST_METHOD(Sorted_SizeHint)
+        {
+            auto hundred = IEnumerable<int>::Range(0, 100)->AsSorted();
+            auto thirty = IEnumerable<int>::Range(50, 30)->AsSorted();
+
+            Assert::IsTrue(SizeHint::Exact == hundred->sizeHint().kind);
+            SizeHint hint = hundred->Distinct()->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 100 == hint.size);
+            hint = hundred->Union(thirty)->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 130 == hint.size);
+            hint = hundred->Except(thirty)->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 100 == hint.size);
+            hint = hundred->Intersect(thirty)->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 30 == hint.size);
+        }
+
+        TEST_METHOD(Sorted_ConstantMemory)
+        {
+            std::vector<int> v;
+            for (int i = 0; i < 1000; i++) {
+                v.push_back(i / 2);
+            }
+            auto lhs = counted(v)->AsSorted();
+            auto rhs = counted(list({ 10, 20, 30 }))->AsSorted();
+
+            // no set: one copy of each distinct element, to compare the next
+            // ones with, and one into the result
+            Counted::reset();
+            std::vector<Counted> result = lhs->Distinct()->ToVector();
+            Assert::IsTrue(500 == result.size());
+            Assert::IsTrue(Counted::copies() <= 1000);
+            Assert::AreEqual(499, result[499].value);
+
+            Counted::reset();
+            result = lhs->Except(rhs)->ToVector();
+            Assert::IsTrue(497 == result.size());
+            Assert::IsTrue(Counted::copies() <= 1000);
+
+            Counted::reset();
+            result = lhs->Intersect(rhs)->ToVector();
+            Assert::IsTrue(list({ 10, 20, 30 }) == values(result));
+            Assert::IsTrue(Counted::copies() < 100);
+        }
+    };
+}
@@ -0,0 +1,225 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include "throwingEnumerable.h"
+#include <algorithm>
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(SpillTest)
+    {
+        // With room for at most 96 ints: a set of 128 slots of 5 bytes.
+        static const size_t SmallBudget = 1000;
+
+        static std::shared_ptr<IEnumerable<int>> ints(const std::vector<int>& v)
+        {
+            return std::make_shared<Vector<int>>(&v[0], v.size());
+        }
+
+        // Each of 0..count-1 repeated times times, shuffled.
+        static std::vector<int> shuffled(int count, int times)
+        {
+            std::vector<int> v;
+            for (int i = 0; i < count * times; i++) {
+                v.push_back((int)(((long long)i * 7919) % count));
+            }
+            return v;
+        }
+
+        static std::vector<int> range(int first, int count)
+        {
+            std::vector<int> v;
+            for (int i = 0; i < count; i++) {
+                v.push_back(first + i);
+            }
+            return v;
+        }
+
+        template <typename T>
+        static std::vector<T> sorted(std::vector<T> v)
+        {
+            std::sort(v.begin(), v.end());
+            return v;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "spill\n");
+
+            SpillTest t;
+            t.Spill_WithinBudget();
+            t.Spill_Distinct();
+            t.Spill_Union();
+            t.Spill_Except();
+            t.Spill_Strings();
+            t.Spill_NoBudget();
+            t.Spill_Deferred();
+            t.Spill_EnumeratedAgain();
+            t.Spill_SizeHint();
+        }
+
+        TEST_METHOD(Spill_WithinBudget)
+        {
+            std::shared_ptr<IEnumerable<int>> source = ints(shuffled(1000, 3));
+            std::shared_ptr<IEnumerable<int>> rhs = IEnumerable<int>::Range(500, 1000);
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(1 << 20);
+
+            // the same elements in the same order as without a budget
+            Assert::IsTrue(source->Distinct()->ToVector() == source->Distinct(budget)->ToVector());
+            Assert::IsTrue(source->Union(rhs)->ToVector() == source->Union(rhs, budget)->ToVector());
+            Assert::IsTrue(source->Except(rhs)->ToVector() == source->Except(rhs, budget)->ToVector());
+
+            MemoryBudget::Statistics statistics = budget->statistics();
+            Assert::IsTrue(0 == statistics.spills && 0 == statistics.partitions && 0 == statistics.bytes);
+        }
+
+        TEST_METHOD(Spill_Distinct)
+        {
+            std::shared_ptr<IEnumerable<int>> source = ints(shuffled(10000, 3));
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(SmallBudget);
+
+            std::vector<int> expected = source->Distinct()->ToVector();
+            std::vector<int> result = source->Distinct(budget)->ToVector();
+            Assert::IsTrue(range(0, 10000) == sorted(result));
+
+            // in the order of the source until the set is full, then a
+            // partition at a time
+            Assert::IsTrue(std::equal(expected.begin(), expected.begin() + 96, result.begin()));
+            Assert::IsFalse(expected == result);
+
+            // the partitions of 10000 / 16 elements did not fit either, and
+            // were split again
+            MemoryBudget::Statistics statistics = budget->statistics();
+            Assert::IsTrue(statistics.spills >= 1 + 16);
+            Assert::IsTrue(statistics.partitions >= 16 + 16 * 16);
+            Assert::IsTrue(statistics.bytes >= (long long)((30000 - 96) * sizeof(int)));
+        }
+
+        TEST_METHOD(Spill_Union)
+        {
+            std::shared_ptr<IEnumerable<int>> lhs = ints(shuffled(5000, 2));
+            std::shared_ptr<IEnumerable<int>> rhs = IEnumerable<int>::Range(2500, 5000);
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(SmallBudget);
+
+            std::vector<int> result = lhs->Union(rhs, budget)->ToVector();
+            Assert::IsTrue(range(0, 7500) == sorted(result));
+            std::vector<int> expected = lhs->Union(rhs)->ToVector();
+            Assert::IsTrue(std::equal(expected.begin(), expected.begin() + 96, result.begin()));
+            Assert::IsTrue(budget->statistics().spills > 0);
+
+            Assert::ExpectException<ArgumentNullException&>([&lhs, &budget]() {
+                lhs->Union(nullptr, budget);
+            });
+        }
+
+        TEST_METHOD(Spill_Except)
+        {
+            std::shared_ptr<IEnumerable<int>> lhs = ints(shuffled(10000, 2));
+            std::shared_ptr<IEnumerable<int>> evens = IEnumerable<int>::Range(0, 5000)
+                ->Select<int>([](int x) { return x * 2; });
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(SmallBudget);
+
+            // rhs does not fit in the set: its elements are partitioned too
+            std::vector<int> result = lhs->Except(evens, budget)->ToVector();
+            Assert::IsTrue(5000 == result.size());
+            Assert::IsTrue(sorted(result) == IEnumerable<int>::Range(0, 5000)
+                ->Select<int>([](int x) { return x * 2 + 1; })->ToVector());
+            Assert::IsTrue(budget->statistics().spills > 0);
+
+            // only lhs spills
+            std::vector<int> small = range(0, 10);
+            result = lhs->Except(ints(small), budget)->ToVector();
+            Assert::IsTrue(range(10, 9990) == sorted(result));
+
+            Assert::ExpectException<ArgumentNullException&>([&lhs, &budget]() {
+                lhs->Except(nullptr, budget);
+            });
+        }
+
+        TEST_METHOD(Spill_Strings)
+        {
+            std::vector<std::string> strings;
+            for (int i = 0; i < 3000; i++) {
+                strings.push_back("a string too long for the small buffer, #" + std::to_string(i % 1000));
+            }
+            std::shared_ptr<IEnumerable<std::string>> source =
+                std::make_shared<Vector<std::string>>(&strings[0], strings.size());
+
+            // the characters count against the budget, not just the slots
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(16 * 1024);
+            std::vector<std::string> result = source->Distinct(budget)->ToVector();
+            Assert::IsTrue(1000 == result.size());
+            Assert::IsTrue(sorted(source->Distinct()->ToVector()) == sorted(result));
+            Assert::IsTrue(budget->statistics().spills > 0);
+        }
+
+        TEST_METHOD(Spill_NoBudget)
+        {
+            // nothing fits: the partitions are split level after level,
+            // until the bits of the hash run out
+            std::shared_ptr<IEnumerable<int>> source = ints(shuffled(20, 2));
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(0);
+            Assert::IsTrue(range(0, 20) == sorted(source->Distinct(budget)->ToVector()));
+            Assert::IsTrue(budget->statistics().spills >= 16);
+
+            Assert::ExpectException<ArgumentNullException&>([&source]() {
+                source->Distinct(std::shared_ptr<MemoryBudget>());
+            });
+        }
+
+        TEST_METHOD(Spill_Deferred)
+        {
+            std::shared_ptr<IEnumerable<int>> throwing(new ThrowingEnumerable());
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(SmallBudget);
+
+            // no exceptions before MoveNext
+            auto e = throwing->Distinct(budget)->GetEnumerator();
+            e = throwing->Union(throwing, budget)->GetEnumerator();
+            e = throwing->Except(throwing, budget)->GetEnumerator();
+            Assert::ExpectException<InvalidOperationException&>([e]() {
+                e->MoveNext();
+            });
+        }
+
+        TEST_METHOD(Spill_EnumeratedAgain)
+        {
+            std::shared_ptr<IEnumerable<int>> source = ints(shuffled(1000, 2));
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(SmallBudget);
+            std::shared_ptr<IEnumerable<int>> distinct = source->Distinct(budget);
+
+            std::vector<int> first = distinct->ToVector();
+            Assert::IsTrue(range(0, 1000) == sorted(first));
+            Assert::IsTrue(first == distinct->ToVector());
+
+            // reset halfway through a partition
+            auto e = distinct->GetEnumerator();
+            for (int i = 0; i < 500; i++) {
+                e->MoveNext();
+            }
+            e->Reset();
+            std::vector<int> again;
+            while (e->MoveNext()) {
+                again.push_back(e->get_Current());
+            }
+            Assert::IsTrue(first == again);
+        }
+
+        TEST_METHOD(Spill_SizeHint)
+        {
+            std::shared_ptr<IEnumerable<int>> source = IEnumerable<int>::Range(0, 100);
+            std::shared_ptr<MemoryBudget> budget = MemoryBudget::create(SmallBudget);
+
+            SizeHint hint = source->Distinct(budget)->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 100 == hint.size);
+            hint = source->Union(IEnumerable<int>::Range(0, 30), budget)->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 130 == hint.size);
+            hint = source->Except(IEnumerable<int>::Range(0, 30), budget)->sizeHint();
+            Assert::IsTrue(SizeHint::AtMost == hint.kind && 100 == hint.size);
+        }
+    };
+}
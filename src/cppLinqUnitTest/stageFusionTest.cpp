@@ -0,0 +1,223 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(StageFusionTest)
+    {
+        // A fiber block that yields 0..count-1 and counts the elements
+        // produced so far.
+        static std::shared_ptr<IEnumerable<int>> counter(int count, int* produced)
+        {
+            auto fn = [count, produced](IteratorBlock<int>* it) {
+                for (int i = 0; i < count; i++) {
+                    (*produced)++;
+                    it->yieldReturn(i);
+                }
+            };
+            return std::shared_ptr<IEnumerable<int>>(new _IteratorBlock<int>(fn));
+        }
+
+        // A fiber block that adds one to every element of source.
+        static std::shared_ptr<IEnumerable<int>> increment(std::shared_ptr<IEnumerable<int>> source)
+        {
+            auto fn = [source](IteratorBlock<int>* it) {
+                foreach<int>(source, [it](int& item) {
+                    it->yieldReturn(item + 1);
+                });
+            };
+            return std::shared_ptr<IEnumerable<int>>(new _IteratorBlock<int>(fn));
+        }
+
+        template <typename T>
+        static std::vector<T> pull(std::shared_ptr<IEnumerable<T>> source)
+        {
+            std::vector<T> result;
+            auto e = source->GetEnumerator();
+            while (e->MoveNext()) {
+                result.push_back(e->get_Current());
+            }
+            return result;
+        }
+
+        template <typename T>
+        static std::vector<T> push(std::shared_ptr<IEnumerable<T>> source)
+        {
+            std::vector<T> result;
+            foreach<T>(source, [&result](T& item) {
+                result.push_back(item);
+            });
+            return result;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "stageFusion\n");
+
+            StageFusionTest t;
+            t.StageFusion_ChainRunsOnOneFiber();
+            t.StageFusion_InlineBlocksTakeNoStack();
+            t.StageFusion_PushAndPullAgree();
+            t.StageFusion_TakeStopsTheSource();
+            t.StageFusion_YieldBreak();
+            t.StageFusion_ExceptionsArePropagated();
+            t.StageFusion_SmallStacksDoNotRunLargerBlocks();
+        }
+
+        TEST_METHOD(StageFusion_ChainRunsOnOneFiber)
+        {
+            int produced = 0;
+            std::shared_ptr<IEnumerable<int>> chain = counter(100, &produced);
+            for (int i = 0; i < 4; i++) {
+                chain = increment(chain);
+            }
+
+            FiberStackPool& pool = FiberStackPool::instance();
+            long long inUse = pool.statistics().inUse;
+            auto e = chain->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(4, e->get_Current());
+            Assert::AreEqual(inUse + 1, pool.statistics().inUse);
+
+            int count = 1;
+            int last = 0;
+            while (e->MoveNext()) {
+                last = e->get_Current();
+                count++;
+            }
+            Assert::AreEqual(100, count);
+            Assert::AreEqual(103, last);
+        }
+
+        TEST_METHOD(StageFusion_InlineBlocksTakeNoStack)
+        {
+            int produced = 0;
+            auto chain = increment(increment(counter(10, &produced)));
+
+            FiberStackPool& pool = FiberStackPool::instance();
+            FiberStackPool::Statistics before = pool.statistics();
+            Assert::AreEqual(10, chain->Count());
+            FiberStackPool::Statistics after = pool.statistics();
+            Assert::AreEqual(before.hits, after.hits);
+            Assert::AreEqual(before.misses, after.misses);
+        }
+
+        TEST_METHOD(StageFusion_PushAndPullAgree)
+        {
+            int produced = 0;
+            std::shared_ptr<IEnumerable<int>> source = counter(20, &produced);
+            auto isOdd = [](int x) { return 1 == (x & 1); };
+
+            std::shared_ptr<IEnumerable<int>> queries[] = {
+                source->Where(isOdd)->Select<int>([](int x) { return x * 10; }),
+                source->WhereIndex([](int x, int index) { return index > 3; })->Skip(2),
+                source->SelectIndex<int>([](int x, int index) { return x + index; })->Take(5),
+                source->SkipWhile([](int x) { return x < 5; })->TakeWhile([](int x) { return x < 12; }),
+                source->SkipWhileIndex([](int x, int index) { return index < 15; })
+                    ->Concat(IEnumerable<int>::Range(100, 3)),
+                source->TakeWhileIndex([](int x, int index) { return index < 7; })
+                    ->Concat(IEnumerable<int>::Repeat(5, 2)),
+                increment(source->Take(3))->Concat(source->Skip(18)),
+                source->Take(0),
+                source->Skip(30)
+            };
+            for (size_t i = 0; i < ARRAYSIZE(queries); i++) {
+                Assert::IsTrue(pull(queries[i]) == push(queries[i]));
+            }
+        }
+
+        TEST_METHOD(StageFusion_TakeStopsTheSource)
+        {
+            int produced = 0;
+            auto query = increment(counter(INT_MAX, &produced))->Take(3);
+
+            int exp[] = { 1, 2, 3 };
+            Assert::IsTrue(std::vector<int>(exp, exp + ARRAYSIZE(exp)) == push(query));
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // (as blocks, Take and TakeWhile pull a batch from their source)
+            Assert::AreEqual(3, produced);
+#endif
+
+            produced = 0;
+            Assert::AreEqual(2, increment(counter(INT_MAX, &produced))->TakeWhile([](int x) { return x < 3; })->Count());
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            Assert::AreEqual(3, produced);
+#endif
+        }
+
+        TEST_METHOD(StageFusion_YieldBreak)
+        {
+            auto fn = [](IteratorBlock<int>* it) {
+                it->yieldReturn(1);
+                it->yieldReturn(2);
+                it->yieldBreak();
+                it->yieldReturn(3);
+            };
+            std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(fn));
+
+            auto result = push(increment(block)->Concat(block));
+            int exp[] = { 2, 3, 1, 2 };
+            Assert::IsTrue(std::vector<int>(exp, exp + ARRAYSIZE(exp)) == result);
+        }
+
+        TEST_METHOD(StageFusion_ExceptionsArePropagated)
+        {
+            auto fn = [](IteratorBlock<int>* it) {
+                it->yieldReturn(1);
+                throw InvalidOperationException();
+            };
+            std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(fn));
+            auto query = increment(block)->Where([](int x) { return x > 0; });
+
+            int sum = 0;
+            Assert::ExpectException<InvalidOperationException&>([query, &sum]() {
+                foreach<int>(query, [&sum](int& item) {
+                    sum += item;
+                });
+            });
+            Assert::AreEqual(2, sum);
+        }
+
+        TEST_METHOD(StageFusion_SmallStacksDoNotRunLargerBlocks)
+        {
+            size_t stackSize = 0;
+            auto inner = [&stackSize](IteratorBlock<int>* it) {
+                stackSize = Fiber::current()->stackSize();
+                it->yieldReturn(1);
+            };
+            std::shared_ptr<IEnumerable<int>> large(new _IteratorBlock<int>(inner, 256 * 1024));
+
+            auto outer = [large](IteratorBlock<int>* it) {
+                foreach<int>(large, [it](int& item) {
+                    it->yieldReturn(item);
+                });
+            };
+            std::shared_ptr<IEnumerable<int>> small(new _IteratorBlock<int>(outer, 32 * 1024));
+            Assert::AreEqual(1, small->First());
+            Assert::IsTrue(256 * 1024 == stackSize);
+
+            std::shared_ptr<IEnumerable<int>> larger(new _IteratorBlock<int>(outer, 512 * 1024));
+            Assert::AreEqual(1, larger->First());
+            Assert::IsTrue(512 * 1024 == stackSize);
+        }
+    };
+}
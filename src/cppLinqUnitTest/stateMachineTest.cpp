@@ -0,0 +1,175 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    // Element type used only by these tests: its operators always run on fibers.
+    struct FiberNumber
+    {
+        FiberNumber() : value(0) {}
+        FiberNumber(int v) : value(v) {}
+
+        int value;
+    };
+}
+
+template <LinqOperator op>
+struct UseFiberBlock<op, UnitTest::FiberNumber>
+{
+    static const bool value = true;
+};
+
+namespace UnitTest
+{
+    TEST_CLASS(StateMachineTest)
+    {
+    public:
+        static void test()
+        {
+            fprintf(stdout, "stateMachine\n");
+
+            StateMachineTest t;
+            t.StateMachine_OperatorsDoNotUseFibers();
+            t.StateMachine_FiberBlocksCanBeRequested();
+            t.StateMachine_Pipeline();
+            t.StateMachine_EnumeratorsAreIndependent();
+            t.StateMachine_Reset();
+            t.StateMachine_MoveNextAfterTheEnd();
+            t.StateMachine_ExceptionsArePropagated();
+        }
+
+        TEST_METHOD(StateMachine_OperatorsDoNotUseFibers)
+        {
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            auto range = IEnumerable<int>::Range(0, 10);
+            auto isEven = [](int x) { return 0 == x % 2; };
+
+            std::shared_ptr<IEnumerable<int>> queries[] = {
+                range,
+                IEnumerable<int>::Repeat(1, 3),
+                range->Concat(range),
+                range->Where(isEven),
+                range->WhereIndex([](int x, int index) { return index > 2; }),
+                range->Select<int>([](int x) { return x * 2; }),
+                range->SelectIndex<int>([](int x, int index) { return x * index; }),
+                range->Skip(2),
+                range->SkipWhile(isEven),
+                range->SkipWhileIndex([](int x, int index) { return index < 2; }),
+                range->Take(2),
+                range->TakeWhile(isEven),
+                range->TakeWhileIndex([](int x, int index) { return index < 2; })
+            };
+            for (size_t i = 0; i < ARRAYSIZE(queries); i++) {
+                Assert::IsTrue(nullptr == dynamic_cast<Fiber*>(queries[i].get()));
+                Assert::IsTrue(nullptr == dynamic_cast<Fiber*>(queries[i]->GetEnumerator().get()));
+            }
+#endif
+        }
+
+        TEST_METHOD(StateMachine_FiberBlocksCanBeRequested)
+        {
+#ifndef CPPLINQ_COROUTINE_BLOCKS
+            auto source = IEnumerable<FiberNumber>::Repeat(FiberNumber(3), 4);
+            Assert::IsTrue(nullptr != dynamic_cast<Fiber*>(source.get()));
+
+            auto result = source->Where([](const FiberNumber& x) { return x.value > 1; });
+            Assert::IsTrue(nullptr != dynamic_cast<Fiber*>(result.get()));
+            Assert::AreEqual(4, result->Count());
+#endif
+        }
+
+        TEST_METHOD(StateMachine_Pipeline)
+        {
+            int v[] = { 5, 1, 4, 2, 8, 3, 7, 6 };
+            std::shared_ptr<IEnumerable<int>> source(new Vector<int>(v, ARRAYSIZE(v)));
+
+            // state machines and fiber blocks mixed in the same query
+            auto result = source->Skip(1)
+                ->Where([](int x) { return x < 8; })
+                ->Reverse()
+                ->Select<int>([](int x) { return x * 10; })
+                ->TakeWhile([](int x) { return x > 10; })
+                ->Concat(IEnumerable<int>::Range(1, 2));
+
+            int exp[] = { 60, 70, 30, 20, 40, 1, 2 };
+            Assert::IsTrue(result->SequenceEqual<int>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(StateMachine_EnumeratorsAreIndependent)
+        {
+            auto result = IEnumerable<int>::Range(0, 5)->Select<int>([](int x) { return x * x; });
+
+            auto e0 = result->GetEnumerator();
+            auto e1 = result->GetEnumerator();
+            Assert::IsTrue(e0->MoveNext());
+            Assert::IsTrue(e0->MoveNext());
+            Assert::IsTrue(e1->MoveNext());
+            Assert::AreEqual(1, e0->get_Current());
+            Assert::AreEqual(0, e1->get_Current());
+        }
+
+        TEST_METHOD(StateMachine_Reset)
+        {
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // only state machines can be reset
+            int v[] = { 1, 2, 3, 4 };
+            std::shared_ptr<IEnumerable<int>> source(new Vector<int>(v, ARRAYSIZE(v)));
+
+            auto e = source->Where([](int x) { return x > 1; })->Take(2)->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsFalse(e->MoveNext());
+
+            e->Reset();
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(2, e->get_Current());
+#endif
+        }
+
+        TEST_METHOD(StateMachine_MoveNextAfterTheEnd)
+        {
+            auto e = IEnumerable<int>::Range(0, 3)->TakeWhile([](int x) { return x < 1; })->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsFalse(e->MoveNext());
+            Assert::IsFalse(e->MoveNext());
+
+            e = IEnumerable<int>::Range(0, 1)->Skip(2)->GetEnumerator();
+            Assert::IsFalse(e->MoveNext());
+            Assert::IsFalse(e->MoveNext());
+        }
+
+        TEST_METHOD(StateMachine_ExceptionsArePropagated)
+        {
+            auto result = IEnumerable<int>::Range(0, 3)->Where([](int x) -> bool {
+                if (x == 1) {
+                    throw InvalidOperationException();
+                }
+                return true;
+            });
+            auto e = result->GetEnumerator();
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::ExpectException<InvalidOperationException&>([e]() {
+                e->MoveNext();
+            });
+        }
+    };
+}
@@ -15,11 +15,30 @@
 #pragma once
 
 #include "../cpplinq/iteratorBlock.h"
+#include <cctype>
+#include <iterator>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+// Containers that keep their elements in an array.
+template <typename Container>
+struct _IsContiguous : public std::false_type {};
+template <typename T, typename A>
+struct _IsContiguous<std::vector<T, A>> : public std::true_type {};
+template <typename C, typename Tr, typename A>
+struct _IsContiguous<std::basic_string<C, Tr, A>> : public std::true_type {};
+
+// Containers whose elements can be indexed.
+template <typename Container>
+struct _IsRandomAccess : public std::is_same<
+    typename std::iterator_traits<typename Container::iterator>::iterator_category,
+    std::random_access_iterator_tag> {};
+
+// A container seen as an IEnumerable, with random access (IRandomAccess) if
+// it has random-access iterators.
 template <typename Container, typename T> 
-class StlEnumerable : public IEnumerable<T>
+class StlEnumerable : public IEnumerable<T>, public IRandomAccess<T>
 {
     class Enumerator : public IEnumerator<T>
     {
@@ -53,8 +72,27 @@ class StlEnumerable : public IEnumerable<T>
             }
             return *_it;
         }
+        virtual size_t MoveNextBatch(T*& items, size_t max) {
+            return moveNextBatch(items, max, _IsContiguous<Container>());
+        }
 
     private:
+        size_t moveNextBatch(T*& items, size_t max, std::false_type) {
+            return IEnumerator<T>::MoveNextBatch(items, max);
+        }
+        size_t moveNextBatch(T*& items, size_t max, std::true_type) {
+            size_t first = (size_t)(_pos + 1);
+            if (_pos >= (int)_v.size() || first >= _v.size()) {
+                _pos = (int)_v.size();
+                return 0;
+            }
+            size_t count = std::min(max, _v.size() - first);
+            items = &_v[first];
+            _pos = (int)(first + count - 1);
+            _it = _v.begin() + _pos;
+            return count;
+        }
+
         Container& _v;
         typename Container::iterator _it;
         int _pos;
@@ -67,7 +105,31 @@ public:
         return std::shared_ptr<IEnumerator<T>>(new Enumerator(_v));
     }
 
+    virtual IRandomAccess<T>* randomAccess() {
+        return _IsRandomAccess<Container>::value ? this : nullptr;
+    }
+
+    // IRandomAccess
+    virtual size_t get_Count() {
+        return _v.size();
+    }
+    virtual T& get_Item(size_t index) {
+        typename Container::iterator it = _v.begin();
+        std::advance(it, index);
+        return *it;
+    }
+    virtual T* get_Data() {
+        return getData(_IsContiguous<Container>());
+    }
+
 private:
+    T* getData(std::false_type) {
+        return nullptr;
+    }
+    T* getData(std::true_type) {
+        return _v.empty() ? nullptr : &_v[0];
+    }
+
     Container& _v;
 };
 
@@ -139,6 +201,79 @@ struct CompareIgnoreCase
     }
 };
 
+// The hash function and equality predicate that match CompareIgnoreCase.
+struct HashIgnoreCase
+{
+    size_t operator()(const String& s) const {
+        size_t hash = 0;
+        for (const char* p = s.c_str(); *p; p++) {
+            hash = hash * 31 + tolower((unsigned char)*p);
+        }
+        return hash;
+    }
+};
+
+struct EqualIgnoreCase
+{
+    bool operator()(const String& lhs, const String& rhs) const {
+        return lhs.CompareIgnoreCase(rhs);
+    }
+};
+
+// An element that counts how many times it is copied and moved, to check
+// that the operators do not copy more than they must.
+struct Counted
+{
+    Counted() : value(0) {}
+    Counted(int v) : value(v) {}
+    Counted(const Counted& rhs) : value(rhs.value) {
+        copies()++;
+    }
+    Counted(Counted&& rhs) : value(rhs.value) {
+        moves()++;
+    }
+
+    Counted& operator=(const Counted& rhs) {
+        value = rhs.value;
+        copies()++;
+        return *this;
+    }
+    Counted& operator=(Counted&& rhs) {
+        value = rhs.value;
+        moves()++;
+        return *this;
+    }
+
+    bool operator==(const Counted& rhs) const {
+        return value == rhs.value;
+    }
+    bool operator<(const Counted& rhs) const {
+        return value < rhs.value;
+    }
+
+    static int& copies() {
+        static int s_copies = 0;
+        return s_copies;
+    }
+    static int& moves() {
+        static int s_moves = 0;
+        return s_moves;
+    }
+    static void reset() {
+        copies() = 0;
+        moves() = 0;
+    }
+
+    int value;
+};
+
+// Yielded by reference by the iterator blocks (see IteratorBlock::yieldReturnRef).
+template <>
+struct YieldByReference<Counted>
+{
+    static const bool value = true;
+};
+
 inline std::string IntToString(int value)
 {
     char buff[16];
@@ -0,0 +1,169 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+#include <thread>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(ThreadMigrationTest)
+    {
+        // Called through a pointer: within a function the compiler may assume
+        // that the thread does not change and reuse the first result.
+        static std::thread::id currentThread() {
+            return std::this_thread::get_id();
+        }
+
+        // An unbatched block that yields 0..count-1 and records the thread
+        // that produced each element.
+        static std::shared_ptr<IEnumerable<int>> counter(int count, std::vector<std::thread::id>* threads)
+        {
+            auto fn = [count, threads](IteratorBlock<int>* it) {
+                std::thread::id (* volatile getThread)() = &currentThread;
+                for (int i = 0; i < count; i++) {
+                    threads->push_back(getThread());
+                    it->yieldReturn(i);
+                }
+            };
+            return std::shared_ptr<IEnumerable<int>>(
+                new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, IteratorBlock<int>::Unbatched));
+        }
+
+        // A block that pulls from source on its own fiber and adds one.
+        static std::shared_ptr<IEnumerable<int>> increment(std::shared_ptr<IEnumerable<int>> source)
+        {
+            auto fn = [source](IteratorBlock<int>* it) {
+                auto e = source->GetEnumerator();
+                while (e->MoveNext()) {
+                    it->yieldReturn(e->get_Current() + 1);
+                }
+            };
+            return std::shared_ptr<IEnumerable<int>>(new _IteratorBlock<int>(fn));
+        }
+
+        // Calls MoveNext count times on a new thread, appending the elements.
+        static void moveNext(std::shared_ptr<IEnumerator<int>> e, int count, std::vector<int>* result)
+        {
+            std::thread worker([e, count, result]() {
+                for (int i = 0; i < count && e->MoveNext(); i++) {
+                    result->push_back(e->get_Current());
+                }
+            });
+            worker.join();
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "threadMigration\n");
+
+            ThreadMigrationTest t;
+            t.ThreadMigration_EnumeratorsResumeOnAnotherThread();
+            t.ThreadMigration_ChainsOfBlocksMigrate();
+            t.ThreadMigration_EnumeratorsAreDestroyedOnAnotherThread();
+            t.ThreadMigration_FirstEnumeratorOnAnyThread();
+        }
+
+        TEST_METHOD(ThreadMigration_EnumeratorsResumeOnAnotherThread)
+        {
+            std::vector<std::thread::id> threads;
+            auto e = counter(9, &threads)->GetEnumerator();
+
+            std::vector<int> result;
+            for (int i = 0; i < 3; i++) {
+                Assert::IsTrue(e->MoveNext());
+                result.push_back(e->get_Current());
+            }
+            moveNext(e, 3, &result);
+            while (e->MoveNext()) {
+                result.push_back(e->get_Current());
+            }
+
+            Assert::AreEqual(9, (int)result.size());
+            for (int i = 0; i < 9; i++) {
+                Assert::AreEqual(i, result[i]);
+            }
+            Assert::IsTrue(std::this_thread::get_id() == threads[2]);
+            Assert::IsTrue(std::this_thread::get_id() != threads[3]);
+            Assert::IsTrue(threads[3] == threads[5]);
+            Assert::IsTrue(std::this_thread::get_id() == threads[6]);
+        }
+
+        TEST_METHOD(ThreadMigration_ChainsOfBlocksMigrate)
+        {
+            std::vector<std::thread::id> threads;
+            auto pulled = increment(increment(counter(100, &threads)));
+            auto fused = counter(100, &threads)->Select<int>([](int x) { return x + 2; });
+            std::shared_ptr<IEnumerable<int>> queries[] = { pulled, fused };
+
+            for (size_t q = 0; q < ARRAYSIZE(queries); q++) {
+                auto e = queries[q]->GetEnumerator();
+                std::vector<int> result;
+                for (int worker = 0; worker < 10; worker++) {
+                    moveNext(e, 10, &result);
+                }
+                Assert::IsFalse(e->MoveNext());
+
+                Assert::AreEqual(100, (int)result.size());
+                for (int i = 0; i < 100; i++) {
+                    Assert::AreEqual(i + 2, result[i]);
+                }
+            }
+        }
+
+        TEST_METHOD(ThreadMigration_EnumeratorsAreDestroyedOnAnotherThread)
+        {
+            FiberStackPool& pool = FiberStackPool::instance();
+            long long inUse = pool.statistics().inUse;
+
+            std::vector<std::thread::id> threads;
+            std::shared_ptr<IEnumerator<int>> e = increment(counter(100, &threads))->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(inUse < pool.statistics().inUse);
+
+            // the worker holds the only reference
+            std::thread worker([](std::shared_ptr<IEnumerator<int>> e) {
+                Assert::IsTrue(e->MoveNext());
+                Assert::AreEqual(2, e->get_Current());
+            }, std::move(e));
+            worker.join();
+            Assert::AreEqual(inUse, pool.statistics().inUse);
+        }
+
+        TEST_METHOD(ThreadMigration_FirstEnumeratorOnAnyThread)
+        {
+            std::vector<std::thread::id> threads;
+            auto block = counter(3, &threads);
+
+            std::shared_ptr<IEnumerator<int>> e;
+            std::thread worker([block, &e]() {
+                e = block->GetEnumerator();
+            });
+            worker.join();
+            Assert::IsTrue(dynamic_cast<void*>(e.get()) == dynamic_cast<void*>(block.get()));
+            Assert::IsTrue(dynamic_cast<void*>(block->GetEnumerator().get()) != dynamic_cast<void*>(block.get()));
+
+            int count = 0;
+            while (e->MoveNext()) {
+                count++;
+            }
+            Assert::AreEqual(3, count);
+        }
+    };
+}
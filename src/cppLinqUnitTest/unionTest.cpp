@@ -34,6 +34,8 @@ namespace UnitTest
             t.Union_NullSecondWithComparer();
             t.Union_UnionWithoutComparer();
             t.Union_UnionWithCaseInsensitiveComparer();
+            t.Union_UnionWithCaseInsensitiveHasher();
+            t.Union_UnionOfHashedInts();
             t.Union_UnionWithEmptyFirstSequence();
             t.Union_UnionWithEmptySecondSequence();
             t.Union_UnionWithTwoEmptySequences();
@@ -96,6 +98,40 @@ namespace UnitTest
             Assert::IsTrue(lhs->Union(rhs, CompareIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
         }
 
+        TEST_METHOD(Union_UnionWithCaseInsensitiveHasher)
+        {
+            String l[] = { "a", "b", "B", "c", "b" };
+            std::shared_ptr<IEnumerable<String>> lhs(new Vector<String>(l, ARRAYSIZE(l)));
+
+            String r[] = { "d", "e", "D", "A" };
+            std::shared_ptr<IEnumerable<String>> rhs(new Vector<String>(r, ARRAYSIZE(r)));
+
+            String exp[] = { "a", "b", "c", "d", "e" };
+            Assert::IsTrue(lhs->Union(rhs, HashIgnoreCase(), EqualIgnoreCase())->SequenceEqual<String>(exp, ARRAYSIZE(exp)));
+
+            std::shared_ptr<IEnumerable<String>> nothing(nullptr);
+            Assert::ExpectException<ArgumentNullException&>([lhs, nothing]() {
+                lhs->Union(nothing, HashIgnoreCase(), EqualIgnoreCase());
+            });
+        }
+
+        TEST_METHOD(Union_UnionOfHashedInts)
+        {
+            // int has std::hash: the set is a FlatHashSet, which grows
+            // while the elements come, in the order they come
+            std::shared_ptr<IEnumerable<int>> lhs = IEnumerable<int>::Range(0, 10000)
+                ->Select<int>([](int x) { return x * 3 % 5000; });
+            std::shared_ptr<IEnumerable<int>> rhs = IEnumerable<int>::Range(0, 10000)
+                ->Where([](int x) { return x % 2 == 0; });
+
+            std::vector<int> result = lhs->Union(rhs)->ToVector();
+            Assert::IsTrue(7500 == result.size());
+            Assert::AreEqual(0, result[0]);
+            Assert::AreEqual(3, result[1]);
+            Assert::AreEqual(5000, result[5000]);
+            Assert::AreEqual(9998, result[7499]);
+        }
+
         TEST_METHOD(Union_UnionWithEmptyFirstSequence)
         {
             String* l = new String[0];
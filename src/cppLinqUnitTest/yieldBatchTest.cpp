@@ -0,0 +1,138 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(YieldBatchTest)
+    {
+        // A block that yields 0..count-1 in batches of batchSize and counts
+        // the elements produced so far.
+        static std::shared_ptr<IEnumerable<int>> counter(int count, size_t batchSize, int* produced)
+        {
+            auto fn = [count, produced](IteratorBlock<int>* it) {
+                for (int i = 0; i < count; i++) {
+                    (*produced)++;
+                    it->yieldReturn(i);
+                }
+            };
+            return std::shared_ptr<IEnumerable<int>>(
+                new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, batchSize));
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "yieldBatch\n");
+
+            YieldBatchTest t;
+            t.YieldBatch_AllElementsAreReturned();
+            t.YieldBatch_ElementsAreProducedInBatches();
+            t.YieldBatch_UnbatchedBlocksRunInStep();
+            t.YieldBatch_YieldBreakFlushesTheBatch();
+            t.YieldBatch_ExceptionsFollowTheBufferedElements();
+            t.YieldBatch_EnumeratorsKeepTheBatchSize();
+        }
+
+        TEST_METHOD(YieldBatch_AllElementsAreReturned)
+        {
+            int produced = 0;
+            auto e = counter(10, 4, &produced)->GetEnumerator();
+            for (int i = 0; i < 10; i++) {
+                Assert::IsTrue(e->MoveNext());
+                Assert::AreEqual(i, e->get_Current());
+            }
+            Assert::IsFalse(e->MoveNext());
+            Assert::IsFalse(e->MoveNext());
+        }
+
+        TEST_METHOD(YieldBatch_ElementsAreProducedInBatches)
+        {
+            int produced = 0;
+            auto e = counter(10, 4, &produced)->GetEnumerator();
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(4, produced);
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(4, produced);
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(8, produced);
+        }
+
+        TEST_METHOD(YieldBatch_UnbatchedBlocksRunInStep)
+        {
+            int produced = 0;
+            auto e = counter(10, IteratorBlock<int>::Unbatched, &produced)->GetEnumerator();
+            for (int i = 1; i <= 10; i++) {
+                Assert::IsTrue(e->MoveNext());
+                Assert::AreEqual(i, produced);
+            }
+            Assert::IsFalse(e->MoveNext());
+        }
+
+        TEST_METHOD(YieldBatch_YieldBreakFlushesTheBatch)
+        {
+            auto fn = [](IteratorBlock<int>* it) {
+                it->yieldReturn(1);
+                it->yieldReturn(2);
+                it->yieldBreak();
+                it->yieldReturn(3);
+            };
+            std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, 16));
+
+            int exp[] = { 1, 2 };
+            Assert::IsTrue(block->SequenceEqual<int>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(YieldBatch_ExceptionsFollowTheBufferedElements)
+        {
+            auto fn = [](IteratorBlock<int>* it) {
+                it->yieldReturn(1);
+                it->yieldReturn(2);
+                throw InvalidOperationException();
+            };
+            std::shared_ptr<IEnumerable<int>> block(new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, 16));
+            auto e = block->GetEnumerator();
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(1, e->get_Current());
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(2, e->get_Current());
+            Assert::ExpectException<InvalidOperationException&>([e]() {
+                e->MoveNext();
+            });
+            Assert::IsFalse(e->MoveNext());
+        }
+
+        TEST_METHOD(YieldBatch_EnumeratorsKeepTheBatchSize)
+        {
+            int produced = 0;
+            auto block = counter(10, 3, &produced);
+            block->GetEnumerator();
+            auto e = block->GetEnumerator();
+            Assert::IsTrue(3 == dynamic_cast<IteratorBlock<int>*>(e.get())->batchSize());
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(3, produced);
+        }
+    };
+}
@@ -0,0 +1,207 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(YieldByReferenceTest)
+    {
+        // An element with no default constructor.
+        struct Token
+        {
+            explicit Token(int v) : value(v) {
+            }
+
+            bool operator<(const Token& rhs) const {
+                return value < rhs.value;
+            }
+
+            int value;
+        };
+
+        // A block that yields the elements of *v with yieldReturnRef.
+        template <typename T>
+        static std::shared_ptr<IEnumerable<T>> elementsOf(std::vector<T>* v, size_t batchSize)
+        {
+            auto fn = [v](IteratorBlock<T>* it) {
+                for (size_t i = 0; i < v->size(); i++) {
+                    it->yieldReturnRef((*v)[i]);
+                }
+            };
+            return std::shared_ptr<IEnumerable<T>>(
+                new _IteratorBlock<T>(fn, Fiber::SmallStackSize, nullptr, batchSize));
+        }
+
+        static std::shared_ptr<IEnumerable<Token>> tokens(int count)
+        {
+            std::vector<Token> v;
+            for (int i = 0; i < count; i++) {
+                v.push_back(Token(i));
+            }
+            return std::make_shared<Vector<Token>>(&v[0], v.size());
+        }
+
+        // The sum of the values, read both with foreach and with MoveNext.
+        template <typename T>
+        static int sum(std::shared_ptr<IEnumerable<T>> query)
+        {
+            int total = 0;
+            foreach<T>(query, [&total](T& item) {
+                total += item.value;
+            });
+            auto e = query->GetEnumerator();
+            while (e->MoveNext()) {
+                total -= e->get_Current().value;
+            }
+            Assert::AreEqual(0, total);
+
+            foreach<T>(query, [&total](T& item) {
+                total += item.value;
+            });
+            return total;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "yieldByReference\n");
+
+            YieldByReferenceTest t;
+            t.YieldByReference_CurrentIsTheYieldedElement();
+            t.YieldByReference_CopiedIntoTheBatchByDefault();
+            t.YieldByReference_BatchedElementsComeFirst();
+            t.YieldByReference_NotDefaultConstructible();
+            t.YieldByReference_PassThroughOperatorsCopyNothing();
+        }
+
+        TEST_METHOD(YieldByReference_CurrentIsTheYieldedElement)
+        {
+            std::vector<Counted> v;
+            for (int i = 0; i < 10; i++) {
+                v.push_back(Counted(i));
+            }
+
+            Counted::reset();
+            auto e = elementsOf(&v, IteratorBlock<Counted>::DefaultBatchSize)->GetEnumerator();
+            for (size_t i = 0; i < v.size(); i++) {
+                Assert::IsTrue(e->MoveNext());
+                Assert::IsTrue(&v[i] == &e->get_Current());
+            }
+            Assert::IsFalse(e->MoveNext());
+
+            // and so is what the sink receives
+            size_t i = 0;
+            bool same = true;
+            foreach<Counted>(elementsOf(&v, IteratorBlock<Counted>::DefaultBatchSize), [&](Counted& c) {
+                same = same && (&v[i++] == &c);
+            });
+            Assert::IsTrue(same);
+            Assert::IsTrue(v.size() == i);
+            Assert::AreEqual(0, Counted::copies());
+        }
+
+        TEST_METHOD(YieldByReference_CopiedIntoTheBatchByDefault)
+        {
+            std::vector<int> v(10);
+            for (int i = 0; i < 10; i++) {
+                v[i] = i;
+            }
+
+            // copied into the batch...
+            std::shared_ptr<IEnumerator<int>> e = elementsOf(&v, IteratorBlock<int>::DefaultBatchSize)->GetEnumerator();
+            for (int i = 0; i < 10; i++) {
+                Assert::IsTrue(e->MoveNext());
+                Assert::AreEqual(i, e->get_Current());
+                Assert::IsTrue(&v[i] != &e->get_Current());
+            }
+            Assert::IsFalse(e->MoveNext());
+
+            int* items = nullptr;
+            e = elementsOf(&v, IteratorBlock<int>::DefaultBatchSize)->GetEnumerator();
+            Assert::IsTrue(10 == e->MoveNextBatch(items, IEnumerator<int>::MaxBatch));
+
+            // ...unless the block is unbatched
+            e = elementsOf(&v, IteratorBlock<int>::Unbatched)->GetEnumerator();
+            for (int i = 0; i < 10; i++) {
+                Assert::IsTrue(e->MoveNext());
+                Assert::IsTrue(&v[i] == &e->get_Current());
+            }
+            Assert::IsFalse(e->MoveNext());
+        }
+
+        TEST_METHOD(YieldByReference_BatchedElementsComeFirst)
+        {
+            Counted last(3);
+            auto fn = [&last](IteratorBlock<Counted>* it) {
+                it->yieldReturn(Counted(1));
+                it->yieldReturn(Counted(2));
+                it->yieldReturnRef(last);
+            };
+            std::shared_ptr<IEnumerable<Counted>> block(new _IteratorBlock<Counted>(fn, Fiber::SmallStackSize));
+
+            auto e = block->GetEnumerator();
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(1, e->get_Current().value);
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(2, e->get_Current().value);
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(&last == &e->get_Current());
+            Assert::IsFalse(e->MoveNext());
+
+            Counted* items = nullptr;
+            e = block->GetEnumerator();
+            Assert::IsTrue(2 == e->MoveNextBatch(items, IEnumerator<Counted>::MaxBatch));
+            Assert::AreEqual(2, items[1].value);
+            Assert::IsTrue(1 == e->MoveNextBatch(items, IEnumerator<Counted>::MaxBatch));
+            Assert::IsTrue(&last == items);
+            Assert::IsTrue(0 == e->MoveNextBatch(items, IEnumerator<Counted>::MaxBatch));
+        }
+
+        TEST_METHOD(YieldByReference_NotDefaultConstructible)
+        {
+            std::shared_ptr<IEnumerable<Token>> source = tokens(20);
+
+            Assert::AreEqual((0 + 19) * 20 / 2, sum(source->Where([](Token& t) { return t.value >= 0; })));
+            Assert::AreEqual((5 + 14) * 10 / 2, sum(source->Skip(5)->Take(10)));
+            Assert::AreEqual((10 + 14) * 5 / 2, sum(source
+                ->SkipWhile([](Token& t) { return t.value < 10; })
+                ->TakeWhile([](Token& t) { return t.value < 15; })));
+            Assert::AreEqual((0 + 19) * 20, sum(source->Concat(tokens(20))));
+            Assert::AreEqual((0 + 19) * 20 / 2, sum(source->Concat(tokens(20))->Distinct()));
+
+            // Token is copied into the batch, and so are the elements that
+            // yieldReturn gets
+            auto fn = [](IteratorBlock<Token>* it) {
+                Token t(1);
+                it->yieldReturn(t);
+                it->yieldReturn(Token(2));
+            };
+            std::shared_ptr<IEnumerable<Token>> block(new _IteratorBlock<Token>(fn, Fiber::SmallStackSize));
+            Assert::AreEqual(3, sum(block));
+        }
+
+        TEST_METHOD(YieldByReference_PassThroughOperatorsCopyNothing)
+        {
+            std::vector<Counted> elements;
+            for (int i = 0; i < 100; i++) {
+                elements.push_back(Counted(i));
+            }
+            std::shared_ptr<IEnumerable<Counted>> source(std::make_shared<Vector<Counted>>(&elements[0], elements.size()));
+
+            Counted::reset();
+            Assert::AreEqual((0 + 98) * 50 / 2, sum(source->Where([](Counted& c) { return c.value % 2 == 0; })));
+            Assert::AreEqual((10 + 59) * 50 / 2, sum(source->Skip(10)->Take(50)));
+            Assert::AreEqual((10 + 59) * 50 / 2, sum(source
+                ->SkipWhile([](Counted& c) { return c.value < 10; })
+                ->TakeWhile([](Counted& c) { return c.value < 60; })));
+            Assert::AreEqual((0 + 99) * 100, sum(source->Concat(source)));
+#ifndef CPPLINQ_COROUTINE_BLOCKS
+            Assert::AreEqual(0, Counted::copies());
+            Assert::AreEqual(0, Counted::moves());
+#endif
+        }
+    };
+}
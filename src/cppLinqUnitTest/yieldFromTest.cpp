@@ -0,0 +1,202 @@
+// Copyright 2012 Paolo Severini
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//     http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+#include "testUtils.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace UnitTest
+{
+    TEST_CLASS(YieldFromTest)
+    {
+        // 0, the elements of inner, 4.
+        static std::shared_ptr<IEnumerable<int>> around(std::shared_ptr<IEnumerable<int>> inner, size_t batchSize)
+        {
+            auto fn = [inner](IteratorBlock<int>* it) {
+                it->yieldReturn(0);
+                it->yieldFrom(inner);
+                it->yieldReturn(4);
+            };
+            return std::shared_ptr<IEnumerable<int>>(
+                new _IteratorBlock<int>(fn, Fiber::DefaultStackSize, nullptr, batchSize));
+        }
+
+        // The leaves of a complete binary tree of the given depth, numbered
+        // from first, flattened by one block per node.
+        static std::shared_ptr<IEnumerable<int>> tree(int depth, int first)
+        {
+            auto fn = [depth, first](IteratorBlock<int>* it) {
+                if (0 == depth) {
+                    it->yieldReturn(first);
+                    return;
+                }
+                int half = 1 << (depth - 1);
+                it->yieldFrom(tree(depth - 1, first));
+                it->yieldFrom(tree(depth - 1, first + half));
+            };
+            return std::shared_ptr<IEnumerable<int>>(
+                new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, IteratorBlock<int>::Unbatched));
+        }
+
+        template <typename T>
+        static std::vector<T> toVector(std::shared_ptr<IEnumerable<T>> source)
+        {
+            std::vector<T> result;
+            auto e = source->GetEnumerator();
+            while (e->MoveNext()) {
+                result.push_back(e->get_Current());
+            }
+            return result;
+        }
+
+    public:
+        static void test()
+        {
+            fprintf(stdout, "yieldFrom\n");
+
+            YieldFromTest t;
+            t.YieldFrom_ElementsAreInOrder();
+            t.YieldFrom_UnbatchedBlocksHandOverTheEnumerator();
+            t.YieldFrom_NestedBlocks();
+            t.YieldFrom_EmptySequences();
+            t.YieldFrom_ExceptionsArePropagated();
+            t.YieldFrom_StopsWithTheConsumer();
+        }
+
+        TEST_METHOD(YieldFrom_ElementsAreInOrder)
+        {
+            int exp[] = { 0, 1, 2, 3, 4 };
+            std::vector<int> expected(exp, exp + ARRAYSIZE(exp));
+            size_t batchSizes[] = { IteratorBlock<int>::Unbatched, 2, IteratorBlock<int>::DefaultBatchSize };
+
+            for (size_t i = 0; i < ARRAYSIZE(batchSizes); i++) {
+                auto query = around(IEnumerable<int>::Range(1, 3), batchSizes[i]);
+                Assert::IsTrue(expected == toVector(query));
+
+                std::vector<int> pushed;
+                foreach<int>(query, [&pushed](int& item) {
+                    pushed.push_back(item);
+                });
+                Assert::IsTrue(expected == pushed);
+            }
+        }
+
+        TEST_METHOD(YieldFrom_UnbatchedBlocksHandOverTheEnumerator)
+        {
+            std::vector<Fiber*> fibers;
+            auto inner = IEnumerable<int>::Range(1, 3)->Select<int>([&fibers](int x) {
+                fibers.push_back(Fiber::current());
+                return x;
+            });
+
+            // the consumer pulls from inner itself, outside of any fiber
+            toVector(around(inner, IteratorBlock<int>::Unbatched));
+            Assert::AreEqual(3, (int)fibers.size());
+#if !defined(CPPLINQ_FIBER_BLOCKS)
+            // (as a block, Select runs the selector on its own fiber)
+            for (size_t i = 0; i < fibers.size(); i++) {
+                Assert::IsTrue(nullptr == fibers[i]);
+            }
+#endif
+
+            // batched, inner runs on the fiber of the block
+            fibers.clear();
+            toVector(around(inner, 16));
+            Assert::AreEqual(3, (int)fibers.size());
+            for (size_t i = 0; i < fibers.size(); i++) {
+                Assert::IsTrue(nullptr != fibers[i]);
+            }
+        }
+
+        TEST_METHOD(YieldFrom_NestedBlocks)
+        {
+            std::vector<int> leaves = toVector(tree(5, 0));
+            Assert::AreEqual(32, (int)leaves.size());
+            for (int i = 0; i < 32; i++) {
+                Assert::AreEqual(i, leaves[i]);
+            }
+
+            auto nested = IEnumerable<int>::Range(0, 3)->SelectMany<int>([](int x) {
+                return IEnumerable<int>::Range(0, x)->SelectMany<int>([x](int y) {
+                    return IEnumerable<int>::Repeat(x * 10 + y, 2);
+                });
+            });
+            int exp[] = { 10, 10, 20, 20, 21, 21 };
+            Assert::IsTrue(nested->SequenceEqual<int>(exp, ARRAYSIZE(exp)));
+        }
+
+        TEST_METHOD(YieldFrom_EmptySequences)
+        {
+            auto fn = [](IteratorBlock<int>* it) {
+                it->yieldFrom(IEnumerable<int>::Empty());
+                it->yieldFrom(IEnumerable<int>::Empty());
+                it->yieldReturn(1);
+                it->yieldFrom(IEnumerable<int>::Empty());
+            };
+            std::shared_ptr<IEnumerable<int>> block(
+                new _IteratorBlock<int>(fn, Fiber::SmallStackSize, nullptr, IteratorBlock<int>::Unbatched));
+
+            int exp[] = { 1 };
+            Assert::IsTrue(block->SequenceEqual<int>(exp, ARRAYSIZE(exp)));
+            Assert::IsTrue(IEnumerable<int>::Empty()->Concat(IEnumerable<int>::Empty())->SequenceEqual<int>(exp, 0));
+        }
+
+        TEST_METHOD(YieldFrom_ExceptionsArePropagated)
+        {
+            auto inner = IEnumerable<int>::Range(1, 3)->Select<int>([](int x) -> int {
+                if (x == 2) {
+                    throw InvalidOperationException();
+                }
+                return x;
+            });
+            auto e = around(inner, IteratorBlock<int>::Unbatched)->GetEnumerator();
+
+            Assert::IsTrue(e->MoveNext());
+            Assert::IsTrue(e->MoveNext());
+            Assert::AreEqual(1, e->get_Current());
+            Assert::ExpectException<InvalidOperationException&>([e]() {
+                e->MoveNext();
+            });
+        }
+
+        TEST_METHOD(YieldFrom_StopsWithTheConsumer)
+        {
+            int produced = 0;
+            auto inner = IEnumerable<int>::Range(1, 100)->Select<int>([&produced](int x) {
+                produced++;
+                return x;
+            });
+
+            int exp[] = { 0, 1, 2 };
+            Assert::IsTrue(around(inner, IteratorBlock<int>::Unbatched)->Take(3)->SequenceEqual<int>(exp, ARRAYSIZE(exp)));
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            // (as blocks, Select and Take pull a batch from their source)
+            Assert::AreEqual(2, produced);
+#endif
+
+            produced = 0;
+            std::vector<int> pushed;
+            foreach<int>(around(inner, 16)->Take(3), [&pushed](int& item) {
+                pushed.push_back(item);
+            });
+            Assert::IsTrue(std::vector<int>(exp, exp + ARRAYSIZE(exp)) == pushed);
+#if !defined(CPPLINQ_COROUTINE_BLOCKS) && !defined(CPPLINQ_FIBER_BLOCKS)
+            Assert::AreEqual(2, produced);
+#endif
+        }
+    };
+}